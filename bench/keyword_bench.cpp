@@ -0,0 +1,89 @@
+// Micro-benchmark for keyword recognition: classifies a stream of
+// identifier-like words with the perfect hash from keywords.hpp and with
+// the former first-char switch + memcmp, then lexes the same words.
+// usage: keyword_bench [words]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "keywords.hpp"
+#include "lexer.hpp"
+#include "source.hpp"
+using namespace std;
+
+//The classifier lexer::ident_or_keyword used before the perfect hash.
+static bool check(const char* s,uint32_t len,const char* keyword,uint32_t klen){
+    return len == klen && memcmp(s, keyword, len) == 0;
+}
+static TokenType switch_classify(const char* s,uint32_t len){
+    switch (s[0]) {
+    case 'b': if(check(s,len,"break", 5)) return Break;break;
+    case 'c': {
+        if(check(s,len,"continue", 8)) return Continue;
+        if(check(s,len,"const", 5)) return Const;
+    }break;
+    case 'e': if(check(s,len,"else", 4)) return Else;break;
+    case 'f': if(check(s,len,"float", 5)) return Float;break;
+    case 'i':{
+        if(check(s,len,"int", 3)) return Int;
+        if(check(s,len,"if", 2)) return If;
+    }break;
+    case 'r':if(check(s,len,"return", 6)) return Return;break;
+    case 'v':if(check(s,len,"void", 4)) return Void;break;
+    case 'w':if(check(s,len,"while", 5)) return While;break;
+    default: break;
+    }
+    return Ident;
+}
+
+int main(int argc,char** argv){
+    long count = argc > 1 ? atol(argv[1]) : 2000000;
+    //Keywords, near misses sharing a first char or length, and plain names.
+    const char* pool[] = {
+        "int","if","i","idx","inner","continue","const","count","cond","c",
+        "while","w","width","return","result","r","else","elem","float","f",
+        "flag","void","value","break","buf","b","a","sum","tmp","j",
+    };
+    const int pool_size = sizeof(pool)/sizeof(pool[0]);
+    string text;
+    vector<pair<uint32_t,uint32_t>> words;
+    srand(42);
+    for(long i = 0;i < count;++i){
+        const char* w = pool[rand() % pool_size];
+        words.push_back({(uint32_t)text.size(),(uint32_t)strlen(w)});
+        text += w;
+        text += ' ';
+    }
+    text += string(8,' '); //find() reads 8 bytes past the start of a word
+
+    auto time = [&](auto classify){
+        long keywords = 0;
+        double best = 1e30;
+        for(int round = 0;round < 5;++round){
+            keywords = 0;
+            auto start = chrono::steady_clock::now();
+            for(auto &w : words) keywords += classify(text.data() + w.first,w.second) != Ident;
+            auto end = chrono::steady_clock::now();
+            best = min(best,chrono::duration<double,nano>(end - start).count());
+        }
+        printf("%8.2f ns/word (%ld keywords)\n",best / words.size(),keywords);
+    };
+    printf("switch + memcmp : ");
+    time([](const char* s,uint32_t len){return switch_classify(s,len);});
+    printf("perfect hash    : ");
+    time([](const char* s,uint32_t len){return keyword_table.find(s,len,Ident);});
+
+    source_buffer src = source_buffer::from_string(text);
+    double best = 1e30;
+    for(int round = 0;round < 5;++round){
+        lexer le(src);
+        auto start = chrono::steady_clock::now();
+        while(le.next_token().type != Eof) {}
+        auto end = chrono::steady_clock::now();
+        best = min(best,chrono::duration<double>(end - start).count());
+    }
+    printf("lexer           : %8.2f ns/word, %.1f MB/s\n",best * 1e9 / words.size(),text.size() / 1e6 / best);
+    return 0;
+}
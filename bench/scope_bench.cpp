@@ -0,0 +1,50 @@
+// Micro-benchmark for scope handling in static_checker: checks a program
+// made of deeply nested blocks where every level declares variables and
+// reads variables declared near the top of the nest (and a global).
+// usage: scope_bench [depth] [repeat]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "arena.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "source.hpp"
+#include "static_checker.hpp"
+using namespace std;
+
+string nested_blocks(int depth,int repeat){
+    stringstream ss;
+    ss << "int g = 1;\nint main(){\n    int v0 = 0;\n";
+    for(int r = 0;r < repeat;++r){
+        for(int d = 1;d <= depth;++d){
+            ss << "{ int v" << d << " = v" << d-1 << " + g; int w" << d << " = v0 + v1;\n";
+        }
+        for(int d = depth;d >= 1;--d) ss << "w" << d << " = v" << d << " + g; }\n";
+    }
+    ss << "    return v0;\n}\n";
+    return ss.str();
+}
+
+int main(int argc,char** argv){
+    int depth = argc > 1 ? atoi(argv[1]) : 512;
+    int repeat = argc > 2 ? atoi(argv[2]) : 200;
+    source_buffer src = source_buffer::from_string(nested_blocks(depth,repeat));
+
+    lexer le(src);
+    arena ast_arena;
+    parser Parser(le,ast_arena);
+    vector<CompUnit> ast = Parser.parse();
+
+    static_checker checker(ast_arena);
+    auto start = chrono::steady_clock::now();
+    checker.check(ast);
+    auto end = chrono::steady_clock::now();
+
+    double ms = chrono::duration<double,milli>(end - start).count();
+    long blocks = (long)depth * repeat;
+    printf("depth %d, %ld blocks: check %.2f ms, %.1f ns per block\n",depth,blocks,ms,ms * 1e6 / blocks);
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "sysy_gen.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace {
+
+//Small deterministic PRNG so a seed gives the same file everywhere.
+struct rng {
+    uint64_t state;
+    explicit rng(uint32_t seed) : state(seed * 0x9e3779b97f4a7c15ull + 1){}
+    uint32_t next(){
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return (uint32_t)(state >> 33);
+    }
+    uint32_t below(uint32_t n){return next() % n;}
+};
+
+struct generator {
+    string out;
+    rng r;
+    uint32_t serial = 0;       //makes every global name unique
+    string last_int_func;      //an int(int,int) function later code may call
+
+    explicit generator(uint32_t seed) : r(seed){}
+
+    string fresh(const char* prefix){return prefix + to_string(serial++);}
+    //Indentation stops growing after 8 levels so deep nests aren't mostly blanks.
+    void line(int indent,const string &s){out.append(min(indent,8) * 4,' ');out += s;out += '\n';}
+
+    string call_or_const(const string &a,const string &b){
+        if(last_int_func.empty()) return "(" + a + " + " + b + ")";
+        return last_int_func + "(" + a + ", " + b + ")";
+    }
+
+    //An int expression over `vars`, about `ops` operators long.
+    string int_expr(const vector<string> &vars,int ops){
+        if(ops <= 0){
+            switch(r.below(4)){
+            case 0: return to_string(r.below(1000));
+            case 1: return "0x" + string(1,"0123456789abcdef"[r.below(16)]) + "f";
+            default: return vars[r.below(vars.size())];
+            }
+        }
+        static const char* binops[] = {" + "," - "," * "," / "," % "};
+        int left = r.below(ops);
+        int op = r.below(5);
+        //Keep divisors away from constants the checker would fold to 0.
+        string right = op >= 3 ? "(" + vars[r.below(vars.size())] + " + " + to_string(1 + r.below(9)) + ")"
+                               : int_expr(vars,ops - 1 - left);
+        string e = int_expr(vars,left) + binops[op] + right;
+        return r.below(3) == 0 ? "(" + e + ")" : e;
+    }
+    string cond_expr(const vector<string> &vars,int terms){
+        static const char* relops[] = {" < "," > "," <= "," >= "," == "," != "};
+        string e;
+        for(int i = 0;i < terms;++i){
+            if(i) e += r.below(2) ? " && " : " || ";
+            if(r.below(5) == 0) e += "!";
+            e += "(" + int_expr(vars,2) + relops[r.below(6)] + int_expr(vars,1) + ")";
+        }
+        return e;
+    }
+
+    void small_function(){
+        string name = fresh("func_");
+        vector<string> vars = {"a","b","i","acc"};
+        line(0,"int " + name + "(int a, int b) {");
+        line(1,"int i = 0;");
+        line(1,"int acc = a;");
+        for(int k = 0;k < 4;++k){
+            string v = "local_" + to_string(k);
+            line(1,"int " + v + " = " + int_expr(vars,3) + ";");
+            vars.push_back(v);
+        }
+        line(1,"while (i < 16) {");
+        line(2,"if (" + cond_expr(vars,2) + ") {");
+        for(int k = 0;k < 3;++k) line(3,"acc = " + int_expr(vars,4) + ";");
+        line(2,"} else {");
+        line(3,"acc = acc - i;");
+        line(2,"}");
+        line(2,"i = i + 1;");
+        line(1,"}");
+        line(1,"acc = acc + " + call_or_const("acc","b") + ";");
+        line(1,"return acc;");
+        line(0,"}");
+        last_int_func = name;
+    }
+
+    void float_function(){
+        string name = fresh("ffunc_");
+        line(0,"float " + name + "(float x, int n) {");
+        line(1,"float y = x * 0.5 + 12.5;");
+        line(1,"int i = 0;");
+        line(1,"while (i < n) {");
+        line(2,"y = y * 0.75 + x / (y + 1.0) - i;");
+        line(2,"i = i + 1;");
+        line(1,"}");
+        line(1,"return y;");
+        line(0,"}");
+    }
+
+    //Blocks nest `depth` levels; every level shadows v and reads the outer ones.
+    void nested_function(int depth){
+        string name = fresh("nest_");
+        line(0,"int " + name + "(int a, int b) {");
+        line(1,"int v = a;");
+        line(1,"int total = 0;");
+        for(int d = 0;d < depth;++d){
+            string outer = "w" + to_string(d);
+            line(d + 1,"int " + outer + " = v + " + to_string(d) + ";");
+            switch(r.below(3)){
+            case 0: line(d + 1,"if (" + outer + " > b) {");break;
+            case 1: line(d + 1,"while (" + outer + " < a) {");break;
+            default: line(d + 1,"{");
+            }
+            line(d + 2,"int v = " + outer + " * 2 - total;");
+            line(d + 2,"total = total + v;");
+        }
+        for(int d = depth - 1;d >= 0;--d){
+            line(d + 2,"total = total + w" + to_string(d) + ";");
+            line(d + 1,"}");
+        }
+        line(1,"return total;");
+        line(0,"}");
+    }
+
+    void expression_function(int ops){
+        string name = fresh("expr_");
+        vector<string> vars = {"a","b","c","d"};
+        line(0,"int " + name + "(int a, int b) {");
+        line(1,"int c = a * b;");
+        line(1,"int d = a - b;");
+        for(int k = 0;k < 4;++k) line(1,"c = " + int_expr(vars,ops) + ";");
+        line(1,"if (" + cond_expr(vars,ops / 8 + 1) + ") {");
+        line(2,"d = " + int_expr(vars,ops) + ";");
+        line(1,"}");
+        line(1,"return c + d;");
+        line(0,"}");
+    }
+
+    void const_array(){
+        string name = fresh("table_");
+        int d0 = 4 + r.below(5),d1 = 8 + r.below(9),d2 = 4;
+        //The checker folds const initializers only when they are flat.
+        line(0,"const int " + name + "[" + to_string(d0) + "][" + to_string(d1) + "][" + to_string(d2) + "] = {");
+        for(int i = 0;i < d0 * d1;++i){
+            string row = "    ";
+            for(int k = 0;k < d2;++k) row += (k ? ", " : "") + to_string(r.below(100000));
+            line(0,row + (i + 1 < d0 * d1 ? "," : ""));
+        }
+        line(0,"};");
+        string flat = fresh("flat_");
+        string init;
+        for(int i = 0;i < 256;++i) init += (i ? ", " : "") + to_string(r.below(1 << 20));
+        line(0,"int " + flat + "[256] = {" + init + "};");
+        line(0,"int " + fresh("sum_") + "(int i, int j) {");
+        //Local arrays take nested initializers, with trailing elements left out.
+        string local = "{";
+        for(int a = 0;a < 8;++a){
+            local += a ? ", {" : "{";
+            int n = 1 + r.below(8);
+            for(int b = 0;b < n;++b) local += (b ? ", " : "") + string("i * ") + to_string(r.below(100)) + " + j";
+            local += "}";
+        }
+        line(1,"int local[8][8] = " + local + "};");
+        line(1,"return " + name + "[i][j][0] + " + name + "[i][j][3] + " + flat + "[i * 16 + j] + local[j][i];");
+        line(0,"}");
+    }
+
+    //Long names that share long prefixes, as in generated or heavily prefixed code.
+    void identifier_function(){
+        string name = fresh("a_rather_long_generated_function_name_for_module_component_");
+        static const char* parts[] = {"buffer","index","counter","accumulator","temporary","offset"};
+        vector<string> vars;
+        line(0,"int " + name + "(int incoming_parameter_value, int second_incoming_parameter_value) {");
+        for(int k = 0;k < 12;++k){
+            string v = string("the_") + parts[r.below(6)] + "_of_the_current_iteration_state_number_" + to_string(k);
+            line(1,"int " + v + " = incoming_parameter_value + " + to_string(k) + ";");
+            vars.push_back(v);
+        }
+        for(int k = 0;k < 12;++k){
+            const string &a = vars[r.below(vars.size())],&b = vars[r.below(vars.size())];
+            line(1,vars[k] + " = " + a + " * second_incoming_parameter_value - " + b + ";");
+        }
+        line(1,"return " + vars[0] + " + " + vars[11] + ";");
+        line(0,"}");
+    }
+
+    void chunk(gen_shape s){
+        switch(s){
+        case gen_shape::functions: small_function();if(r.below(8) == 0) float_function();break;
+        case gen_shape::nesting: nested_function(32 + r.below(64));break;
+        case gen_shape::expressions: expression_function(40 + r.below(80));break;
+        case gen_shape::arrays: const_array();break;
+        case gen_shape::identifiers: identifier_function();break;
+        case gen_shape::mixed: chunk(all_shapes[r.below(5)]);break;
+        }
+    }
+};
+
+}
+
+string generate_sysy(const gen_options &opt){
+    generator g(opt.seed);
+    g.line(0,"const int N = 16;");
+    g.line(0,"int g[16];");
+    while(g.out.size() < opt.target_bytes) g.chunk(opt.shape);
+    g.line(0,"int main() {");
+    g.line(1,"putint(" + g.call_or_const("1","2") + ");");
+    g.line(1,"return 0;");
+    g.line(0,"}");
+    return std::move(g.out);
+}
+
+static const char* shape_names[] = {"functions","nesting","expressions","arrays","identifiers","mixed"};
+
+const char* shape_name(gen_shape s){return shape_names[(int)s];}
+
+bool parse_shape(const string &name,gen_shape &out){
+    for(gen_shape s : all_shapes){
+        if(name == shape_name(s)){out = s;return true;}
+    }
+    return false;
+}
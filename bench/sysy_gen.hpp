@@ -0,0 +1,35 @@
+#ifndef sysy_gen_hpp
+#define sysy_gen_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Synthetic SysY programs for the throughput benchmarks. Every shape
+// stresses one part of the front end; the output always passes the
+// static checker so all three phases can be timed on it.
+enum class gen_shape {
+    functions,   //many small functions calling each other
+    nesting,     //deeply nested if/while blocks with shadowing
+    expressions, //long arithmetic / logical expressions
+    arrays,      //big multi-dimensional const arrays with nested initializers
+    identifiers, //long identifiers, mostly near-misses of each other
+    mixed,       //all of the above in one file
+};
+
+struct gen_options {
+    gen_shape shape = gen_shape::mixed;
+    size_t target_bytes = 4 << 20; //stop after roughly this much text
+    uint32_t seed = 1;
+};
+
+std::string generate_sysy(const gen_options &opt);
+
+const char* shape_name(gen_shape s);
+bool parse_shape(const std::string &name,gen_shape &out);
+constexpr gen_shape all_shapes[] = {
+    gen_shape::functions,gen_shape::nesting,gen_shape::expressions,
+    gen_shape::arrays,gen_shape::identifiers,gen_shape::mixed,
+};
+
+#endif
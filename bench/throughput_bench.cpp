@@ -0,0 +1,184 @@
+// Front-end throughput benchmark: generates SysY programs of each shape
+// in sysy_gen.hpp and times the lexer, the parser and the static checker
+// on them separately (best of N rounds).
+// usage: throughput_bench [--shape NAME] [--size MB] [--repeat N] [-j N]
+//                         [--save FILE] [--compare FILE] [--threshold PCT]
+//                         [--emit FILE]
+//   --save     write the results as TSV (see bench/results/)
+//   --compare  print the change against a saved TSV; exits with 1 if any
+//              phase lost more than --threshold percent (default 10) of
+//              its throughput
+//   --emit     write the generated program to FILE and exit
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "arena.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "source.hpp"
+#include "static_checker.hpp"
+#include "sysy_gen.hpp"
+using namespace std;
+
+struct result {
+    string shape;
+    string phase;
+    size_t bytes;
+    double ms;
+    double mb_per_s() const {return bytes / ms / 1e3;}
+};
+
+template<typename F>
+static double best_ms(int repeat,F &&run){
+    double best = 1e30;
+    for(int i = 0;i < repeat;++i) best = min(best,run());
+    return best;
+}
+template<typename F>
+static double time_ms(F &&f){
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double,milli>(chrono::steady_clock::now() - start).count();
+}
+
+static vector<result> bench_shape(gen_shape shape,size_t bytes,int repeat,unsigned jobs){
+    gen_options opt;
+    opt.shape = shape;
+    opt.target_bytes = bytes;
+    source_buffer src = source_buffer::from_string(generate_sysy(opt));
+    const char* name = shape_name(shape);
+
+    size_t tokens = 0;
+    double lex = best_ms(repeat,[&]{
+        lexer le(src);
+        tokens = 0;
+        return time_ms([&]{
+            for(Token t = le.next_token();t.type != Eof;t = le.next_token()) tokens++;
+        });
+    });
+    //The parser pulls tokens from the lexer, so this includes lexing.
+    double parse = best_ms(repeat,[&]{
+        lexer le(src);
+        arena a;
+        parser p(le,a);
+        vector<CompUnit> ast;
+        double ms = time_ms([&]{ast = p.parse();});
+        return ms;
+    });
+    double check = best_ms(repeat,[&]{
+        lexer le(src);
+        arena a;
+        parser p(le,a);
+        vector<CompUnit> ast = p.parse();
+        static_checker checker(a);
+        return time_ms([&]{
+            try{
+                checker.check(ast,jobs);
+            }catch(string s){
+                fprintf(stderr,"%s: %s\n",name,s.c_str());
+                exit(1);
+            }
+        });
+    });
+
+    printf("%-12s %7.2f MB %9zu tokens  lex %8.2f ms %7.1f MB/s  parse %8.2f ms %7.1f MB/s  check %8.2f ms %7.1f MB/s\n",
+        name,src.size / 1e6,tokens,lex,src.size / lex / 1e3,parse,src.size / parse / 1e3,check,src.size / check / 1e3);
+    return {{name,"lex",src.size,lex},{name,"parse",src.size,parse},{name,"check",src.size,check}};
+}
+
+static void save(const char* path,const vector<result> &results,int repeat){
+    ofstream out(path);
+    out << "# throughput_bench, best of " << repeat << " rounds\n";
+    out << "# shape\tphase\tbytes\tms\tMB/s\n";
+    for(auto &r : results){
+        char buf[64];
+        snprintf(buf,sizeof(buf),"%.3f\t%.1f",r.ms,r.mb_per_s());
+        out << r.shape << '\t' << r.phase << '\t' << r.bytes << '\t' << buf << '\n';
+    }
+}
+
+//Throughput is compared rather than time, so runs at another --size still line up.
+static bool compare(const char* path,const vector<result> &results,double threshold){
+    ifstream in(path);
+    if(!in){
+        fprintf(stderr,"cannot open %s\n",path);
+        return false;
+    }
+    map<pair<string,string>,double> old;
+    string shape,phase;
+    size_t bytes;
+    double ms,mbs;
+    while(in >> shape){
+        if(shape[0] == '#'){getline(in,shape);continue;}
+        in >> phase >> bytes >> ms >> mbs;
+        old[{shape,phase}] = mbs;
+    }
+    bool ok = true;
+    printf("\n%-12s %-6s %10s %10s %8s\n","shape","phase","old MB/s","new MB/s","change");
+    for(auto &r : results){
+        auto it = old.find({r.shape,r.phase});
+        if(it == old.end()) continue;
+        double change = (r.mb_per_s() / it->second - 1) * 100;
+        bool slower = change < -threshold;
+        ok = ok && !slower;
+        printf("%-12s %-6s %10.1f %10.1f %+7.1f%%%s\n",r.shape.c_str(),r.phase.c_str(),it->second,r.mb_per_s(),change,slower ? "  slower" : "");
+    }
+    return ok;
+}
+
+int main(int argc,char** argv){
+    vector<gen_shape> shapes(begin(all_shapes),end(all_shapes));
+    double size_mb = 4;
+    int repeat = 5;
+    unsigned jobs = 1;
+    double threshold = 10;
+    const char *save_path = nullptr,*compare_path = nullptr,*emit_path = nullptr;
+    for(int i = 1;i < argc;++i){
+        string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if(value == nullptr){
+            fprintf(stderr,"missing value for %s\n",argv[i]);
+            return 1;
+        }
+        ++i;
+        if(arg == "--shape"){
+            gen_shape s;
+            if(!parse_shape(value,s)){
+                fprintf(stderr,"unknown shape %s\n",value);
+                return 1;
+            }
+            shapes = {s};
+        }
+        else if(arg == "--size") size_mb = atof(value);
+        else if(arg == "--repeat") repeat = max(1,atoi(value));
+        else if(arg == "-j") jobs = max(1,atoi(value));
+        else if(arg == "--save") save_path = value;
+        else if(arg == "--compare") compare_path = value;
+        else if(arg == "--threshold") threshold = atof(value);
+        else if(arg == "--emit") emit_path = value;
+        else{
+            fprintf(stderr,"unknown option %s\n",arg.c_str());
+            return 1;
+        }
+    }
+    size_t bytes = size_mb * (1 << 20);
+    if(emit_path){
+        gen_options opt;
+        opt.shape = shapes[0];
+        opt.target_bytes = bytes;
+        ofstream(emit_path) << generate_sysy(opt);
+        return 0;
+    }
+
+    vector<result> results;
+    for(gen_shape s : shapes){
+        for(auto &r : bench_shape(s,bytes,repeat,jobs)) results.push_back(r);
+    }
+    if(save_path) save(save_path,results,repeat);
+    if(compare_path && !compare(compare_path,results,threshold)) return 1;
+    return 0;
+}
@@ -0,0 +1,120 @@
+#ifndef arena_hpp
+#define arena_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Bump allocator owning every node of one compilation.
+// Objects are never freed one by one: release() runs the destructors that
+// were registered (only for types that need one) and frees the chunks.
+struct arena {
+    struct chunk {
+        chunk *next;
+        size_t size;
+    };
+    struct dtor_record {
+        void (*destroy)(void*);
+        void *obj;
+        dtor_record *next;
+    };
+
+    static constexpr size_t default_chunk_size = 64 * 1024;
+
+    chunk *chunks;
+    char *cur;
+    char *end;
+    dtor_record *dtors;
+    size_t object_count;
+    size_t used_bytes;
+
+    arena() : chunks(nullptr),cur(nullptr),end(nullptr),dtors(nullptr),object_count(0),used_bytes(0){};
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+    arena(arena &&o) noexcept
+        : chunks(o.chunks),cur(o.cur),end(o.end),dtors(o.dtors),object_count(o.object_count),used_bytes(o.used_bytes){
+        o.chunks = nullptr;o.cur = o.end = nullptr;o.dtors = nullptr;
+    }
+    ~arena(){release();}
+
+    void* allocate(size_t size,size_t align){
+        uintptr_t p = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+        if(cur == nullptr || p + size > (uintptr_t)end){
+            grow(size + align);
+            p = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+        }
+        cur = (char*)(p + size);
+        used_bytes += size;
+        return (void*)p;
+    }
+
+    template<typename T,typename... Args>
+    T* make(Args&&... args){
+        T *obj = new (allocate(sizeof(T),alignof(T))) T(std::forward<Args>(args)...);
+        object_count++;
+        if constexpr (!std::is_trivially_destructible<T>::value){
+            auto rec = (dtor_record*)allocate(sizeof(dtor_record),alignof(dtor_record));
+            rec->destroy = [](void *p){((T*)p)->~T();};
+            rec->obj = obj;
+            rec->next = dtors;
+            dtors = rec;
+        }
+        return obj;
+    }
+
+    //Take over everything owned by another arena, e.g. a worker-local one.
+    void merge(arena &&o){
+        if(o.dtors){
+            dtor_record *tail = o.dtors;
+            while(tail->next) tail = tail->next;
+            tail->next = dtors;
+            dtors = o.dtors;
+        }
+        if(o.chunks){
+            chunk *tail = o.chunks;
+            while(tail->next) tail = tail->next;
+            if(chunks){
+                //Keep our current chunk at the head so allocation goes on there.
+                tail->next = chunks->next;
+                chunks->next = o.chunks;
+            }else{
+                chunks = o.chunks;
+                cur = o.cur;end = o.end;
+            }
+        }
+        object_count += o.object_count;
+        used_bytes += o.used_bytes;
+        o.chunks = nullptr;o.cur = o.end = nullptr;o.dtors = nullptr;
+        o.object_count = o.used_bytes = 0;
+    }
+
+    void release(){
+        for(dtor_record *r = dtors;r != nullptr;r = r->next) r->destroy(r->obj);
+        dtors = nullptr;
+        while(chunks){
+            chunk *next = chunks->next;
+            std::free(chunks);
+            chunks = next;
+        }
+        cur = end = nullptr;
+        object_count = used_bytes = 0;
+    }
+
+private:
+    void grow(size_t at_least){
+        size_t size = default_chunk_size;
+        while(size < at_least + sizeof(chunk)) size *= 2;
+        chunk *c = (chunk*)std::malloc(size);
+        if(c == nullptr) throw std::bad_alloc();
+        c->size = size;
+        c->next = chunks;
+        chunks = c;
+        cur = (char*)(c + 1);
+        end = (char*)c + size;
+    }
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef const_eval_hpp
+#define const_eval_hpp
+
+#include <cstdint>
+#include <functional>
+#include "symbol.hpp"
+#include "syntax_tree.hpp"
+#include "token.hpp"
+
+struct literal_value {
+	TokenType type; //Int, Float, or Void for a call of a void function
+	int32_t i;
+	float f;
+};
+
+// Runs a call of a SysY function while checking, for the places the
+// language needs its value: array dimensions and initializers of constants
+// and globals. body(f) is the checked definition of f, or null for what
+// must not be run (runtime functions, functions defined later). Gives up,
+// returning false, on whatever could turn out differently at run time or
+// trap: reads of globals that aren't const, writes to any global, division
+// by zero, accesses out of bounds, and more steps, memory or nesting than
+// a compiler should spend on it.
+bool evaluate_call(fun_call_expr &call,const std::function<func_def*(symbol)> &body,literal_value &result);
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef ir_hpp
+#define ir_hpp
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// SSA form of a checked program.
+// A function keeps all of its instructions in one array and a value is the
+// index of the instruction defining it, so operands are plain integers.
+// Blocks list the instructions they execute in order: phis first, exactly
+// one terminator last. Constants, arguments, global addresses and undef
+// belong to no block and can be used anywhere in the function.
+
+enum class ir_op : uint8_t {
+    iconst,fconst,undef,arg,global, //not in a block
+    add,sub,mul,div,rem,            //i32, div and rem truncate like C
+    fadd,fsub,fmul,fdiv,fneg,       //f32
+    icmp,fcmp,                      //i32 0 or 1, condition in cc; icmp also
+                                    //compares two ptrs
+    itof,ftoi,
+    alloca,                         //imm bytes of stack, entry block only
+    ptradd,                         //ptr + i32 byte offset
+    load,store,                     //store: ops = {ptr,value}
+    memzero,                        //clears imm bytes at ops[0]
+    call,                           //callee function in index, args in the list
+    phi,                            //list is aligned with the block's preds
+    br,condbr,ret,                  //br: ops[0] = block, condbr: ops = {cond,then,else},
+                                    //taking then when the i32 cond is not 0
+    nop,                            //erased
+};
+enum class ir_type : uint8_t {none,i32,f32,ptr};
+enum class ir_cmp : uint8_t {eq,ne,lt,le,gt,ge};
+
+constexpr uint32_t no_value = ~0u;
+constexpr uint32_t no_block = ~0u;
+
+struct ir_inst {
+    ir_op op;
+    ir_type type;
+    ir_cmp cc;
+    uint32_t block; //no_block for constants, arguments and erased instructions
+    uint32_t ops[3];
+    union {
+        int32_t imm;    //iconst, alloca, memzero
+        float fimm;     //fconst
+        uint32_t index; //arg number, global id, callee id
+    };
+    uint32_t list;  //call arguments and phi incoming values: lists[list, list + nlist)
+    uint32_t nlist;
+};
+static_assert(sizeof(ir_inst) == 32,"keep ir_inst at half a cache line.");
+
+struct ir_block {
+    std::vector<uint32_t> insts;
+    std::vector<uint32_t> preds;
+};
+
+struct ir_function {
+    std::string name;
+    ir_type ret;
+    std::vector<ir_type> params;
+    bool is_extern;          //runtime function, no body
+    std::vector<uint32_t> args; //value of each parameter
+    std::vector<ir_inst> insts;
+    std::vector<ir_block> blocks; //blocks[0] is the entry
+    std::vector<uint32_t> lists;
+
+    ir_function(std::string name,ir_type ret,std::vector<ir_type> params,bool is_extern)
+        : name(std::move(name)),ret(ret),params(std::move(params)),is_extern(is_extern){}
+
+    //Adds an instruction outside of any block and returns its value.
+    uint32_t add(const ir_inst &i);
+    //Adds an instruction at the end of block b.
+    uint32_t append(uint32_t b,const ir_inst &i);
+    uint32_t new_block();
+
+    uint32_t* list(const ir_inst &i){return lists.data() + i.list;}
+    const uint32_t* list(const ir_inst &i) const {return lists.data() + i.list;}
+    void set_list(uint32_t v,const std::vector<uint32_t> &values);
+
+    const ir_inst* terminator(uint32_t b) const;
+    //Writes the successors of b to out and returns how many there are.
+    uint32_t successors(uint32_t b,uint32_t out[2]) const;
+    //Drops the edge pred -> b: removes pred from b's preds and its phi operands.
+    void remove_pred(uint32_t b,uint32_t pred);
+    //Rewrites every use of `from` to `to`.
+    void replace_uses(uint32_t from,uint32_t to);
+    //Takes v out of its block; the slot in insts stays as a nop.
+    void erase(uint32_t v);
+    //Removes blocks not reachable from the entry and renumbers the rest.
+    //Returns the number of blocks removed.
+    uint32_t remove_unreachable();
+    //Instructions in blocks, i.e. what would be executed or emitted.
+    uint32_t inst_count() const;
+};
+
+inline bool is_terminator(ir_op op){return op == ir_op::br || op == ir_op::condbr || op == ir_op::ret;}
+//Constants, arguments and global addresses: values that live in no block.
+inline bool is_leaf(ir_op op){return op <= ir_op::global;}
+inline bool has_side_effects(ir_op op){
+    return op == ir_op::store || op == ir_op::memzero || op == ir_op::call || is_terminator(op);
+}
+
+//Calls f(operand) on every value operand of i (block targets excluded);
+//operands are passed by reference, so f may rewrite them when fn isn't const.
+template<typename Fn,typename Inst,typename F>
+void for_each_operand(Fn &fn,Inst &i,F &&f){
+    switch(i.op){
+    case ir_op::iconst: case ir_op::fconst: case ir_op::undef: case ir_op::arg: case ir_op::global:
+    case ir_op::alloca: case ir_op::br: case ir_op::nop:
+        return;
+    case ir_op::call: case ir_op::phi:
+        for(uint32_t k = 0;k < i.nlist;++k) f(fn.lists[i.list + k]);
+        return;
+    case ir_op::condbr: case ir_op::fneg: case ir_op::itof: case ir_op::ftoi:
+    case ir_op::load: case ir_op::memzero:
+        f(i.ops[0]);
+        return;
+    case ir_op::ret:
+        if(i.ops[0] != no_value) f(i.ops[0]);
+        return;
+    default:
+        f(i.ops[0]);
+        f(i.ops[1]);
+    }
+}
+
+struct ir_global {
+    std::string name;
+    ir_type elem;               //i32 or f32
+    uint32_t size;              //bytes
+    bool is_const;
+    std::vector<uint32_t> init; //initial words, missing ones are zero
+};
+
+struct ir_module {
+    std::vector<ir_global> globals;
+    std::vector<ir_function> functions;
+
+    int find_function(const std::string &name) const;
+    uint32_t inst_count() const;
+};
+
+std::ostream& operator<<(std::ostream &os,ir_type t);
+void print(std::ostream &os,const ir_function &fn,const ir_module &m);
+void print(std::ostream &os,const ir_module &m);
+//Throws a string describing the first inconsistency found.
+void verify(const ir_function &fn);
+void verify(const ir_module &m);
+
+#endif
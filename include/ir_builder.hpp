@@ -0,0 +1,172 @@
+#ifndef ir_builder_hpp
+#define ir_builder_hpp
+
+#include "ir.hpp"
+#include "static_checker.hpp"
+#include "symbol.hpp"
+#include "syntax_tree.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// (block,variable) -> current value. Open addressing with linear probing:
+// the builder does a few million of these lookups on big inputs and a
+// node-based map spends most of that time in malloc.
+struct def_table {
+    static constexpr uint64_t empty = ~0ull;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> values;
+    uint32_t count = 0;
+
+    static uint64_t key(uint32_t block,uint32_t var){return (uint64_t)block << 32 | var;}
+    uint32_t slot(uint64_t k) const {return (uint32_t)((k * 0x9e3779b97f4a7c15ull) >> 32) & (keys.size() - 1);}
+    void clear(){
+        if(keys.size() != 64){
+            keys.assign(64,empty);
+            values.assign(64,0);
+        }else std::fill(keys.begin(),keys.end(),empty);
+        count = 0;
+    }
+    const uint32_t* find(uint64_t k) const {
+        for(uint32_t s = slot(k);;s = (s + 1) & (keys.size() - 1)){
+            if(keys[s] == k) return &values[s];
+            if(keys[s] == empty) return nullptr;
+        }
+    }
+    void set(uint64_t k,uint32_t v){
+        if(2 * (count + 1) > keys.size()) grow();
+        uint32_t s = slot(k);
+        while(keys[s] != k && keys[s] != empty) s = (s + 1) & (keys.size() - 1);
+        if(keys[s] == empty){keys[s] = k;count++;}
+        values[s] = v;
+    }
+    void grow(){
+        std::vector<uint64_t> old_keys(keys.size() * 2,empty);
+        std::vector<uint32_t> old_values(keys.size() * 2,0);
+        old_keys.swap(keys);
+        old_values.swap(values);
+        count = 0;
+        for(size_t i = 0;i < old_keys.size();++i){
+            if(old_keys[i] != empty) set(old_keys[i],old_values[i]);
+        }
+    }
+};
+
+// Lowers a checked AST to SSA (see ir.hpp).
+// Scalar locals never touch memory. They become SSA variables and phis are
+// placed while the code is generated, following Braun et al., "Simple and
+// Efficient Construction of SSA Form": a block is sealed once all of its
+// preds are known, and a read in an unsealed block goes through a
+// placeholder phi that gets its operands when the block is sealed.
+// Arrays live in memory: an alloca in the entry block, a global, or the
+// pointer passed in. index_expr becomes `ptradd base, index * stepsize`.
+struct ir_builder : tree_visitor {
+    struct variable {
+        enum {ssa,global,address} kind;
+        ir_type type; //element type
+        bool is_array;
+        uint32_t id;  //SSA variable, global id, or the value holding the array's address
+    };
+    struct scoped {
+        variable var;
+        symbol name;
+        int32_t shadowed;
+    };
+    struct loop_targets {
+        uint32_t cont;
+        uint32_t brk;
+    };
+
+    ir_module &mod;
+    const std::unordered_map<symbol,Func> &funcs;
+    std::unordered_map<symbol,uint32_t> func_ids;
+
+    //Same scheme as scope_table: one slot per symbol plus an undo stack.
+    std::vector<int32_t> head;
+    std::vector<scoped> scope;
+    std::vector<uint32_t> markers;
+
+    uint32_t fn_id;
+    ir_function *fn; //nullptr while lowering globals
+    uint32_t cur;    //block receiving new instructions
+    uint32_t result; //value of the last expression visited
+    uint32_t nallocas;
+    std::vector<loop_targets> loops;
+
+    //SSA construction state of the current function.
+    std::vector<ir_type> var_types;
+    def_table defs;
+    std::vector<std::vector<std::pair<uint32_t,uint32_t>>> incomplete; //per block: (variable,phi)
+    std::vector<char> sealed;
+    std::vector<uint32_t> forward; //trivial phi -> the value replacing it
+    std::unordered_map<uint64_t,uint32_t> leaves;
+
+    ir_builder(ir_module &m,const std::unordered_map<symbol,Func> &funcs) : mod(m),funcs(funcs),fn(nullptr){}
+    void build(std::vector<CompUnit> &ast);
+
+    void enter_scope(){markers.push_back(scope.size());}
+    void quit_scope();
+    void declare(symbol name,const variable &v);
+    variable& lookup(symbol name);
+
+    uint32_t function_id(symbol name);
+    uint32_t new_block();
+    uint32_t emit(ir_op op,ir_type type,uint32_t a = no_value,uint32_t b = no_value);
+    uint32_t iconst(int v);
+    uint32_t fconst(float v);
+    uint32_t undef(ir_type t);
+    uint32_t global_addr(uint32_t id);
+    ir_type type_of(uint32_t v){return fn->insts[v].type;}
+    uint32_t convert(uint32_t v,ir_type to);
+    uint32_t value(expr* e){e->accept(*this);return result;}
+    uint32_t address(index_expr &e);
+    void cond(expr* e,uint32_t then_block,uint32_t else_block);
+    void jump(uint32_t target);
+    void branch(uint32_t c,uint32_t then_block,uint32_t else_block);
+    bool terminated();
+    void start_unreachable();
+    void start_function(uint32_t id);
+    void finish_function();
+
+    uint32_t new_var(ir_type t);
+    void write_var(uint32_t var,uint32_t block,uint32_t v);
+    uint32_t read_var(uint32_t var,uint32_t block);
+    uint32_t add_phi_operands(uint32_t var,uint32_t phi);
+    uint32_t try_remove_trivial_phi(uint32_t phi);
+    void seal(uint32_t block);
+    uint32_t resolve(uint32_t v);
+
+    void global_decl(decl &e,const std::vector<int> &dimens);
+    void local_decl(decl &e,const std::vector<int> &dimens);
+
+    void accept(ast_node&);
+    void accept(expr &e);
+    void accept(var_expr& ve) final;
+    void accept(int_literal_expr& e) final;
+    void accept(float_literal_expr& e) final;
+    void accept(binary_expr& e) final;
+    void accept(assign_expr& e) final;
+    void accept(prefix_expr& e)final;
+    void accept(fun_call_expr& e) final;
+    void accept(index_expr& e)final;
+    void accept(init_val&)final;
+    void accept(Type&)final;
+    void accept(func_def&) final;
+    void accept(decl&) final;
+    void accept(block_item&) final;
+    void accept(stmt&) final;
+    void accept(empty_stmt&) final;
+    void accept(expr_stmt&) final;
+    void accept(block_stmt&) final;
+    void accept(if_stmt&) final;
+    void accept(while_stmt&) final;
+    void accept(continue_stmt&) final;
+    void accept(break_stmt&) final;
+    void accept(return_stmt&) final;
+};
+
+ir_module build_ir(std::vector<CompUnit> &ast,const static_checker &checker);
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef ir_opt_hpp
+#define ir_opt_hpp
+
+#include "ir.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Immediate dominators after Cooper, Harvey and Kennedy, "A Simple, Fast
+// Dominance Algorithm". Blocks unreachable from the entry have no idom and
+// are in no order.
+struct dominator_tree {
+    std::vector<uint32_t> idom;  //no_block for the entry and unreachable blocks
+    std::vector<uint32_t> rpo;   //reachable blocks in reverse postorder
+    std::vector<uint32_t> order; //position of each block in rpo, no_block if unreachable
+    std::vector<std::vector<uint32_t>> children;
+    std::vector<uint32_t> enter,leave; //preorder interval of each subtree
+
+    explicit dominator_tree(const ir_function &fn);
+    bool dominates(uint32_t a,uint32_t b) const {return enter[a] <= enter[b] && leave[b] <= leave[a];}
+};
+
+// Natural loops: a back edge goes to a block dominating its source, and the
+// loop of a header is the header plus every block reaching one of its back
+// edges without passing through it. Loops are listed in reverse postorder
+// of their headers, so an enclosing loop comes before the loops it holds.
+constexpr uint32_t no_loop = ~0u;
+struct ir_loop {
+    uint32_t header;
+    uint32_t parent;             //enclosing loop or no_loop
+    uint32_t depth;              //1 for outermost loops
+    std::vector<uint32_t> blocks; //header first, then in reverse postorder
+    std::vector<uint32_t> latches;
+};
+struct loop_forest {
+    std::vector<ir_loop> loops;
+    std::vector<uint32_t> innermost; //innermost loop of each block, or no_loop
+
+    loop_forest(const ir_function &fn,const dominator_tree &dom);
+    bool contains(uint32_t loop,uint32_t b) const {
+        for(uint32_t l = innermost[b];l != no_loop;l = loops[l].parent){
+            if(l == loop) return true;
+        }
+        return false;
+    }
+};
+
+// Optimizations of the SSA IR (see ir.hpp). Every pass works on one
+// function, leaves it verifiable and returns how many instructions it
+// removed from the blocks, i.e. the drop in inst_count().
+
+// Sparse conditional constant propagation (Wegman and Zadeck). Values are
+// assumed constant until shown otherwise and blocks unreachable until a
+// branch that can be taken leads there, so constants flow through phis and
+// loops and branches on known conditions become jumps. Loads from const
+// globals at known offsets fold to their initial value; divisions that
+// would trap are left for run time.
+uint32_t sccp(ir_function &fn,const ir_module &m);
+// Computes arithmetic, compare or conversion i on the bits of constant
+// operands a and b the way the generated code would. Returns false where
+// that traps or is undefined: division by zero, INT_MIN / -1 and float to
+// int conversions out of range.
+bool fold_constant(const ir_inst &i,uint32_t a,uint32_t b,uint32_t &out);
+
+// Mark and sweep: stores, calls and terminators are live, and so is
+// everything they use; the rest is removed, dead phi cycles included.
+uint32_t dead_code(ir_function &fn);
+
+// Cleans up the control flow graph until nothing changes: conditional
+// branches with one target become jumps, blocks holding just a jump are
+// bypassed, a block is merged into its only pred when that pred jumps to
+// it, and blocks no longer reachable are dropped.
+uint32_t simplify_cfg(ir_function &fn);
+
+// Loop-invariant code motion. Gives every loop a preheader, a block that
+// only jumps to the header and that all entries into the loop go through,
+// then moves there, innermost loops first, the pure instructions whose
+// operands are all defined outside the loop. The preheader runs even when
+// the loop body doesn't, so what could trap stays put: a division only
+// moves with a constant divisor other than 0 and -1, or from the header,
+// which runs whenever the preheader does. Loads move only out of loops
+// without stores and calls, and only from the header or from a known
+// offset inside a global. Returns how many instructions were hoisted.
+uint32_t licm(ir_function &fn,const ir_module &m);
+
+// Strength reduction of addresses. In a loop entered from a preheader and
+// closed by one latch, an address base + i * c + d, with i stepped by a
+// constant each trip and base and d invariant, becomes a pointer phi that
+// starts at the first address and is advanced by a constant in the latch.
+// Scales the backends fold into the address (1, 2, 4 and 8 after a single
+// multiplication) are left alone unless i can go away: when the addresses
+// and the exit test are all that use it, every address is reduced and the
+// test `i cc n` in the header becomes a compare of the pointer against the
+// address it reaches when i gets to n (linear-function test replacement).
+// Returns how many addresses were reduced; replaced tests are added to
+// tests_replaced.
+uint32_t reduce_strength(ir_function &fn,uint32_t &tests_replaced);
+
+// Global value numbering over the dominator tree. Instructions computing
+// the same operation on the same values as one in a dominating block are
+// replaced by it; add, mul, fadd, fmul and compares match with their
+// operands swapped, constants with the same bits are one value, and phis
+// of a block match when their incoming values do. A load matches an
+// earlier load of the same address, or the value stored there, when no
+// store, memzero or call can run in between. Loads removed are added to
+// loads.
+uint32_t gvn(ir_function &fn,uint32_t &loads);
+
+// What value numbering removed from one function, for --gvn-report.
+struct gvn_stats {
+    std::string function;
+    uint32_t instructions = 0; //before value numbering
+    uint32_t eliminated = 0;
+    uint32_t loads = 0;        //loads among the eliminated
+};
+void print_gvn_report(std::ostream &os,const std::vector<gvn_stats> &stats);
+
+// Replaces calls on constant arguments by their result, running the
+// callee on an interpreter of the IR at compile time. Only callees that
+// can't have an effect outside their own stack slots are run: no calls of
+// runtime functions, no stores to globals and no loads from globals that
+// aren't const. Calls that would trap or don't finish within bounds on
+// steps, memory and nesting are left for run time. Marks the functions it
+// changed in changed and returns how many calls it replaced.
+uint32_t fold_calls(ir_module &m,std::vector<char> &changed);
+
+// Tail recursion elimination. A call of fn (function self of the module)
+// whose result fn returns becomes a jump to a loop header holding the
+// entry's code, with a phi per parameter; the entry keeps the stack slots.
+// So does `x + call` or `x * call` on ints, with the x accumulated in a
+// phi starting at 0 or 1 that the other returns add or multiply into what
+// they return. Calls passing a pointer that may lead into fn's stack slots
+// are left alone, since the slots are reused by the next trip. Returns how
+// many calls became jumps.
+uint32_t tail_recursion(ir_function &fn,uint32_t self);
+
+// Inlines calls to functions with a body that are on no call cycle,
+// callees before their callers so that what they inlined comes along. A
+// call site is expanded when the callee's size, less what the call costs and
+// two instructions for every use of an argument given a constant or a
+// global, fits a budget of the level that grows with the loop depth of the
+// call; callers stop growing at a size limit of the level. Array parameters
+// are plain pointers in the IR, so they need nothing special. Callee stack
+// slots go to the caller's entry block. Marks the functions it changed in
+// changed and returns how many calls it expanded.
+uint32_t inline_calls(ir_module &m,unsigned level,std::vector<char> &changed);
+
+// Runs the passes of an optimization level over every function with a
+// body; -O0 runs none. Instruction counts go to compile_report, and what
+// value numbering did to each function to stats when given.
+void optimize(ir_module &m,unsigned level,std::vector<gvn_stats> *stats = nullptr);
+
+#endif
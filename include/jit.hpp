@@ -0,0 +1,29 @@
+#ifndef jit_hpp
+#define jit_hpp
+
+#include "ir.hpp"
+#include "x86.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Native code for a whole module, placed in executable memory of this
+// process. Runtime functions are called directly at their host address.
+struct jit_program {
+    uint8_t *code = nullptr;
+    size_t code_size = 0;   //bytes of machine code
+    size_t mapped = 0;
+    std::vector<std::vector<uint32_t>> globals;
+    std::vector<uint32_t> entry; //offset of each function in code
+    int main = -1;
+
+    jit_program() = default;
+    jit_program(const jit_program&) = delete;
+    jit_program& operator=(const jit_program&) = delete;
+    ~jit_program();
+    int run();
+};
+
+void compile_jit(const ir_module &m,jit_program &out,x86_regalloc alloc = x86_regalloc::linear_scan,std::vector<regalloc_stats> *stats = nullptr);
+
+#endif
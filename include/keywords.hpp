@@ -0,0 +1,94 @@
+#ifndef keywords_hpp
+#define keywords_hpp
+
+#include "token.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+struct keyword {
+    std::string_view text{};
+    TokenType type = Ident;
+};
+
+// Add new reserved words here; the table below is rebuilt at compile time.
+constexpr keyword sysy_keywords[] = {
+    {"break",Break},{"const",Const},{"continue",Continue},{"else",Else},
+    {"float",Float},{"if",If},{"int",Int},{"return",Return},
+    {"void",Void},{"while",While},
+};
+
+// Perfect hash over a fixed word list, built at compile time.
+// A word is reduced to a 32-bit key (first, second and last char plus the
+// length) and the slot is taken from the high bits of key * seed. The
+// constructor searches for a seed that puts every word in its own slot,
+// so find() is one multiply and one compare of the first 8 bytes (plus a
+// memcmp of the rest for words longer than that).
+// find() reads 8 bytes at s, which the source padding makes safe.
+template<size_t N>
+struct perfect_hash_table {
+    static constexpr uint32_t bits = N <= 8 ? 4 : N <= 16 ? 5 : N <= 32 ? 6 : N <= 64 ? 7 : 8;
+    static constexpr uint32_t size = 1u << bits;
+
+    keyword slots[size];
+    uint64_t prefix[size]; //first 8 bytes of slots[i], zero filled
+    uint32_t seed;
+    uint32_t min_len;
+    uint32_t max_len;
+
+    static constexpr uint32_t key(const char *s,uint32_t len){
+        return (uint32_t)(uint8_t)s[0] | (uint32_t)(uint8_t)s[1] << 8
+             | (uint32_t)(uint8_t)s[len - 1] << 16 | len << 24;
+    }
+    static constexpr uint64_t load_prefix(const char *s,uint32_t len){
+        uint64_t v = 0;
+        for(uint32_t i = 0;i < 8 && i < len;++i) v |= (uint64_t)(uint8_t)s[i] << (8 * i);
+        return v;
+    }
+    constexpr uint32_t slot(uint32_t k) const {return (k * seed) >> (32 - bits);}
+
+    constexpr perfect_hash_table(const keyword (&words)[N]) : slots(),prefix(),seed(0),min_len(~0u),max_len(0){
+        for(auto &w : words){
+            if(w.text.size() < min_len) min_len = w.text.size();
+            if(w.text.size() > max_len) max_len = w.text.size();
+        }
+        for(uint32_t candidate = 1;candidate < 1000000;candidate += 2){
+            seed = candidate;
+            bool used[size] = {};
+            bool ok = true;
+            for(size_t i = 0;i < N && ok;++i){
+                uint32_t h = slot(key(words[i].text.data(),words[i].text.size()));
+                if(used[h]) ok = false;
+                used[h] = true;
+            }
+            if(ok) break;
+            seed = 0;
+        }
+        for(size_t i = 0;seed != 0 && i < N;++i){
+            uint32_t h = slot(key(words[i].text.data(),words[i].text.size()));
+            slots[h] = words[i];
+            prefix[h] = load_prefix(words[i].text.data(),words[i].text.size());
+        }
+    }
+
+    TokenType find(const char *s,uint32_t len,TokenType otherwise) const {
+        if(len < min_len || len > max_len) return otherwise;
+        uint32_t h = slot(key(s,len));
+        const keyword &k = slots[h];
+        if(k.text.size() != len) return otherwise;
+        uint64_t head;
+        memcpy(&head,s,8);
+        if(len < 8) head &= ~0ull >> (64 - 8 * len);
+        if(head != prefix[h]) return otherwise;
+        if(len > 8 && memcmp(k.text.data() + 8,s + 8,len - 8) != 0) return otherwise;
+        return k.type;
+    }
+};
+
+constexpr perfect_hash_table<sizeof(sysy_keywords)/sizeof(keyword)> keyword_table(sysy_keywords);
+static_assert(keyword_table.seed != 0,"no perfect hash seed for the keyword list.");
+static_assert(keyword_table.min_len >= 2,"key() reads the second char of every word.");
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,"prefix compare assumes a little-endian load.");
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef lexer_hpp
 #define lexer_hpp
 
+#include "scan.hpp"
+#include "source.hpp"
 #include "token.hpp"
 #include <cstdint>
 #include <algorithm>
@@ -8,37 +10,34 @@
 #include <string>
 #include <vector>
 
-#ifdef __linux__
-#define eof 255
-#else
-#define eof -1
-#endif
+// The source buffer is followed by zero padding (see source.hpp).
+constexpr char eof = '\0';
 
 
 struct lexer {
-    std::string src;
+    const char* src; //text followed by source_buffer::padding zero bytes
+    const scanner &scan;
     uint32_t cur_beg;uint32_t cur;
     uint32_t line;
     uint32_t beg_column;uint32_t column;
-    void init(){
+    lexer(const source_buffer& s) : src(s.data),scan(active_scanner()) {
         cur = cur_beg = 0; line = beg_column = column = 1;
-        src.push_back(eof);
     }
-    lexer(std::string&& s) : src(s) {init();}
-    lexer(const std::string& s) : src(s) {init();}
     Token next_token();
-    Token make_token(TokenType type,void* literal);
+    Token make_token(TokenType type);
+    Token make_int(int v);
+    Token make_float(float v);
+    Token make_error(const char* msg);
     bool is_end();
     char advance();
     char peek(uint32_t i);
     bool match(char expect);
+    void skip(const scan_result &r);
     Token ident_or_keyword();
     void skip_white_comment();
-    char parse_char(char surround);
     Token parse_hex();
     Token parse_oct();
     Token parse_dec(char);
-    bool check_keyword(const char*,int);
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef parser_hpp
 #define parser_hpp
 
+#include "arena.hpp"
+#include "lexer.hpp"
 #include "syntax_tree.hpp"
 #include "token.hpp"
 #include <cstdint>
@@ -8,33 +10,43 @@
 #include <string>
 #include <utility>
 #include <vector>
+// Tokens are pulled from the lexer on demand. The grammar never looks
+// further than peek(2), so a ring of 4 tokens is all the parser keeps.
 struct parser {
-    std::vector<Token> src;
-    uint32_t cur;
+    static constexpr uint32_t lookahead = 4;
+    lexer &src;
+    Token ring[lookahead];
+    uint32_t ring_head;
+    uint32_t ring_size;
+    bool lexed_eof;
     uint32_t line;
     uint32_t column;
+    arena &ast_arena;
 
-    parser(std::vector<Token> &src) : src(src),cur(0),line(1),column(1){};
-    parser(std::vector<Token> &&src) : src(src),cur(0),line(1),column(1){};
+    parser(lexer &src,arena &a) : src(src),ring_head(0),ring_size(0),lexed_eof(false),line(1),column(1),ast_arena(a){};
+
+    template<typename T,typename... Args>
+    T* make(Args&&... args){return ast_arena.make<T>(std::forward<Args>(args)...);}
 
 
     bool match(TokenType type) noexcept;
     void update_line_column() noexcept;
     std::string report_line_column();
-    Token& peek(uint32_t i) noexcept;
-    Token& next() noexcept;
-    Token& expect(TokenType type,const char* err_msg);
-    std::vector<std::shared_ptr<expr>> parse_params();
-    std::shared_ptr<expr> parse_expr(int min_binding);
+    void fill(uint32_t n) noexcept;
+    const Token& peek(uint32_t i) noexcept;
+    Token next() noexcept;
+    Token expect(TokenType type,const char* err_msg);
+    std::vector<expr*> parse_params();
+    expr* parse_expr(int min_binding);
 
     std::vector<CompUnit> parse();
 
-    std::vector<std::pair<Type, std::string>> parse_fparams();
-    std::shared_ptr<func_def> parse_function();
-    std::vector<std::shared_ptr<decl>> parse_decl(bool);
-    std::shared_ptr<init_val> parse_init();
-    std::shared_ptr<block_stmt> parse_block();
-    std::shared_ptr<stmt> parse_stmt();
+    std::vector<std::pair<Type, symbol>> parse_fparams();
+    func_def* parse_function();
+    std::vector<decl*> parse_decl(bool);
+    init_val* parse_init();
+    block_stmt* parse_block();
+    stmt* parse_stmt();
 };
 
 #endif
\ No newline at end of file
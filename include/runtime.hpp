@@ -0,0 +1,29 @@
+#ifndef runtime_hpp
+#define runtime_hpp
+
+#include "token.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The SysY runtime library (runtime/sylib.c): I/O and timing functions
+// every program can call without declaring them. The checker registers
+// them as functions; the VM and the JIT call the implementations linked
+// into sysyc, emitted assembly calls them by name.
+enum class runtime_arg : uint8_t {i32,f32,i32_array,f32_array};
+
+struct runtime_function {
+    const char* name;
+    TokenType ret; //Int, Float or Void
+    std::vector<runtime_arg> params;
+    void* native;  //the implementation, with the C signature the name suggests
+};
+
+extern const std::vector<runtime_function> runtime_functions;
+//Index into runtime_functions, or -1.
+int find_runtime(const std::string &name);
+
+//Flushes what the program printed, before sysyc prints anything else.
+void runtime_finish();
+
+#endif
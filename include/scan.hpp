@@ -0,0 +1,28 @@
+#ifndef scan_hpp
+#define scan_hpp
+
+#include <cstdint>
+
+// Bulk scanners used by the lexer to skip runs of bytes. They rely on the
+// zero padding after the source text (see source.hpp): every run stops at
+// the '\0' sentinel and vector loads may read past the end of the text.
+struct scan_result {
+    uint32_t len;          //bytes in the run
+    uint32_t newlines;     //'\n' inside the run
+    uint32_t last_newline; //offset of the last '\n', valid if newlines > 0
+};
+
+struct scanner {
+    const char* name;
+    uint32_t (*ident)(const char*);            //[A-Za-z0-9_]*
+    scan_result (*blank)(const char*);         //[ \t\n]*
+    uint32_t (*line_comment)(const char*);     //up to '\n' or end
+    scan_result (*block_comment)(const char*); //up to "*/" or end
+};
+
+// Picks the widest implementation the CPU supports (avx2, sse2, scalar).
+// The SYSY_SCAN environment variable can force one of them by name.
+const scanner& active_scanner();
+const scanner* find_scanner(const char* name);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef source_hpp
+#define source_hpp
+
+#include <cstddef>
+#include <string>
+
+// Source text as the lexer sees it: `size` bytes of text followed by at
+// least `padding` zero bytes, so the lexer can use '\0' as its sentinel and
+// read a little past the end without bounds checks.
+// Regular files are mmap'ed directly; the padding comes from an anonymous
+// mapping placed right after the file pages.
+struct source_buffer {
+    static constexpr size_t padding = 64;
+
+    const char *data;
+    size_t size;
+
+    source_buffer() : data(nullptr),size(0),map_base(nullptr),map_len(0),owned(nullptr){};
+    source_buffer(const source_buffer&) = delete;
+    source_buffer& operator=(const source_buffer&) = delete;
+    source_buffer(source_buffer &&o) noexcept;
+    source_buffer& operator=(source_buffer &&o) noexcept;
+    ~source_buffer();
+
+    static source_buffer from_file(const char *path);
+    static source_buffer from_string(const std::string &s);
+
+private:
+    void *map_base;
+    size_t map_len;
+    char *owned; //heap copy when the input can't be mapped
+    void release();
+};
+
+#endif
@@ -4,13 +4,16 @@
 #include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <exception>
 #include <iostream>
-#include <malloc/_malloc.h>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
-#include <map>
+#include <unordered_map>
+#include "arena.hpp"
+#include "symbol.hpp"
 #include "syntax_tree.hpp"
 #include "token.hpp"
 
@@ -19,39 +22,88 @@
 
 struct Func {
 	TokenType return_type;
-	std::vector<std::pair<VarType, std::string>> params;
+	std::vector<std::pair<VarType, symbol>> params;
 };
 
-struct Environment {
-	std::map<std::string,VarType> vars;
-	Environment *enclosing;
-
-	Environment *enter_env(){
-		Environment *env = new Environment;
-		env->enclosing = this;
-		return env;
+// All scopes share one flat table indexed by symbol id: head[s] is the
+// innermost binding of s and every binding remembers the one it shadows.
+// enter() pushes a marker, quit() pops the bindings made since then, so
+// neither allocates once the vectors have grown and lookup is one probe.
+struct scope_table {
+	struct binding {
+		VarType type;
+		symbol name;
+		uint32_t depth;
+		int32_t shadowed; //previous binding of name, -1 if none
+	};
+	std::vector<int32_t> head;
+	std::vector<binding> bindings;
+	std::vector<uint32_t> markers;
+	//Globals from this binding on are declared after the function being
+	//checked, and are not in its scope.
+	uint32_t visible = UINT32_MAX;
+
+	uint32_t depth() const {return markers.size();}
+	void enter(){markers.push_back(bindings.size());}
+	void quit(){
+		uint32_t m = markers.back();
+		markers.pop_back();
+		while(bindings.size() > m){
+			binding &b = bindings.back();
+			head[b.name] = b.shadowed;
+			bindings.pop_back();
+		}
+	}
+	VarType* lookup(symbol s){
+		if(s >= head.size() || head[s] < 0) return nullptr;
+		binding &b = bindings[head[s]];
+		if(b.depth == 0 && (uint32_t)head[s] >= visible) return nullptr;
+		return &b.type;
+	}
+	bool declared_here(symbol s){
+		return s < head.size() && head[s] >= 0 && bindings[head[s]].depth == depth();
 	}
-	VarType* lookup(std::string&& s){return lookup(s);}
-	VarType* lookup(std::string& s){
-		if(vars.count(s)) return &vars[s]; 
-		if(enclosing) return enclosing->lookup(s);
-		return nullptr;
+	void insert(symbol s,VarType t){
+		if(s >= head.size()) head.resize(std::max<size_t>(symbols.size(),s+1),-1);
+		bindings.push_back({std::move(t),s,depth(),head[s]});
+		head[s] = bindings.size() - 1;
 	}
 };
 
+// Function definitions in source order. Each body is checked once, by the
+// pass over bodies or first by a constant expression calling it. A failed
+// check isn't run again on the tree it partly folded: its error is kept.
+struct function_bodies {
+	std::vector<func_def*> defs;
+	std::unordered_map<symbol,uint32_t> index;
+	std::unique_ptr<std::once_flag[]> checked;
+	std::unique_ptr<std::exception_ptr[]> errors;
+	std::vector<uint32_t> globals; //declared before each function
+};
+
 struct static_checker : tree_visitor {
-	std::map<std::string,Func> funcs;
-	Environment* env;
+	std::unordered_map<symbol,Func> funcs;
+	scope_table env;
+	arena &ast_arena;
+	std::shared_ptr<function_bodies> bodies;
+	const static_checker *root; //whose global scope bodies are checked in
+	//Functions defined before what is being checked: the ones constant
+	//expressions may call.
+	uint32_t defined;
 
 	bool need_replace;
 	bool second_pass;
-	std::shared_ptr<expr> replace_expr;
-	std::shared_ptr<stmt> replace_stmt;
+	//Nonzero while checking an expression the language needs the value of:
+	//array dimensions and initializers of constants and globals. Operators
+	//are folded only there; elsewhere the IR optimizer does it.
+	uint32_t const_context;
+	expr* replace_expr;
+	stmt* replace_stmt;
 	
-	bool is_global(){return env->enclosing == nullptr;}
+	bool is_global(){return env.depth() == 0;}
 
 
-	void check_replace(std::shared_ptr<expr> &origin){
+	void check_replace(expr* &origin){
 		if(need_replace){
 			origin = replace_expr;
 			replace_expr = nullptr;
@@ -59,24 +111,35 @@ struct static_checker : tree_visitor {
 		}
 	}
 
-	void save_replace(std::shared_ptr<expr> renew){
+	void save_replace(expr* renew){
 		replace_expr = renew;
 		need_replace = true;
 	}
 
 	void enter_env(){
-		env = env->enter_env();
+		env.enter();
 	}
 	void quit_env(){
-		if(env == nullptr) return;
-		Environment *old = env;
-		env = env->enclosing;
-		delete old;
+		env.quit();
 	}
-	static_checker();
-	~static_checker() ;
-
-	void check(std::vector<CompUnit> &ast);
+	template<typename T,typename... Args>
+	T* make(Args&&... args){return ast_arena.make<T>(std::forward<Args>(args)...);}
+	VarType* new_type(VarType &&t){return make<VarType>(std::move(t));}
+	int_literal_expr* int_literal_with_vartype(int v);
+	float_literal_expr* float_literal_with_vartype(float v);
+	//The checked definition of f if constant expressions may call it.
+	func_def* checked_body(symbol f);
+	//Checks body i, with checker or else in the global scope, unless that
+	//was done; throws the error of the check either way.
+	void check_once(uint32_t i,static_checker *checker);
+
+	static_checker(arena &a);
+	//Worker for the second pass: shares the read-only global scope and funcs.
+	static_checker(const static_checker &global,arena &a);
+
+	//With jobs > 1 the function bodies are checked concurrently; the error
+	//reported is the one of the first failing function in source order.
+	void check(std::vector<CompUnit> &ast,unsigned jobs = 1);
 
 	void accept(ast_node&);
     void accept(expr &e);
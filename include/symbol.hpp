@@ -0,0 +1,32 @@
+#ifndef symbol_hpp
+#define symbol_hpp
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Identifiers are interned once by the lexer; every later phase works with
+// the integer id. Ids are dense, starting from 0.
+using symbol = uint32_t;
+
+struct symbol_table {
+    std::unordered_map<std::string_view,symbol> ids;
+    std::deque<std::string> names; //deque keeps the keys of ids stable
+
+    symbol intern(std::string_view s){
+        auto it = ids.find(s);
+        if(it != ids.end()) return it->second;
+        symbol id = names.size();
+        names.emplace_back(s);
+        ids.emplace(std::string_view(names.back()),id);
+        return id;
+    }
+    const std::string& name(symbol s) const {return names[s];}
+    uint32_t size() const {return names.size();}
+};
+
+extern symbol_table symbols;
+
+#endif
@@ -1,11 +1,14 @@
 #ifndef syntax_hpp
 #define syntax_hpp
 
+#include "symbol.hpp"
 #include "token.hpp"
 #include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -75,11 +78,12 @@ struct VarType {
 
 struct tree_visitor;
 
+// Nodes are allocated in the arena of the compilation (see arena.hpp) and
+// are never deleted individually, so they have no virtual destructor.
 struct ast_node {
     void *info;
     ast_node() : info(nullptr){};
     virtual void accept(tree_visitor&);
-    virtual ~ast_node() ;
 };
 
 
@@ -87,67 +91,57 @@ struct expr : ast_node {
     VarType* type;
     expr() : type(nullptr){};
     void accept(tree_visitor&);
-    virtual ~expr() {if(type) delete type;};
 };
 
 struct var_expr : expr {
-    std::string varname;
+    symbol varname;
 
-    var_expr(std::string &s) : varname(s) {};
-    ~var_expr();
+    var_expr(symbol s) : varname(s) {};
     void accept(tree_visitor&);
 };
 struct int_literal_expr : expr {
     int value;
 
     int_literal_expr(int v) : value(v){};
-    ~int_literal_expr();
     void accept(tree_visitor&);
 };
 struct float_literal_expr : expr {
     float value;
     float_literal_expr(float v) : value(v){};
-    ~float_literal_expr();
     void accept(tree_visitor&);
 };
 struct binary_expr : expr {
     TokenType op;
-    std::shared_ptr<expr> lhs,rhs;
+    expr *lhs,*rhs;
 
-    binary_expr(TokenType op,std::shared_ptr<expr> lhs,std::shared_ptr<expr> rhs) : op(op),lhs(lhs),rhs(rhs){};
-
-    ~binary_expr();
+    binary_expr(TokenType op,expr* lhs,expr* rhs) : op(op),lhs(lhs),rhs(rhs){};
     void accept(tree_visitor&);
 };
 struct assign_expr : expr {
-    std::shared_ptr<expr> lhs,rhs;
-    assign_expr(std::shared_ptr<expr> lhs,std::shared_ptr<expr> rhs) : lhs(lhs),rhs(rhs){};
-    ~assign_expr();
+    expr *lhs,*rhs;
+    assign_expr(expr* lhs,expr* rhs) : lhs(lhs),rhs(rhs){};
     void accept(tree_visitor&);
 };
 struct prefix_expr : expr {
     TokenType op;
-    std::shared_ptr<expr> rhs;
+    expr* rhs;
 
-    prefix_expr(TokenType op,std::shared_ptr<expr> rhs) : op(op),rhs(rhs){};
-    ~prefix_expr();
+    prefix_expr(TokenType op,expr* rhs) : op(op),rhs(rhs){};
     void accept(tree_visitor&);
 };
 struct fun_call_expr : expr {
-    std::shared_ptr<expr> func;
-    std::vector<std::shared_ptr<expr>> params;
+    expr* func;
+    std::vector<expr*> params;
 
-    fun_call_expr(std::shared_ptr<expr> func, std::vector<std::shared_ptr<expr>>& params) : func(func),params(params){};
-    fun_call_expr(std::shared_ptr<expr> func, std::vector<std::shared_ptr<expr>>&& params) : func(func),params(params){};
-    ~fun_call_expr();
+    fun_call_expr(expr* func, std::vector<expr*>& params) : func(func),params(params){};
+    fun_call_expr(expr* func, std::vector<expr*>&& params) : func(func),params(params){};
     void accept(tree_visitor&);
 };
 struct index_expr : expr{
-    std::shared_ptr<expr> array;
-    std::shared_ptr<expr> index;
+    expr* array;
+    expr* index;
 
-    index_expr(std::shared_ptr<expr> array,std::shared_ptr<expr> index) : array(array),index(index){};
-    ~index_expr();
+    index_expr(expr* array,expr* index) : array(array),index(index){};
     void accept(tree_visitor&);
 };
 
@@ -160,17 +154,22 @@ struct stmt;
 struct block_stmt;
 
 struct init_val : ast_node {
-    std::shared_ptr<expr> val;
-    std::vector<std::shared_ptr<init_val>> vals;
+    expr* val;
+    std::vector<init_val*> vals;
 
-    init_val(std::shared_ptr<expr> v) : val(v){};
-    init_val(std::shared_ptr<expr> v,std::vector<std::shared_ptr<init_val>> &&vals) : val(v),vals(vals){};
+    init_val(expr* v) : val(v){};
+    init_val(expr* v,std::vector<init_val*> &&vals) : val(v),vals(vals){};
     void accept(tree_visitor&);
 };
+// Lays an initializer out over an array of the given dimensions (row-major,
+// one entry per element, nullptr where the element is zero-filled). As in
+// C, a nested brace list starts at the next boundary of the largest
+// sub-array it can fill.
+std::vector<expr*> flatten_init(const init_val* init,const std::vector<int> &dimens);
 
 struct Type : ast_node {
     TokenType typ; //Void Int or Float
-    std::vector<std::shared_ptr<expr>> dimens;
+    std::vector<expr*> dimens;
 
     Type() = default;
     Type(const Type &t) = default;
@@ -180,11 +179,11 @@ struct Type : ast_node {
 
 struct func_def : ast_node {
     TokenType return_type;
-    std::string name;
-    std::vector<std::pair<Type,std::string>> fparams;
-    std::shared_ptr<block_stmt> body;
+    symbol name;
+    std::vector<std::pair<Type,symbol>> fparams;
+    block_stmt* body;
 
-    func_def(TokenType t,std::string &n,std::vector<std::pair<Type,std::string>> &&fparams,std::shared_ptr<block_stmt> body) :
+    func_def(TokenType t,symbol n,std::vector<std::pair<Type,symbol>> &&fparams,block_stmt* body) :
         return_type(t),name(n),fparams(fparams),body(body){}
 
     void accept(tree_visitor&);
@@ -192,19 +191,19 @@ struct func_def : ast_node {
 struct decl : ast_node {
     bool is_const;
     Type type;
-    std::string name;
-    std::shared_ptr<init_val> init;
+    symbol name;
+    init_val* init;
 
-    decl(bool is_const,Type &&t,std::string &name,std::shared_ptr<init_val> init)
+    decl(bool is_const,Type &&t,symbol name,init_val* init)
         : is_const(is_const),type(t),name(name),init(init){}
     void accept(tree_visitor&);
 };
 
 struct block_item : ast_node {
-    std::shared_ptr<stmt> statement;
-    std::shared_ptr<decl> declaration;
+    stmt* statement;
+    decl* declaration;
 
-    block_item(std::shared_ptr<stmt> statement,std::shared_ptr<decl> declaration) :statement(statement),declaration(declaration){};
+    block_item(stmt* statement,decl* declaration) :statement(statement),declaration(declaration){};
     void accept(tree_visitor&);
 };
 
@@ -216,9 +215,9 @@ struct empty_stmt : stmt {
     void accept(tree_visitor&);
 };
 struct expr_stmt : stmt {
-    std::shared_ptr<expr> e;
+    expr* e;
 
-    expr_stmt(std::shared_ptr<expr> e) : e(e){};
+    expr_stmt(expr* e) : e(e){};
     void accept(tree_visitor&);
 };
 struct block_stmt : stmt {
@@ -228,21 +227,21 @@ struct block_stmt : stmt {
     void accept(tree_visitor&);
 };
 struct if_stmt : stmt {
-    std::shared_ptr<expr> cond;
-    std::shared_ptr<stmt> then_branch;
-    std::shared_ptr<stmt> else_branch;
+    expr* cond;
+    stmt* then_branch;
+    stmt* else_branch;
 
     if_stmt(
-        std::shared_ptr<expr> cond,
-        std::shared_ptr<stmt> then_branch,
-        std::shared_ptr<stmt> else_branch
+        expr* cond,
+        stmt* then_branch,
+        stmt* else_branch
     ): cond(cond),then_branch(then_branch),else_branch(else_branch){}
     void accept(tree_visitor&);
 };
 struct while_stmt : stmt {
-    std::shared_ptr<expr> cond;
-    std::shared_ptr<stmt> body;
-    while_stmt(std::shared_ptr<expr> cond,std::shared_ptr<stmt> body) : cond(cond),body(body){}
+    expr* cond;
+    stmt* body;
+    while_stmt(expr* cond,stmt* body) : cond(cond),body(body){}
     void accept(tree_visitor&);
 };
 struct continue_stmt : stmt {
@@ -252,15 +251,15 @@ struct break_stmt : stmt{
     void accept(tree_visitor&);
 };
 struct return_stmt : stmt {
-    std::shared_ptr<expr> return_value;
+    expr* return_value;
 
-    return_stmt(std::shared_ptr<expr> e) : return_value(e){}
+    return_stmt(expr* e) : return_value(e){}
     void accept(tree_visitor&);
 };
 
 struct CompUnit{
-    std::shared_ptr<decl> declaration;
-    std::shared_ptr<func_def> function;
+    decl* declaration;
+    func_def* function;
     void accept(tree_visitor&);
 };
 
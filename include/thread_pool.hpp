@@ -0,0 +1,51 @@
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers running batches of indexed tasks.
+// run() deals the task indices out in contiguous blocks, one deque per
+// worker. A worker pops from the back of its own deque and, once that is
+// empty, steals from the front of the others. The calling thread works as
+// worker 0, so a pool of size 1 starts no thread at all.
+struct thread_pool {
+    using task_fn = std::function<void(uint32_t task,unsigned worker)>;
+
+    explicit thread_pool(unsigned workers);
+    ~thread_pool();
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    unsigned size() const {return queues.size();}
+    //Returns once every task has finished. fn must not throw.
+    void run(uint32_t count,const task_fn &fn);
+
+private:
+    struct task_queue {
+        std::mutex m;
+        std::deque<uint32_t> tasks;
+    };
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex m;
+    std::condition_variable start_cv,done_cv;
+    uint64_t generation;
+    unsigned busy;
+    bool stopping;
+    const task_fn *job;
+
+    bool pop(unsigned worker,uint32_t &task);
+    void work(unsigned worker);
+    void loop(unsigned worker);
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef time_report_hpp
+#define time_report_hpp
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Resource usage of one phase of the compilation (or of one function).
+struct usage_sample {
+    double wall_ms;
+    double cpu_ms;       //process CPU time, or thread CPU time for functions
+    uint64_t allocs;     //calls to operator new
+    uint64_t alloc_bytes;
+};
+
+struct phase_record {
+    std::string name;
+    usage_sample usage;
+    long peak_rss_kb; //high-water mark at the end of the phase
+};
+
+// Collected when --time-report is given; printed by main at exit.
+struct time_report {
+    bool enabled = false;
+    std::vector<phase_record> phases;
+    std::vector<phase_record> functions; //second pass of static_checker
+    std::vector<std::pair<std::string,double>> counters; //e.g. instructions executed by --run
+
+    void print_table(std::ostream &os) const;
+    void print_json(std::ostream &os) const;
+};
+
+extern time_report compile_report;
+
+// Process-wide and per-thread counters of operator new; they are always
+// maintained so a report costs nothing extra to turn on.
+uint64_t alloc_count();
+uint64_t alloc_bytes();
+uint64_t thread_alloc_count();
+uint64_t thread_alloc_bytes();
+long peak_rss_kb();
+double wall_now_ms();
+double process_cpu_ms();
+double thread_cpu_ms();
+
+// Records the enclosing scope as a phase of compile_report.
+struct phase_timer {
+    const char *name;
+    usage_sample start;
+    explicit phase_timer(const char *name);
+    ~phase_timer();
+};
+
+// Measures one function on the current thread.
+struct function_timer {
+    usage_sample start;
+    function_timer();
+    usage_sample stop() const;
+};
+
+#endif
@@ -4,7 +4,10 @@
 #include <cstdint>
 #include <ostream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <iostream>
+#include "symbol.hpp"
 enum TokenType{
 	//Single-Char token
 	Comma,SemiColon, // ','  ';'
@@ -35,33 +38,29 @@ enum TokenType{
 
 std::ostream& operator<<(std::ostream&,const TokenType&);
 
+// Trivially copyable: identifiers and string literals refer to their
+// lexeme in the source buffer (which must outlive the tokens), numbers are
+// stored inline and LexError points to a static message.
 struct Token {
 	TokenType type;
-	void* literal; //Pointer to a int,float,or string.
 	uint32_t line;uint32_t column;
-	Token(TokenType type,void* literal,uint32_t line,uint32_t column) :
-		type(type),literal(literal),line(line),column(column){};
-	Token(Token&& at) {
-		type = at.type;
-		literal = at.literal;
-		line = at.line;
-		column = at.column;
-		at.literal = nullptr;
+	uint32_t len;
+	const char* beg;
+	union {
+		int int_value;
+		float float_value;
+		symbol sym; //Ident
 	};
-	Token(const Token& at) : type(at.type),line(at.line),column(at.column) {
-		switch (type) {
-		case IntLiteral : literal = new int(*(int*)at.literal);break;
-		case FloatLiteral : literal = new float(*(float*)at.literal);break;
-		case StringLiteral :
-		case LexError:
-		case Ident : literal = new std::string(*(std::string*)at.literal);break;
-		default: literal = nullptr;
-		}
-	};
-	~Token();
+	Token() : type(Eof),line(0),column(0),len(0),beg(nullptr),int_value(0){};
+	Token(TokenType type,const char* beg,uint32_t len,uint32_t line,uint32_t column) :
+		type(type),line(line),column(column),len(len),beg(beg),int_value(0){};
+
+	std::string_view text() const {return std::string_view(beg,len);}
+	std::string string_value() const; //StringLiteral with escapes decoded
 
 	friend std::ostream& operator<<(std::ostream&,const Token&);
 };
+static_assert(std::is_trivially_copyable<Token>::value,"Token must stay trivially copyable.");
 
 
 
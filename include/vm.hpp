@@ -0,0 +1,85 @@
+#ifndef vm_hpp
+#define vm_hpp
+
+#include "ir.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Register bytecode lowered from the SSA IR, and the interpreter running it.
+// Every IR value gets a register of the frame. A frame is laid out as
+// [constants][parameters][values]: the constants are copied in on entry so
+// that every operand is a plain register index and no instruction needs an
+// immediate form. Phis are replaced by copies on the incoming edges.
+#define VM_OPS(X) \
+    X(mov) \
+    X(add) X(sub) X(mul) X(div) X(rem) \
+    X(fadd) X(fsub) X(fmul) X(fdiv) X(fneg) \
+    X(eq) X(ne) X(lt) X(le) X(gt) X(ge) \
+    X(feq) X(fne) X(flt) X(fle) X(fgt) X(fge) \
+    X(peq) X(pne) X(plt) X(ple) X(pgt) X(pge) \
+    X(itof) X(ftoi) \
+    X(alloca) X(index4) X(ptradd) X(load) X(store) X(memzero) \
+    X(jmp) X(jnz) X(jz) \
+    X(jeq) X(jne) X(jlt) X(jle) X(jgt) X(jge) \
+    X(jfeq) X(jfne) X(jflt) X(jfle) X(jfgt) X(jfge) \
+    X(call) X(callrt) X(ret) X(retv)
+
+enum class vm_op : uint32_t {
+#define VM_ENUM(name) name,
+    VM_OPS(VM_ENUM)
+#undef VM_ENUM
+};
+
+// a is the destination, or the first source of stores and branches.
+// Jumps take their target pc in c. call: b is the callee and c the offset
+// of the argument registers in vm_function::args (callrt: b indexes
+// runtime_functions). alloca: b is the offset in the frame's memory;
+// memzero: b is the size.
+struct vm_inst {
+    vm_op op;
+    uint32_t a,b,c;
+};
+static_assert(sizeof(vm_inst) == 16,"four words per instruction.");
+
+union vm_value {
+    int32_t i;
+    float f;
+    char *p;
+};
+static_assert(sizeof(vm_value) == 8,"registers hold a host pointer.");
+
+struct vm_function {
+    std::string name;
+    int runtime = -1;      //index in runtime_functions for library functions
+    uint32_t nparams = 0;
+    uint32_t nregs = 0;    //constants + parameters + values
+    uint32_t frame_bytes = 0; //memory of the allocas
+    std::vector<vm_value> consts; //registers [0, consts.size())
+    std::vector<uint32_t> args;   //argument registers of the calls
+    std::vector<vm_inst> code;
+};
+
+struct vm_program {
+    std::vector<vm_function> functions;
+    std::vector<std::vector<uint32_t>> globals; //storage, constants point into it
+    int entry = -1; //main
+
+    uint32_t inst_count() const;
+};
+
+vm_program compile_bytecode(const ir_module &m);
+void print(std::ostream &os,const vm_program &p);
+
+// Runs main() of a program; errors at run time (division by zero, stack
+// overflow) are thrown as strings.
+struct vm {
+    const vm_program &program;
+    uint64_t executed = 0; //instructions dispatched by the last run
+
+    explicit vm(const vm_program &p) : program(p){}
+    int run();
+};
+
+#endif
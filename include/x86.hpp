@@ -0,0 +1,196 @@
+#ifndef x86_hpp
+#define x86_hpp
+
+#include "ir.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// x86-64 code lowered from the SSA IR, before it is encoded (x86_encoder)
+// or printed. Registers below first_vreg are physical; the lowering
+// produces virtual registers and fixed physical ones only where the ABI
+// or an instruction demands them (arguments, results, idiv, rep stos).
+// A register allocator then rewrites every virtual register.
+enum x86_reg : uint32_t {
+    rax,rcx,rdx,rbx,rsp,rbp,rsi,rdi,r8,r9,r10,r11,r12,r13,r14,r15,
+    xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7,xmm8,xmm9,xmm10,xmm11,xmm12,xmm13,xmm14,xmm15,
+    first_vreg,
+};
+constexpr uint32_t no_reg = ~0u;
+inline bool is_xmm(uint32_t r){return r >= xmm0 && r <= xmm15;}
+inline bool is_callee_saved(uint32_t r){return r == rbx || (r >= r12 && r <= r15);}
+extern const uint32_t int_arg_regs[6];
+extern const uint32_t caller_saved_regs[9];
+// The order allocators hand out registers in: caller-saved ones first, so
+// code without calls needs no saves.
+extern const uint32_t gpr_alloc_order[14],xmm_alloc_order[16];
+
+// Condition codes in hardware order; fe and fne are the ordered equal and
+// unordered-or-not-equal tests after ucomiss, which need two flags.
+enum class x86_cc : uint8_t {o,no,b,ae,e,ne,be,a,s,ns,p,np,l,ge,le,g,fe,fne};
+x86_cc invert(x86_cc cc);
+
+// Operands are listed destination first, as in Intel syntax.
+enum class x86_op : uint8_t {
+    mov32,mov64,movss,     //movss between registers is a full register move
+    movsx,                 //sign-extends a 32-bit source to 64 bits
+    lea,lea_global,        //lea_global: address of the global in ops[1]
+    add32,sub32,imul32,and32,or32,xor32,add64,sub64,
+    imul3,                 //ops[0] = ops[1] * imm ops[2]
+    shl32,sar32,shr32,neg32,
+    cmp32,cmp64,test32,
+    cdq,idiv32,            //rdx:rax / ops[0]
+    setcc,                 //ops[0] = cc ? 1 : 0
+    addss,subss,mulss,divss,xorps,ucomiss,
+    cvtsi2ss,cvttss2si,
+    movd_to_xmm,movd_from_xmm,
+    rep_stosd,             //zeroes rcx dwords at rdi, clobbers rax
+    jmp,jcc,               //target block in ops[0]
+    call,                  //func or runtime in ops[0]; reads int_args/float_args argument registers
+    tail_jmp,              //like call, but after the epilogue and in place of the ret: the callee returns to our caller
+    push,pop,ret,
+};
+
+enum class x86_kind : uint8_t {none,reg,imm,mem,block,global,func,runtime};
+
+struct x86_operand {
+    x86_kind kind = x86_kind::none;
+    uint8_t scale = 1;        //mem: index scale
+    uint32_t reg = no_reg;    //reg; mem: base
+    uint32_t index = no_reg;  //mem: index register; block, global, func or runtime id
+    uint32_t slot = no_reg;   //mem: frame slot the displacement is relative to
+    int64_t disp = 0;         //mem: displacement; imm: the value
+
+    static x86_operand r(uint32_t id){x86_operand o;o.kind = x86_kind::reg;o.reg = id;return o;}
+    static x86_operand i(int64_t v){x86_operand o;o.kind = x86_kind::imm;o.disp = v;return o;}
+    static x86_operand m(uint32_t base,int64_t disp = 0,uint32_t index = no_reg,uint8_t scale = 1){
+        x86_operand o;o.kind = x86_kind::mem;o.reg = base;o.disp = disp;o.index = index;o.scale = scale;return o;
+    }
+    static x86_operand frame(uint32_t slot,int64_t disp = 0){
+        x86_operand o;o.kind = x86_kind::mem;o.slot = slot;o.disp = disp;return o;
+    }
+    static x86_operand ref(x86_kind k,uint32_t id){x86_operand o;o.kind = k;o.index = id;return o;}
+    bool is(x86_kind k) const {return kind == k;}
+};
+
+struct x86_inst {
+    x86_op op;
+    x86_cc cc;
+    uint8_t int_args,float_args; //call, tail_jmp: argument registers read
+    x86_operand ops[3];
+};
+
+struct x86_block {
+    std::vector<x86_inst> insts;
+};
+
+struct x86_slot {
+    uint32_t size;
+    int32_t offset; //from rbp, set by layout_frame
+};
+
+struct x86_function {
+    std::string name;
+    std::vector<x86_block> blocks;   //blocks[0] is the entry, emitted in order
+    std::vector<ir_type> vregs;      //type of virtual register first_vreg + i
+    std::vector<x86_slot> slots;
+    uint32_t outgoing = 0;           //bytes of stack arguments for calls
+    std::vector<uint32_t> saved;     //callee-saved registers to preserve
+    uint32_t frame_size = 0;         //rsp is 16-byte aligned below it, set by layout_frame
+
+    uint32_t new_vreg(ir_type t){vregs.push_back(t);return first_vreg + vregs.size() - 1;}
+    ir_type vreg_type(uint32_t r) const {return vregs[r - first_vreg];}
+    bool is_float(uint32_t r) const {return r < first_vreg ? is_xmm(r) : vreg_type(r) == ir_type::f32;}
+    uint32_t new_slot(uint32_t size){slots.push_back({size,0});return slots.size() - 1;}
+    //Writes the successors of b to out and returns how many there are.
+    uint32_t successors(uint32_t b,uint32_t out[2]) const;
+};
+
+// How an instruction accesses operand k; memory operands only read their
+// base and index registers.
+enum x86_access : uint8_t {access_none = 0,access_use = 1,access_def = 2,access_use_def = 3};
+x86_access operand_access(const x86_inst &i,uint32_t k);
+uint32_t operand_count(x86_op op);
+inline bool is_copy(const x86_inst &i){
+    return (i.op == x86_op::mov32 || i.op == x86_op::mov64 || i.op == x86_op::movss) && i.ops[0].is(x86_kind::reg) && i.ops[1].is(x86_kind::reg);
+}
+
+// Calls use and def for every register instruction i reads and writes,
+// the implicit ones included.
+template<class Use,class Def> void for_each_register(const x86_inst &i,Use use,Def def){
+    for(uint32_t k = 0;k < operand_count(i.op);++k){
+        const x86_operand &o = i.ops[k];
+        if(o.is(x86_kind::mem)){
+            if(o.reg != no_reg) use(o.reg);
+            if(o.index != no_reg) use(o.index);
+        }else if(o.is(x86_kind::reg)){
+            x86_access a = operand_access(i,k);
+            if(a & access_use) use(o.reg);
+            if(a & access_def) def(o.reg);
+        }
+    }
+    switch(i.op){
+    case x86_op::cdq: use(rax);def(rdx);break;
+    case x86_op::idiv32: use(rax);use(rdx);def(rax);def(rdx);break;
+    case x86_op::rep_stosd: use(rdi);use(rcx);use(rax);def(rdi);def(rcx);break;
+    case x86_op::call:
+        for(uint32_t k = 0;k < i.int_args;++k) use(int_arg_regs[k]);
+        for(uint32_t k = 0;k < i.float_args;++k) use(xmm0 + k);
+        for(uint32_t r : caller_saved_regs) def(r);
+        for(uint32_t r = xmm0;r <= xmm15;++r) def(r);
+        break;
+    case x86_op::tail_jmp:
+        for(uint32_t k = 0;k < i.int_args;++k) use(int_arg_regs[k]);
+        for(uint32_t k = 0;k < i.float_args;++k) use(xmm0 + k);
+        break;
+    default: break;
+    }
+}
+
+// What a register allocator did to one function, for --spill-report.
+struct regalloc_stats {
+    std::string function;
+    uint32_t vregs = 0;
+    uint32_t intervals = 0;       //live intervals after splitting, or graph nodes after coalescing
+    uint32_t spilled = 0;         //virtual registers given a stack slot
+    uint32_t loads = 0,stores = 0; //spill code added
+    uint32_t moves = 0;           //register to register copies left
+    double cost = 0;              //loads and stores weighted by 10^loop depth
+};
+void print_spill_report(std::ostream &os,const std::vector<regalloc_stats> &stats);
+// Spills and copies per function under linear scan and graph coloring.
+void print_regalloc_comparison(std::ostream &os,const std::vector<regalloc_stats> &fast,const std::vector<regalloc_stats> &coloring);
+
+// Loop nesting depth of every block.
+std::vector<uint32_t> loop_depth(const x86_function &f);
+// The virtual registers live into each block, (vregs + 63) / 64 bit words
+// per block. Physical registers never live across blocks in lowered code.
+std::vector<uint64_t> vreg_live_in(const x86_function &f);
+
+std::vector<x86_function> lower_x86(const ir_module &m);
+// Gives every virtual register its own stack slot, loading it into a
+// scratch register around each instruction that touches it.
+regalloc_stats assign_stack_slots(x86_function &f);
+// Linear scan over live intervals, separately for general purpose and
+// xmm registers. An interval is split where it runs out of registers and
+// the piece without uses waits in a stack slot; the register to take is the
+// one whose holders are cheapest to reload by loop depth. Values live across
+// a call end up in rbx and r12-r15 (listed in f.saved) or on the stack.
+regalloc_stats linear_scan(x86_function &f);
+// Iterated register coalescing (George and Appel) on the interference
+// graph. Slower than linear scan, but copies between virtual registers and
+// into argument and result registers are coalesced away where that keeps
+// the graph colorable, and spilled values are reloaded right at their uses.
+regalloc_stats graph_coloring(x86_function &f);
+// Places the slots below rbp, rewrites slot operands to rbp offsets and
+// adds the prologue and the epilogues.
+void layout_frame(x86_function &f);
+// Drops jumps to the next block and inverts branches around them.
+void remove_fallthrough(x86_function &f);
+enum class x86_regalloc : uint8_t {stack,linear_scan,graph_coloring};
+// All of the above for every function with a body; extern functions are
+// left empty. With stats, appends what the allocator did to each function.
+std::vector<x86_function> compile_x86(const ir_module &m,x86_regalloc alloc = x86_regalloc::linear_scan,std::vector<regalloc_stats> *stats = nullptr);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef x86_asm_hpp
+#define x86_asm_hpp
+
+#include "ir.hpp"
+#include "x86.hpp"
+#include <iosfwd>
+#include <vector>
+
+// GNU as (AT&T syntax) text for a module: its globals and the allocated
+// functions from compile_x86. main is the only global symbol; runtime
+// functions are called by their SysY names, so the output links against
+// runtime/sylib.c or any other sylib.
+void write_assembly(std::ostream &os,const ir_module &m,const std::vector<x86_function> &fns);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef x86_encoder_hpp
+#define x86_encoder_hpp
+
+#include "x86.hpp"
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+// Machine code for allocated x86_functions (no virtual registers, frame
+// laid out). Functions are appended to one buffer; calls between them are
+// left as fixups for whoever places the buffer. Globals and runtime
+// functions are referenced by absolute address, so the code is only valid
+// in the process that encoded it.
+struct x86_encoder {
+    struct call_fixup {
+        uint32_t pos;  //rel32 field of a call or tail jump
+        uint32_t func;
+    };
+    std::vector<uint8_t> code;
+    std::vector<call_fixup> calls;
+    std::vector<uint64_t> globals; //address of each global
+
+    //Returns the offset of the function's first instruction.
+    uint32_t encode(const x86_function &f);
+
+    void byte(uint8_t b){code.push_back(b);}
+    void u32(uint32_t v);
+    void u64(uint64_t v);
+    void rex(bool w,uint32_t reg,const x86_operand &rm,bool byte_reg = false);
+    void modrm(uint32_t reg,const x86_operand &rm);
+    //[prefix] [rex] opcode... modrm: the usual shape of an instruction
+    void op_rm(uint8_t prefix,bool w,std::initializer_list<uint8_t> opcode,uint32_t reg,const x86_operand &rm,bool byte_reg = false);
+    void alu(uint8_t ext,uint8_t rm_reg,uint8_t reg_rm,bool w,const x86_operand &dst,const x86_operand &src);
+    void mov(bool w,const x86_operand &dst,const x86_operand &src);
+    void inst(const x86_inst &i,std::vector<std::pair<uint32_t,uint32_t>> &labels);
+};
+
+#endif
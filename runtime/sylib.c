@@ -0,0 +1,68 @@
+/* clock_gettime and CLOCK_MONOTONIC under -std=c11. */
+#define _POSIX_C_SOURCE 199309L
+#include "sylib.h"
+#include <stdio.h>
+#include <time.h>
+
+/* Same formats as the reference sylib. */
+int getint(void){
+    int v = 0;
+    if(scanf("%d",&v) != 1) return 0;
+    return v;
+}
+int getch(void){
+    int c = getchar();
+    return c == EOF ? -1 : c;
+}
+float getfloat(void){
+    float v = 0;
+    if(scanf("%a",&v) != 1) return 0;
+    return v;
+}
+int getarray(int a[]){
+    int n = getint();
+    for(int i = 0;i < n;++i) a[i] = getint();
+    return n;
+}
+int getfarray(float a[]){
+    int n = getint();
+    for(int i = 0;i < n;++i) a[i] = getfloat();
+    return n;
+}
+void putint(int v){printf("%d",v);}
+void putch(int c){putchar(c);}
+void putfloat(float v){printf("%a",v);}
+void putarray(int n,int a[]){
+    printf("%d:",n);
+    for(int i = 0;i < n;++i) printf(" %d",a[i]);
+    putchar('\n');
+}
+void putfarray(int n,float a[]){
+    printf("%d:",n);
+    for(int i = 0;i < n;++i) printf(" %a",a[i]);
+    putchar('\n');
+}
+
+static struct timespec timer_start;
+static long long timer_total_us = 0;
+static int timer_used = 0;
+static long long elapsed_us(const struct timespec *a,const struct timespec *b){
+    return (b->tv_sec - a->tv_sec) * 1000000ll + (b->tv_nsec - a->tv_nsec) / 1000;
+}
+void starttime(void){
+    timer_used = 1;
+    clock_gettime(CLOCK_MONOTONIC,&timer_start);
+}
+void stoptime(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    timer_total_us += elapsed_us(&timer_start,&now);
+}
+
+/* The total of the starttime/stoptime pairs goes to stderr at exit. */
+__attribute__((destructor)) static void timer_report(void){
+    long long us = timer_total_us;
+    if(!timer_used) return;
+    fflush(stdout);
+    fprintf(stderr,"TOTAL: %lldH-%lldM-%lldS-%lldus\n",us / 3600000000ll,us / 60000000ll % 60,us / 1000000 % 60,us % 1000000);
+}
@@ -0,0 +1,27 @@
+#ifndef sylib_h
+#define sylib_h
+
+/* The SysY runtime library. Linked into sysyc for --run, and compiled next
+   to the assembly sysyc emits when it builds an executable. */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int getint(void);
+int getch(void);
+float getfloat(void);
+int getarray(int a[]);
+int getfarray(float a[]);
+void putint(int v);
+void putch(int c);
+void putfloat(float v);
+void putarray(int n,int a[]);
+void putfarray(int n,float a[]);
+void starttime(void);
+void stoptime(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,255 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+using namespace std;
+
+// Bounds of one evaluation, nested calls included, and of all of them.
+static const uint64_t call_steps = 1 << 18;   //instructions executed
+static const uint64_t module_steps = 1 << 22;
+static const uint64_t call_memory = 1 << 22;  //bytes of values and stack slots
+static const uint32_t call_depth = 256;
+
+// Runs IR functions on constant arguments. Gives up on whatever could turn
+// out differently at run time or trap: calls of runtime functions, stores
+// to globals, loads from globals that aren't const, accesses outside a
+// stack slot, what fold_constant() refuses, and running out of bounds.
+// Pointers are a stack slot, or a global with the top bit set, in the high
+// word and a byte offset in the low one.
+struct ir_evaluator {
+    const ir_module &m;
+    uint64_t steps = 0,step_limit = 0,memory = 0;
+    uint32_t depth = 0;
+    vector<vector<uint32_t>> slots; //of the calls running, as words
+
+    explicit ir_evaluator(const ir_module &m) : m(m){}
+
+    static uint64_t pointer(uint32_t region,uint32_t offset){return (uint64_t)region << 32 | offset;}
+
+    bool load(uint64_t p,uint32_t &out) const {
+        uint32_t region = p >> 32,offset = (uint32_t)p;
+        if(offset % 4 != 0) return false;
+        if(region & 0x80000000u){
+            const ir_global &g = m.globals[region & 0x7fffffffu];
+            if(!g.is_const || offset >= g.size) return false;
+            out = offset / 4 < g.init.size() ? g.init[offset / 4] : 0;
+            return true;
+        }
+        if(offset / 4 >= slots[region].size()) return false;
+        out = slots[region][offset / 4];
+        return true;
+    }
+    uint32_t* word(uint64_t p){
+        uint32_t region = p >> 32,offset = (uint32_t)p;
+        if((region & 0x80000000u) || offset % 4 != 0 || offset / 4 >= slots[region].size()) return nullptr;
+        return &slots[region][offset / 4];
+    }
+
+    bool run(uint32_t f,const vector<uint64_t> &args,uint64_t &result){
+        const ir_function &fn = m.functions[f];
+        if(fn.is_extern || depth == call_depth) return false;
+        uint64_t used = 8 * fn.insts.size();
+        if(memory + used > call_memory) return false;
+        depth++;
+        memory += used;
+        size_t first_slot = slots.size();
+        bool ok = execute(fn,args,result);
+        for(size_t s = first_slot;s < slots.size();++s) memory -= 4 * slots[s].size();
+        slots.resize(first_slot);
+        memory -= used;
+        depth--;
+        return ok;
+    }
+
+    bool execute(const ir_function &fn,const vector<uint64_t> &args,uint64_t &result){
+        vector<uint64_t> r(fn.insts.size(),0);
+        auto value = [&](uint32_t v) -> uint64_t {
+            const ir_inst &i = fn.insts[v];
+            switch(i.op){
+            case ir_op::iconst: return (uint32_t)i.imm;
+            case ir_op::fconst:{
+                uint32_t bits;
+                memcpy(&bits,&i.fimm,4);
+                return bits;
+            }
+            case ir_op::arg: return args[i.index];
+            case ir_op::global: return pointer(0x80000000u | i.index,0);
+            case ir_op::undef: return 0;
+            default: return r[v];
+            }
+        };
+        vector<uint64_t> incoming;
+        for(uint32_t b = 0,from = no_block;;){
+            auto &insts = fn.blocks[b].insts;
+            size_t k = 0;
+            if(from != no_block){
+                //Phis read their operands before any of them is written.
+                uint32_t edge = find(fn.blocks[b].preds.begin(),fn.blocks[b].preds.end(),from) - fn.blocks[b].preds.begin();
+                incoming.clear();
+                for(;k < insts.size() && fn.insts[insts[k]].op == ir_op::phi;++k) incoming.push_back(value(fn.list(fn.insts[insts[k]])[edge]));
+                for(size_t p = 0;p < k;++p) r[insts[p]] = incoming[p];
+            }
+            for(;;++k){
+                uint32_t v = insts[k];
+                const ir_inst &i = fn.insts[v];
+                if(++steps > step_limit) return false;
+                switch(i.op){
+                case ir_op::alloca:
+                    if(memory + i.imm > call_memory) return false;
+                    memory += (i.imm + 3) / 4 * 4;
+                    slots.emplace_back((i.imm + 3) / 4,0);
+                    r[v] = pointer(slots.size() - 1,0);
+                    continue;
+                case ir_op::ptradd:{
+                    uint64_t p = value(i.ops[0]);
+                    r[v] = (p & ~0xffffffffull) | (uint32_t)((uint32_t)p + (uint32_t)value(i.ops[1]));
+                    continue;
+                }
+                case ir_op::load:{
+                    uint32_t w;
+                    if(!load(value(i.ops[0]),w)) return false;
+                    r[v] = w;
+                    continue;
+                }
+                case ir_op::store:{
+                    uint32_t *w = word(value(i.ops[0]));
+                    if(!w) return false;
+                    *w = value(i.ops[1]);
+                    continue;
+                }
+                case ir_op::memzero:
+                    for(uint32_t offset = 0;offset < (uint32_t)i.imm;offset += 4){
+                        uint64_t p = value(i.ops[0]);
+                        uint32_t *w = word(pointer(p >> 32,(uint32_t)p + offset));
+                        if(!w) return false;
+                        *w = 0;
+                    }
+                    continue;
+                case ir_op::call:{
+                    vector<uint64_t> a(i.nlist);
+                    for(uint32_t n = 0;n < i.nlist;++n) a[n] = value(fn.list(i)[n]);
+                    if(!run(i.index,a,r[v])) return false;
+                    continue;
+                }
+                case ir_op::br:
+                    from = b;
+                    b = i.ops[0];
+                    break;
+                case ir_op::condbr:
+                    from = b;
+                    b = value(i.ops[0]) ? i.ops[1] : i.ops[2];
+                    break;
+                case ir_op::ret:
+                    result = i.ops[0] == no_value ? 0 : value(i.ops[0]);
+                    return true;
+                default:{
+                    uint32_t out;
+                    if(!fold_constant(i,value(i.ops[0]),i.ops[1] == no_value ? 0 : value(i.ops[1]),out)) return false;
+                    r[v] = out;
+                    continue;
+                }
+                }
+                break;
+            }
+        }
+    }
+};
+
+//Functions that neither call runtime functions nor touch globals other
+//than by reading const ones, assuming the same of the functions they call.
+static vector<char> maybe_pure(const ir_module &m){
+    uint32_t n = m.functions.size();
+    vector<char> pure(n,0);
+    for(uint32_t f = 0;f < n;++f) pure[f] = !m.functions[f].is_extern;
+    auto root = [](const ir_function &fn,uint32_t p){
+        while(fn.insts[p].op == ir_op::ptradd) p = fn.insts[p].ops[0];
+        return &fn.insts[p];
+    };
+    for(bool changed = true;changed;){
+        changed = false;
+        for(uint32_t f = 0;f < n;++f){
+            if(!pure[f]) continue;
+            const ir_function &fn = m.functions[f];
+            bool ok = true;
+            for(auto &b : fn.blocks){
+                for(uint32_t v : b.insts){
+                    const ir_inst &i = fn.insts[v];
+                    if(i.op == ir_op::call) ok &= pure[i.index];
+                    else if(i.op == ir_op::store || i.op == ir_op::memzero) ok &= root(fn,i.ops[0])->op != ir_op::global;
+                    else if(i.op == ir_op::load){
+                        const ir_inst *g = root(fn,i.ops[0]);
+                        ok &= g->op != ir_op::global || m.globals[g->index].is_const;
+                    }
+                }
+            }
+            if(!ok){
+                pure[f] = 0;
+                changed = true;
+            }
+        }
+    }
+    return pure;
+}
+
+uint32_t fold_calls(ir_module &m,vector<char> &changed){
+    vector<char> pure = maybe_pure(m);
+    ir_evaluator e(m);
+    map<vector<uint32_t>,pair<bool,uint32_t>> known; //callee and arguments -> result
+    uint32_t folded = 0;
+    for(uint32_t f = 0;f < m.functions.size();++f){
+        ir_function &fn = m.functions[f];
+        if(fn.is_extern) continue;
+        vector<uint32_t> result;
+        for(auto &b : fn.blocks){
+            for(uint32_t v : b.insts){
+                const ir_inst &i = fn.insts[v];
+                if(i.op != ir_op::call || i.type == ir_type::none || !pure[i.index]) continue;
+                vector<uint32_t> key = {i.index};
+                vector<uint64_t> args;
+                for(uint32_t k = 0;k < i.nlist;++k){
+                    const ir_inst &a = fn.insts[fn.list(i)[k]];
+                    if(a.op != ir_op::iconst && a.op != ir_op::fconst) break;
+                    uint32_t bits;
+                    memcpy(&bits,&a.imm,4);
+                    key.push_back(bits);
+                    args.push_back(bits);
+                }
+                if(args.size() != i.nlist) continue;
+                auto [it,fresh] = known.try_emplace(key,false,0);
+                if(fresh && e.steps < module_steps){
+                    uint64_t r = 0;
+                    e.step_limit = min(e.steps + call_steps,module_steps);
+                    it->second = {e.run(i.index,args,r),(uint32_t)r};
+                }
+                if(!it->second.first) continue;
+                ir_inst c{};
+                c.op = i.type == ir_type::f32 ? ir_op::fconst : ir_op::iconst;
+                c.type = i.type;
+                c.ops[0] = c.ops[1] = c.ops[2] = no_value;
+                c.imm = it->second.second;
+                if(result.empty()) result.assign(fn.insts.size(),no_value);
+                result[v] = fn.add(c);
+            }
+        }
+        if(result.empty()) continue;
+        for(auto &b : fn.blocks){
+            auto done = [&](uint32_t v){
+                if(result[v] == no_value) return false;
+                fn.insts[v].op = ir_op::nop;
+                fn.insts[v].block = no_block;
+                folded++;
+                return true;
+            };
+            b.insts.erase(remove_if(b.insts.begin(),b.insts.end(),done),b.insts.end());
+            for(uint32_t v : b.insts){
+                for_each_operand(fn,fn.insts[v],[&](uint32_t &op){
+                    if(op < result.size() && result[op] != no_value) op = result[op];
+                });
+            }
+        }
+        changed[f] = 1;
+    }
+    return folded;
+}
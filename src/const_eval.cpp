@@ -0,0 +1,290 @@
+#include "const_eval.hpp"
+#include <cstring>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Bounds of one evaluation, nested calls included.
+static const uint64_t eval_steps = 1 << 20;  //expressions and statements
+static const uint64_t eval_words = 1 << 20;  //of variables and arrays
+static const uint32_t eval_depth = 256;      //calls running
+
+// A variable, an array or what's left of one after indexing. Scalars and
+// arrays of the functions running live in the evaluator's memory, const
+// globals are read where the checker keeps their values.
+struct place {
+    const char *data;           //of a const global, or null
+    uint64_t base;              //first word
+    uint64_t words;             //from base to the end of the array
+    std::vector<int> dimens;    //left; the first is -1 for an array parameter
+    TokenType type;
+};
+
+enum class flow {next,brk,cont,ret,fail};
+
+static bool convert(literal_value &v,TokenType to){
+    if(v.type == Void) return false;
+    if(v.type == to) return true;
+    if(to == Float) v.f = (float)v.i;
+    else{
+        if(!(v.f >= -2147483648.0f && v.f < 2147483648.0f)) return false;
+        v.i = (int32_t)v.f;
+    }
+    v.type = to;
+    return true;
+}
+static bool truth(const literal_value &v){return v.type == Float ? v.f != 0 : v.i != 0;}
+
+struct ast_evaluator {
+    const function<func_def*(symbol)> &body;
+    uint64_t steps = 0;
+    uint32_t depth = 0;
+    vector<uint32_t> memory;
+    vector<pair<symbol,place>> vars; //of the calls running; the current one's from frame on
+    size_t frame = 0;
+    literal_value returned{};
+
+    explicit ast_evaluator(const function<func_def*(symbol)> &body) : body(body){}
+
+    bool allocate(uint64_t words,place &p,TokenType type,vector<int> dimens){
+        if(memory.size() + words > eval_words) return false;
+        p = {nullptr,memory.size(),words,std::move(dimens),type};
+        memory.resize(memory.size() + words,0);
+        return true;
+    }
+    bool read(const place &p,literal_value &v){
+        uint32_t w;
+        if(p.data) memcpy(&w,p.data + 4 * p.base,4);
+        else w = memory[p.base];
+        v.type = p.type;
+        if(p.type == Float) memcpy(&v.f,&w,4);
+        else v.i = w;
+        return true;
+    }
+    bool write(const place &p,const literal_value &v){
+        if(p.data) return false;
+        if(p.type == Float) memcpy(&memory[p.base],&v.f,4);
+        else memory[p.base] = v.i;
+        return true;
+    }
+
+    bool address(expr *e,place &p){
+        if(++steps > eval_steps) return false;
+        if(auto *v = dynamic_cast<var_expr*>(e)){
+            for(size_t k = vars.size();k-- > frame;){
+                if(vars[k].first != v->varname) continue;
+                p = vars[k].second;
+                return true;
+            }
+            //Not a local: only arrays of const globals can be read.
+            VarType *t = v->type;
+            if(t == nullptr || !t->is_const || !t->is_array()) return false;
+            p = {t->data.get() + t->offset,0,(uint64_t)t->size / 4,t->dimens,t->basetype};
+            return true;
+        }
+        auto *ix = dynamic_cast<index_expr*>(e);
+        literal_value i;
+        if(ix == nullptr || !address(ix->array,p) || p.dimens.empty()) return false;
+        if(!eval(ix->index,i) || !convert(i,Int) || i.i < 0) return false;
+        if(p.dimens[0] > 0 && i.i >= p.dimens[0]) return false;
+        uint64_t stride = 1;
+        for(size_t k = 1;k < p.dimens.size();++k) stride *= p.dimens[k];
+        if((i.i + 1) * stride > p.words) return false;
+        p.base += i.i * stride;
+        p.words = stride;
+        p.dimens.erase(p.dimens.begin());
+        return true;
+    }
+
+    bool eval(expr *e,literal_value &v){
+        if(++steps > eval_steps) return false;
+        if(auto *l = dynamic_cast<int_literal_expr*>(e)){
+            v = {Int,l->value,0};
+            return true;
+        }
+        if(auto *l = dynamic_cast<float_literal_expr*>(e)){
+            v = {Float,0,l->value};
+            return true;
+        }
+        if(dynamic_cast<var_expr*>(e) || dynamic_cast<index_expr*>(e)){
+            place p;
+            return address(e,p) && p.dimens.empty() && read(p,v);
+        }
+        if(auto *u = dynamic_cast<prefix_expr*>(e)){
+            if(!eval(u->rhs,v)) return false;
+            if(u->op == Minus){
+                if(v.type == Float) v.f = -v.f;
+                else v.i = (int32_t)(0u - (uint32_t)v.i);
+            }else if(u->op == Not) v = {Int,!truth(v),0};
+            return true;
+        }
+        if(auto *a = dynamic_cast<assign_expr*>(e)){
+            place p;
+            if(!eval(a->rhs,v) || !address(a->lhs,p) || !p.dimens.empty()) return false;
+            return convert(v,p.type) && write(p,v);
+        }
+        if(auto *c = dynamic_cast<fun_call_expr*>(e)) return call(*c,v);
+        auto *b = dynamic_cast<binary_expr*>(e);
+        if(b == nullptr || !eval(b->lhs,v)) return false;
+        if(b->op == And || b->op == Or){
+            //Short-circuits, as the code built for it does.
+            bool l = truth(v);
+            if(l == (b->op == Or)){
+                v = {Int,l,0};
+                return true;
+            }
+            if(!eval(b->rhs,v)) return false;
+            v = {Int,truth(v),0};
+            return true;
+        }
+        literal_value r;
+        if(!eval(b->rhs,r) || v.type == Void || r.type == Void) return false;
+        if(v.type == Float || r.type == Float){
+            convert(v,Float);
+            convert(r,Float);
+            float x = v.f,y = r.f;
+            switch(b->op){
+            case Plus: v.f = x + y;return true;
+            case Minus: v.f = x - y;return true;
+            case Mul: v.f = x * y;return true;
+            case Div: v.f = x / y;return true;
+            case EqualEqual: v = {Int,x == y,0};return true;
+            case NotEqual: v = {Int,x != y,0};return true;
+            case Less: v = {Int,x < y,0};return true;
+            case LessEqual: v = {Int,x <= y,0};return true;
+            case Greater: v = {Int,x > y,0};return true;
+            case GreaterEqual: v = {Int,x >= y,0};return true;
+            default: return false;
+            }
+        }
+        int32_t x = v.i,y = r.i;
+        switch(b->op){
+        case Plus: v.i = (int32_t)((uint32_t)x + (uint32_t)y);return true;
+        case Minus: v.i = (int32_t)((uint32_t)x - (uint32_t)y);return true;
+        case Mul: v.i = (int32_t)((uint32_t)x * (uint32_t)y);return true;
+        case Div: case Mod:
+            if(y == 0 || (x == INT32_MIN && y == -1)) return false;
+            v.i = b->op == Div ? x / y : x % y;
+            return true;
+        case EqualEqual: v.i = x == y;return true;
+        case NotEqual: v.i = x != y;return true;
+        case Less: v.i = x < y;return true;
+        case LessEqual: v.i = x <= y;return true;
+        case Greater: v.i = x > y;return true;
+        case GreaterEqual: v.i = x >= y;return true;
+        default: return false;
+        }
+    }
+
+    bool call(fun_call_expr &c,literal_value &v){
+        func_def *f = body(static_cast<var_expr*>(c.func)->varname);
+        if(f == nullptr || f->fparams.size() != c.params.size() || depth == eval_depth) return false;
+        //Arguments are worked out in the caller's frame.
+        size_t mark = memory.size(),first = vars.size();
+        for(size_t k = 0;k < c.params.size();++k){
+            Type &formal = f->fparams[k].first;
+            place p;
+            if(formal.dimens.empty()){
+                if(!eval(c.params[k],v) || !convert(v,formal.typ) || !allocate(1,p,formal.typ,{})) return false;
+                write(p,v);
+            }else{
+                if(!address(c.params[k],p) || p.dimens.size() != formal.dimens.size()) return false;
+                for(size_t d = 1;d < formal.dimens.size();++d){
+                    if(p.dimens[d] != static_cast<int_literal_expr*>(formal.dimens[d])->value) return false;
+                }
+                p.dimens[0] = -1;
+            }
+            vars.push_back({f->fparams[k].second,std::move(p)});
+        }
+        size_t caller = frame;
+        frame = first;
+        depth++;
+        flow done = exec(f->body);
+        depth--;
+        frame = caller;
+        vars.resize(first);
+        memory.resize(mark);
+        if(done == flow::fail) return false;
+        if(f->return_type == Void){
+            v = {Void,0,0};
+            return true;
+        }
+        //Falling off the end of a function that returns a value.
+        if(done != flow::ret) return false;
+        v = returned;
+        return convert(v,f->return_type);
+    }
+
+    bool declare(decl &d){
+        vector<int> dimens;
+        uint64_t words = 1;
+        for(expr *dimen : d.type.dimens){
+            if(auto *l = dynamic_cast<int_literal_expr*>(dimen)) dimens.push_back(l->value);
+            else if(auto *l = dynamic_cast<float_literal_expr*>(dimen)) dimens.push_back(l->value);
+            else return false;
+            words *= dimens.back();
+        }
+        place p;
+        if(!allocate(words,p,d.type.typ,dimens)) return false;
+        if(d.init){
+            //Uninitialized locals and elements start at 0, like globals.
+            vector<expr*> elems = flatten_init(d.init,dimens);
+            for(size_t k = 0;k < elems.size();++k){
+                literal_value v;
+                if(elems[k] == nullptr) continue;
+                if(!eval(elems[k],v) || !convert(v,d.type.typ)) return false;
+                place at = p;
+                at.base += k;
+                at.dimens.clear();
+                write(at,v);
+            }
+        }
+        vars.push_back({d.name,std::move(p)});
+        return true;
+    }
+
+    flow exec(stmt *s){
+        if(++steps > eval_steps) return flow::fail;
+        literal_value v;
+        if(auto *b = dynamic_cast<block_stmt*>(s)){
+            size_t scope = vars.size();
+            flow r = flow::next;
+            for(auto &item : b->block){
+                if(item.declaration && !declare(*item.declaration)) r = flow::fail;
+                else if(item.statement) r = exec(item.statement);
+                if(r != flow::next) break;
+            }
+            vars.resize(scope);
+            return r;
+        }
+        if(auto *e = dynamic_cast<expr_stmt*>(s)) return eval(e->e,v) ? flow::next : flow::fail;
+        if(auto *i = dynamic_cast<if_stmt*>(s)){
+            if(!eval(i->cond,v)) return flow::fail;
+            if(truth(v)) return exec(i->then_branch);
+            return i->else_branch ? exec(i->else_branch) : flow::next;
+        }
+        if(auto *w = dynamic_cast<while_stmt*>(s)){
+            for(;;){
+                if(!eval(w->cond,v)) return flow::fail;
+                if(!truth(v)) return flow::next;
+                flow r = exec(w->body);
+                if(r == flow::brk) return flow::next;
+                if(r == flow::ret || r == flow::fail) return r;
+            }
+        }
+        if(dynamic_cast<break_stmt*>(s)) return flow::brk;
+        if(dynamic_cast<continue_stmt*>(s)) return flow::cont;
+        if(auto *r = dynamic_cast<return_stmt*>(s)){
+            v = {Void,0,0};
+            if(r->return_value && !eval(r->return_value,v)) return flow::fail;
+            returned = v;
+            return flow::ret;
+        }
+        return flow::next;
+    }
+};
+
+bool evaluate_call(fun_call_expr &call,const function<func_def*(symbol)> &body,literal_value &result){
+    ast_evaluator e(body);
+    return e.call(call,result);
+}
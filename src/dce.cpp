@@ -0,0 +1,149 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+uint32_t dead_code(ir_function &fn){
+    vector<char> live(fn.insts.size(),0);
+    vector<uint32_t> work;
+    for(auto &b : fn.blocks){
+        for(uint32_t v : b.insts){
+            if(has_side_effects(fn.insts[v].op)){
+                live[v] = 1;
+                work.push_back(v);
+            }
+        }
+    }
+    while(!work.empty()){
+        uint32_t v = work.back();
+        work.pop_back();
+        for_each_operand(fn,fn.insts[v],[&](uint32_t op){
+            if(!live[op] && fn.insts[op].block != no_block){
+                live[op] = 1;
+                work.push_back(op);
+            }
+        });
+    }
+    uint32_t removed = 0;
+    for(auto &b : fn.blocks){
+        auto dead = [&](uint32_t v){
+            if(live[v]) return false;
+            fn.insts[v].op = ir_op::nop;
+            fn.insts[v].block = no_block;
+            removed++;
+            return true;
+        };
+        b.insts.erase(remove_if(b.insts.begin(),b.insts.end(),dead),b.insts.end());
+    }
+    return removed;
+}
+
+//Whether every phi of s takes the same value on both edges from b.
+static bool same_incoming(const ir_function &fn,uint32_t s,uint32_t b){
+    auto &preds = fn.blocks[s].preds;
+    uint32_t first = find(preds.begin(),preds.end(),b) - preds.begin();
+    uint32_t second = find(preds.begin() + first + 1,preds.end(),b) - preds.begin();
+    for(uint32_t v : fn.blocks[s].insts){
+        const ir_inst &i = fn.insts[v];
+        if(i.op != ir_op::phi) break;
+        if(fn.list(i)[first] != fn.list(i)[second]) return false;
+    }
+    return true;
+}
+
+//b only jumps to s: sends its preds straight to s. Not done when s has
+//phis and one of them already reaches s, which would need two values
+//for the same edge.
+static bool forward(ir_function &fn,uint32_t b,uint32_t s){
+    auto &from = fn.blocks[b].preds;
+    auto &preds = fn.blocks[s].preds;
+    bool has_phis = fn.insts[fn.blocks[s].insts.front()].op == ir_op::phi;
+    if(has_phis){
+        for(uint32_t p : from){
+            if(find(preds.begin(),preds.end(),p) != preds.end()) return false;
+        }
+    }
+    uint32_t k = find(preds.begin(),preds.end(),b) - preds.begin();
+    for(uint32_t v : fn.blocks[s].insts){
+        ir_inst &i = fn.insts[v];
+        if(i.op != ir_op::phi) break;
+        vector<uint32_t> values(fn.list(i),fn.list(i) + i.nlist);
+        values.insert(values.end(),from.size() - 1,values[k]);
+        fn.set_list(v,values);
+    }
+    preds[k] = from[0];
+    preds.insert(preds.end(),from.begin() + 1,from.end());
+    for(uint32_t p : from){
+        ir_inst &t = fn.insts[fn.blocks[p].insts.back()];
+        if(t.op == ir_op::br && t.ops[0] == b) t.ops[0] = s;
+        if(t.op == ir_op::condbr){
+            if(t.ops[1] == b) t.ops[1] = s;
+            if(t.ops[2] == b) t.ops[2] = s;
+        }
+    }
+    from.clear();
+    return true;
+}
+
+//Appends s, whose only pred is b, to b in place of b's jump.
+static void merge(ir_function &fn,uint32_t b,uint32_t s){
+    auto &insts = fn.blocks[b].insts;
+    fn.insts[insts.back()].op = ir_op::nop;
+    fn.insts[insts.back()].block = no_block;
+    insts.pop_back();
+    for(uint32_t v : fn.blocks[s].insts){
+        ir_inst &i = fn.insts[v];
+        if(i.op == ir_op::phi){
+            fn.replace_uses(v,fn.list(i)[0]);
+            i.op = ir_op::nop;
+            i.block = no_block;
+            continue;
+        }
+        i.block = b;
+        insts.push_back(v);
+    }
+    uint32_t succ[2];
+    for(uint32_t k = fn.successors(b,succ);k-- > 0;){
+        for(auto &p : fn.blocks[succ[k]].preds){
+            if(p == s) p = b;
+        }
+    }
+    fn.blocks[s].insts.clear();
+    fn.blocks[s].preds.clear();
+}
+
+//One step of cleaning up b; returns whether anything changed.
+static bool simplify_block(ir_function &fn,uint32_t b){
+    auto &insts = fn.blocks[b].insts;
+    if(insts.empty() || (b != 0 && fn.blocks[b].preds.empty())) return false;
+    ir_inst &t = fn.insts[insts.back()];
+    if(t.op == ir_op::condbr && t.ops[1] == t.ops[2] && same_incoming(fn,t.ops[1],b)){
+        fn.remove_pred(t.ops[1],b);
+        t.op = ir_op::br;
+        t.ops[0] = t.ops[1];
+        t.ops[1] = t.ops[2] = no_value;
+        return true;
+    }
+    if(t.op != ir_op::br || t.ops[0] == b) return false;
+    uint32_t s = t.ops[0];
+    if(insts.size() == 1 && b != 0 && forward(fn,b,s)) return true;
+    if(s != 0 && fn.blocks[s].preds.size() == 1){
+        merge(fn,b,s);
+        return true;
+    }
+    return false;
+}
+
+uint32_t simplify_cfg(ir_function &fn){
+    uint32_t before = fn.inst_count();
+    fn.remove_unreachable();
+    for(bool changed = true;changed;){
+        changed = false;
+        for(uint32_t b = 0;b < fn.blocks.size();++b){
+            while(simplify_block(fn,b)) changed = true;
+        }
+    }
+    fn.remove_unreachable();
+    return before - fn.inst_count();
+}
@@ -0,0 +1,554 @@
+#include "x86.hpp"
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Iterated register coalescing, after George and Appel, "Iterated Register
+// Coalescing" (and Appel's Modern Compiler Implementation, chapter 11).
+// The nodes of the interference graph are the physical registers, which
+// are precolored, and the virtual registers; general purpose and xmm
+// registers never interfere with each other, so one graph holds both
+// classes. Nodes of insignificant degree are simplified away, copies are
+// coalesced when the Briggs or George test says the graph stays colorable,
+// and copies that block simplification are frozen. When only significant
+// nodes are left one becomes a spill candidate and is colored optimistically;
+// if it gets no color, every access to it goes through a new short-lived
+// virtual register and the function is allocated again.
+//
+// Coloring never splits a node, so a value that is used in a loop and
+// live across a call outside it is first copied into a register of its own
+// for just that call. Coalescing merges the copy back when a callee-saved
+// register can hold the whole value; otherwise only the copy is spilled,
+// around the call, and the loop keeps the value in a register.
+
+struct graph_coloring_allocator {
+    enum node_state : uint8_t {precolored,initial,simplify,freeze,spill,spilled,coalesced,colored,selected};
+    enum move_state : uint8_t {move_worklist,move_active,move_coalesced,move_constrained,move_frozen};
+    struct move {
+        uint32_t dst,src;
+        move_state state;
+    };
+
+    x86_function &f;
+    vector<uint32_t> depth;
+    vector<char> no_spill; //virtual registers made to reload a spilled one
+    regalloc_stats stats;
+
+    //The graph of one round: physical registers, then virtual ones.
+    uint32_t n = 0;
+    unordered_set<uint64_t> adj_set;
+    vector<vector<uint32_t>> adj_list,move_list;
+    vector<uint32_t> degree,alias,color;
+    vector<node_state> state;
+    vector<double> cost;  //reloads if spilled, by loop depth
+    vector<move> moves;
+    //Worklists keep stale entries; a node counts only while its state matches.
+    vector<uint32_t> simplify_list,freeze_list,spill_list,move_queue,select_stack,spilled_nodes;
+    vector<uint32_t> mark;
+    uint32_t stamp = 0;
+
+    explicit graph_coloring_allocator(x86_function &f) : f(f),no_spill(f.vregs.size(),0){}
+
+    static bool allocatable(uint32_t r){return r != rsp && r != rbp;}
+    uint32_t colors(uint32_t r) const {return f.is_float(r) ? size(xmm_alloc_order) : size(gpr_alloc_order);}
+    double weight(uint32_t b) const {
+        double w = 1;
+        for(uint32_t d = depth[b];d;--d) w *= 10;
+        return w;
+    }
+    uint32_t get_alias(uint32_t r) const {
+        while(state[r] == coalesced) r = alias[r];
+        return r;
+    }
+    bool adjacent_pair(uint32_t u,uint32_t v) const {
+        return adj_set.count((uint64_t)min(u,v) << 32 | max(u,v)) != 0;
+    }
+    template<class F> void for_adjacent(uint32_t r,F fn){
+        for(size_t k = 0;k < adj_list[r].size();++k){
+            uint32_t w = adj_list[r][k];
+            if(state[w] != selected && state[w] != coalesced) fn(w);
+        }
+    }
+    template<class F> void for_moves(uint32_t r,F fn){
+        for(uint32_t m : move_list[r]){
+            if(moves[m].state == move_worklist || moves[m].state == move_active) fn(m);
+        }
+    }
+    bool move_related(uint32_t r){
+        for(uint32_t m : move_list[r]){
+            if(moves[m].state == move_worklist || moves[m].state == move_active) return true;
+        }
+        return false;
+    }
+    bool take(vector<uint32_t> &list,node_state s,uint32_t &r){
+        while(!list.empty()){
+            r = list.back();
+            list.pop_back();
+            if(state[r] == s) return true;
+        }
+        return false;
+    }
+    void push(uint32_t r,node_state s){
+        state[r] = s;
+        (s == simplify ? simplify_list : s == freeze ? freeze_list : spill_list).push_back(r);
+    }
+
+    void split_around_calls();
+    void add_edge(uint32_t u,uint32_t v);
+    void build();
+    void make_worklists();
+    void enable_moves(uint32_t r);
+    void decrement_degree(uint32_t r);
+    void simplify_node(uint32_t r);
+    void add_worklist(uint32_t r);
+    bool george(uint32_t u,uint32_t v);
+    bool briggs(uint32_t u,uint32_t v);
+    void combine(uint32_t u,uint32_t v);
+    void coalesce(uint32_t m);
+    void freeze_moves(uint32_t r);
+    bool select_spill();
+    void assign_colors();
+    void rewrite_spills();
+    regalloc_stats run();
+};
+
+void graph_coloring_allocator::split_around_calls(){
+    uint32_t words = (f.vregs.size() + 63) / 64;
+    vector<uint64_t> live_in = vreg_live_in(f),live(words);
+    vector<uint32_t> deepest(f.vregs.size(),0); //loop depth of the deepest access
+    for(uint32_t b = 0;b < f.blocks.size();++b){
+        for(auto &i : f.blocks[b].insts){
+            auto access = [&](uint32_t r){if(r >= first_vreg) deepest[r - first_vreg] = max(deepest[r - first_vreg],depth[b]);};
+            for_each_register(i,access,access);
+        }
+    }
+    for(uint32_t b = 0;b < f.blocks.size();++b){
+        auto &insts = f.blocks[b].insts;
+        uint32_t succ[2],ns = f.successors(b,succ);
+        for(uint32_t w = 0;w < words;++w){
+            live[w] = 0;
+            for(uint32_t k = 0;k < ns;++k) live[w] |= live_in[(size_t)succ[k] * words + w];
+        }
+        vector<pair<uint32_t,uint32_t>> across; //(call,virtual register), calls from the last
+        for(uint32_t k = insts.size();k-- > 0;){
+            if(insts[k].op == x86_op::call){
+                for(uint32_t w = 0;w < words;++w){
+                    for(uint64_t bits = live[w];bits;bits &= bits - 1){
+                        uint32_t v = 64 * w + __builtin_ctzll(bits);
+                        if(deepest[v] > depth[b]) across.push_back({k,first_vreg + v});
+                    }
+                }
+            }
+            for_each_register(insts[k],[&](uint32_t){},[&](uint32_t r){
+                if(r >= first_vreg) live[(r - first_vreg) / 64] &= ~(1ull << (r - first_vreg) % 64);
+            });
+            for_each_register(insts[k],[&](uint32_t r){
+                if(r >= first_vreg) live[(r - first_vreg) / 64] |= 1ull << (r - first_vreg) % 64;
+            },[&](uint32_t){});
+        }
+        if(across.empty()) continue;
+        reverse(across.begin(),across.end());
+        vector<x86_inst> out;
+        out.reserve(insts.size() + 2 * across.size());
+        auto copy = [&](uint32_t dst,uint32_t src){
+            x86_inst i{};
+            i.op = f.is_float(src) ? x86_op::movss : x86_op::mov64;
+            i.ops[0] = x86_operand::r(dst);
+            i.ops[1] = x86_operand::r(src);
+            out.push_back(i);
+        };
+        size_t a = 0;
+        for(uint32_t k = 0;k < insts.size();++k){
+            size_t first = a;
+            vector<uint32_t> copies;
+            for(;a < across.size() && across[a].first == k;++a){
+                copies.push_back(f.new_vreg(f.vreg_type(across[a].second)));
+                no_spill.push_back(0);
+                copy(copies.back(),across[a].second);
+            }
+            out.push_back(insts[k]);
+            for(size_t c = first;c < a;++c) copy(across[c].second,copies[c - first]);
+        }
+        insts = std::move(out);
+    }
+}
+
+void graph_coloring_allocator::add_edge(uint32_t u,uint32_t v){
+    if(u == v || (u < first_vreg && v < first_vreg) || f.is_float(u) != f.is_float(v)) return;
+    if(!adj_set.insert((uint64_t)min(u,v) << 32 | max(u,v)).second) return;
+    if(state[u] != precolored){
+        adj_list[u].push_back(v);
+        degree[u]++;
+    }
+    if(state[v] != precolored){
+        adj_list[v].push_back(u);
+        degree[v]++;
+    }
+}
+
+//Walks each block backwards from its live-out set: a write interferes with
+//everything live after it, except the source of a copy.
+void graph_coloring_allocator::build(){
+    n = first_vreg + f.vregs.size();
+    adj_set.clear();
+    adj_list.assign(n,{});
+    move_list.assign(n,{});
+    degree.assign(n,0);
+    alias.resize(n);
+    iota(alias.begin(),alias.end(),0);
+    color.assign(n,no_reg);
+    state.assign(n,initial);
+    cost.assign(n,0);
+    moves.clear();
+    simplify_list.clear();
+    freeze_list.clear();
+    spill_list.clear();
+    move_queue.clear();
+    for(uint32_t r = 0;r < first_vreg;++r){
+        state[r] = precolored;
+        color[r] = r;
+        degree[r] = ~0u / 2;
+    }
+    uint32_t words = (f.vregs.size() + 63) / 64;
+    vector<uint64_t> live_in = vreg_live_in(f);
+    //The live set, as a sparse set so it can be walked quickly.
+    vector<uint32_t> live,index(n,no_reg);
+    auto insert = [&](uint32_t r){
+        if(index[r] != no_reg) return;
+        index[r] = live.size();
+        live.push_back(r);
+    };
+    auto erase = [&](uint32_t r){
+        if(index[r] == no_reg) return;
+        index[live.back()] = index[r];
+        live[index[r]] = live.back();
+        live.pop_back();
+        index[r] = no_reg;
+    };
+    for(uint32_t b = 0;b < f.blocks.size();++b){
+        for(uint32_t r : live) index[r] = no_reg;
+        live.clear();
+        uint32_t succ[2],ns = f.successors(b,succ);
+        for(uint32_t w = 0;w < words;++w){
+            uint64_t out = 0;
+            for(uint32_t k = 0;k < ns;++k) out |= live_in[(size_t)succ[k] * words + w];
+            for(;out;out &= out - 1) insert(first_vreg + 64 * w + __builtin_ctzll(out));
+        }
+        double w = weight(b);
+        auto &insts = f.blocks[b].insts;
+        for(uint32_t k = insts.size();k-- > 0;){
+            const x86_inst &i = insts[k];
+            uint32_t defs[32],ndefs = 0,uses[32],nuses = 0;
+            for_each_register(i,[&](uint32_t r){if(allocatable(r)) uses[nuses++] = r;},[&](uint32_t r){if(allocatable(r)) defs[ndefs++] = r;});
+            for(uint32_t d = 0;d < ndefs;++d) cost[defs[d]] += w;
+            for(uint32_t u = 0;u < nuses;++u) cost[uses[u]] += w;
+            if(is_copy(i) && i.ops[0].reg != i.ops[1].reg && allocatable(i.ops[0].reg) && allocatable(i.ops[1].reg)){
+                erase(i.ops[1].reg);
+                uint32_t m = moves.size();
+                moves.push_back({i.ops[0].reg,i.ops[1].reg,move_worklist});
+                move_list[i.ops[0].reg].push_back(m);
+                move_list[i.ops[1].reg].push_back(m);
+                move_queue.push_back(m);
+            }
+            for(uint32_t d = 0;d < ndefs;++d) insert(defs[d]);
+            for(uint32_t d = 0;d < ndefs;++d){
+                for(size_t l = 0;l < live.size();++l) add_edge(live[l],defs[d]);
+            }
+            for(uint32_t d = 0;d < ndefs;++d) erase(defs[d]);
+            for(uint32_t u = 0;u < nuses;++u) insert(uses[u]);
+        }
+    }
+}
+
+void graph_coloring_allocator::make_worklists(){
+    for(uint32_t r = first_vreg;r < n;++r){
+        if(degree[r] >= colors(r)) push(r,spill);
+        else if(move_related(r)) push(r,freeze);
+        else push(r,simplify);
+    }
+}
+
+void graph_coloring_allocator::enable_moves(uint32_t r){
+    for_moves(r,[&](uint32_t m){
+        if(moves[m].state != move_active) return;
+        moves[m].state = move_worklist;
+        move_queue.push_back(m);
+    });
+}
+
+void graph_coloring_allocator::decrement_degree(uint32_t r){
+    if(state[r] == precolored) return;
+    uint32_t d = degree[r]--;
+    if(d != colors(r)) return;
+    enable_moves(r);
+    for_adjacent(r,[&](uint32_t w){enable_moves(w);});
+    if(state[r] == spill) push(r,move_related(r) ? freeze : simplify);
+}
+
+void graph_coloring_allocator::simplify_node(uint32_t r){
+    state[r] = selected;
+    select_stack.push_back(r);
+    for_adjacent(r,[&](uint32_t w){decrement_degree(w);});
+}
+
+void graph_coloring_allocator::add_worklist(uint32_t r){
+    if(state[r] == freeze && !move_related(r) && degree[r] < colors(r)) push(r,simplify);
+}
+
+//Every neighbour of v is insignificant or already interferes with u,
+//which is precolored.
+bool graph_coloring_allocator::george(uint32_t u,uint32_t v){
+    bool ok = true;
+    for_adjacent(v,[&](uint32_t t){
+        ok &= degree[t] < colors(t) || state[t] == precolored || adjacent_pair(t,u);
+    });
+    return ok;
+}
+
+//The merged node has fewer than K significant neighbours.
+bool graph_coloring_allocator::briggs(uint32_t u,uint32_t v){
+    mark.resize(n,0);
+    ++stamp;
+    uint32_t significant = 0;
+    auto count = [&](uint32_t t){
+        if(mark[t] == stamp) return;
+        mark[t] = stamp;
+        significant += degree[t] >= colors(t);
+    };
+    for_adjacent(u,count);
+    for_adjacent(v,count);
+    return significant < colors(u);
+}
+
+void graph_coloring_allocator::combine(uint32_t u,uint32_t v){
+    state[v] = coalesced;
+    alias[v] = u;
+    move_list[u].insert(move_list[u].end(),move_list[v].begin(),move_list[v].end());
+    cost[u] += cost[v];
+    enable_moves(v);
+    for_adjacent(v,[&](uint32_t t){
+        add_edge(t,u);
+        decrement_degree(t);
+    });
+    if(state[u] == freeze && degree[u] >= colors(u)) push(u,spill);
+}
+
+void graph_coloring_allocator::coalesce(uint32_t m){
+    uint32_t x = get_alias(moves[m].dst),y = get_alias(moves[m].src),u = x,v = y;
+    if(state[y] == precolored) swap(u,v);
+    if(u == v){
+        moves[m].state = move_coalesced;
+        add_worklist(u);
+    }else if(state[v] == precolored || adjacent_pair(u,v)){
+        moves[m].state = move_constrained;
+        add_worklist(u);
+        add_worklist(v);
+    }else if(state[u] == precolored ? george(u,v) : briggs(u,v)){
+        moves[m].state = move_coalesced;
+        combine(u,v);
+        add_worklist(u);
+    }else moves[m].state = move_active;
+}
+
+//Gives up on coalescing the copies of r, so it can be simplified.
+void graph_coloring_allocator::freeze_moves(uint32_t r){
+    for_moves(r,[&](uint32_t m){
+        uint32_t x = get_alias(moves[m].dst),y = get_alias(moves[m].src);
+        uint32_t v = y == get_alias(r) ? x : y;
+        moves[m].state = move_frozen;
+        if(state[v] == freeze && !move_related(v) && degree[v] < colors(v)) push(v,simplify);
+    });
+}
+
+//The cheapest node to spill per neighbour it frees; reload temporaries only
+//when nothing else is left.
+bool graph_coloring_allocator::select_spill(){
+    uint32_t best = no_reg;
+    double best_cost = 0;
+    size_t kept = 0;
+    for(uint32_t r : spill_list){
+        if(state[r] != spill) continue;
+        spill_list[kept++] = r;
+        double c = no_spill[r - first_vreg] ? 1e300 : cost[r] / degree[r];
+        if(best == no_reg || c < best_cost){
+            best = r;
+            best_cost = c;
+        }
+    }
+    spill_list.resize(kept);
+    if(best == no_reg) return false;
+    push(best,simplify);
+    freeze_moves(best);
+    return true;
+}
+
+void graph_coloring_allocator::assign_colors(){
+    while(!select_stack.empty()){
+        uint32_t r = select_stack.back();
+        select_stack.pop_back();
+        bool taken[first_vreg] = {};
+        for(uint32_t w : adj_list[r]){
+            uint32_t a = get_alias(w);
+            if(state[a] == colored || state[a] == precolored) taken[color[a]] = true;
+        }
+        //Prefer the color of a copy's other end, which deletes the copy.
+        uint32_t c = no_reg;
+        for(uint32_t m : move_list[r]){
+            uint32_t x = get_alias(moves[m].dst),y = get_alias(moves[m].src),other = x == r ? y : x;
+            if((state[other] == colored || state[other] == precolored) && !taken[color[other]]){
+                c = color[other];
+                break;
+            }
+        }
+        const uint32_t *order = f.is_float(r) ? xmm_alloc_order : gpr_alloc_order;
+        for(uint32_t k = 0;k < colors(r) && c == no_reg;++k){
+            if(!taken[order[k]]) c = order[k];
+        }
+        if(c == no_reg){
+            state[r] = spilled;
+            spilled_nodes.push_back(r);
+        }else{
+            state[r] = colored;
+            color[r] = c;
+        }
+    }
+    for(uint32_t r = first_vreg;r < n;++r){
+        if(state[r] == coalesced) color[r] = color[get_alias(r)];
+    }
+}
+
+//Gives every spilled node a slot, shared by the virtual registers coalesced
+//into it. A copy to or from a spilled register becomes the load or store
+//itself; any other access goes through a new register loaded right before
+//the instruction and stored right after it.
+void graph_coloring_allocator::rewrite_spills(){
+    vector<uint32_t> slot(n,no_reg);
+    for(uint32_t r : spilled_nodes) slot[r] = f.new_slot(8);
+    for(uint32_t r = first_vreg;r < n;++r){
+        if(state[r] != coalesced && state[r] != spilled) continue;
+        slot[r] = slot[get_alias(r)];
+        stats.spilled += slot[r] != no_reg && cost[r] > 0;
+    }
+    auto slot_of = [&](uint32_t r){return r >= first_vreg && r < n ? slot[r] : no_reg;};
+    for(uint32_t b = 0;b < f.blocks.size();++b){
+        double w = weight(b);
+        vector<x86_inst> out;
+        out.reserve(f.blocks[b].insts.size());
+        for(x86_inst &i : f.blocks[b].insts){
+            if(is_copy(i)){
+                uint32_t d = slot_of(i.ops[0].reg),s = slot_of(i.ops[1].reg);
+                if(d != no_reg && d == s) continue;
+                if(d == no_reg && s != no_reg){
+                    i.ops[1] = x86_operand::frame(s);
+                    out.push_back(i);
+                    stats.loads++,stats.cost += w;
+                    continue;
+                }
+                if(d != no_reg && s == no_reg){
+                    i.ops[0] = x86_operand::frame(d);
+                    out.push_back(i);
+                    stats.stores++,stats.cost += w;
+                    continue;
+                }
+            }
+            struct reload {
+                uint32_t vreg,temp;
+                bool load,store;
+            };
+            reload reloads[4];
+            uint32_t count = 0;
+            auto temp = [&](uint32_t r,bool load,bool store){
+                uint32_t k = 0;
+                while(k < count && reloads[k].vreg != r) ++k;
+                if(k == count){
+                    reloads[count++] = {r,f.new_vreg(f.vreg_type(r)),false,false};
+                    no_spill.push_back(1);
+                }
+                reloads[k].load |= load;
+                reloads[k].store |= store;
+                return reloads[k].temp;
+            };
+            for(uint32_t k = 0;k < operand_count(i.op);++k){
+                x86_operand &o = i.ops[k];
+                if(o.is(x86_kind::mem)){
+                    if(slot_of(o.reg) != no_reg) o.reg = temp(o.reg,true,false);
+                    if(slot_of(o.index) != no_reg) o.index = temp(o.index,true,false);
+                }else if(o.is(x86_kind::reg) && slot_of(o.reg) != no_reg){
+                    x86_access a = operand_access(i,k);
+                    o.reg = temp(o.reg,a & access_use,a & access_def);
+                }
+            }
+            auto spill_move = [&](const reload &r,bool load){
+                x86_inst m{};
+                m.op = f.is_float(r.vreg) ? x86_op::movss : x86_op::mov64;
+                m.ops[load ? 0 : 1] = x86_operand::r(r.temp);
+                m.ops[load ? 1 : 0] = x86_operand::frame(slot[r.vreg]);
+                out.push_back(m);
+                (load ? stats.loads : stats.stores)++;
+                stats.cost += w;
+            };
+            for(uint32_t k = 0;k < count;++k) if(reloads[k].load) spill_move(reloads[k],true);
+            out.push_back(i);
+            for(uint32_t k = 0;k < count;++k) if(reloads[k].store) spill_move(reloads[k],false);
+        }
+        f.blocks[b].insts = std::move(out);
+    }
+}
+
+regalloc_stats graph_coloring_allocator::run(){
+    stats.function = f.name;
+    stats.vregs = f.vregs.size();
+    depth = loop_depth(f);
+    split_around_calls();
+    for(;;){
+        build();
+        make_worklists();
+        for(;;){
+            uint32_t r;
+            if(take(simplify_list,simplify,r)) simplify_node(r);
+            else if(!move_queue.empty()){
+                uint32_t m = move_queue.back();
+                move_queue.pop_back();
+                if(moves[m].state == move_worklist) coalesce(m);
+            }else if(take(freeze_list,freeze,r)){
+                push(r,simplify);
+                freeze_moves(r);
+            }else if(!select_spill()) break;
+        }
+        assign_colors();
+        if(spilled_nodes.empty()) break;
+        for(uint32_t r : spilled_nodes){
+            if(no_spill[r - first_vreg]) throw string("graph coloring: out of registers in ") + f.name + ".";
+        }
+        rewrite_spills();
+        spilled_nodes.clear();
+    }
+    for(uint32_t r = first_vreg;r < n;++r) stats.intervals += state[r] == colored && cost[r] > 0;
+    vector<char> used(first_vreg,0);
+    for(auto &b : f.blocks){
+        for(auto &i : b.insts){
+            for(uint32_t k = 0;k < operand_count(i.op);++k){
+                x86_operand &o = i.ops[k];
+                if(!o.is(x86_kind::reg) && !o.is(x86_kind::mem)) continue;
+                if(o.reg != no_reg && o.reg >= first_vreg) used[o.reg = color[o.reg]] = 1;
+                if(o.is(x86_kind::mem) && o.index != no_reg && o.index >= first_vreg) used[o.index = color[o.index]] = 1;
+            }
+        }
+        auto &insts = b.insts;
+        insts.erase(remove_if(insts.begin(),insts.end(),[](const x86_inst &i){return is_copy(i) && i.ops[0].reg == i.ops[1].reg;}),insts.end());
+        for(auto &i : insts) stats.moves += is_copy(i);
+    }
+    f.saved.clear();
+    for(uint32_t r = 0;r < first_vreg;++r) if(used[r] && is_callee_saved(r)) f.saved.push_back(r);
+    f.vregs.clear();
+    return stats;
+}
+
+regalloc_stats graph_coloring(x86_function &f){
+    return graph_coloring_allocator(f).run();
+}
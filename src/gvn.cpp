@@ -0,0 +1,199 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include <algorithm>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// What makes two instructions compute the same value: operands are already
+// replaced by their leaders, and loads carry the memory state they read.
+struct gvn_key {
+    ir_op op;
+    ir_type type;
+    ir_cmp cc;
+    uint32_t a,b;
+    uint32_t extra; //leaf bits, or the memory state of a load
+    bool operator==(const gvn_key &o) const {
+        return op == o.op && type == o.type && cc == o.cc && a == o.a && b == o.b && extra == o.extra;
+    }
+};
+static size_t hash_of(const gvn_key &k){
+    uint64_t h = (uint64_t)k.op << 16 | (uint64_t)k.type << 8 | (uint64_t)k.cc;
+    h = h * 0x9e3779b97f4a7c15ull ^ k.a;
+    h = h * 0x9e3779b97f4a7c15ull ^ k.b;
+    h = h * 0x9e3779b97f4a7c15ull ^ k.extra;
+    return h ^ h >> 29;
+}
+
+static bool writes_memory(ir_op op){
+    return op == ir_op::store || op == ir_op::memzero || op == ir_op::call;
+}
+
+struct value_numbering {
+    ir_function &fn;
+    const dominator_tree &dom;
+    vector<uint32_t> leader;
+    //Open addressing, never shrinking: an entry is only used where its
+    //value's block dominates, and is taken over by a later value otherwise.
+    vector<pair<gvn_key,uint32_t>> table;
+    vector<char> writes;         //blocks with a store, memzero or call
+    vector<uint32_t> memory_out; //memory state at the end of each block
+    vector<uint32_t> mark,work;
+    uint32_t states = 0,eliminated = 0,loads = 0;
+
+    value_numbering(ir_function &fn,const dominator_tree &dom)
+        : fn(fn),dom(dom),leader(fn.insts.size()),writes(fn.blocks.size(),0),memory_out(fn.blocks.size(),0),mark(fn.blocks.size(),no_block){
+        for(uint32_t v = 0;v < leader.size();++v) leader[v] = v;
+        size_t size = 16;
+        while(size < 2 * fn.insts.size()) size *= 2;
+        table.assign(size,{gvn_key{},no_value});
+        for(uint32_t b = 0;b < fn.blocks.size();++b){
+            for(uint32_t v : fn.blocks[b].insts) writes[b] |= writes_memory(fn.insts[v].op);
+        }
+    }
+
+    //Whether memory at the start of b is as idom(b) left it: no block on a
+    //path from idom(b) to b, b itself included if a loop leads back to it,
+    //writes. Gives up on large regions.
+    bool memory_kept(uint32_t b){
+        uint32_t d = dom.idom[b],seen = 0;
+        work.assign(fn.blocks[b].preds.begin(),fn.blocks[b].preds.end());
+        while(!work.empty()){
+            uint32_t p = work.back();
+            work.pop_back();
+            if(p == d || mark[p] == b || dom.order[p] == no_block) continue;
+            if(writes[p] || ++seen > 64) return false;
+            mark[p] = b;
+            work.insert(work.end(),fn.blocks[p].preds.begin(),fn.blocks[p].preds.end());
+        }
+        return true;
+    }
+
+    //The slot holding k, or the empty slot where it would go.
+    pair<gvn_key,uint32_t>& slot(const gvn_key &k){
+        size_t mask = table.size() - 1;
+        for(size_t h = hash_of(k) & mask;;h = (h + 1) & mask){
+            if(table[h].second == no_value || table[h].first == k) return table[h];
+        }
+    }
+    //The value computing k that is available in b, after making v that
+    //value when there is none.
+    uint32_t find_or_add(const gvn_key &k,uint32_t v,uint32_t b){
+        auto &s = slot(k);
+        if(s.second != no_value){
+            uint32_t d = fn.insts[s.second].block;
+            if(d == no_block || dom.dominates(d,b)) return s.second;
+        }
+        s = {k,v};
+        return v;
+    }
+
+    //Constants, arguments and globals with the same bits share one value.
+    void number_leaves(){
+        for(uint32_t v = 0;v < fn.insts.size();++v){
+            const ir_inst &i = fn.insts[v];
+            if(!is_leaf(i.op)) continue;
+            gvn_key k{i.op,i.type,ir_cmp::eq,no_value,no_value,i.op == ir_op::undef ? 0 : i.index};
+            leader[v] = find_or_add(k,v,0);
+        }
+    }
+
+    //The key of a pure instruction, or false when it has none.
+    bool key_of(const ir_inst &i,uint32_t memory,gvn_key &k) const {
+        k = {i.op,i.type,ir_cmp::eq,no_value,no_value,0};
+        switch(i.op){
+        case ir_op::add: case ir_op::mul: case ir_op::fadd: case ir_op::fmul:
+            k.a = min(leader[i.ops[0]],leader[i.ops[1]]);
+            k.b = max(leader[i.ops[0]],leader[i.ops[1]]);
+            return true;
+        case ir_op::sub: case ir_op::div: case ir_op::rem: case ir_op::fsub: case ir_op::fdiv: case ir_op::ptradd:
+            k.a = leader[i.ops[0]];
+            k.b = leader[i.ops[1]];
+            return true;
+        case ir_op::icmp: case ir_op::fcmp:{
+            static const ir_cmp swapped[] = {ir_cmp::eq,ir_cmp::ne,ir_cmp::gt,ir_cmp::ge,ir_cmp::lt,ir_cmp::le};
+            k.a = leader[i.ops[0]];
+            k.b = leader[i.ops[1]];
+            k.cc = i.cc;
+            if(k.a > k.b){
+                swap(k.a,k.b);
+                k.cc = swapped[(int)k.cc];
+            }
+            return true;
+        }
+        case ir_op::fneg: case ir_op::itof: case ir_op::ftoi:
+            k.a = leader[i.ops[0]];
+            return true;
+        case ir_op::load:
+            k.a = leader[i.ops[0]];
+            k.extra = memory;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    //Same-block phis with the same incoming values.
+    void number_phis(uint32_t b){
+        auto &insts = fn.blocks[b].insts;
+        if(insts.size() < 2 || fn.insts[insts[1]].op != ir_op::phi) return;
+        vector<pair<vector<uint32_t>,uint32_t>> seen;
+        for(uint32_t v : fn.blocks[b].insts){
+            const ir_inst &i = fn.insts[v];
+            if(i.op != ir_op::phi) break;
+            vector<uint32_t> in(i.nlist);
+            for(uint32_t k = 0;k < i.nlist;++k) in[k] = leader[fn.list(i)[k]];
+            auto it = find_if(seen.begin(),seen.end(),[&](auto &s){return s.first == in && fn.insts[s.second].type == i.type;});
+            if(it != seen.end()) leader[v] = it->second;
+            else seen.push_back({std::move(in),v});
+        }
+    }
+
+    void number_block(uint32_t b){
+        uint32_t memory = b != 0 && memory_kept(b) ? memory_out[dom.idom[b]] : states++;
+        number_phis(b);
+        for(uint32_t v : fn.blocks[b].insts){
+            const ir_inst &i = fn.insts[v];
+            if(writes_memory(i.op)){
+                memory = states++;
+                //A load right after a store reads what was stored.
+                if(i.op == ir_op::store){
+                    gvn_key k{ir_op::load,fn.insts[i.ops[1]].type,ir_cmp::eq,leader[i.ops[0]],no_value,memory};
+                    slot(k) = {k,leader[i.ops[1]]};
+                }
+                continue;
+            }
+            gvn_key k;
+            if(!key_of(i,memory,k)) continue;
+            leader[v] = find_or_add(k,v,b);
+        }
+        memory_out[b] = memory;
+    }
+
+    //Blocks in reverse postorder: what a block computes is available in
+    //the blocks it dominates, which come after it.
+    void run(){
+        number_leaves();
+        for(uint32_t b : dom.rpo) number_block(b);
+        for(auto &blk : fn.blocks){
+            for(uint32_t v : blk.insts) for_each_operand(fn,fn.insts[v],[&](uint32_t &op){op = leader[op];});
+            auto redundant = [&](uint32_t v){
+                if(leader[v] == v) return false;
+                loads += fn.insts[v].op == ir_op::load;
+                fn.insts[v].op = ir_op::nop;
+                fn.insts[v].block = no_block;
+                eliminated++;
+                return true;
+            };
+            blk.insts.erase(remove_if(blk.insts.begin(),blk.insts.end(),redundant),blk.insts.end());
+        }
+    }
+};
+
+uint32_t gvn(ir_function &fn,uint32_t &loads){
+    dominator_tree dom(fn);
+    value_numbering n(fn,dom);
+    n.run();
+    loads += n.loads;
+    return n.eliminated;
+}
@@ -0,0 +1,281 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+// How much an optimization level lets a call site grow its caller.
+struct inline_limits {
+    int budget;          //instructions a call out of loops may add beyond what the call costs
+    uint32_t max_caller; //callers are not grown past this size
+};
+static const inline_limits limits[3] = {{0,0},{12,4000},{40,16000}};
+
+//Functions in reverse topological order of the call graph, callees first
+//(Tarjan), with those on a call cycle marked.
+static vector<uint32_t> bottom_up(const ir_module &m,vector<char> &recursive){
+    uint32_t n = m.functions.size(),clock = 0;
+    vector<vector<uint32_t>> calls(n);
+    for(uint32_t f = 0;f < n;++f){
+        for(auto &b : m.functions[f].blocks){
+            for(uint32_t v : b.insts){
+                const ir_inst &i = m.functions[f].insts[v];
+                if(i.op != ir_op::call) continue;
+                calls[f].push_back(i.index);
+                if(i.index == f) recursive[f] = 1;
+            }
+        }
+    }
+    vector<uint32_t> order,index(n,~0u),low(n),stack;
+    vector<char> on_stack(n,0);
+    vector<pair<uint32_t,uint32_t>> walk;
+    for(uint32_t root = 0;root < n;++root){
+        if(index[root] != ~0u) continue;
+        walk.push_back({root,0});
+        index[root] = low[root] = clock++;
+        stack.push_back(root);
+        on_stack[root] = 1;
+        while(!walk.empty()){
+            auto &[f,k] = walk.back();
+            if(k < calls[f].size()){
+                uint32_t g = calls[f][k++];
+                if(index[g] == ~0u){
+                    index[g] = low[g] = clock++;
+                    stack.push_back(g);
+                    on_stack[g] = 1;
+                    walk.push_back({g,0});
+                }else if(on_stack[g]) low[f] = min(low[f],index[g]);
+                continue;
+            }
+            uint32_t done = f;
+            walk.pop_back();
+            if(!walk.empty()) low[walk.back().first] = min(low[walk.back().first],low[done]);
+            if(low[done] != index[done]) continue;
+            uint32_t first = order.size();
+            for(uint32_t g = ~0u;g != done;){
+                g = stack.back();
+                stack.pop_back();
+                on_stack[g] = 0;
+                order.push_back(g);
+            }
+            if(order.size() - first > 1){
+                for(uint32_t k = first;k < order.size();++k) recursive[order[k]] = 1;
+            }
+        }
+    }
+    return order;
+}
+
+struct inliner {
+    ir_module &m;
+    const inline_limits &lim;
+    uint32_t inlined = 0;
+
+    inliner(ir_module &m,unsigned level) : m(m),lim(limits[min(level,2u)]),arg_uses(m.functions.size()){}
+
+    //Uses of each parameter in the body of g, worked out once per callee.
+    vector<vector<uint32_t>> arg_uses;
+    const vector<uint32_t>& uses_of_args(uint32_t gi){
+        auto &r = arg_uses[gi];
+        const ir_function &g = m.functions[gi];
+        if(!r.empty() || g.args.empty()) return r;
+        vector<uint32_t> uses(g.insts.size(),0);
+        for(auto &b : g.blocks){
+            for(uint32_t v : b.insts) for_each_operand(g,g.insts[v],[&](uint32_t op){uses[op]++;});
+        }
+        for(uint32_t a : g.args) r.push_back(uses[a]);
+        return r;
+    }
+
+    //Whether inlining call c of f pays for itself: the callee's body minus
+    //what the call costs and what constant arguments are likely to fold
+    //away, against a budget growing with the loop depth of the call.
+    bool worth(const ir_function &f,const ir_inst &c,uint32_t caller_size){
+        const ir_function &g = m.functions[c.index];
+        int size = g.inst_count();
+        int saved = 4 + c.nlist; //the call, the return, the frame and an argument move each
+        int folded = 0;
+        for(uint32_t k = 0;k < c.nlist;++k){
+            ir_op op = f.insts[f.list(c)[k]].op;
+            if(op == ir_op::iconst || op == ir_op::fconst || op == ir_op::global) folded += 2 * uses_of_args(c.index)[k];
+        }
+        int cost = size - saved - folded;
+        if(cost <= 0) return true;
+        if(caller_size + size > lim.max_caller || cost > lim.budget * 7) return false;
+        return cost <= lim.budget * (1 + 2 * (int)min(loop_depth(f,c.block),3u));
+    }
+
+    //Loop depth of the blocks of the function being inlined into, worked
+    //out when a call first needs it and kept up to date by expand().
+    vector<uint32_t> depth;
+    uint32_t loop_depth(const ir_function &f,uint32_t b){
+        if(depth.empty()){
+            dominator_tree dom(f);
+            loop_forest lf(f,dom);
+            depth.assign(f.blocks.size(),0);
+            for(uint32_t k = 0;k < f.blocks.size();++k){
+                if(lf.innermost[k] != no_loop) depth[k] = lf.loops[lf.innermost[k]].depth;
+            }
+        }
+        return depth[b];
+    }
+
+    //Moves what follows position pos in b to a new block, which takes over
+    //b's edges to its successors.
+    uint32_t split(ir_function &f,uint32_t b,size_t pos){
+        uint32_t tail = f.new_block();
+        auto &insts = f.blocks[b].insts;
+        f.blocks[tail].insts.assign(insts.begin() + pos + 1,insts.end());
+        insts.resize(pos + 1);
+        for(uint32_t v : f.blocks[tail].insts) f.insts[v].block = tail;
+        uint32_t succ[2];
+        for(uint32_t k = f.successors(tail,succ);k-- > 0;){
+            for(auto &p : f.blocks[succ[k]].preds){
+                if(p == b) p = tail;
+            }
+        }
+        return tail;
+    }
+
+    //Replaces call c in f by a copy of g's body; returns the value standing
+    //for the call's result.
+    uint32_t expand(ir_function &f,uint32_t c,const ir_function &g){
+        uint32_t b = f.insts[c].block;
+        auto &insts = f.blocks[b].insts;
+        uint32_t tail = split(f,b,find(insts.begin(),insts.end(),c) - insts.begin());
+        uint32_t d = depth.empty() ? 0 : depth[b];
+        if(!depth.empty()) depth.push_back(d);
+        f.blocks[b].insts.pop_back();
+        vector<uint32_t> args(f.list(f.insts[c]),f.list(f.insts[c]) + f.insts[c].nlist);
+
+        vector<uint32_t> block_of(g.blocks.size()),value_of(g.insts.size(),no_value);
+        for(uint32_t k = 0;k < g.blocks.size();++k){
+            block_of[k] = f.new_block();
+            if(!depth.empty()) depth.push_back(d);
+        }
+        for(uint32_t k = 0;k < g.args.size();++k) value_of[g.args[k]] = args[k];
+        for(uint32_t v = 0;v < g.insts.size();++v){
+            const ir_inst &i = g.insts[v];
+            if(is_leaf(i.op) && i.op != ir_op::arg) value_of[v] = f.add(i);
+        }
+        //Copies first, operands once every value has its copy.
+        vector<pair<uint32_t,uint32_t>> returns; //block, value
+        vector<uint32_t> allocas;
+        for(uint32_t k = 0;k < g.blocks.size();++k){
+            uint32_t nb = block_of[k];
+            for(uint32_t p : g.blocks[k].preds) f.blocks[nb].preds.push_back(block_of[p]);
+            for(uint32_t v : g.blocks[k].insts){
+                const ir_inst &i = g.insts[v];
+                if(i.op == ir_op::ret){
+                    returns.push_back({nb,i.ops[0]});
+                    continue;
+                }
+                value_of[v] = f.append(nb,i);
+                if(i.op == ir_op::alloca) allocas.push_back(value_of[v]);
+            }
+        }
+        for(uint32_t k = 0;k < g.blocks.size();++k){
+            for(uint32_t v : f.blocks[block_of[k]].insts){
+                ir_inst &i = f.insts[v];
+                if(i.op == ir_op::phi || i.op == ir_op::call){
+                    vector<uint32_t> list(g.lists.begin() + i.list,g.lists.begin() + i.list + i.nlist);
+                    for(auto &x : list) x = value_of[x];
+                    f.set_list(v,list);
+                    continue;
+                }
+                if(i.op == ir_op::br) i.ops[0] = block_of[i.ops[0]];
+                else if(i.op == ir_op::condbr){
+                    i.ops[0] = value_of[i.ops[0]];
+                    i.ops[1] = block_of[i.ops[1]];
+                    i.ops[2] = block_of[i.ops[2]];
+                }else for_each_operand(f,i,[&](uint32_t &op){op = value_of[op];});
+            }
+        }
+        for(auto &r : returns){
+            ir_inst br{};
+            br.op = ir_op::br;
+            br.ops[0] = tail;
+            br.ops[1] = br.ops[2] = no_value;
+            f.append(r.first,br);
+            f.blocks[tail].preds.push_back(r.first);
+        }
+        //Stack slots stay in the entry block.
+        for(uint32_t a : allocas){
+            auto &from = f.blocks[f.insts[a].block].insts;
+            from.erase(find(from.begin(),from.end(),a));
+            f.insts[a].block = 0;
+        }
+        auto &entry = f.blocks[0].insts;
+        entry.insert(entry.begin(),allocas.begin(),allocas.end());
+
+        ir_inst br{};
+        br.op = ir_op::br;
+        br.ops[0] = block_of[0];
+        br.ops[1] = br.ops[2] = no_value;
+        f.append(b,br);
+        f.blocks[block_of[0]].preds.push_back(b);
+        f.insts[c].op = ir_op::nop;
+        f.insts[c].block = no_block;
+        inlined++;
+
+        if(g.ret == ir_type::none) return no_value;
+        if(returns.size() == 1) return value_of[returns[0].second];
+        ir_inst phi{};
+        phi.op = ir_op::phi;
+        phi.type = g.ret;
+        phi.ops[0] = phi.ops[1] = phi.ops[2] = no_value;
+        uint32_t p = f.add(phi);
+        f.insts[p].block = tail;
+        f.blocks[tail].insts.insert(f.blocks[tail].insts.begin(),p);
+        vector<uint32_t> values;
+        for(auto &r : returns) values.push_back(value_of[r.second]);
+        f.set_list(p,values);
+        return p;
+    }
+
+    bool run(uint32_t fi,const vector<char> &recursive){
+        ir_function &f = m.functions[fi];
+        vector<uint32_t> sites;
+        for(auto &b : f.blocks){
+            for(uint32_t v : b.insts){
+                const ir_inst &i = f.insts[v];
+                if(i.op != ir_op::call) continue;
+                const ir_function &g = m.functions[i.index];
+                //A callee whose entry is a loop header would need an edge
+                //into its entry.
+                if(g.is_extern || recursive[i.index] || !g.blocks[0].preds.empty()) continue;
+                sites.push_back(v);
+            }
+        }
+        if(sites.empty()) return false;
+        uint32_t size = f.inst_count(),before = inlined;
+        vector<uint32_t> result(f.insts.size(),no_value);
+        depth.clear();
+        for(uint32_t c : sites){
+            const ir_function &g = m.functions[f.insts[c].index];
+            if(!worth(f,f.insts[c],size)) continue;
+            size += g.inst_count();
+            result[c] = expand(f,c,g);
+        }
+        if(inlined == before) return false;
+        //Results may be arguments of later calls that were inlined too.
+        auto resolve = [&](uint32_t v){
+            while(v < result.size() && result[v] != no_value) v = result[v];
+            return v;
+        };
+        for(auto &b : f.blocks){
+            for(uint32_t v : b.insts) for_each_operand(f,f.insts[v],[&](uint32_t &op){op = resolve(op);});
+        }
+        return true;
+    }
+};
+
+uint32_t inline_calls(ir_module &m,unsigned level,vector<char> &changed){
+    if(level == 0) return 0;
+    vector<char> recursive(m.functions.size(),0);
+    inliner in(m,level);
+    for(uint32_t f : bottom_up(m,recursive)){
+        if(!m.functions[f].is_extern && in.run(f,recursive)) changed[f] = 1;
+    }
+    return in.inlined;
+}
@@ -0,0 +1,343 @@
+#include "ir.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+uint32_t ir_function::add(const ir_inst &i){
+    insts.push_back(i);
+    insts.back().block = no_block;
+    return insts.size() - 1;
+}
+uint32_t ir_function::append(uint32_t b,const ir_inst &i){
+    uint32_t v = add(i);
+    insts[v].block = b;
+    blocks[b].insts.push_back(v);
+    return v;
+}
+uint32_t ir_function::new_block(){
+    blocks.emplace_back();
+    return blocks.size() - 1;
+}
+void ir_function::set_list(uint32_t v,const vector<uint32_t> &values){
+    insts[v].list = lists.size();
+    insts[v].nlist = values.size();
+    lists.insert(lists.end(),values.begin(),values.end());
+}
+
+const ir_inst* ir_function::terminator(uint32_t b) const {
+    if(blocks[b].insts.empty()) return nullptr;
+    const ir_inst &i = insts[blocks[b].insts.back()];
+    return is_terminator(i.op) ? &i : nullptr;
+}
+uint32_t ir_function::successors(uint32_t b,uint32_t out[2]) const {
+    const ir_inst *t = terminator(b);
+    if(t == nullptr || t->op == ir_op::ret) return 0;
+    if(t->op == ir_op::br){
+        out[0] = t->ops[0];
+        return 1;
+    }
+    out[0] = t->ops[1];
+    out[1] = t->ops[2];
+    return 2;
+}
+
+void ir_function::remove_pred(uint32_t b,uint32_t pred){
+    auto &preds = blocks[b].preds;
+    auto it = find(preds.begin(),preds.end(),pred);
+    if(it == preds.end()) return;
+    uint32_t k = it - preds.begin();
+    preds.erase(it);
+    for(uint32_t v : blocks[b].insts){
+        ir_inst &i = insts[v];
+        if(i.op != ir_op::phi) break;
+        uint32_t *ops = list(i);
+        copy(ops + k + 1,ops + i.nlist,ops + k);
+        i.nlist--;
+    }
+}
+
+void ir_function::replace_uses(uint32_t from,uint32_t to){
+    for(auto &b : blocks){
+        for(uint32_t v : b.insts){
+            for_each_operand(*this,insts[v],[&](uint32_t &op){if(op == from) op = to;});
+        }
+    }
+}
+
+void ir_function::erase(uint32_t v){
+    ir_inst &i = insts[v];
+    if(i.block == no_block) return;
+    auto &list = blocks[i.block].insts;
+    list.erase(find(list.begin(),list.end(),v));
+    i.op = ir_op::nop;
+    i.block = no_block;
+}
+
+uint32_t ir_function::remove_unreachable(){
+    vector<char> seen(blocks.size(),0);
+    vector<uint32_t> work = {0};
+    seen[0] = 1;
+    while(!work.empty()){
+        uint32_t b = work.back();
+        work.pop_back();
+        uint32_t succ[2];
+        for(uint32_t k = successors(b,succ);k-- > 0;){
+            if(!seen[succ[k]]){seen[succ[k]] = 1;work.push_back(succ[k]);}
+        }
+    }
+    uint32_t removed = 0;
+    for(uint32_t b = 0;b < blocks.size();++b){
+        if(seen[b]) continue;
+        removed++;
+        uint32_t succ[2];
+        for(uint32_t k = successors(b,succ);k-- > 0;){
+            if(seen[succ[k]]) remove_pred(succ[k],b);
+        }
+    }
+    if(removed == 0) return 0;
+
+    vector<uint32_t> renumber(blocks.size(),no_block);
+    vector<ir_block> kept;
+    for(uint32_t b = 0;b < blocks.size();++b){
+        if(seen[b]){
+            renumber[b] = kept.size();
+            kept.push_back(std::move(blocks[b]));
+        }else{
+            for(uint32_t v : blocks[b].insts){
+                insts[v].op = ir_op::nop;
+                insts[v].block = no_block;
+            }
+        }
+    }
+    blocks = std::move(kept);
+    for(uint32_t b = 0;b < blocks.size();++b){
+        for(auto &p : blocks[b].preds) p = renumber[p];
+        for(uint32_t v : blocks[b].insts){
+            ir_inst &i = insts[v];
+            i.block = b;
+            if(i.op == ir_op::br) i.ops[0] = renumber[i.ops[0]];
+            else if(i.op == ir_op::condbr){
+                i.ops[1] = renumber[i.ops[1]];
+                i.ops[2] = renumber[i.ops[2]];
+            }
+        }
+    }
+    return removed;
+}
+
+uint32_t ir_function::inst_count() const {
+    uint32_t n = 0;
+    for(auto &b : blocks) n += b.insts.size();
+    return n;
+}
+
+int ir_module::find_function(const string &name) const {
+    for(uint32_t f = 0;f < functions.size();++f){
+        if(functions[f].name == name) return f;
+    }
+    return -1;
+}
+uint32_t ir_module::inst_count() const {
+    uint32_t n = 0;
+    for(auto &f : functions) n += f.inst_count();
+    return n;
+}
+
+ostream& operator<<(ostream &os,ir_type t){
+    switch(t){
+    case ir_type::none: return os << "void";
+    case ir_type::i32: return os << "i32";
+    case ir_type::f32: return os << "f32";
+    case ir_type::ptr: return os << "ptr";
+    }
+    return os;
+}
+
+static const char* op_name(ir_op op){
+    static const char* names[] = {
+        "iconst","fconst","undef","arg","global",
+        "add","sub","mul","div","rem",
+        "fadd","fsub","fmul","fdiv","fneg",
+        "icmp","fcmp","itof","ftoi",
+        "alloca","ptradd","load","store","memzero",
+        "call","phi","br","condbr","ret","nop",
+    };
+    return names[(int)op];
+}
+static const char* cmp_name(ir_cmp c){
+    static const char* names[] = {"eq","ne","lt","le","gt","ge"};
+    return names[(int)c];
+}
+static string float_text(float f){
+    char buf[32];
+    snprintf(buf,sizeof(buf),"%.9g",f);
+    string s = buf;
+    if(s.find_first_of(".en") == string::npos) s += ".0";
+    return s;
+}
+
+static void print_value(ostream &os,const ir_function &fn,const ir_module &m,uint32_t v){
+    if(v == no_value){os << "?";return;}
+    const ir_inst &i = fn.insts[v];
+    switch(i.op){
+    case ir_op::iconst: os << i.imm;break;
+    case ir_op::fconst: os << float_text(i.fimm);break;
+    case ir_op::undef: os << "undef";break;
+    case ir_op::global: os << "@" << m.globals[i.index].name;break;
+    default: os << "%" << v;
+    }
+}
+
+static void print_inst(ostream &os,const ir_function &fn,const ir_module &m,uint32_t v){
+    const ir_inst &i = fn.insts[v];
+    auto value = [&](uint32_t x){print_value(os,fn,m,x);};
+    os << "  ";
+    if(i.type != ir_type::none) os << "%" << v << " = ";
+    os << op_name(i.op);
+    switch(i.op){
+    case ir_op::icmp: case ir_op::fcmp:
+        os << " " << cmp_name(i.cc) << " ";
+        value(i.ops[0]);os << ", ";value(i.ops[1]);
+        break;
+    case ir_op::alloca:
+        os << " " << i.imm;
+        break;
+    case ir_op::memzero:
+        os << " ";value(i.ops[0]);os << ", " << i.imm;
+        break;
+    case ir_op::load:
+        os << " " << i.type << " ";value(i.ops[0]);
+        break;
+    case ir_op::call:{
+        const ir_function &callee = m.functions[i.index];
+        os << " " << callee.ret << " @" << callee.name << "(";
+        for(uint32_t k = 0;k < i.nlist;++k){
+            if(k) os << ", ";
+            value(fn.list(i)[k]);
+        }
+        os << ")";
+    }break;
+    case ir_op::phi:{
+        os << " " << i.type;
+        auto &preds = fn.blocks[i.block].preds;
+        for(uint32_t k = 0;k < i.nlist;++k){
+            os << (k ? ", [" : " [");
+            value(fn.list(i)[k]);
+            os << ", b" << (k < preds.size() ? (int)preds[k] : -1) << "]";
+        }
+    }break;
+    case ir_op::br:
+        os << " b" << i.ops[0];
+        break;
+    case ir_op::condbr:
+        os << " ";value(i.ops[0]);os << ", b" << i.ops[1] << ", b" << i.ops[2];
+        break;
+    case ir_op::ret:
+        if(i.ops[0] != no_value){os << " ";value(i.ops[0]);}
+        break;
+    default:{
+        const char* sep = " ";
+        for_each_operand(fn,i,[&](uint32_t x){os << sep;value(x);sep = ", ";});
+    }
+    }
+    os << "\n";
+}
+
+void print(ostream &os,const ir_function &fn,const ir_module &m){
+    os << (fn.is_extern ? "declare " : "define ") << fn.ret << " @" << fn.name << "(";
+    for(uint32_t k = 0;k < fn.params.size();++k){
+        if(k) os << ", ";
+        os << fn.params[k];
+        if(!fn.is_extern) os << " %" << fn.args[k];
+    }
+    os << ")";
+    if(fn.is_extern){os << "\n";return;}
+    os << " {\n";
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        os << "b" << b << ":";
+        if(!fn.blocks[b].preds.empty()){
+            os << "  ; preds";
+            for(uint32_t p : fn.blocks[b].preds) os << " b" << p;
+        }
+        os << "\n";
+        for(uint32_t v : fn.blocks[b].insts) print_inst(os,fn,m,v);
+    }
+    os << "}\n";
+}
+
+void print(ostream &os,const ir_module &m){
+    for(auto &g : m.globals){
+        os << "@" << g.name << " = " << (g.is_const ? "const " : "global ") << "[" << g.size / 4 << " x " << g.elem << "]";
+        if(g.init.empty()) os << " zeroinitializer";
+        else{
+            os << " {";
+            for(uint32_t k = 0;k < g.init.size();++k){
+                if(k) os << ", ";
+                if(g.elem == ir_type::f32){
+                    float f;
+                    memcpy(&f,&g.init[k],4);
+                    os << float_text(f);
+                }else os << (int32_t)g.init[k];
+            }
+            os << "}";
+        }
+        os << "\n";
+    }
+    if(!m.globals.empty()) os << "\n";
+    for(auto &f : m.functions){
+        print(os,f,m);
+        if(!f.is_extern) os << "\n";
+    }
+}
+
+void verify(const ir_function &fn){
+    auto fail = [&](const string &what,uint32_t b){
+        throw "IR of " + fn.name + " is broken in b" + to_string(b) + ": " + what;
+    };
+    vector<uint32_t> edges(fn.blocks.size(),0);
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        auto &blk = fn.blocks[b];
+        if(blk.insts.empty() || fn.terminator(b) == nullptr) fail("no terminator",b);
+        bool in_phis = true;
+        for(uint32_t k = 0;k < blk.insts.size();++k){
+            uint32_t v = blk.insts[k];
+            if(v >= fn.insts.size()) fail("bad instruction id",b);
+            const ir_inst &i = fn.insts[v];
+            if(i.block != b) fail("%" + to_string(v) + " thinks it is in b" + to_string(i.block),b);
+            if(i.op == ir_op::nop || is_leaf(i.op)) fail("%" + to_string(v) + " can't be in a block",b);
+            if(i.op == ir_op::phi){
+                if(!in_phis) fail("phi %" + to_string(v) + " after a non-phi",b);
+                if(i.nlist != blk.preds.size()) fail("phi %" + to_string(v) + " doesn't match the preds",b);
+            }else in_phis = false;
+            if(is_terminator(i.op) != (k + 1 == blk.insts.size())) fail("terminator in the middle",b);
+            if(i.op == ir_op::alloca && b != 0) fail("alloca outside the entry block",b);
+            for_each_operand(fn,i,[&](uint32_t op){
+                if(op >= fn.insts.size()) fail("%" + to_string(v) + " uses an undefined value",b);
+                const ir_inst &def = fn.insts[op];
+                if(def.op == ir_op::nop || (!is_leaf(def.op) && def.block == no_block)){
+                    fail("%" + to_string(v) + " uses erased %" + to_string(op),b);
+                }
+            });
+        }
+        uint32_t succ[2];
+        for(uint32_t k = fn.successors(b,succ);k-- > 0;){
+            if(succ[k] >= fn.blocks.size()) fail("branch to a missing block",b);
+            auto &preds = fn.blocks[succ[k]].preds;
+            if(find(preds.begin(),preds.end(),b) == preds.end()) fail("not a pred of its successor b" + to_string(succ[k]),b);
+            edges[succ[k]]++;
+        }
+    }
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        if(edges[b] != fn.blocks[b].preds.size()) fail("preds don't match the branches",b);
+    }
+}
+
+void verify(const ir_module &m){
+    for(auto &f : m.functions){
+        if(!f.is_extern) verify(f);
+    }
+}
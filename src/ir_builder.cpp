@@ -0,0 +1,612 @@
+#include "ir_builder.hpp"
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+static ir_type ir_type_of(TokenType t){
+    switch(t){
+    case Int: return ir_type::i32;
+    case Float: return ir_type::f32;
+    default: return ir_type::none;
+    }
+}
+
+void ir_builder::quit_scope(){
+    uint32_t m = markers.back();
+    markers.pop_back();
+    while(scope.size() > m){
+        head[scope.back().name] = scope.back().shadowed;
+        scope.pop_back();
+    }
+}
+void ir_builder::declare(symbol name,const variable &v){
+    if(name >= head.size()) head.resize(max<size_t>(symbols.size(),name + 1),-1);
+    scope.push_back({v,name,head[name]});
+    head[name] = scope.size() - 1;
+}
+ir_builder::variable& ir_builder::lookup(symbol name){
+    if(name >= head.size() || head[name] < 0) throw symbols.name(name) + " : undefined variable.";
+    return scope[head[name]].var;
+}
+
+uint32_t ir_builder::function_id(symbol name){
+    auto it = func_ids.find(name);
+    if(it != func_ids.end()) return it->second;
+    //A runtime function: declared on first use.
+    const Func &f = funcs.at(name);
+    vector<ir_type> params;
+    for(auto &p : f.params) params.push_back(!p.first.dimens.empty() ? ir_type::ptr : ir_type_of(p.first.basetype));
+    mod.functions.emplace_back(symbols.name(name),ir_type_of(f.return_type),std::move(params),true);
+    if(fn != nullptr) fn = &mod.functions[fn_id];
+    return func_ids[name] = mod.functions.size() - 1;
+}
+
+uint32_t ir_builder::new_block(){
+    sealed.push_back(0);
+    incomplete.emplace_back();
+    return fn->new_block();
+}
+uint32_t ir_builder::emit(ir_op op,ir_type type,uint32_t a,uint32_t b){
+    ir_inst i{};
+    i.op = op;
+    i.type = type;
+    i.ops[0] = a;
+    i.ops[1] = b;
+    i.ops[2] = no_value;
+    return fn->append(cur,i);
+}
+uint32_t ir_builder::iconst(int v){
+    auto [it,fresh] = leaves.try_emplace((uint64_t)ir_op::iconst << 32 | (uint32_t)v,0);
+    if(fresh){
+        ir_inst i{};
+        i.op = ir_op::iconst;i.type = ir_type::i32;i.imm = v;
+        it->second = fn->add(i);
+    }
+    return it->second;
+}
+uint32_t ir_builder::fconst(float v){
+    uint32_t bits;
+    memcpy(&bits,&v,4);
+    auto [it,fresh] = leaves.try_emplace((uint64_t)ir_op::fconst << 32 | bits,0);
+    if(fresh){
+        ir_inst i{};
+        i.op = ir_op::fconst;i.type = ir_type::f32;i.fimm = v;
+        it->second = fn->add(i);
+    }
+    return it->second;
+}
+uint32_t ir_builder::undef(ir_type t){
+    auto [it,fresh] = leaves.try_emplace((uint64_t)ir_op::undef << 32 | (uint32_t)t,0);
+    if(fresh){
+        ir_inst i{};
+        i.op = ir_op::undef;i.type = t;
+        it->second = fn->add(i);
+    }
+    return it->second;
+}
+uint32_t ir_builder::global_addr(uint32_t id){
+    auto [it,fresh] = leaves.try_emplace((uint64_t)ir_op::global << 32 | id,0);
+    if(fresh){
+        ir_inst i{};
+        i.op = ir_op::global;i.type = ir_type::ptr;i.index = id;
+        it->second = fn->add(i);
+    }
+    return it->second;
+}
+
+uint32_t ir_builder::convert(uint32_t v,ir_type to){
+    ir_type from = type_of(v);
+    if(from == to) return v;
+    const ir_inst &i = fn->insts[v];
+    if(i.op == ir_op::iconst) return fconst(i.imm);
+    //Out of range or NaN, ftoi does what the target does at run time.
+    if(i.op == ir_op::fconst && i.fimm >= -2147483648.0f && i.fimm < 2147483648.0f) return iconst((int32_t)i.fimm);
+    if(to == ir_type::f32) return emit(ir_op::itof,ir_type::f32,v);
+    return emit(ir_op::ftoi,ir_type::i32,v);
+}
+
+void ir_builder::jump(uint32_t target){
+    ir_inst i{};
+    i.op = ir_op::br;
+    i.ops[0] = target;
+    i.ops[1] = i.ops[2] = no_value;
+    fn->append(cur,i);
+    fn->blocks[target].preds.push_back(cur);
+}
+void ir_builder::branch(uint32_t c,uint32_t then_block,uint32_t else_block){
+    ir_inst i{};
+    i.op = ir_op::condbr;
+    i.ops[0] = c;
+    i.ops[1] = then_block;
+    i.ops[2] = else_block;
+    fn->append(cur,i);
+    fn->blocks[then_block].preds.push_back(cur);
+    fn->blocks[else_block].preds.push_back(cur);
+}
+bool ir_builder::terminated(){
+    return fn->terminator(cur) != nullptr;
+}
+//Code after return, break or continue goes to a block without preds,
+//which finish_function() drops.
+void ir_builder::start_unreachable(){
+    cur = new_block();
+    seal(cur);
+}
+
+uint32_t ir_builder::new_var(ir_type t){
+    var_types.push_back(t);
+    return var_types.size() - 1;
+}
+void ir_builder::write_var(uint32_t var,uint32_t block,uint32_t v){
+    defs.set(def_table::key(block,var),v);
+}
+uint32_t ir_builder::resolve(uint32_t v){
+    while(v < forward.size() && forward[v] != no_value) v = forward[v];
+    return v;
+}
+uint32_t ir_builder::read_var(uint32_t var,uint32_t block){
+    if(const uint32_t *v = defs.find(def_table::key(block,var))) return resolve(*v);
+
+    auto &preds = fn->blocks[block].preds;
+    uint32_t v;
+    auto new_phi = [&]{
+        ir_inst i{};
+        i.op = ir_op::phi;
+        i.type = var_types[var];
+        uint32_t phi = fn->add(i);
+        fn->insts[phi].block = block;
+        auto &insts = fn->blocks[block].insts;
+        uint32_t at = 0;
+        while(at < insts.size() && fn->insts[insts[at]].op == ir_op::phi) at++;
+        insts.insert(insts.begin() + at,phi);
+        return phi;
+    };
+    if(!sealed[block]){
+        v = new_phi();
+        incomplete[block].push_back({var,v});
+    }else if(preds.empty()){
+        v = undef(var_types[var]);
+    }else if(preds.size() == 1){
+        v = read_var(var,preds[0]);
+    }else{
+        //Written first so that a loop back to this block finds the phi.
+        v = new_phi();
+        write_var(var,block,v);
+        v = add_phi_operands(var,v);
+    }
+    write_var(var,block,v);
+    return v;
+}
+uint32_t ir_builder::add_phi_operands(uint32_t var,uint32_t phi){
+    //The operands are read straight into fn->lists; the range is reserved
+    //first since reading them can add more phis (and lists) recursively.
+    uint32_t block = fn->insts[phi].block;
+    uint32_t n = fn->blocks[block].preds.size();
+    uint32_t at = fn->lists.size();
+    fn->lists.resize(at + n);
+    fn->insts[phi].list = at;
+    fn->insts[phi].nlist = n;
+    for(uint32_t k = 0;k < n;++k){
+        uint32_t v = read_var(var,fn->blocks[block].preds[k]);
+        fn->lists[at + k] = v;
+    }
+    return try_remove_trivial_phi(phi);
+}
+uint32_t ir_builder::try_remove_trivial_phi(uint32_t phi){
+    uint32_t same = no_value;
+    ir_inst &i = fn->insts[phi];
+    for(uint32_t k = 0;k < i.nlist;++k){
+        uint32_t op = resolve(fn->list(i)[k]);
+        if(op == same || op == phi) continue;
+        if(same != no_value) return phi;
+        same = op;
+    }
+    if(same == no_value) same = undef(i.type);
+    if(forward.size() <= phi) forward.resize(fn->insts.size(),no_value);
+    forward[phi] = same;
+    fn->erase(phi);
+    return same;
+}
+void ir_builder::seal(uint32_t block){
+    auto pending = std::move(incomplete[block]);
+    incomplete[block].clear();
+    for(auto [var,phi] : pending) add_phi_operands(var,phi);
+    sealed[block] = 1;
+}
+
+void ir_builder::start_function(uint32_t id){
+    fn_id = id;
+    fn = &mod.functions[id];
+    var_types.clear();
+    defs.clear();
+    incomplete.clear();
+    sealed.clear();
+    forward.clear();
+    leaves.clear();
+    loops.clear();
+    nallocas = 0;
+    cur = new_block();
+    seal(cur);
+}
+
+void ir_builder::finish_function(){
+    auto rewrite = [&]{
+        for(auto &b : fn->blocks){
+            for(uint32_t v : b.insts){
+                for_each_operand(*fn,fn->insts[v],[&](uint32_t &op){op = resolve(op);});
+            }
+        }
+    };
+    rewrite();
+    fn->remove_unreachable();
+    //Removing phis can make others trivial; Braun et al. recurse over the
+    //users of a removed phi, here the whole function is swept until stable.
+    for(bool changed = true;changed;){
+        changed = false;
+        for(auto &b : fn->blocks){
+            vector<uint32_t> phis;
+            for(uint32_t v : b.insts){
+                if(fn->insts[v].op != ir_op::phi) break;
+                phis.push_back(v);
+            }
+            for(uint32_t phi : phis){
+                if(try_remove_trivial_phi(phi) != phi) changed = true;
+            }
+        }
+        if(changed) rewrite();
+    }
+    fn = nullptr;
+}
+
+void ir_builder::build(vector<CompUnit> &ast){
+    for(auto &unit : ast){
+        if(!unit.function) continue;
+        func_def &f = *unit.function;
+        vector<ir_type> params;
+        for(auto &p : f.fparams) params.push_back(p.first.dimens.empty() ? ir_type_of(p.first.typ) : ir_type::ptr);
+        mod.functions.emplace_back(symbols.name(f.name),ir_type_of(f.return_type),std::move(params),false);
+        func_ids[f.name] = mod.functions.size() - 1;
+    }
+    enter_scope();
+    for(auto &unit : ast) unit.accept(*this);
+    quit_scope();
+}
+
+void ir_builder::accept(ast_node& e){}
+void ir_builder::accept(expr& e){}
+void ir_builder::accept(init_val& e){}
+void ir_builder::accept(Type& e){}
+void ir_builder::accept(stmt& e){}
+void ir_builder::accept(empty_stmt& e){}
+
+void ir_builder::accept(int_literal_expr& e){
+    result = iconst(e.value);
+}
+void ir_builder::accept(float_literal_expr& e){
+    result = fconst(e.value);
+}
+void ir_builder::accept(var_expr& e){
+    variable &v = lookup(e.varname);
+    switch(v.kind){
+    case variable::ssa: result = read_var(v.id,cur);break;
+    case variable::address: result = v.id;break;
+    case variable::global:
+        result = global_addr(v.id);
+        if(!v.is_array) result = emit(ir_op::load,v.type,result);
+        break;
+    }
+}
+
+void ir_builder::accept(binary_expr& e){
+    if(e.op == And || e.op == Or){
+        //A condition used as a value: 1 on one path, 0 on the other.
+        uint32_t t = new_block(),f = new_block(),done = new_block();
+        uint32_t var = new_var(ir_type::i32);
+        cond(&e,t,f);
+        seal(t);seal(f);
+        cur = t;write_var(var,cur,iconst(1));jump(done);
+        cur = f;write_var(var,cur,iconst(0));jump(done);
+        seal(done);
+        cur = done;
+        result = read_var(var,cur);
+        return;
+    }
+    uint32_t lhs = value(e.lhs);
+    uint32_t rhs = value(e.rhs);
+    bool is_float = type_of(lhs) == ir_type::f32 || type_of(rhs) == ir_type::f32;
+    if(is_float){
+        lhs = convert(lhs,ir_type::f32);
+        rhs = convert(rhs,ir_type::f32);
+    }
+    auto compare = [&](ir_cmp cc){
+        uint32_t v = emit(is_float ? ir_op::fcmp : ir_op::icmp,ir_type::i32,lhs,rhs);
+        fn->insts[v].cc = cc;
+        return v;
+    };
+    ir_type t = is_float ? ir_type::f32 : ir_type::i32;
+    switch(e.op){
+    case Plus: result = emit(is_float ? ir_op::fadd : ir_op::add,t,lhs,rhs);break;
+    case Minus: result = emit(is_float ? ir_op::fsub : ir_op::sub,t,lhs,rhs);break;
+    case Mul: result = emit(is_float ? ir_op::fmul : ir_op::mul,t,lhs,rhs);break;
+    case Div: result = emit(is_float ? ir_op::fdiv : ir_op::div,t,lhs,rhs);break;
+    case Mod: result = emit(ir_op::rem,t,lhs,rhs);break;
+    case EqualEqual: result = compare(ir_cmp::eq);break;
+    case NotEqual: result = compare(ir_cmp::ne);break;
+    case Less: result = compare(ir_cmp::lt);break;
+    case LessEqual: result = compare(ir_cmp::le);break;
+    case Greater: result = compare(ir_cmp::gt);break;
+    case GreaterEqual: result = compare(ir_cmp::ge);break;
+    default: throw string("Unknown infix operator.");
+    }
+}
+void ir_builder::accept(prefix_expr& e){
+    uint32_t v = value(e.rhs);
+    bool is_float = type_of(v) == ir_type::f32;
+    switch(e.op){
+    case Plus: result = v;break;
+    case Minus:
+        result = is_float ? emit(ir_op::fneg,ir_type::f32,v) : emit(ir_op::sub,ir_type::i32,iconst(0),v);
+        break;
+    case Not:
+        result = is_float ? emit(ir_op::fcmp,ir_type::i32,v,fconst(0)) : emit(ir_op::icmp,ir_type::i32,v,iconst(0));
+        fn->insts[result].cc = ir_cmp::eq;
+        break;
+    default: throw string("Unknown prefix operator.");
+    }
+}
+void ir_builder::accept(assign_expr& e){
+    uint32_t rhs = value(e.rhs);
+    if(auto ve = dynamic_cast<var_expr*>(e.lhs)){
+        variable &v = lookup(ve->varname);
+        rhs = convert(rhs,v.type);
+        if(v.kind == variable::ssa) write_var(v.id,cur,rhs);
+        else emit(ir_op::store,ir_type::none,global_addr(v.id),rhs);
+    }else{
+        auto &ie = dynamic_cast<index_expr&>(*e.lhs);
+        uint32_t p = address(ie);
+        rhs = convert(rhs,ir_type_of(ie.type->basetype));
+        emit(ir_op::store,ir_type::none,p,rhs);
+    }
+    result = rhs;
+}
+void ir_builder::accept(fun_call_expr& e){
+    uint32_t callee = function_id(dynamic_cast<var_expr*>(e.func)->varname);
+    vector<uint32_t> args;
+    for(uint32_t k = 0;k < e.params.size();++k){
+        uint32_t v = value(e.params[k]);
+        ir_type want = mod.functions[callee].params[k];
+        args.push_back(want == ir_type::ptr ? v : convert(v,want));
+    }
+    result = emit(ir_op::call,mod.functions[callee].ret);
+    fn->insts[result].index = callee;
+    fn->set_list(result,args);
+}
+uint32_t ir_builder::address(index_expr &e){
+    uint32_t base = value(e.array);
+    uint32_t index = convert(value(e.index),ir_type::i32);
+    uint32_t offset = emit(ir_op::mul,ir_type::i32,index,iconst(e.array->type->stepsize));
+    return emit(ir_op::ptradd,ir_type::ptr,base,offset);
+}
+void ir_builder::accept(index_expr& e){
+    uint32_t p = address(e);
+    result = e.type->is_array() ? p : emit(ir_op::load,ir_type_of(e.type->basetype),p);
+}
+
+void ir_builder::cond(expr* e,uint32_t then_block,uint32_t else_block){
+    if(auto be = dynamic_cast<binary_expr*>(e);be && (be->op == And || be->op == Or)){
+        uint32_t next = new_block();
+        if(be->op == And) cond(be->lhs,next,else_block);
+        else cond(be->lhs,then_block,next);
+        seal(next);
+        cur = next;
+        cond(be->rhs,then_block,else_block);
+        return;
+    }
+    if(auto pe = dynamic_cast<prefix_expr*>(e);pe && pe->op == Not){
+        cond(pe->rhs,else_block,then_block);
+        return;
+    }
+    uint32_t v = value(e);
+    if(type_of(v) == ir_type::f32){
+        v = emit(ir_op::fcmp,ir_type::i32,v,fconst(0));
+        fn->insts[v].cc = ir_cmp::ne;
+    }
+    branch(v,then_block,else_block);
+}
+
+void ir_builder::accept(func_def& e){
+    start_function(func_ids[e.name]);
+    enter_scope();
+    for(uint32_t k = 0;k < e.fparams.size();++k){
+        auto &[type,name] = e.fparams[k];
+        ir_inst i{};
+        i.op = ir_op::arg;
+        i.type = fn->params[k];
+        i.index = k;
+        uint32_t arg = fn->add(i);
+        fn->args.push_back(arg);
+        if(i.type == ir_type::ptr){
+            declare(name,{variable::address,ir_type_of(type.typ),true,arg});
+        }else{
+            uint32_t var = new_var(i.type);
+            write_var(var,cur,arg);
+            declare(name,{variable::ssa,i.type,false,var});
+        }
+    }
+    e.body->accept(*this);
+    if(!terminated()){
+        //Falling off the end returns 0 from int and float functions.
+        uint32_t v = no_value;
+        if(fn->ret == ir_type::i32) v = iconst(0);
+        else if(fn->ret == ir_type::f32) v = fconst(0);
+        emit(ir_op::ret,ir_type::none,v);
+    }
+    quit_scope();
+    finish_function();
+}
+
+static vector<int> dimensions(const decl &e){
+    vector<int> dimens;
+    for(auto d : e.type.dimens) dimens.push_back(dynamic_cast<int_literal_expr*>(d)->value);
+    return dimens;
+}
+static uint32_t literal_bits(expr* e,ir_type t){
+    float f = 0;
+    int i = 0;
+    if(auto il = dynamic_cast<int_literal_expr*>(e)){i = il->value;f = i;}
+    else{
+        f = dynamic_cast<float_literal_expr*>(e)->value;
+        if(t == ir_type::i32){
+            if(!(f >= -2147483648.0f && f < 2147483648.0f)) throw string("Initializer out of the range of int.");
+            i = f;
+        }
+    }
+    uint32_t bits;
+    if(t == ir_type::f32) memcpy(&bits,&f,4);
+    else memcpy(&bits,&i,4);
+    return bits;
+}
+
+void ir_builder::global_decl(decl &e,const vector<int> &dimens){
+    ir_global g;
+    g.name = symbols.name(e.name);
+    if(fn != nullptr){
+        //A const array inside a function: read-only data named after both.
+        g.name = fn->name + "." + g.name;
+        for(auto &other : mod.globals){
+            if(other.name == g.name){g.name += "." + to_string(mod.globals.size());break;}
+        }
+    }
+    g.elem = ir_type_of(e.type.typ);
+    g.size = 4;
+    for(int d : dimens) g.size *= d;
+    g.is_const = e.is_const;
+    if(e.init){
+        vector<expr*> elems = flatten_init(e.init,dimens);
+        size_t used = elems.size();
+        while(used > 0 && (elems[used - 1] == nullptr || literal_bits(elems[used - 1],g.elem) == 0)) used--;
+        for(size_t k = 0;k < used;++k) g.init.push_back(elems[k] ? literal_bits(elems[k],g.elem) : 0);
+    }
+    mod.globals.push_back(std::move(g));
+    declare(e.name,{variable::global,ir_type_of(e.type.typ),!dimens.empty(),(uint32_t)mod.globals.size() - 1});
+}
+
+void ir_builder::local_decl(decl &e,const vector<int> &dimens){
+    ir_type t = ir_type_of(e.type.typ);
+    if(dimens.empty()){
+        expr* init = e.init ? flatten_init(e.init,dimens)[0] : nullptr;
+        //Uninitialized locals start at 0, like globals.
+        uint32_t v = init ? convert(value(init),t) : (t == ir_type::f32 ? fconst(0) : iconst(0));
+        uint32_t var = new_var(t);
+        write_var(var,cur,v);
+        declare(e.name,{variable::ssa,t,false,var});
+        return;
+    }
+    uint32_t size = 4;
+    for(int d : dimens) size *= d;
+    ir_inst a{};
+    a.op = ir_op::alloca;
+    a.type = ir_type::ptr;
+    a.imm = size;
+    uint32_t p = fn->add(a);
+    fn->insts[p].block = 0;
+    auto &entry = fn->blocks[0].insts;
+    entry.insert(entry.begin() + nallocas++,p);
+    if(e.init){
+        vector<expr*> elems = flatten_init(e.init,dimens);
+        bool full = true;
+        for(auto x : elems) full = full && x != nullptr;
+        if(!full){
+            uint32_t z = emit(ir_op::memzero,ir_type::none,p);
+            fn->insts[z].imm = size;
+        }
+        for(size_t k = 0;k < elems.size();++k){
+            if(elems[k] == nullptr) continue;
+            uint32_t v = convert(value(elems[k]),t);
+            uint32_t at = emit(ir_op::ptradd,ir_type::ptr,p,iconst(4 * k));
+            emit(ir_op::store,ir_type::none,at,v);
+        }
+    }
+    declare(e.name,{variable::address,t,true,p});
+}
+
+void ir_builder::accept(decl& e){
+    vector<int> dimens = dimensions(e);
+    //Const scalars never reach here as variables: the checker replaced every use by a literal.
+    if(e.is_const && dimens.empty()) return;
+    if(fn == nullptr || e.is_const) global_decl(e,dimens);
+    else local_decl(e,dimens);
+}
+
+void ir_builder::accept(block_item& e){
+    if(e.declaration) e.declaration->accept(*this);
+    if(e.statement) e.statement->accept(*this);
+}
+void ir_builder::accept(expr_stmt& e){
+    value(e.e);
+}
+void ir_builder::accept(block_stmt& e){
+    enter_scope();
+    for(auto &item : e.block) item.accept(*this);
+    quit_scope();
+}
+void ir_builder::accept(if_stmt& e){
+    uint32_t then_block = new_block();
+    uint32_t else_block = e.else_branch ? new_block() : no_block;
+    uint32_t done = new_block();
+    cond(e.cond,then_block,e.else_branch ? else_block : done);
+    seal(then_block);
+    cur = then_block;
+    e.then_branch->accept(*this);
+    if(!terminated()) jump(done);
+    if(e.else_branch){
+        seal(else_block);
+        cur = else_block;
+        e.else_branch->accept(*this);
+        if(!terminated()) jump(done);
+    }
+    seal(done);
+    cur = done;
+}
+void ir_builder::accept(while_stmt& e){
+    uint32_t header = new_block(),body = new_block(),done = new_block();
+    jump(header);
+    cur = header;
+    cond(e.cond,body,done);
+    seal(body);
+    cur = body;
+    loops.push_back({header,done});
+    e.body->accept(*this);
+    loops.pop_back();
+    if(!terminated()) jump(header);
+    seal(header);
+    seal(done);
+    cur = done;
+}
+void ir_builder::accept(continue_stmt& e){
+    if(loops.empty()) throw string("continue outside of a loop.");
+    jump(loops.back().cont);
+    start_unreachable();
+}
+void ir_builder::accept(break_stmt& e){
+    if(loops.empty()) throw string("break outside of a loop.");
+    jump(loops.back().brk);
+    start_unreachable();
+}
+void ir_builder::accept(return_stmt& e){
+    uint32_t v = no_value;
+    if(e.return_value && fn->ret != ir_type::none) v = convert(value(e.return_value),fn->ret);
+    else if(e.return_value) value(e.return_value);
+    emit(ir_op::ret,ir_type::none,v);
+    start_unreachable();
+}
+
+ir_module build_ir(vector<CompUnit> &ast,const static_checker &checker){
+    ir_module m;
+    ir_builder builder(m,checker.funcs);
+    builder.build(ast);
+    verify(m);
+    return m;
+}
@@ -0,0 +1,94 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include "time_report.hpp"
+#include <iomanip>
+#include <ostream>
+#include <vector>
+using namespace std;
+
+void optimize(ir_module &m,unsigned level,vector<gvn_stats> *stats){
+    if(level == 0) return;
+    uint32_t before = m.inst_count();
+    uint64_t folded = 0,dead = 0,jumps = 0,hoisted = 0,numbered = 0,reduced = 0;
+    uint32_t tests = 0;
+    auto clean = [&](ir_function &fn){
+        folded += sccp(fn,m);
+        //Folded branches leave dead conditions, and removing those can
+        //empty more blocks.
+        for(bool changed = true;changed;){
+            uint32_t d = dead_code(fn),j = simplify_cfg(fn);
+            dead += d;
+            jumps += j;
+            changed = d + j > 0;
+        }
+    };
+    for(auto &fn : m.functions){
+        if(!fn.is_extern) clean(fn);
+    }
+    //On constant arguments sccp has found.
+    vector<char> changed(m.functions.size(),0);
+    uint32_t evaluated = fold_calls(m,changed);
+    //Before inlining, to which functions that no longer call themselves
+    //are no longer recursive.
+    uint32_t tails = 0;
+    for(uint32_t f = 0;f < m.functions.size();++f){
+        if(m.functions[f].is_extern) continue;
+        uint32_t t = tail_recursion(m.functions[f],f);
+        tails += t;
+        if(t > 0) changed[f] = 1;
+    }
+    //On cleaned up callees, so that their sizes are what inlining adds;
+    //constant arguments fold in the callers afterwards.
+    uint32_t inlined = inline_calls(m,level,changed);
+    for(uint32_t f = 0;f < m.functions.size();++f){
+        if(changed[f]) clean(m.functions[f]);
+    }
+    for(auto &fn : m.functions){
+        if(fn.is_extern) continue;
+        hoisted += licm(fn,m);
+        //Preheaders nothing was hoisted into go again.
+        jumps += simplify_cfg(fn);
+        //After LICM, so that copies hoisted into one preheader from
+        //different blocks meet.
+        gvn_stats g;
+        g.function = fn.name;
+        g.instructions = fn.inst_count();
+        g.eliminated = gvn(fn,g.loads);
+        numbered += g.eliminated;
+        if(stats) stats->push_back(g);
+        //The induction variables and multiplies the new pointers replace
+        //are left dead.
+        uint32_t r = reduce_strength(fn,tests);
+        reduced += r;
+        if(r > 0) dead += dead_code(fn);
+    }
+    verify(m);
+    compile_report.counters.push_back({"ir instructions built",(double)before});
+    compile_report.counters.push_back({"removed by sccp",(double)folded});
+    compile_report.counters.push_back({"removed by dce",(double)dead});
+    compile_report.counters.push_back({"removed by cfg cleanup",(double)jumps});
+    compile_report.counters.push_back({"calls evaluated",(double)evaluated});
+    compile_report.counters.push_back({"tail calls turned into loops",(double)tails});
+    compile_report.counters.push_back({"calls inlined",(double)inlined});
+    compile_report.counters.push_back({"hoisted by licm",(double)hoisted});
+    compile_report.counters.push_back({"removed by gvn",(double)numbered});
+    compile_report.counters.push_back({"addresses strength-reduced",(double)reduced});
+    compile_report.counters.push_back({"exit tests replaced",(double)tests});
+    compile_report.counters.push_back({"ir instructions optimized",(double)m.inst_count()});
+}
+
+void print_gvn_report(ostream &os,const vector<gvn_stats> &stats){
+    auto row = [&](const gvn_stats &s){
+        os << left << setw(24) << s.function << right << setw(14) << s.instructions << setw(12) << s.eliminated << setw(8) << s.loads << "\n";
+    };
+    os << left << setw(24) << "function" << right << setw(14) << "instructions" << setw(12) << "eliminated" << setw(8) << "loads" << "\n";
+    gvn_stats total;
+    total.function = "total";
+    for(auto &s : stats){
+        row(s);
+        total.instructions += s.instructions;
+        total.eliminated += s.eliminated;
+        total.loads += s.loads;
+    }
+    row(total);
+}
@@ -0,0 +1,48 @@
+#include "jit.hpp"
+#include "x86.hpp"
+#include "x86_encoder.hpp"
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+using namespace std;
+
+jit_program::~jit_program(){
+    if(code) munmap(code,mapped);
+}
+
+void compile_jit(const ir_module &m,jit_program &out,x86_regalloc alloc,vector<regalloc_stats> *stats){
+    x86_encoder enc;
+    for(auto &g : m.globals){
+        out.globals.emplace_back((g.size + 3) / 4,0);
+        copy(g.init.begin(),g.init.end(),out.globals.back().begin());
+        enc.globals.push_back((uint64_t)out.globals.back().data());
+    }
+    vector<x86_function> fns = compile_x86(m,alloc,stats);
+    out.entry.assign(m.functions.size(),0);
+    for(uint32_t f = 0;f < fns.size();++f){
+        if(!m.functions[f].is_extern) out.entry[f] = enc.encode(fns[f]);
+    }
+    for(auto &c : enc.calls){
+        int32_t rel = out.entry[c.func] - (c.pos + 4);
+        memcpy(&enc.code[c.pos],&rel,4);
+    }
+    out.main = m.find_function("main");
+    if(out.main < 0) throw string("No main function.");
+
+    //Written while writable, then flipped to executable: never both.
+    size_t page = sysconf(_SC_PAGESIZE);
+    out.code_size = enc.code.size();
+    out.mapped = (out.code_size + page - 1) / page * page;
+    void *p = mmap(nullptr,out.mapped,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if(p == MAP_FAILED) throw string("Can't map memory for the JIT.");
+    out.code = (uint8_t*)p;
+    memcpy(out.code,enc.code.data(),out.code_size);
+    if(mprotect(out.code,out.mapped,PROT_READ | PROT_EXEC) != 0) throw string("Can't make the JIT code executable.");
+}
+
+int jit_program::run(){
+    auto fn = (int(*)())(code + entry[main]);
+    return fn();
+}
@@ -1,4 +1,6 @@
+#include "keywords.hpp"
 #include "lexer.hpp"
+#include "symbol.hpp"
 #include "token.hpp"
 #include <cstdio>
 #include <cstring>
@@ -15,12 +17,27 @@ bool is_alpha(char c){
     return false;
 }
 
-Token lexer::make_token(TokenType type, void *literal = nullptr){
-    auto t =  Token(type,literal,this->line,this->beg_column);
+Token lexer::make_token(TokenType type){
+    auto t =  Token(type,src+cur_beg,cur-cur_beg,this->line,this->beg_column);
     cur_beg = cur;
     beg_column = column;
     return t;
 }
+Token lexer::make_int(int v){
+    Token t = make_token(IntLiteral);
+    t.int_value = v;
+    return t;
+}
+Token lexer::make_float(float v){
+    Token t = make_token(FloatLiteral);
+    t.float_value = v;
+    return t;
+}
+Token lexer::make_error(const char* msg){
+    Token t = make_token(LexError);
+    t.beg = msg;t.len = strlen(msg);
+    return t;
+}
 bool lexer::is_end(){
     return src[cur] == eof;
 }
@@ -77,11 +94,11 @@ Token lexer::next_token(){
     }
     case '&' : {
         if(match('&')) return make_token(And);
-        else return make_token(LexError,new std::string("Expect '&' after '&'."));
+        else return make_error("Expect '&' after '&'.");
     }
     case '|' : {
         if(match('|')) return make_token(Or);
-        else return make_token(LexError,new std::string("Expect '|' after '|'."));
+        else return make_error("Expect '|' after '|'.");
     }
     
     case '+' : return make_token(Plus);
@@ -91,12 +108,16 @@ Token lexer::next_token(){
     case '%' : return make_token(Mod);
     
     case '"' : {
-        std::string res;
-        while(peek(0) != '"'){
-            res.push_back(parse_char('"'));
+        while(peek(0) != '"' && !is_end()){
+            if(peek(0) == '\\') advance(); //keep the escaped char in the lexeme
+            advance();
         }
+        if(is_end()) return make_error("Unterminated string literal.");
+        Token t = make_token(StringLiteral);
+        t.beg++;t.len--; //lexeme without the quotes
         advance(); //eat '"'
-        return make_token(StringLiteral,new std::string(std::move(res)));
+        cur_beg = cur;beg_column = column;
+        return t;
     }
     case eof : return make_token(Eof);
     default:{
@@ -113,20 +134,15 @@ Token lexer::next_token(){
         }
     }
     }
-    return make_token(LexError,new std::string("Unknown char"));
+    return make_error("Unknown char");
 }
-char lexer::parse_char(char surround){
-    switch (peek(0)) {
-    case '\\' : {
-        advance(); //eat backslash
-        switch (advance()) {//todo!
-        case 'n' : return '\n';
-        case 't' : return '\t';
-        case '\"' : return '\"';
-        default: return '\\';
-        }
-    }
-    default: return advance();
+void lexer::skip(const scan_result &r){
+    cur += r.len;
+    if(r.newlines){
+        line += r.newlines;
+        column = r.len - r.last_newline;
+    }else{
+        column += r.len;
     }
 }
 void lexer::skip_white_comment(){
@@ -134,18 +150,25 @@ void lexer::skip_white_comment(){
         switch (peek(0)) {
         case '\n':
         case '\t':
-        case ' ':advance();continue;
+        case ' ':{
+            //Single separators are far more common than long runs.
+            char next = peek(1);
+            if(next != ' ' && next != '\t' && next != '\n') advance();
+            else skip(scan.blank(src + cur));
+        }continue;
 
         case '/' : {
             char next = peek(1);
             if(next == '/'){
                 advance();advance();
-                while(!is_end() && advance() != '\n') {}
+                skip({scan.line_comment(src + cur),0,0});
+                if(!is_end()) advance(); //eat '\n'
                 continue;
             }
             if(next == '*'){
                 advance();advance();
-                while(!is_end() && (peek(0) != '*' || peek(1) != '/')) advance();
+                skip(scan.block_comment(src + cur));
+                if(!is_end()){advance();advance();} //eat '*/'
                 continue;
             }
         }break;
@@ -157,8 +180,8 @@ void lexer::skip_white_comment(){
 
 Token lexer::parse_oct(){
     int value = 0;
-    for(;;){
-        char c = advance();
+    for(;;advance()){
+        char c = peek(0);
         if(c >= '0' && c <= '7'){
             value *= 8;
             value += (c-'0');
@@ -166,23 +189,23 @@ Token lexer::parse_oct(){
         }else if(c == '_'){
             continue;
         }else if(c == '8' || c == '9' || is_alpha(c)){
-            return make_token(LexError,new std::string("Unexpected char while scanning an octonary number."));
+            return make_error("Unexpected char while scanning an octonary number.");
         }
-        return make_token(IntLiteral,new int(value));
+        return make_int(value);
     }
 }
 Token lexer::parse_hex(){
     int value = 0;
-    for(;;){
-        char c = advance();
+    for(;;advance()){
+        char c = peek(0);
         if(is_digit(c)){value *= 16;value += c - '0';continue;}
         if(c >= 'a' && c <= 'f'){value *= 16;value += c-'a'+10;continue;}
         if(c >= 'A' && c <= 'F'){value *= 16;value += c-'A'+10;continue;}
         if(c == '_') continue;
-        if((c >= 'g' && c <= 'z') || (c >= 'G' && c <= 'Z')) return make_token(LexError,new std::string("Unpected char whiling scanning a hexadecimal number"));
+        if((c >= 'g' && c <= 'z') || (c >= 'G' && c <= 'Z')) return make_error("Unpected char whiling scanning a hexadecimal number");
         break;
     }
-    return make_token(IntLiteral,new int(value));
+    return make_int(value);
 }
 Token lexer::parse_dec(char head){
     int iv = head - '0';float fv = 0,base = 0.1;
@@ -201,44 +224,26 @@ Token lexer::parse_dec(char head){
             }
         }else if(c == '.'){
             advance();
-            if(is_float) return make_token(LexError,new std::string("Meet two '.' while scanning a floating number."));
+            if(is_float) return make_error("Meet two '.' while scanning a floating number.");
             is_float = true;
             fv = iv;
         }else{
             break;
         }
     }
-    if(is_float) return make_token(FloatLiteral,new float(fv));
-    else return make_token(IntLiteral,new int(iv));
+    if(is_float) return make_float(fv);
+    else return make_int(iv);
 }
 
-bool lexer::check_keyword(const char* keyword,int len){
-    const char* start = src.c_str() + cur_beg;
-    const char* end = src.c_str() + cur;
-    if(end - start == len && memcmp(start, keyword, len) == 0) return true;
-    else return false;
-}
-
-
 Token lexer::ident_or_keyword(){
-    char head = src[cur_beg];
-    while(is_alpha(peek(0)) || is_digit(peek(0))) advance();
-    switch (head) {
-    case 'b': if(check_keyword("break", 5)) return make_token(Break);break;
-    case 'c': {
-        if(check_keyword("continue", 8)) return make_token(Continue);
-        if(check_keyword("const", 5)) return make_token(Const);
-    }break;
-    case 'e': if(check_keyword("else", 4)) return make_token(Else);break;
-    case 'f': if(check_keyword("float", 5)) return make_token(Float);break;
-    case 'i':{
-        if(check_keyword("int", 3)) return make_token(Int);
-        if(check_keyword("if", 2)) return make_token(If);
-    }break;
-    case 'r':if(check_keyword("return", 6)) return make_token(Return);break;
-    case 'v':if(check_keyword("void", 4)) return make_token(Void);break;
-    case 'w':if(check_keyword("while", 5)) return make_token(While);break;
-    default: break;
-    }
-    return make_token(Ident,new std::string(src.c_str()+cur_beg,cur-cur_beg));
+    //Most identifiers are short: only hand long ones to the bulk scanner.
+    uint32_t n = 0;
+    while(n < 8 && (is_alpha(peek(n)) || is_digit(peek(n)))) n++;
+    if(n == 8) n += scan.ident(src + cur + n);
+    skip({n,0,0});
+    TokenType type = keyword_table.find(src + cur_beg, cur - cur_beg, Ident);
+    if(type != Ident) return make_token(type);
+    Token t = make_token(Ident);
+    t.sym = symbols.intern(t.text());
+    return t;
 }
\ No newline at end of file
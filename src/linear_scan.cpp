@@ -0,0 +1,657 @@
+#include "x86.hpp"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <queue>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Linear scan with interval splitting after Wimmer and Mössenböck,
+// "Optimized Interval Splitting in a Linear Scan Register Allocator".
+// Instruction k of the function (blocks in emission order) reads its
+// operands at position 2k and writes its results at 2k + 1, so a value
+// dying at an instruction and the one it defines may share a register.
+// Moves between the pieces of a split interval go in the gap before an
+// instruction; moves on control flow edges are added after allocation.
+
+static const uint32_t max_pos = ~0u;
+
+static bool allocatable(uint32_t r){return r != rsp && r != rbp;}
+
+vector<uint32_t> loop_depth(const x86_function &f){
+    uint32_t n = f.blocks.size();
+    vector<vector<uint32_t>> preds(n),latches(n);
+    for(uint32_t b = 0;b < n;++b){
+        uint32_t succ[2],ns = f.successors(b,succ);
+        for(uint32_t k = 0;k < ns;++k) preds[succ[k]].push_back(b);
+    }
+    //A depth-first walk finds the back edges; the loop of a header is every
+    //block that reaches one of them without passing through the header.
+    vector<uint8_t> state(n,0); //1: on the walk's stack, 2: finished
+    vector<pair<uint32_t,uint32_t>> stack;
+    if(n){
+        stack.push_back({0,0});
+        state[0] = 1;
+    }
+    while(!stack.empty()){
+        uint32_t b = stack.back().first,succ[2],ns = f.successors(b,succ);
+        if(stack.back().second == ns){
+            state[b] = 2;
+            stack.pop_back();
+            continue;
+        }
+        uint32_t s = succ[stack.back().second++];
+        if(state[s] == 1) latches[s].push_back(b);
+        else if(state[s] == 0){
+            state[s] = 1;
+            stack.push_back({s,0});
+        }
+    }
+    vector<uint32_t> depth(n,0),mark(n,no_reg);
+    for(uint32_t h = 0;h < n;++h){
+        if(latches[h].empty()) continue;
+        vector<uint32_t> work = latches[h];
+        mark[h] = h;
+        depth[h]++;
+        while(!work.empty()){
+            uint32_t b = work.back();
+            work.pop_back();
+            if(mark[b] == h) continue;
+            mark[b] = h;
+            depth[b]++;
+            for(uint32_t p : preds[b]) work.push_back(p);
+        }
+    }
+    return depth;
+}
+
+vector<uint64_t> vreg_live_in(const x86_function &f){
+    uint32_t n = f.blocks.size(),words = (f.vregs.size() + 63) / 64;
+    vector<uint64_t> gen((size_t)n * words),kill((size_t)n * words);
+    for(uint32_t b = 0;b < n;++b){
+        uint64_t *g = gen.data() + (size_t)b * words,*k = kill.data() + (size_t)b * words;
+        for(auto &i : f.blocks[b].insts){
+            uint32_t defs[32],ndefs = 0;
+            for_each_register(i,[&](uint32_t r){
+                if(r < first_vreg) return;
+                r -= first_vreg;
+                if(!(k[r / 64] >> r % 64 & 1)) g[r / 64] |= 1ull << r % 64;
+            },[&](uint32_t r){
+                if(r >= first_vreg) defs[ndefs++] = r - first_vreg;
+            });
+            for(uint32_t d = 0;d < ndefs;++d) k[defs[d] / 64] |= 1ull << defs[d] % 64;
+        }
+    }
+    vector<uint64_t> live_in((size_t)n * words,0);
+    for(bool changed = true;changed;){
+        changed = false;
+        for(uint32_t b = n;b-- > 0;){
+            uint32_t succ[2],ns = f.successors(b,succ);
+            uint64_t *in = live_in.data() + (size_t)b * words;
+            for(uint32_t w = 0;w < words;++w){
+                uint64_t out = 0;
+                for(uint32_t k = 0;k < ns;++k) out |= live_in[(size_t)succ[k] * words + w];
+                uint64_t x = gen[(size_t)b * words + w] | (out & ~kill[(size_t)b * words + w]);
+                if(x != in[w]){
+                    in[w] = x;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return live_in;
+}
+
+struct live_range {
+    uint32_t from,to; //[from,to)
+};
+
+// Where one register is live: a virtual register, a piece of one after
+// splitting, or the fixed uses of a physical register.
+struct live_interval {
+    uint32_t vreg;
+    vector<live_range> ranges; //sorted and disjoint
+    vector<uint32_t> uses;     //positions that need the value in a register
+    uint32_t reg = no_reg;     //no_reg: in the virtual register's stack slot
+    uint32_t next = no_reg;    //the next piece of the same virtual register
+
+    uint32_t start() const {return ranges.front().from;}
+    uint32_t end() const {return ranges.back().to;}
+    //Index of the first range ending after pos.
+    size_t range_after(uint32_t pos) const {
+        return lower_bound(ranges.begin(),ranges.end(),pos + 1,[](const live_range &r,uint32_t p){return r.to < p;}) - ranges.begin();
+    }
+    bool covers(uint32_t pos) const {
+        size_t k = range_after(pos);
+        return k < ranges.size() && ranges[k].from <= pos;
+    }
+    uint32_t next_use(uint32_t pos) const {
+        auto u = lower_bound(uses.begin(),uses.end(),pos);
+        return u == uses.end() ? max_pos : *u;
+    }
+    //The first position from pos on that both intervals cover.
+    uint32_t intersect(const live_interval &o,uint32_t pos) const {
+        size_t i = range_after(pos),j = o.range_after(pos);
+        while(i < ranges.size() && j < o.ranges.size()){
+            uint32_t from = max({ranges[i].from,o.ranges[j].from,pos}),to = min(ranges[i].to,o.ranges[j].to);
+            if(from < to) return from;
+            if(ranges[i].to < o.ranges[j].to) ++i;
+            else ++j;
+        }
+        return max_pos;
+    }
+};
+
+struct linear_scan_allocator {
+    //A location is a physical register, or first_vreg + a frame slot.
+    struct move {
+        uint32_t dst,src,vreg;
+    };
+
+    x86_function &f;
+    uint32_t nvregs;
+    vector<uint32_t> block_start; //position of each block's first instruction, then the end
+    vector<uint32_t> depth;
+    uint32_t words;                     //of a set of virtual registers
+    vector<uint64_t> live_in;           //words per block
+    vector<live_interval> iv;           //physical registers, virtual registers, then split pieces
+    vector<pair<uint32_t,uint32_t>> hints; //(virtual register,register it is copied to or from)
+    vector<uint32_t> slot_of;
+    vector<uint32_t> def_pos;           //virtual register -> its only write, or no_reg
+    vector<uint32_t> active,inactive;
+    priority_queue<pair<uint32_t,uint32_t>,vector<pair<uint32_t,uint32_t>>,greater<pair<uint32_t,uint32_t>>> unhandled;
+    regalloc_stats stats;
+
+    explicit linear_scan_allocator(x86_function &f) : f(f),nvregs(f.vregs.size()),words((nvregs + 63) / 64){}
+
+    const uint64_t* live(uint32_t b) const {return live_in.data() + (size_t)b * words;}
+
+    uint32_t block_of(uint32_t pos) const {
+        return upper_bound(block_start.begin(),block_start.end(),pos) - block_start.begin() - 1;
+    }
+    bool at_block_start(uint32_t pos) const {
+        return binary_search(block_start.begin(),block_start.end(),pos);
+    }
+    double weight(uint32_t pos) const {
+        double w = 1;
+        for(uint32_t d = depth[block_of(pos)];d;--d) w *= 10;
+        return w;
+    }
+    uint32_t slot(uint32_t vreg){
+        uint32_t &s = slot_of[vreg - first_vreg];
+        if(s == no_reg){
+            s = f.new_slot(8);
+            stats.spilled++;
+        }
+        return s;
+    }
+    bool wanted(uint32_t r,bool xmm) const {return r >= first_vreg ? f.is_float(r) == xmm : is_xmm(r) == xmm;}
+    void enqueue(uint32_t i){unhandled.push({iv[i].start(),i});}
+
+    void build();
+    uint32_t split(uint32_t i,uint32_t pos);
+    void spill(uint32_t i,uint32_t pos);
+    bool try_free(uint32_t cur,uint32_t pos);
+    void allocate_blocked(uint32_t cur,uint32_t pos);
+    void allocate(bool xmm);
+    uint32_t piece_at(uint32_t vreg,uint32_t pos) const;
+    uint32_t location(uint32_t vreg,uint32_t pos);
+    void resolve();
+    void emit_moves(vector<move> moves,uint32_t block,vector<x86_inst> &out);
+    void rewrite();
+    regalloc_stats run();
+};
+
+//Builds the intervals walking the blocks and instructions backwards, so
+//ranges are collected in reverse and flipped at the end.
+void linear_scan_allocator::build(){
+    uint32_t n = f.blocks.size();
+    block_start.assign(n + 1,0);
+    for(uint32_t b = 0;b < n;++b) block_start[b + 1] = block_start[b] + 2 * f.blocks[b].insts.size();
+    iv.resize(first_vreg + nvregs);
+    for(uint32_t r = 0;r < iv.size();++r) iv[r].vreg = r;
+    slot_of.assign(nvregs,no_reg);
+    def_pos.assign(nvregs,max_pos);
+    auto add_range = [&](uint32_t r,uint32_t from,uint32_t to){
+        auto &ranges = iv[r].ranges;
+        if(from >= to) return;
+        if(!ranges.empty() && to >= ranges.back().from){
+            ranges.back().from = min(ranges.back().from,from);
+            ranges.back().to = max(ranges.back().to,to);
+        }else ranges.push_back({from,to});
+    };
+    for(uint32_t b = n;b-- > 0;){
+        uint32_t from = block_start[b],to = block_start[b + 1];
+        uint32_t succ[2],ns = f.successors(b,succ);
+        for(uint32_t w = 0;w < words;++w){
+            uint64_t out = 0;
+            for(uint32_t k = 0;k < ns;++k) out |= live(succ[k])[w];
+            for(;out;out &= out - 1) add_range(first_vreg + 64 * w + __builtin_ctzll(out),from,to);
+        }
+        auto &insts = f.blocks[b].insts;
+        for(uint32_t k = insts.size();k-- > 0;){
+            uint32_t pos = from + 2 * k;
+            uint32_t defs[32],ndefs = 0,uses[32],nuses = 0;
+            for_each_register(insts[k],[&](uint32_t r){if(allocatable(r)) uses[nuses++] = r;},[&](uint32_t r){if(allocatable(r)) defs[ndefs++] = r;});
+            for(uint32_t d = 0;d < ndefs;++d){
+                auto &ranges = iv[defs[d]].ranges;
+                if(!ranges.empty() && ranges.back().from <= pos + 1 && pos + 1 < ranges.back().to) ranges.back().from = pos + 1;
+                else add_range(defs[d],pos + 1,pos + 2);
+                iv[defs[d]].uses.push_back(pos + 1);
+                if(defs[d] >= first_vreg){
+                    uint32_t &p = def_pos[defs[d] - first_vreg];
+                    p = p == max_pos ? pos + 1 : no_reg;
+                }
+            }
+            for(uint32_t u = 0;u < nuses;++u){
+                add_range(uses[u],from,pos + 1);
+                iv[uses[u]].uses.push_back(pos);
+            }
+            const x86_inst &i = insts[k];
+            if(is_copy(i)){
+                if(i.ops[0].reg >= first_vreg) hints.push_back({i.ops[0].reg,i.ops[1].reg});
+                if(i.ops[1].reg >= first_vreg) hints.push_back({i.ops[1].reg,i.ops[0].reg});
+            }
+        }
+    }
+    for(auto &it : iv){
+        reverse(it.ranges.begin(),it.ranges.end());
+        reverse(it.uses.begin(),it.uses.end());
+    }
+    reverse(hints.begin(),hints.end());
+    stable_sort(hints.begin(),hints.end(),[](const pair<uint32_t,uint32_t> &a,const pair<uint32_t,uint32_t> &b){return a.first < b.first;});
+}
+
+//Cuts interval i at pos and returns the piece from pos on.
+uint32_t linear_scan_allocator::split(uint32_t i,uint32_t pos){
+    if(pos <= iv[i].start() || pos >= iv[i].end()) throw string("linear scan: bad split of ") + f.name + ".";
+    live_interval child;
+    child.vreg = iv[i].vreg;
+    auto &ranges = iv[i].ranges;
+    size_t k = iv[i].range_after(pos);
+    if(ranges[k].from < pos){
+        child.ranges.push_back({pos,ranges[k].to});
+        ranges[k].to = pos;
+        ++k;
+    }
+    child.ranges.insert(child.ranges.end(),ranges.begin() + k,ranges.end());
+    ranges.erase(ranges.begin() + k,ranges.end());
+    auto &uses = iv[i].uses;
+    auto u = lower_bound(uses.begin(),uses.end(),pos);
+    child.uses.assign(u,uses.end());
+    uses.erase(u,uses.end());
+    child.next = iv[i].next;
+    iv[i].next = iv.size();
+    iv.push_back(std::move(child));
+    stats.intervals++;
+    return iv.size() - 1;
+}
+
+//Takes the register of interval i away from pos on. The value is stored
+//at the shallowest block boundary after its last use before pos, so a
+//value not used in a loop is not stored inside it, and reloaded just
+//before its next use.
+void linear_scan_allocator::spill(uint32_t i,uint32_t pos){
+    uint32_t at = pos,child = i;
+    if(iv[i].covers(pos)){
+        auto u = lower_bound(iv[i].uses.begin(),iv[i].uses.end(),pos);
+        uint32_t last = u == iv[i].uses.begin() ? iv[i].start() : *(u - 1);
+        uint32_t best = depth[block_of(pos)];
+        for(uint32_t b = block_of(pos);b > 0 && block_start[b] > last;--b){
+            if(depth[b] < best && block_start[b] > iv[i].start()){
+                best = depth[b];
+                at = block_start[b];
+            }
+        }
+    }
+    if(at > iv[i].start()) child = split(i,at);
+    iv[child].reg = no_reg;
+    uint32_t next = iv[child].next_use(iv[child].start());
+    if(next == max_pos) return;
+    if((next & ~1u) > iv[child].start()) enqueue(split(child,next & ~1u));
+    else enqueue(child);
+}
+
+bool linear_scan_allocator::try_free(uint32_t cur,uint32_t pos){
+    bool xmm = f.is_float(iv[cur].vreg);
+    const uint32_t *order = xmm ? xmm_alloc_order : gpr_alloc_order;
+    uint32_t count = xmm ? size(xmm_alloc_order) : size(gpr_alloc_order);
+    uint32_t free_until[first_vreg] = {};
+    for(uint32_t k = 0;k < count;++k){
+        uint32_t r = order[k];
+        free_until[r] = iv[r].ranges.empty() ? max_pos : iv[r].intersect(iv[cur],pos);
+    }
+    for(uint32_t a : active) free_until[iv[a].reg] = 0;
+    for(uint32_t a : inactive) free_until[iv[a].reg] = min(free_until[iv[a].reg],iv[a].intersect(iv[cur],pos));
+    uint32_t end = iv[cur].end(),reg = no_reg;
+    auto partners = equal_range(hints.begin(),hints.end(),make_pair(iv[cur].vreg,0u),[](const pair<uint32_t,uint32_t> &a,const pair<uint32_t,uint32_t> &b){return a.first < b.first;});
+    for(auto it = partners.first;it != partners.second;++it){
+        uint32_t h = it->second;
+        if(h >= first_vreg){
+            //The register of the partner's piece next to this interval.
+            uint32_t p = piece_at(h,iv[cur].start() - 1);
+            if(p == no_reg || iv[p].reg == no_reg) p = piece_at(h,end);
+            if(p == no_reg) continue;
+            h = iv[p].reg;
+        }
+        if(h != no_reg && free_until[h] >= end){
+            reg = h;
+            break;
+        }
+    }
+    for(uint32_t k = 0;k < count && reg == no_reg;++k){
+        if(free_until[order[k]] >= end) reg = order[k];
+    }
+    if(reg == no_reg){
+        for(uint32_t k = 0;k < count;++k){
+            if(reg == no_reg || free_until[order[k]] > free_until[reg]) reg = order[k];
+        }
+        //A move into the interval's next piece goes before an instruction.
+        if((free_until[reg] & ~1u) <= pos) return false;
+    }
+    iv[cur].reg = reg;
+    if(free_until[reg] < end){
+        enqueue(split(cur,free_until[reg] & ~1u));
+    }
+    return true;
+}
+
+//Every register is taken at pos: either cur waits on the stack until its
+//next use, or it takes the register whose holders are cheapest to reload,
+//counting each reload by the loop depth it happens at.
+void linear_scan_allocator::allocate_blocked(uint32_t cur,uint32_t pos){
+    bool xmm = f.is_float(iv[cur].vreg);
+    uint32_t first = iv[cur].next_use(pos);
+    if(first == max_pos){
+        iv[cur].reg = no_reg;
+        return;
+    }
+    uint32_t use_pos[first_vreg],block_pos[first_vreg];
+    double cost[first_vreg];
+    for(uint32_t r = 0;r < first_vreg;++r){
+        use_pos[r] = block_pos[r] = max_pos;
+        cost[r] = 0;
+        if(wanted(r,xmm) && allocatable(r) && !iv[r].ranges.empty()){
+            uint32_t x = iv[r].intersect(iv[cur],pos);
+            use_pos[r] = block_pos[r] = x;
+        }
+    }
+    auto holder = [&](uint32_t a){
+        uint32_t r = iv[a].reg,next = iv[a].next_use(pos);
+        use_pos[r] = min(use_pos[r],next);
+        cost[r] += weight(next == max_pos ? pos : next);
+    };
+    for(uint32_t a : active) holder(a);
+    for(uint32_t a : inactive) if(iv[a].intersect(iv[cur],pos) != max_pos) holder(a);
+    const uint32_t *order = xmm ? xmm_alloc_order : gpr_alloc_order;
+    uint32_t count = xmm ? size(xmm_alloc_order) : size(gpr_alloc_order),reg = no_reg;
+    for(uint32_t k = 0;k < count;++k){
+        uint32_t r = order[k];
+        if(use_pos[r] <= pos + 1 || (block_pos[r] & ~1u) <= pos) continue;
+        if(reg == no_reg || cost[r] < cost[reg] || (cost[r] == cost[reg] && use_pos[r] > use_pos[reg])) reg = r;
+    }
+    bool can_wait = (first & ~1u) > pos;
+    if(can_wait && (reg == no_reg || weight(first) < cost[reg] || (weight(first) == cost[reg] && first > use_pos[reg]))){
+        iv[cur].reg = no_reg;
+        enqueue(split(cur,first & ~1u));
+        return;
+    }
+    if(reg == no_reg) throw string("linear scan: out of registers in ") + f.name + ".";
+    iv[cur].reg = reg;
+    if(block_pos[reg] < iv[cur].end()){
+        enqueue(split(cur,block_pos[reg] & ~1u));
+    }
+    for(size_t k = 0;k < active.size();){
+        if(iv[active[k]].reg != reg){
+            ++k;
+            continue;
+        }
+        spill(active[k],pos);
+        active.erase(active.begin() + k);
+    }
+    for(size_t k = 0;k < inactive.size();){
+        if(iv[inactive[k]].reg != reg || iv[inactive[k]].intersect(iv[cur],pos) == max_pos){
+            ++k;
+            continue;
+        }
+        spill(inactive[k],pos);
+        inactive.erase(inactive.begin() + k);
+    }
+}
+
+void linear_scan_allocator::allocate(bool xmm){
+    for(uint32_t v = 0;v < nvregs;++v){
+        if(f.is_float(first_vreg + v) == xmm && !iv[first_vreg + v].ranges.empty()) enqueue(first_vreg + v);
+    }
+    active.clear();
+    inactive.clear();
+    while(!unhandled.empty()){
+        uint32_t pos = unhandled.top().first,cur = unhandled.top().second;
+        unhandled.pop();
+        for(size_t k = 0;k < active.size();){
+            live_interval &a = iv[active[k]];
+            if(a.end() <= pos || !a.covers(pos)){
+                if(a.end() > pos) inactive.push_back(active[k]);
+                active.erase(active.begin() + k);
+            }else ++k;
+        }
+        for(size_t k = 0;k < inactive.size();){
+            live_interval &a = iv[inactive[k]];
+            if(a.end() <= pos || a.covers(pos)){
+                if(a.end() > pos) active.push_back(inactive[k]);
+                inactive.erase(inactive.begin() + k);
+            }else ++k;
+        }
+        if(!try_free(cur,pos)) allocate_blocked(cur,pos);
+        if(iv[cur].reg != no_reg) active.push_back(cur);
+    }
+}
+
+uint32_t linear_scan_allocator::piece_at(uint32_t vreg,uint32_t pos) const {
+    if(iv[vreg].ranges.empty()) return no_reg;
+    for(uint32_t p = vreg;p != no_reg && iv[p].start() <= pos;p = iv[p].next){
+        if(iv[p].covers(pos)) return p;
+    }
+    return no_reg;
+}
+
+//Where vreg is at pos: a register, first_vreg + its slot, or no_reg when
+//it is not live there.
+uint32_t linear_scan_allocator::location(uint32_t vreg,uint32_t pos){
+    uint32_t p = piece_at(vreg,pos);
+    if(p == no_reg) return no_reg;
+    return iv[p].reg != no_reg ? iv[p].reg : first_vreg + slot(vreg);
+}
+
+//Parallel moves: each goes once nothing else still reads its destination;
+//a cycle of registers is broken through the stack slot of one of them.
+void linear_scan_allocator::emit_moves(vector<move> moves,uint32_t block,vector<x86_inst> &out){
+    double w = 1;
+    for(uint32_t d = depth[block];d;--d) w *= 10;
+    auto emit = [&](uint32_t dst,uint32_t src,uint32_t vreg){
+        x86_inst i{};
+        i.op = f.is_float(vreg) ? x86_op::movss : x86_op::mov64;
+        i.ops[0] = dst < first_vreg ? x86_operand::r(dst) : x86_operand::frame(dst - first_vreg);
+        i.ops[1] = src < first_vreg ? x86_operand::r(src) : x86_operand::frame(src - first_vreg);
+        out.push_back(i);
+        if(dst >= first_vreg) stats.stores++,stats.cost += w;
+        else if(src >= first_vreg) stats.loads++,stats.cost += w;
+    };
+    while(!moves.empty()){
+        bool progress = false;
+        for(size_t m = 0;m < moves.size();++m){
+            bool read = false;
+            for(auto &o : moves) read |= o.src == moves[m].dst;
+            if(read) continue;
+            emit(moves[m].dst,moves[m].src,moves[m].vreg);
+            moves.erase(moves.begin() + m);
+            progress = true;
+            break;
+        }
+        if(progress) continue;
+        uint32_t d = moves[0].dst;
+        for(auto &o : moves){
+            if(o.src != d) continue;
+            uint32_t s = first_vreg + slot(o.vreg);
+            emit(s,d,o.vreg);
+            o.src = s;
+            break;
+        }
+    }
+}
+
+void linear_scan_allocator::resolve(){
+    uint32_t n = f.blocks.size();
+    //(block,instruction,order) -> moves made together before the instruction;
+    //order puts edge moves into a block and stores after a write first, then
+    //the in-block ones, then the edge moves out of it.
+    map<tuple<uint32_t,uint32_t,uint32_t>,vector<move>> groups;
+    //A value written once is stored right after the write when any piece of
+    //it lives on the stack; the write dominates every piece, so no other
+    //store is needed.
+    vector<char> stored(nvregs,0);
+    for(uint32_t v = 0;v < nvregs;++v){
+        if(def_pos[v] == no_reg || def_pos[v] == max_pos) continue;
+        bool on_stack = false;
+        for(uint32_t p = first_vreg + v;p != no_reg;p = iv[p].next) on_stack |= iv[p].reg == no_reg;
+        if(!on_stack) continue;
+        stored[v] = 1;
+        uint32_t b = block_of(def_pos[v]);
+        groups[{b,(def_pos[v] - block_start[b]) / 2 + 1,0}].push_back({first_vreg + slot(first_vreg + v),location(first_vreg + v,def_pos[v]),first_vreg + v});
+    }
+    //Inside blocks, between consecutive pieces of a split interval. A piece
+    //can start at a write (2k + 1) only by going to the stack; that store
+    //follows the moves for position 2k in the same gap, and is dropped when
+    //the register was just loaded from the slot for a read at 2k.
+    for(uint32_t v = 0;v < nvregs;++v){
+        if(iv[first_vreg + v].ranges.empty()) continue;
+        for(uint32_t before = no_reg,p = first_vreg + v;iv[p].next != no_reg;before = p,p = iv[p].next){
+            const live_interval &a = iv[p],&c = iv[a.next];
+            if(a.end() != c.start() || at_block_start(c.start())) continue;
+            if(before != no_reg && c.reg == no_reg && c.start() % 2 && iv[before].reg == no_reg && iv[before].end() == a.start() && a.end() == a.start() + 1) continue;
+            uint32_t src = a.reg != no_reg ? a.reg : first_vreg + slot(first_vreg + v);
+            uint32_t dst = c.reg != no_reg ? c.reg : first_vreg + slot(first_vreg + v);
+            if(src == dst || (stored[v] && dst >= first_vreg)) continue;
+            uint32_t b = block_of(c.start());
+            groups[{b,(c.start() - block_start[b]) / 2,1 + c.start() % 2}].push_back({dst,src,first_vreg + v});
+        }
+    }
+    //On edges: at the end of a block with one successor, at the start of a
+    //block with one predecessor, or in a new block on a critical edge.
+    vector<uint32_t> npreds(n);
+    for(uint32_t b = 0;b < n;++b){
+        uint32_t succ[2],ns = f.successors(b,succ);
+        for(uint32_t k = 0;k < ns;++k) npreds[succ[k]]++;
+    }
+    vector<pair<pair<uint32_t,uint32_t>,vector<move>>> critical;
+    for(uint32_t b = 0;b < n;++b){
+        uint32_t succ[2],ns = f.successors(b,succ);
+        for(uint32_t k = 0;k < ns;++k){
+            uint32_t s = succ[k];
+            vector<move> moves;
+            for(uint32_t w = 0;w < words;++w){
+                for(uint64_t bits = live(s)[w];bits;bits &= bits - 1){
+                    uint32_t v = first_vreg + 64 * w + __builtin_ctzll(bits);
+                    uint32_t src = location(v,block_start[b + 1] - 1),dst = location(v,block_start[s]);
+                    if(src == dst || src == no_reg || dst == no_reg || (stored[v - first_vreg] && dst >= first_vreg)) continue;
+                    moves.push_back({dst,src,v});
+                }
+            }
+            if(moves.empty()) continue;
+            if(ns == 1){
+                auto &insts = f.blocks[b].insts;
+                uint32_t index = insts.size();
+                while(index > 0 && (insts[index - 1].op == x86_op::jmp || insts[index - 1].op == x86_op::jcc)) --index;
+                auto &g = groups[{b,index,3}];
+                g.insert(g.end(),moves.begin(),moves.end());
+            }else if(npreds[s] == 1 && s != 0){
+                auto &g = groups[{s,0,0}];
+                g.insert(g.end(),moves.begin(),moves.end());
+            }else critical.push_back({{b,s},std::move(moves)});
+        }
+    }
+    rewrite();
+    //Splice the moves in, walking each block's groups in order.
+    for(auto g = groups.begin();g != groups.end();){
+        uint32_t b = get<0>(g->first);
+        auto &insts = f.blocks[b].insts;
+        vector<x86_inst> out;
+        out.reserve(insts.size() + 8);
+        for(uint32_t k = 0;k <= insts.size();++k){
+            for(;g != groups.end() && get<0>(g->first) == b && get<1>(g->first) == k;++g) emit_moves(g->second,b,out);
+            if(k < insts.size()) out.push_back(insts[k]);
+        }
+        insts = std::move(out);
+    }
+    for(auto &c : critical){
+        uint32_t b = c.first.first,s = c.first.second,nb = f.blocks.size();
+        f.blocks.emplace_back();
+        depth.push_back(min(depth[b],depth[s]));
+        vector<x86_inst> out;
+        emit_moves(c.second,nb,out);
+        x86_inst j{};
+        j.op = x86_op::jmp;
+        j.ops[0] = x86_operand::ref(x86_kind::block,s);
+        out.push_back(j);
+        f.blocks[nb].insts = std::move(out);
+        for(auto &i : f.blocks[b].insts){
+            if((i.op == x86_op::jmp || i.op == x86_op::jcc) && i.ops[0].index == s) i.ops[0].index = nb;
+        }
+    }
+}
+
+//Replaces every virtual register by the register of its piece at the
+//instruction.
+void linear_scan_allocator::rewrite(){
+    uint32_t pos = 0;
+    auto reg_at = [&](uint32_t v,uint32_t at){
+        uint32_t r = location(v,at);
+        if(r >= first_vreg) throw string("linear scan: no register for a use in ") + f.name + ".";
+        return r;
+    };
+    for(auto &b : f.blocks){
+        for(auto &i : b.insts){
+            for(uint32_t k = 0;k < operand_count(i.op);++k){
+                x86_operand &o = i.ops[k];
+                if(o.is(x86_kind::mem)){
+                    if(o.reg != no_reg && o.reg >= first_vreg) o.reg = reg_at(o.reg,pos);
+                    if(o.index != no_reg && o.index >= first_vreg) o.index = reg_at(o.index,pos);
+                }else if(o.is(x86_kind::reg) && o.reg >= first_vreg){
+                    o.reg = reg_at(o.reg,operand_access(i,k) & access_use ? pos : pos + 1);
+                }
+            }
+            pos += 2;
+        }
+    }
+}
+
+regalloc_stats linear_scan_allocator::run(){
+    stats.function = f.name;
+    stats.vregs = nvregs;
+    depth = loop_depth(f);
+    live_in = vreg_live_in(f);
+    build();
+    for(uint32_t v = 0;v < nvregs;++v) stats.intervals += !iv[first_vreg + v].ranges.empty();
+    allocate(false);
+    allocate(true);
+    resolve();
+    //Copies that ended up between one register and itself.
+    for(auto &b : f.blocks){
+        auto &insts = b.insts;
+        insts.erase(remove_if(insts.begin(),insts.end(),[](const x86_inst &i){return is_copy(i) && i.ops[0].reg == i.ops[1].reg;}),insts.end());
+        for(auto &i : insts) stats.moves += is_copy(i);
+    }
+    vector<char> used(first_vreg,0);
+    for(uint32_t k = first_vreg;k < iv.size();++k) if(iv[k].reg != no_reg) used[iv[k].reg] = 1;
+    f.saved.clear();
+    for(uint32_t r = 0;r < first_vreg;++r) if(used[r] && is_callee_saved(r)) f.saved.push_back(r);
+    f.vregs.clear();
+    return stats;
+}
+
+regalloc_stats linear_scan(x86_function &f){
+    return linear_scan_allocator(f).run();
+}
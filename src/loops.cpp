@@ -0,0 +1,268 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include <algorithm>
+#include <utility>
+#include <vector>
+using namespace std;
+
+dominator_tree::dominator_tree(const ir_function &fn){
+    uint32_t n = fn.blocks.size();
+    idom.assign(n,no_block);
+    order.assign(n,no_block);
+    children.assign(n,{});
+    enter.assign(n,0);
+    leave.assign(n,0);
+    if(n == 0) return;
+
+    vector<char> seen(n,0);
+    vector<pair<uint32_t,uint32_t>> stack = {{0,0}};
+    seen[0] = 1;
+    while(!stack.empty()){
+        uint32_t b = stack.back().first,succ[2],ns = fn.successors(b,succ);
+        if(stack.back().second == ns){
+            rpo.push_back(b);
+            stack.pop_back();
+            continue;
+        }
+        uint32_t s = succ[stack.back().second++];
+        if(!seen[s]){
+            seen[s] = 1;
+            stack.push_back({s,0});
+        }
+    }
+    reverse(rpo.begin(),rpo.end());
+    for(uint32_t k = 0;k < rpo.size();++k) order[rpo[k]] = k;
+
+    auto intersect = [&](uint32_t a,uint32_t b){
+        while(a != b){
+            while(order[a] > order[b]) a = idom[a];
+            while(order[b] > order[a]) b = idom[b];
+        }
+        return a;
+    };
+    idom[0] = 0;
+    for(bool changed = true;changed;){
+        changed = false;
+        for(uint32_t k = 1;k < rpo.size();++k){
+            uint32_t b = rpo[k],d = no_block;
+            for(uint32_t p : fn.blocks[b].preds){
+                if(idom[p] == no_block) continue;
+                d = d == no_block ? p : intersect(p,d);
+            }
+            if(d != idom[b]){
+                idom[b] = d;
+                changed = true;
+            }
+        }
+    }
+    idom[0] = no_block;
+    for(uint32_t b : rpo){
+        if(idom[b] != no_block) children[idom[b]].push_back(b);
+    }
+
+    uint32_t clock = 0;
+    stack = {{0,0}};
+    enter[0] = clock++;
+    while(!stack.empty()){
+        auto &[b,k] = stack.back();
+        if(k == children[b].size()){
+            leave[b] = clock++;
+            stack.pop_back();
+            continue;
+        }
+        uint32_t c = children[b][k++];
+        enter[c] = clock++;
+        stack.push_back({c,0});
+    }
+}
+
+loop_forest::loop_forest(const ir_function &fn,const dominator_tree &dom){
+    innermost.assign(fn.blocks.size(),no_loop);
+    vector<uint32_t> mark(fn.blocks.size(),no_loop);
+    for(uint32_t h : dom.rpo){
+        ir_loop l;
+        l.header = h;
+        for(uint32_t p : fn.blocks[h].preds){
+            if(dom.order[p] != no_block && dom.dominates(h,p) && find(l.latches.begin(),l.latches.end(),p) == l.latches.end()){
+                l.latches.push_back(p);
+            }
+        }
+        if(l.latches.empty()) continue;
+        uint32_t id = loops.size();
+        l.parent = innermost[h];
+        l.depth = l.parent == no_loop ? 1 : loops[l.parent].depth + 1;
+        mark[h] = id;
+        vector<uint32_t> work = l.latches;
+        while(!work.empty()){
+            uint32_t b = work.back();
+            work.pop_back();
+            if(mark[b] == id) continue;
+            mark[b] = id;
+            l.blocks.push_back(b);
+            for(uint32_t p : fn.blocks[b].preds){
+                if(dom.order[p] != no_block && mark[p] != id) work.push_back(p);
+            }
+        }
+        sort(l.blocks.begin(),l.blocks.end(),[&](uint32_t a,uint32_t b){return dom.order[a] < dom.order[b];});
+        l.blocks.insert(l.blocks.begin(),h);
+        for(uint32_t b : l.blocks) innermost[b] = id;
+        loops.push_back(std::move(l));
+    }
+}
+
+//The block that jumps to the header of l from outside, if it is the only
+//way in and jumps nowhere else.
+static uint32_t preheader(const ir_function &fn,const loop_forest &lf,uint32_t l){
+    uint32_t h = lf.loops[l].header,found = no_block;
+    for(uint32_t p : fn.blocks[h].preds){
+        if(lf.contains(l,p)) continue;
+        if(found != no_block) return no_block;
+        found = p;
+    }
+    if(found == no_block || fn.terminator(found)->op != ir_op::br) return no_block;
+    return found;
+}
+
+//Routes the edges entering l from outside through a new block; the header's
+//phis take what came in along them from a phi there.
+static void make_preheader(ir_function &fn,const loop_forest &lf,uint32_t l){
+    uint32_t h = lf.loops[l].header;
+    uint32_t pre = fn.new_block();
+    auto &preds = fn.blocks[h].preds;
+    vector<uint32_t> outside,inside;
+    for(uint32_t k = 0;k < preds.size();++k){
+        if(lf.contains(l,preds[k])) inside.push_back(k);
+        else outside.push_back(k);
+    }
+    for(uint32_t k : outside) fn.blocks[pre].preds.push_back(preds[k]);
+    vector<uint32_t> phis;
+    for(uint32_t v : fn.blocks[h].insts){
+        if(fn.insts[v].op != ir_op::phi) break;
+        phis.push_back(v);
+    }
+    for(uint32_t v : phis){
+        vector<uint32_t> in,values;
+        for(uint32_t k : outside) in.push_back(fn.list(fn.insts[v])[k]);
+        uint32_t merged = in[0];
+        if(any_of(in.begin(),in.end(),[&](uint32_t x){return x != in[0];})){
+            ir_inst phi{};
+            phi.op = ir_op::phi;
+            phi.type = fn.insts[v].type;
+            phi.ops[0] = phi.ops[1] = phi.ops[2] = no_value;
+            merged = fn.append(pre,phi);
+            fn.set_list(merged,in);
+        }
+        values.push_back(merged);
+        for(uint32_t k : inside) values.push_back(fn.list(fn.insts[v])[k]);
+        fn.set_list(v,values);
+    }
+    for(uint32_t p : fn.blocks[pre].preds){
+        ir_inst &t = fn.insts[fn.blocks[p].insts.back()];
+        if(t.op == ir_op::br && t.ops[0] == h) t.ops[0] = pre;
+        if(t.op == ir_op::condbr){
+            if(t.ops[1] == h) t.ops[1] = pre;
+            if(t.ops[2] == h) t.ops[2] = pre;
+        }
+    }
+    vector<uint32_t> new_preds = {pre};
+    for(uint32_t k : inside) new_preds.push_back(preds[k]);
+    preds = std::move(new_preds);
+    ir_inst br{};
+    br.op = ir_op::br;
+    br.ops[0] = h;
+    br.ops[1] = br.ops[2] = no_value;
+    fn.append(pre,br);
+}
+
+//Whether p points into a global at constant offsets, so it can be read
+//whatever the loop does.
+static bool in_bounds(const ir_function &fn,const ir_module &m,uint32_t p){
+    int64_t offset = 0;
+    for(;fn.insts[p].op == ir_op::ptradd;p = fn.insts[p].ops[0]){
+        const ir_inst &o = fn.insts[fn.insts[p].ops[1]];
+        if(o.op != ir_op::iconst) return false;
+        offset += o.imm;
+    }
+    const ir_inst &base = fn.insts[p];
+    return base.op == ir_op::global && offset >= 0 && offset + 4 <= m.globals[base.index].size;
+}
+
+//Hoists out of every loop that has a preheader, innermost loops first.
+static uint32_t licm_loops(ir_function &fn,const ir_module &m,const loop_forest &lf){
+    uint32_t hoisted = 0;
+    vector<char> in_loop(fn.blocks.size(),0);
+    for(uint32_t l = lf.loops.size();l-- > 0;){
+        const ir_loop &loop = lf.loops[l];
+        uint32_t pre = preheader(fn,lf,l);
+        if(pre == no_block) continue;
+        bool writes = false;
+        for(uint32_t b : loop.blocks){
+            in_loop[b] = 1;
+            for(uint32_t v : fn.blocks[b].insts) writes |= has_side_effects(fn.insts[v].op) && !is_terminator(fn.insts[v].op);
+        }
+        //What may trap is hoisted from the header, which every trip runs,
+        //but not past a store or call made before it there.
+        auto hoistable = [&](const ir_inst &i,uint32_t b,bool effects){
+            switch(i.op){
+            case ir_op::add: case ir_op::sub: case ir_op::mul:
+            case ir_op::fadd: case ir_op::fsub: case ir_op::fmul: case ir_op::fdiv: case ir_op::fneg:
+            case ir_op::icmp: case ir_op::fcmp: case ir_op::itof: case ir_op::ftoi: case ir_op::ptradd:
+                return true;
+            case ir_op::div: case ir_op::rem:{
+                const ir_inst &d = fn.insts[i.ops[1]];
+                return (b == loop.header && !effects) || (d.op == ir_op::iconst && d.imm != 0 && d.imm != -1);
+            }
+            case ir_op::load:
+                return !writes && ((b == loop.header && !effects) || in_bounds(fn,m,i.ops[0]));
+            default:
+                return false;
+            }
+        };
+        vector<uint32_t> moved;
+        for(uint32_t b : loop.blocks){
+            auto &insts = fn.blocks[b].insts;
+            size_t first = moved.size();
+            bool effects = false;
+            for(uint32_t v : insts){
+                ir_inst &i = fn.insts[v];
+                bool can = hoistable(i,b,effects);
+                effects |= has_side_effects(i.op);
+                if(!can) continue;
+                bool invariant = true;
+                for_each_operand(fn,i,[&](uint32_t op){
+                    uint32_t d = fn.insts[op].block;
+                    if(d != no_block && in_loop[d]) invariant = false;
+                });
+                if(!invariant) continue;
+                //Out of the loop from here on, so its users can follow.
+                i.block = pre;
+                moved.push_back(v);
+            }
+            if(moved.size() != first) insts.erase(remove_if(insts.begin(),insts.end(),[&](uint32_t v){return fn.insts[v].block != b;}),insts.end());
+        }
+        auto &insts = fn.blocks[pre].insts;
+        insts.insert(insts.end() - 1,moved.begin(),moved.end());
+        hoisted += moved.size();
+        for(uint32_t b : loop.blocks) in_loop[b] = 0;
+    }
+    return hoisted;
+}
+
+uint32_t licm(ir_function &fn,const ir_module &m){
+    {
+        dominator_tree dom(fn);
+        loop_forest lf(fn,dom);
+        if(lf.loops.empty()) return 0;
+        bool added = false;
+        for(uint32_t l = 0;l < lf.loops.size();++l){
+            if(lf.loops[l].header == 0 || preheader(fn,lf,l) != no_block) continue;
+            make_preheader(fn,lf,l);
+            added = true;
+        }
+        if(!added) return licm_loops(fn,m,lf);
+    }
+    //The new preheaders belong to the loops around theirs.
+    dominator_tree dom(fn);
+    loop_forest lf(fn,dom);
+    return licm_loops(fn,m,lf);
+}
@@ -1,61 +1,338 @@
 #include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
+#include "arena.hpp"
+#include "ir.hpp"
+#include "ir_builder.hpp"
+#include "ir_opt.hpp"
+#include "jit.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "runtime.hpp"
+#include "source.hpp"
 #include "static_checker.hpp"
 #include "syntax_tree.hpp"
+#include "time_report.hpp"
+#include "vm.hpp"
+#include "x86.hpp"
+#include "x86_asm.hpp"
 using namespace std;
 
+#ifndef SYSY_RUNTIME_DIR
+#define SYSY_RUNTIME_DIR "runtime"
+#endif
 
-string read_file(const char* file){
-    ifstream f(file);
-    if(!f.is_open()) throw string("file doesn't exist!");
-    stringstream buf;
-    buf << f.rdbuf();
-    f.close();
-    return buf.str();
+ostream& operator<<(ostream& os,const VarType& vt);
+
+struct options {
+    const char* input = nullptr;
+    bool dump_tokens = false;
+    bool dump_ast = false;
+    bool dump_ir = false;
+    bool dump_bytecode = false;
+    bool run = false;
+    bool jit = false;
+    bool assembly = false;       //-S
+    const char* output = nullptr; //-o
+    unsigned opt_level = 1;       //-O0, -O1, -O2
+    bool regalloc_given = false;  //--regalloc overrides the one opt_level picks
+    x86_regalloc regalloc = x86_regalloc::linear_scan;
+    bool spill_report = false;
+    bool regalloc_compare = false;
+    bool gvn_report = false;
+    unsigned jobs = 1;
+    enum {no_report,table_report,json_report} time_report = no_report;
+};
+
+void usage(const char* prog){
+    fprintf(stderr, "Usage: %s [options] path/to/sysy_file\n",prog);
+    fprintf(stderr, "  --dump-tokens   print every token\n");
+    fprintf(stderr, "  --dump-ast      print the AST before and after checking\n");
+    fprintf(stderr, "  --dump-ir       print the SSA IR\n");
+    fprintf(stderr, "  --dump-bytecode print the VM bytecode\n");
+    fprintf(stderr, "  --run           execute the program; the exit status is main's result, or 125\n");
+    fprintf(stderr, "                  if it doesn't compile\n");
+    fprintf(stderr, "  --jit           with --run: compile to native code in memory instead of bytecode\n");
+    fprintf(stderr, "  -S              write x86-64 assembly (to -o, or the input name with .s)\n");
+    fprintf(stderr, "  -o FILE         output file; without -S, an executable linked by $CC (cc)\n");
+    fprintf(stderr, "                  with the SysY runtime ($SYSY_RUNTIME/sylib.c)\n");
+    fprintf(stderr, "  -O0, -O1, -O2   optimization level (-O1): -O1 and up optimize the IR; the native\n");
+    fprintf(stderr, "                  backend allocates registers with stack slots, linear scan or\n");
+    fprintf(stderr, "                  graph coloring; -O2 also inlines larger functions\n");
+    fprintf(stderr, "  --regalloc=linear-scan|graph-coloring|stack\n");
+    fprintf(stderr, "                  register allocator of the native backend, whatever the -O level\n");
+    fprintf(stderr, "  --spill-report  print the register allocator's spills per function to stderr\n");
+    fprintf(stderr, "  --regalloc-compare\n");
+    fprintf(stderr, "                  print spills and copies of linear scan and graph coloring to stderr\n");
+    fprintf(stderr, "  --gvn-report    print what value numbering removed per function to stderr\n");
+    fprintf(stderr, "  -j N            check function bodies on N threads (0: all cores)\n");
+    fprintf(stderr, "  --time-report[=json]\n");
+    fprintf(stderr, "                  print time and memory used by each phase to stderr\n");
 }
 
+bool parse_args(int argc,char** argv,options &opt){
+    for(int i = 1;i < argc;++i){
+        string arg = argv[i];
+        if(arg == "--dump-tokens") opt.dump_tokens = true;
+        else if(arg == "--dump-ast") opt.dump_ast = true;
+        else if(arg == "--dump-ir") opt.dump_ir = true;
+        else if(arg == "--dump-bytecode") opt.dump_bytecode = true;
+        else if(arg == "--run") opt.run = true;
+        else if(arg == "--jit") opt.jit = true;
+        else if(arg == "-S") opt.assembly = true;
+        else if(arg == "-o"){
+            if(i + 1 >= argc) return false;
+            opt.output = argv[++i];
+        }
+        else if(arg.size() == 3 && arg.rfind("-O",0) == 0 && arg[2] >= '0' && arg[2] <= '3') opt.opt_level = min(arg[2] - '0',2);
+        else if(arg == "--regalloc=linear-scan") opt.regalloc = x86_regalloc::linear_scan,opt.regalloc_given = true;
+        else if(arg == "--regalloc=graph-coloring") opt.regalloc = x86_regalloc::graph_coloring,opt.regalloc_given = true;
+        else if(arg == "--regalloc=stack") opt.regalloc = x86_regalloc::stack,opt.regalloc_given = true;
+        else if(arg == "--spill-report") opt.spill_report = true;
+        else if(arg == "--regalloc-compare") opt.regalloc_compare = true;
+        else if(arg == "--gvn-report") opt.gvn_report = true;
+        else if(arg == "--time-report") opt.time_report = options::table_report;
+        else if(arg == "--time-report=json") opt.time_report = options::json_report;
+        else if(arg.rfind("-j",0) == 0){
+            string n = arg.size() > 2 ? arg.substr(2) : (i + 1 < argc ? argv[++i] : "");
+            if(n.empty() || n.find_first_not_of("0123456789") != string::npos) return false;
+            opt.jobs = stoul(n);
+            if(opt.jobs == 0) opt.jobs = max(1u,thread::hardware_concurrency());
+        }
+        else if(arg.size() > 1 && arg[0] == '-'){
+            fprintf(stderr, "Unknown option %s\n",argv[i]);
+            return false;
+        }else if(opt.input == nullptr) opt.input = argv[i];
+        else return false;
+    }
+    if(!opt.regalloc_given){
+        static const x86_regalloc by_level[3] = {x86_regalloc::stack,x86_regalloc::linear_scan,x86_regalloc::graph_coloring};
+        opt.regalloc = by_level[opt.opt_level];
+    }
+    return opt.input != nullptr;
+}
 
-ostream& operator<<(ostream& os,const VarType& vt);
+//With --run, compile errors exit with 125, as env and timeout do for their
+//own failures, so that they aren't taken for a status main returned.
+int compile_error(const options &opt){return opt.run ? 125 : 1;}
 
-int main(int argc,char** argv){
-    // VarType c(true,false,Int,{5,6});
-    // auto d = c.index(0);
-    // auto e = d.index(1);
-    // cerr << e;
-    if(argc == 1){
-        fprintf(stderr, "Usage: %s path/to/sysy_file\n",argv[0]);
-        return 1;
+int run_jit(const options &opt,const ir_module &m){
+    jit_program program;
+    vector<regalloc_stats> stats;
+    try{
+        phase_timer timer("jit");
+        compile_jit(m,program,opt.regalloc,&stats);
+    }catch(string s){
+        cerr << s << endl;
+        return compile_error(opt);
+    }
+    if(opt.spill_report) print_spill_report(cerr,stats);
+    compile_report.counters.push_back({"jit code bytes",(double)program.code_size});
+    int status;
+    {
+        phase_timer timer("run");
+        status = program.run();
+    }
+    runtime_finish();
+    return status;
+}
+
+//Runs argv[0] with its arguments and returns its exit status.
+int run_command(const vector<string> &args){
+    vector<char*> argv;
+    for(auto &a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if(pid == 0){
+        execvp(argv[0],argv.data());
+        perror(argv[0]);
+        _exit(127);
+    }
+    int status = 0;
+    if(pid < 0 || waitpid(pid,&status,0) < 0) return 1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int emit_native(const options &opt,const ir_module &m){
+    vector<x86_function> fns;
+    vector<regalloc_stats> stats;
+    try{
+        phase_timer timer("x86");
+        fns = compile_x86(m,opt.regalloc,&stats);
+    }catch(string s){
+        cerr << s << endl;
+        return compile_error(opt);
+    }
+    if(opt.spill_report) print_spill_report(cerr,stats);
+    string asm_path;
+    if(opt.assembly){
+        if(opt.output) asm_path = opt.output;
+        else{
+            asm_path = opt.input;
+            asm_path = asm_path.substr(asm_path.find_last_of('/') + 1);
+            asm_path = asm_path.substr(0,asm_path.find_last_of('.')) + ".s";
+        }
+    }else{
+        char tmp[] = "/tmp/sysyc-XXXXXX.s";
+        int fd = mkstemps(tmp,2);
+        if(fd < 0){
+            perror("mkstemps");
+            return 1;
+        }
+        close(fd);
+        asm_path = tmp;
     }
-    string src = read_file(argv[1]);
-    lexer le(move(src));
-    vector<Token> tokens;
-    for(;;){
-        Token t = le.next_token();
-        tokens.push_back(t);
-        if(t.type != Eof) cout << t << "\n";
-        else break;
+    {
+        phase_timer timer("write assembly");
+        ofstream out(asm_path);
+        write_assembly(out,m,fns);
+        if(!out){
+            cerr << "Can't write " << asm_path << endl;
+            return 1;
+        }
     }
-    parser Parser(tokens);
+    if(opt.assembly) return 0;
+    phase_timer timer("link");
+    const char *cc = getenv("CC"),*runtime = getenv("SYSY_RUNTIME");
+    string sylib = string(runtime ? runtime : SYSY_RUNTIME_DIR) + "/sylib.c";
+    int status = run_command({cc ? cc : "cc","-O2","-o",opt.output,asm_path,sylib});
+    unlink(asm_path.c_str());
+    return status;
+}
+
+int compile(const options &opt){
+    source_buffer src;
+    try{
+        phase_timer timer("read");
+        src = source_buffer::from_file(opt.input);
+    }catch(string s){
+        cerr << s << endl;
+        return compile_error(opt);
+    }
+    if(opt.dump_tokens){
+        phase_timer timer("dump tokens");
+        lexer dump(src);
+        for(Token t = dump.next_token();t.type != Eof;t = dump.next_token()) cout << t << "\n";
+    }
+    lexer le(src);
+    arena ast_arena; //owns every node of this compilation
+    parser Parser(le,ast_arena);
     ast_printerv1 a;
     vector<CompUnit> ast;
     try{
+        phase_timer timer("lex + parse");
         ast = Parser.parse();
-        for(auto &cu : ast) cu.accept(a);
     }catch(string s){
-        cerr << s << endl;   
+        cerr << s << endl;
+        return compile_error(opt);
     }
-    static_checker checker;
+    if(opt.dump_ast){
+        phase_timer timer("dump ast");
+        for(auto &cu : ast) cu.accept(a);
+    }
+    static_checker checker(ast_arena);
     try{
-        checker.check(ast);
+        phase_timer timer("check");
+        checker.check(ast,opt.jobs);
     }catch(string s){
-        cout << s << endl;
+        cerr << s << endl;
+        return compile_error(opt);
+    }
+    if(opt.dump_ast){
+        phase_timer timer("dump checked ast");
+        for(auto &cu : ast) cu.accept(a);
+    }
+    if(!opt.dump_ir && !opt.dump_bytecode && !opt.run && !opt.assembly && !opt.output && !opt.regalloc_compare && !opt.gvn_report){
+        phase_timer timer("release");
+        ast_arena.release();
         return 0;
     }
-    for(auto &cu : ast) cu.accept(a);
-    return 0;
-}
\ No newline at end of file
+    ir_module m;
+    try{
+        phase_timer timer("ir");
+        m = build_ir(ast,checker);
+    }catch(string s){
+        cerr << s << endl;
+        return compile_error(opt);
+    }
+    vector<gvn_stats> numbered;
+    try{
+        phase_timer timer("optimize");
+        optimize(m,opt.opt_level,opt.gvn_report ? &numbered : nullptr);
+    }catch(string s){
+        cerr << s << endl;
+        return compile_error(opt);
+    }
+    if(opt.gvn_report) print_gvn_report(cerr,numbered);
+    {
+        phase_timer timer("release");
+        ast_arena.release();
+    }
+    if(opt.dump_ir){
+        phase_timer timer("dump ir");
+        print(cout,m);
+    }
+    if(opt.regalloc_compare){
+        vector<regalloc_stats> fast,coloring;
+        try{
+            phase_timer timer("regalloc compare");
+            compile_x86(m,x86_regalloc::linear_scan,&fast);
+            compile_x86(m,x86_regalloc::graph_coloring,&coloring);
+        }catch(string s){
+            cerr << s << endl;
+            return compile_error(opt);
+        }
+        print_regalloc_comparison(cerr,fast,coloring);
+    }
+    if(opt.run && opt.jit) return run_jit(opt,m);
+    if(opt.assembly || opt.output) return emit_native(opt,m);
+    if(!opt.dump_bytecode && !opt.run) return 0;
+    vm_program program;
+    try{
+        phase_timer timer("bytecode");
+        program = compile_bytecode(m);
+    }catch(string s){
+        cerr << s << endl;
+        return compile_error(opt);
+    }
+    if(opt.dump_bytecode){
+        phase_timer timer("dump bytecode");
+        print(cout,program);
+    }
+    if(!opt.run) return 0;
+    vm machine(program);
+    int status;
+    double start = wall_now_ms();
+    try{
+        phase_timer timer("run");
+        status = machine.run();
+    }catch(string s){
+        runtime_finish();
+        cerr << s << endl;
+        return 1;
+    }
+    double ms = wall_now_ms() - start;
+    runtime_finish();
+    compile_report.counters.push_back({"vm instructions",(double)machine.executed});
+    compile_report.counters.push_back({"vm instructions/s",ms > 0 ? machine.executed / (ms / 1000) : 0});
+    return status;
+}
+
+int main(int argc,char** argv){
+    options opt;
+    if(!parse_args(argc, argv, opt)){
+        usage(argv[0]);
+        return 1;
+    }
+    compile_report.enabled = opt.time_report != options::no_report;
+    int status = compile(opt);
+    if(opt.time_report == options::table_report) compile_report.print_table(cerr);
+    else if(opt.time_report == options::json_report) compile_report.print_json(cerr);
+    return status;
+}
@@ -10,36 +10,49 @@
 
 
 using namespace std;
+void parser::fill(uint32_t n) noexcept{
+    while(ring_size < n){
+        Token &slot = ring[(ring_head + ring_size) % lookahead];
+        if(lexed_eof){
+            //Never run the lexer past the end; repeat the Eof token instead.
+            slot = ring[(ring_head + ring_size + lookahead - 1) % lookahead];
+        }else{
+            slot = src.next_token();
+            lexed_eof = slot.type == Eof;
+        }
+        ring_size++;
+    }
+}
 void parser::update_line_column() noexcept{
-    line = src[cur].line;
-    column = src[cur].column;
+    const Token &t = peek(0);
+    line = t.line;
+    column = t.column;
 }
 bool parser::match(TokenType type) noexcept{
-    if(src[cur].type == type){
-        cur++;update_line_column();
+    if(peek(0).type == type){
+        ring_head = (ring_head + 1) % lookahead;ring_size--;
+        update_line_column();
         return true;
     }else{
         return false;
     }
 }
-Token& parser::peek(uint32_t i) noexcept {
-    if(cur + i > src.size()){
-        return src.back();
-    }else{
-        return src[cur+i];
-    }
+const Token& parser::peek(uint32_t i) noexcept {
+    fill(i + 1);
+    return ring[(ring_head + i) % lookahead];
 }
-Token& parser::next() noexcept {
+Token parser::next() noexcept {
     update_line_column();
-    cur++;
-    return src[cur-1];
+    Token t = ring[ring_head];
+    ring_head = (ring_head + 1) % lookahead;ring_size--;
+    return t;
 }
 string parser::report_line_column(){
     stringstream ss;
     ss << "At line " << line << ", column " << column << ":";
     return ss.str();
 }
-Token& parser::expect(TokenType type, const char *err_msg){
+Token parser::expect(TokenType type, const char *err_msg){
     if(peek(0).type == type){
         return next();
     }
@@ -104,8 +117,8 @@ int postfix_binding(TokenType typ) {
 }
 
 
-vector<shared_ptr<expr>> parser::parse_params(){
-    vector<shared_ptr<expr>> res;
+vector<expr*> parser::parse_params(){
+    vector<expr*> res;
     while(peek(0).type != RightParen){
         res.push_back(parse_expr(0));
         if(peek(0).type == RightParen) break;
@@ -114,28 +127,28 @@ vector<shared_ptr<expr>> parser::parse_params(){
     return res;
 }
 
-shared_ptr<expr> parser::parse_expr(int min_binding){
+expr* parser::parse_expr(int min_binding){
     auto next_token = next();
-    shared_ptr<expr> lhs = nullptr;
+    expr* lhs = nullptr;
 
     if(next_token.type == IntLiteral){
-        lhs = make_shared<int_literal_expr>(*(int*)next_token.literal);
+        lhs = make<int_literal_expr>(next_token.int_value);
     }else if(next_token.type == FloatLiteral){
-        lhs = make_shared<float_literal_expr>(*(float*)next_token.literal);
+        lhs = make<float_literal_expr>(next_token.float_value);
     }else if(next_token.type == Ident){
-        lhs = make_shared<var_expr>(*(string*)next_token.literal);
+        lhs = make<var_expr>(next_token.sym);
     }else if(next_token.type == LeftParen){
         lhs = parse_expr(0);
         expect(RightParen, "Expect ')'.");
     }else if(int rb = prefix_binding(next_token.type); rb > 0){
-        shared_ptr<expr> rhs = parse_expr(rb);
-        lhs = make_shared<prefix_expr>(next_token.type,rhs);
+        expr* rhs = parse_expr(rb);
+        lhs = make<prefix_expr>(next_token.type,rhs);
     }else{
         throw report_line_column() + " expect prefix operator or variable or literal.";
     }
 
     while(true){
-        Token& current = peek(0);
+        Token current = peek(0);
 
         if(int bind_power = postfix_binding(current.type);bind_power > 0){
             if(bind_power < min_binding) {
@@ -146,11 +159,11 @@ shared_ptr<expr> parser::parse_expr(int min_binding){
             if(current.type == LeftBracket){ //Array index
                 auto rhs = parse_expr(0);
                 expect(RightBracket, "Expect ']'.");
-                lhs = make_shared<index_expr>(lhs,rhs);
+                lhs = make<index_expr>(lhs,rhs);
             }else if(current.type == LeftParen){
                 auto params = parse_params();
                 expect(RightParen, "Expect ')' after parameters.");
-                lhs = make_shared<fun_call_expr>(lhs,std::move(params));
+                lhs = make<fun_call_expr>(lhs,std::move(params));
             }else{
                 throw string("Unreachable.");
             }
@@ -164,9 +177,9 @@ shared_ptr<expr> parser::parse_expr(int min_binding){
             next();
             auto rhs = parse_expr(bp.second);
             if(current.type == Equal){
-                lhs = make_shared<assign_expr>(lhs,rhs);
+                lhs = make<assign_expr>(lhs,rhs);
             }else{
-                lhs = make_shared<binary_expr>(current.type,lhs,rhs);
+                lhs = make<binary_expr>(current.type,lhs,rhs);
             }
             continue;
         }
@@ -176,42 +189,42 @@ shared_ptr<expr> parser::parse_expr(int min_binding){
     return lhs;
 }
 
-shared_ptr<init_val> parser::parse_init(){
+init_val* parser::parse_init(){
     if(peek(0).type == StringLiteral) {
-        vector<shared_ptr<init_val>> initvals;
-        for(char c : *(string*)next().literal) {
-            initvals.push_back(make_shared<init_val>(make_shared<int_literal_expr>(c)));
+        vector<init_val*> initvals;
+        for(char c : next().string_value()) {
+            initvals.push_back(make<init_val>(make<int_literal_expr>(c)));
         }
-        initvals.push_back(make_shared<init_val>(make_shared<int_literal_expr>(0)));
-        return make_shared<init_val>(nullptr,std::move(initvals));
+        initvals.push_back(make<init_val>(make<int_literal_expr>(0)));
+        return make<init_val>(nullptr,std::move(initvals));
     }else if(peek(0).type == LeftBrace){
-        vector<shared_ptr<init_val>> initvals;
+        vector<init_val*> initvals;
         next();//eat '{'
         while(!match(RightBrace)){
             if(peek(0).type == LeftBrace || peek(0).type == StringLiteral) initvals.push_back(parse_init());
-            else initvals.push_back(make_shared<init_val>(parse_expr(0)));
+            else initvals.push_back(make<init_val>(parse_expr(0)));
             match(Comma);
         }
-        return make_shared<init_val>(nullptr,std::move(initvals));
+        return make<init_val>(nullptr,std::move(initvals));
     }else{
-        return make_shared<init_val>(parse_expr(0));
+        return make<init_val>(parse_expr(0));
     }
 }
 
-vector<shared_ptr<decl>> parser::parse_decl(bool is_const){
+vector<decl*> parser::parse_decl(bool is_const){
     TokenType baseType = next().type;
-    vector<shared_ptr<decl>> decls;
+    vector<decl*> decls;
     do{
-        string varname = *(string*)expect(Ident, "Expect identifier in variable declaration.").literal;
+        symbol varname = expect(Ident, "Expect identifier in variable declaration.").sym;
         Type t;t.typ = baseType;
         while(match(LeftBracket)) {
             t.dimens.push_back(parse_expr(0));
             expect(RightBracket, "Expect ']' in dimension definition.");
         }
         if(match(Equal)){
-            decls.push_back(make_shared<decl>(is_const,move(t),varname,parse_init()));
+            decls.push_back(make<decl>(is_const,move(t),varname,parse_init()));
         }else{
-            decls.push_back(make_shared<decl>(is_const,move(t),varname,nullptr));
+            decls.push_back(make<decl>(is_const,move(t),varname,nullptr));
         }
         if(!match(Comma)) break;
     }while(peek(0).type != SemiColon);
@@ -221,9 +234,9 @@ vector<shared_ptr<decl>> parser::parse_decl(bool is_const){
 }
 
 
-vector<pair<Type, string>> parser::parse_fparams(){
+vector<pair<Type, symbol>> parser::parse_fparams(){
     expect(LeftParen, "Expect '(' after funtion name.");
-    vector<pair<Type, string>> res;
+    vector<pair<Type, symbol>> res;
 
     while(!match(RightParen)){
         match(Comma);
@@ -235,10 +248,10 @@ vector<pair<Type, string>> parser::parse_fparams(){
         default: throw report_line_column() + "expetc type or ')' in function parameter list.";
         }
 
-        string param_name = *(string*)expect(Ident, "expect a parameter name.").literal;
+        symbol param_name = expect(Ident, "expect a parameter name.").sym;
         while(match(LeftBracket)){
             if(match(RightBracket)){
-                t.dimens.push_back(make_shared<int_literal_expr>(-1));
+                t.dimens.push_back(make<int_literal_expr>(-1));
                 continue;
             }else{
                 t.dimens.push_back(parse_expr(0));
@@ -252,18 +265,20 @@ vector<pair<Type, string>> parser::parse_fparams(){
     return res;
 }
 
-shared_ptr<func_def> parser::parse_function(){
+func_def* parser::parse_function(){
     TokenType return_type = next().type;
-    string func_name = *(string*)expect(Ident, "Expect function name.").literal;
-    return make_shared<func_def>(
+    symbol func_name = expect(Ident, "Expect function name.").sym;
+    auto fparams = parse_fparams(); //must be parsed before the body
+    auto body = parse_block();
+    return make<func_def>(
         return_type,
         func_name,
-        parse_fparams(),
-        parse_block()
+        std::move(fparams),
+        body
     );
 }
 
-shared_ptr<block_stmt> parser::parse_block() {
+block_stmt* parser::parse_block() {
     expect(LeftBrace, "Block should start with '{'.");
     vector<block_item> block;
     while(true){
@@ -281,33 +296,33 @@ shared_ptr<block_stmt> parser::parse_block() {
             default: block.push_back({parse_stmt(),nullptr});
         }
     }
-    return make_shared<block_stmt>(move(block));
+    return make<block_stmt>(move(block));
 }
 
-shared_ptr<stmt> parser::parse_stmt() {
+stmt* parser::parse_stmt() {
     switch (peek(0).type) {
     case Continue : {
         next();expect(SemiColon, "expect ';' after 'continue'.");
-        return make_shared<continue_stmt>();
+        return make<continue_stmt>();
     }
     case Break : {
         next();expect(SemiColon, "expect ';' after 'break'.");
-        return make_shared<break_stmt>();
+        return make<break_stmt>();
     }
     case Return : {
         next();
         if(match(SemiColon)){
-            return make_shared<return_stmt>(nullptr);
+            return make<return_stmt>(nullptr);
         }else{
             auto e = parse_expr(0);
             expect(SemiColon, "expect ';' after expression.");
-            return make_shared<return_stmt>(e);
+            return make<return_stmt>(e);
         }
     }
     case LeftBrace : {
         return parse_block();
     }
-    case SemiColon : next();return make_shared<empty_stmt>();
+    case SemiColon : next();return make<empty_stmt>();
     case If:{
         next();expect(LeftParen, "Expect '(' after 'if'.");
         auto cond = parse_expr(0);
@@ -315,9 +330,9 @@ shared_ptr<stmt> parser::parse_stmt() {
         auto then_branch = parse_stmt();
         if(match(Else)){
             auto else_branch = parse_stmt();
-            return make_shared<if_stmt>(cond,then_branch,else_branch);
+            return make<if_stmt>(cond,then_branch,else_branch);
         }else{
-            return make_shared<if_stmt>(cond,then_branch,nullptr);
+            return make<if_stmt>(cond,then_branch,nullptr);
         }
     }
     case While:{
@@ -325,12 +340,12 @@ shared_ptr<stmt> parser::parse_stmt() {
         auto cond = parse_expr(0);
         expect(RightParen, "Expect ')' after condition.");
         auto loop_body = parse_stmt();
-        return make_shared<while_stmt>(cond,loop_body);
+        return make<while_stmt>(cond,loop_body);
     }
     default:{
         auto e = parse_expr(0);
         expect(SemiColon, "Expect ';' afyer experrsion in expr_stmt.");
-        return make_shared<expr_stmt>(e);
+        return make<expr_stmt>(e);
     }
     }
 }
@@ -357,8 +372,7 @@ vector<CompUnit> parser::parse(){
         case Void: ast.push_back(CompUnit{nullptr,parse_function()});break;
         case Int:
         case Float:{
-            Token& peek2 = peek(2);
-            if(peek2.type == LeftParen){
+            if(peek(2).type == LeftParen){
                 ast.push_back(CompUnit{nullptr,parse_function()});
             }else {
                 for(auto d : parse_decl(false)) ast.push_back(CompUnit{d,nullptr});
@@ -0,0 +1,30 @@
+#include "runtime.hpp"
+#include "sylib.h"
+#include <cstdio>
+using namespace std;
+
+const vector<runtime_function> runtime_functions = {
+    {"getint",Int,{},(void*)getint},
+    {"getch",Int,{},(void*)getch},
+    {"getfloat",Float,{},(void*)getfloat},
+    {"getarray",Int,{runtime_arg::i32_array},(void*)getarray},
+    {"getfarray",Int,{runtime_arg::f32_array},(void*)getfarray},
+    {"putint",Void,{runtime_arg::i32},(void*)putint},
+    {"putch",Void,{runtime_arg::i32},(void*)putch},
+    {"putfloat",Void,{runtime_arg::f32},(void*)putfloat},
+    {"putarray",Void,{runtime_arg::i32,runtime_arg::i32_array},(void*)putarray},
+    {"putfarray",Void,{runtime_arg::i32,runtime_arg::f32_array},(void*)putfarray},
+    {"starttime",Void,{},(void*)starttime},
+    {"stoptime",Void,{},(void*)stoptime},
+};
+
+int find_runtime(const string &name){
+    for(size_t i = 0;i < runtime_functions.size();++i){
+        if(name == runtime_functions[i].name) return i;
+    }
+    return -1;
+}
+
+void runtime_finish(){
+    fflush(stdout);
+}
@@ -0,0 +1,199 @@
+#include "scan.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static inline bool ident_char(char c){
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static uint32_t ident_scalar(const char* p){
+    uint32_t n = 0;
+    while(ident_char(p[n])) n++;
+    return n;
+}
+static scan_result blank_scalar(const char* p){
+    scan_result r{0,0,0};
+    for(;;r.len++){
+        char c = p[r.len];
+        if(c == '\n'){r.newlines++;r.last_newline = r.len;continue;}
+        if(c == ' ' || c == '\t') continue;
+        return r;
+    }
+}
+static uint32_t line_comment_scalar(const char* p){
+    uint32_t n = 0;
+    while(p[n] != '\n' && p[n] != '\0') n++;
+    return n;
+}
+static scan_result block_comment_scalar(const char* p){
+    scan_result r{0,0,0};
+    for(;;r.len++){
+        char c = p[r.len];
+        if(c == '\0' || (c == '*' && p[r.len+1] == '/')) return r;
+        if(c == '\n'){r.newlines++;r.last_newline = r.len;}
+    }
+}
+
+//Adds the newlines in the first `n` lanes of `nl` (bit i = lane i) to r.
+static inline void count_newlines(scan_result &r,uint64_t nl,uint32_t n){
+    if(n < 64) nl &= (1ull << n) - 1;
+    if(nl){
+        r.newlines += __builtin_popcountll(nl);
+        r.last_newline = r.len + 63 - __builtin_clzll(nl);
+    }
+}
+
+#ifdef SCAN_X86
+
+//Bytes in [lo,hi]; bytes >= 0x80 are negative and never match.
+static inline __m128i in_range16(__m128i v,char lo,char hi){
+    return _mm_and_si128(_mm_cmpgt_epi8(v,_mm_set1_epi8(lo - 1)),_mm_cmplt_epi8(v,_mm_set1_epi8(hi + 1)));
+}
+static uint32_t ident_sse2(const char* p){
+    uint32_t n = 0;
+    for(;;n += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + n));
+        __m128i lower = _mm_or_si128(v,_mm_set1_epi8(0x20)); //folds 'A'-'Z' onto 'a'-'z'
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(in_range16(lower,'a','z'),in_range16(v,'0','9')),
+            _mm_cmpeq_epi8(v,_mm_set1_epi8('_')));
+        uint32_t stop = ~_mm_movemask_epi8(m) & 0xffff;
+        if(stop) return n + __builtin_ctz(stop);
+    }
+}
+static scan_result blank_sse2(const char* p){
+    scan_result r{0,0,0};
+    for(;;){
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + r.len));
+        __m128i nl = _mm_cmpeq_epi8(v,_mm_set1_epi8('\n'));
+        __m128i ws = _mm_or_si128(nl,_mm_or_si128(
+            _mm_cmpeq_epi8(v,_mm_set1_epi8(' ')),_mm_cmpeq_epi8(v,_mm_set1_epi8('\t'))));
+        uint32_t stop = ~_mm_movemask_epi8(ws) & 0xffff;
+        uint32_t n = stop ? __builtin_ctz(stop) : 16;
+        count_newlines(r,(uint32_t)_mm_movemask_epi8(nl),n);
+        r.len += n;
+        if(n < 16) return r;
+    }
+}
+static uint32_t line_comment_sse2(const char* p){
+    uint32_t n = 0;
+    for(;;n += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + n));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('\n')),_mm_cmpeq_epi8(v,_mm_setzero_si128()));
+        uint32_t stop = _mm_movemask_epi8(m);
+        if(stop) return n + __builtin_ctz(stop);
+    }
+}
+static scan_result block_comment_sse2(const char* p){
+    scan_result r{0,0,0};
+    for(;;){
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + r.len));
+        __m128i next = _mm_loadu_si128((const __m128i*)(p + r.len + 1));
+        __m128i end = _mm_and_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('*')),_mm_cmpeq_epi8(next,_mm_set1_epi8('/')));
+        end = _mm_or_si128(end,_mm_cmpeq_epi8(v,_mm_setzero_si128()));
+        uint32_t stop = _mm_movemask_epi8(end);
+        uint32_t n = stop ? __builtin_ctz(stop) : 16;
+        count_newlines(r,(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_set1_epi8('\n'))),n);
+        r.len += n;
+        if(n < 16) return r;
+    }
+}
+
+#define AVX2 __attribute__((target("avx2")))
+AVX2 static inline __m256i in_range32(__m256i v,char lo,char hi){
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v,_mm256_set1_epi8(lo - 1)),_mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1),v));
+}
+AVX2 static uint32_t ident_avx2(const char* p){
+    uint32_t n = 0;
+    for(;;n += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + n));
+        __m256i lower = _mm256_or_si256(v,_mm256_set1_epi8(0x20));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(in_range32(lower,'a','z'),in_range32(v,'0','9')),
+            _mm256_cmpeq_epi8(v,_mm256_set1_epi8('_')));
+        uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(m);
+        if(stop) return n + __builtin_ctz(stop);
+    }
+}
+AVX2 static scan_result blank_avx2(const char* p){
+    scan_result r{0,0,0};
+    for(;;){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + r.len));
+        __m256i nl = _mm256_cmpeq_epi8(v,_mm256_set1_epi8('\n'));
+        __m256i ws = _mm256_or_si256(nl,_mm256_or_si256(
+            _mm256_cmpeq_epi8(v,_mm256_set1_epi8(' ')),_mm256_cmpeq_epi8(v,_mm256_set1_epi8('\t'))));
+        uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(ws);
+        uint32_t n = stop ? __builtin_ctz(stop) : 32;
+        count_newlines(r,(uint32_t)_mm256_movemask_epi8(nl),n);
+        r.len += n;
+        if(n < 32) return r;
+    }
+}
+AVX2 static uint32_t line_comment_avx2(const char* p){
+    uint32_t n = 0;
+    for(;;n += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + n));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('\n')),_mm256_cmpeq_epi8(v,_mm256_setzero_si256()));
+        uint32_t stop = _mm256_movemask_epi8(m);
+        if(stop) return n + __builtin_ctz(stop);
+    }
+}
+AVX2 static scan_result block_comment_avx2(const char* p){
+    scan_result r{0,0,0};
+    for(;;){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + r.len));
+        __m256i next = _mm256_loadu_si256((const __m256i*)(p + r.len + 1));
+        __m256i end = _mm256_and_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('*')),_mm256_cmpeq_epi8(next,_mm256_set1_epi8('/')));
+        end = _mm256_or_si256(end,_mm256_cmpeq_epi8(v,_mm256_setzero_si256()));
+        uint32_t stop = _mm256_movemask_epi8(end);
+        uint32_t n = stop ? __builtin_ctz(stop) : 32;
+        count_newlines(r,(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('\n'))),n);
+        r.len += n;
+        if(n < 32) return r;
+    }
+}
+#undef AVX2
+#endif
+
+static const scanner scanners[] = {
+#ifdef SCAN_X86
+    {"avx2",ident_avx2,blank_avx2,line_comment_avx2,block_comment_avx2},
+    {"sse2",ident_sse2,blank_sse2,line_comment_sse2,block_comment_sse2},
+#endif
+    {"scalar",ident_scalar,blank_scalar,line_comment_scalar,block_comment_scalar},
+};
+
+static bool supported(const scanner &s){
+#ifdef SCAN_X86
+    if(strcmp(s.name,"avx2") == 0) return __builtin_cpu_supports("avx2");
+    if(strcmp(s.name,"sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    return true;
+}
+
+const scanner* find_scanner(const char* name){
+    for(auto &s : scanners){
+        if(strcmp(s.name,name) == 0) return supported(s) ? &s : nullptr;
+    }
+    return nullptr;
+}
+
+static const scanner& select_scanner(){
+    if(const char* forced = getenv("SYSY_SCAN")){
+        if(const scanner *s = find_scanner(forced)) return *s;
+    }
+    for(auto &s : scanners){
+        if(supported(s)) return s;
+    }
+    return scanners[sizeof(scanners)/sizeof(scanners[0]) - 1];
+}
+
+const scanner& active_scanner(){
+    static const scanner &s = select_scanner();
+    return s;
+}
@@ -0,0 +1,351 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// A value is unknown until an executable instruction defines it, then one
+// constant, then overdefined; it only ever moves down that order.
+enum class sccp_state : uint8_t {unknown,constant,overdefined};
+struct sccp_value {
+    sccp_state state;
+    uint32_t bits; //constant: the i32, or the f32 bit pattern
+};
+
+static float as_float(uint32_t bits){float f;memcpy(&f,&bits,4);return f;}
+static uint32_t float_bits(float f){uint32_t b;memcpy(&b,&f,4);return b;}
+
+static bool compare(ir_cmp cc,int32_t a,int32_t b){
+    switch(cc){
+    case ir_cmp::eq: return a == b;
+    case ir_cmp::ne: return a != b;
+    case ir_cmp::lt: return a < b;
+    case ir_cmp::le: return a <= b;
+    case ir_cmp::gt: return a > b;
+    case ir_cmp::ge: return a >= b;
+    }
+    return false;
+}
+//ne is true on NaN, the others false, as in C.
+static bool compare(ir_cmp cc,float a,float b){
+    switch(cc){
+    case ir_cmp::eq: return a == b;
+    case ir_cmp::ne: return a != b;
+    case ir_cmp::lt: return a < b;
+    case ir_cmp::le: return a <= b;
+    case ir_cmp::gt: return a > b;
+    case ir_cmp::ge: return a >= b;
+    }
+    return false;
+}
+
+bool fold_constant(const ir_inst &i,uint32_t a,uint32_t b,uint32_t &out){
+    int32_t x = a,y = b;
+    float f = as_float(a),g = as_float(b);
+    switch(i.op){
+    case ir_op::add: out = a + b;return true;
+    case ir_op::sub: out = a - b;return true;
+    case ir_op::mul: out = a * b;return true;
+    case ir_op::div: case ir_op::rem:
+        if(y == 0 || (x == INT_MIN && y == -1)) return false;
+        out = i.op == ir_op::div ? x / y : x % y;
+        return true;
+    case ir_op::fadd: out = float_bits(f + g);return true;
+    case ir_op::fsub: out = float_bits(f - g);return true;
+    case ir_op::fmul: out = float_bits(f * g);return true;
+    case ir_op::fdiv: out = float_bits(f / g);return true;
+    case ir_op::fneg: out = a ^ 0x80000000u;return true;
+    case ir_op::icmp: out = compare(i.cc,x,y);return true;
+    case ir_op::fcmp: out = compare(i.cc,f,g);return true;
+    case ir_op::itof: out = float_bits((float)x);return true;
+    case ir_op::ftoi:
+        if(!(f >= -2147483648.0f && f < 2147483648.0f)) return false;
+        out = (uint32_t)(int32_t)f;
+        return true;
+    default: return false;
+    }
+}
+
+struct sccp_solver {
+    ir_function &fn;
+    const ir_module &m;
+    vector<sccp_value> values;
+    vector<char> executable;         //blocks
+    vector<uint32_t> edge_start;     //edge_executable[edge_start[b] + k]: edge from preds[k] into b
+    vector<char> edge_executable;
+    vector<uint32_t> user_start,users; //instructions reading each value
+    vector<uint32_t> block_work,value_work;
+
+    sccp_solver(ir_function &fn,const ir_module &m) : fn(fn),m(m){}
+
+    //The const global a load's address points into through a chain of
+    //ptradds, or null.
+    const ir_global* const_root(uint32_t p) const {
+        while(fn.insts[p].op == ir_op::ptradd) p = fn.insts[p].ops[0];
+        if(fn.insts[p].op != ir_op::global || !m.globals[fn.insts[p].index].is_const) return nullptr;
+        return &m.globals[fn.insts[p].index];
+    }
+    //Calls f on the byte offset of every ptradd in the chain.
+    template<typename F> void for_each_offset(uint32_t p,F &&f) const {
+        for(;fn.insts[p].op == ir_op::ptradd;p = fn.insts[p].ops[0]) f(fn.insts[p].ops[1]);
+    }
+
+    void build_users(){
+        user_start.assign(fn.insts.size() + 1,0);
+        auto each_use = [&](uint32_t v,auto &&f){
+            ir_inst &i = fn.insts[v];
+            for_each_operand(fn,i,[&](uint32_t op){f(op);});
+            //A load from a const global also changes with the offsets of its address.
+            if(i.op == ir_op::load && const_root(i.ops[0])) for_each_offset(i.ops[0],f);
+        };
+        for(auto &b : fn.blocks){
+            for(uint32_t v : b.insts) each_use(v,[&](uint32_t op){user_start[op + 1]++;});
+        }
+        for(uint32_t v = 0;v < fn.insts.size();++v) user_start[v + 1] += user_start[v];
+        users.resize(user_start.back());
+        vector<uint32_t> fill(user_start.begin(),user_start.end() - 1);
+        for(auto &b : fn.blocks){
+            for(uint32_t v : b.insts) each_use(v,[&](uint32_t op){users[fill[op]++] = v;});
+        }
+    }
+
+    void lower(uint32_t v,sccp_value nv){
+        sccp_value &old = values[v];
+        if(nv.state == sccp_state::unknown || old.state == sccp_state::overdefined) return;
+        if(old.state == sccp_state::constant){
+            if(nv.state == sccp_state::constant && nv.bits == old.bits) return;
+            nv.state = sccp_state::overdefined;
+        }
+        old = nv;
+        value_work.push_back(v);
+    }
+
+    void mark_edge(uint32_t from,uint32_t to){
+        auto &preds = fn.blocks[to].preds;
+        bool fresh = false;
+        for(uint32_t k = 0;k < preds.size();++k){
+            if(preds[k] == from && !edge_executable[edge_start[to] + k]){
+                edge_executable[edge_start[to] + k] = 1;
+                fresh = true;
+            }
+        }
+        if(!fresh) return;
+        if(!executable[to]){
+            executable[to] = 1;
+            block_work.push_back(to);
+            return;
+        }
+        //A new way in only changes the phis.
+        for(uint32_t v : fn.blocks[to].insts){
+            if(fn.insts[v].op != ir_op::phi) break;
+            visit(v);
+        }
+    }
+
+    void visit(uint32_t v){
+        const ir_inst &i = fn.insts[v];
+        const sccp_value over = {sccp_state::overdefined,0};
+        switch(i.op){
+        case ir_op::phi:{
+            sccp_value r = {sccp_state::unknown,0};
+            const uint32_t *ops = fn.list(i);
+            for(uint32_t k = 0;k < i.nlist;++k){
+                if(!edge_executable[edge_start[i.block] + k]) continue;
+                const sccp_value &x = values[ops[k]];
+                if(x.state == sccp_state::unknown) continue;
+                if(x.state == sccp_state::overdefined || (r.state == sccp_state::constant && r.bits != x.bits)){
+                    r = over;
+                    break;
+                }
+                r = x;
+            }
+            lower(v,r);
+            return;
+        }
+        case ir_op::br:
+            mark_edge(i.block,i.ops[0]);
+            return;
+        case ir_op::condbr:{
+            const sccp_value &c = values[i.ops[0]];
+            if(c.state == sccp_state::constant) mark_edge(i.block,c.bits ? i.ops[1] : i.ops[2]);
+            else if(c.state == sccp_state::overdefined){
+                mark_edge(i.block,i.ops[1]);
+                mark_edge(i.block,i.ops[2]);
+            }
+            return;
+        }
+        case ir_op::load:{
+            const ir_global *g = const_root(i.ops[0]);
+            int64_t offset = 0;
+            bool waiting = false,known = g != nullptr;
+            if(known){
+                for_each_offset(i.ops[0],[&](uint32_t o){
+                    if(values[o].state == sccp_state::unknown) waiting = true;
+                    else if(values[o].state == sccp_state::overdefined) known = false;
+                    else offset += (int32_t)values[o].bits;
+                });
+            }
+            if(known && waiting) return;
+            if(!known || offset < 0 || offset % 4 != 0 || offset + 4 > g->size){
+                lower(v,over);
+                return;
+            }
+            uint32_t word = offset / 4;
+            lower(v,{sccp_state::constant,word < g->init.size() ? g->init[word] : 0});
+            return;
+        }
+        case ir_op::add: case ir_op::sub: case ir_op::mul: case ir_op::div: case ir_op::rem:
+        case ir_op::fadd: case ir_op::fsub: case ir_op::fmul: case ir_op::fdiv: case ir_op::fneg:
+        case ir_op::icmp: case ir_op::fcmp: case ir_op::itof: case ir_op::ftoi:{
+            uint32_t bits[2] = {0,0},n = 0;
+            bool waiting = false,unknown_operand = false;
+            for_each_operand(fn,i,[&](uint32_t op){
+                const sccp_value &x = values[op];
+                if(x.state == sccp_state::unknown) waiting = true;
+                else if(x.state == sccp_state::overdefined) unknown_operand = true;
+                bits[n++] = x.bits;
+            });
+            if(unknown_operand){lower(v,over);return;}
+            if(waiting) return;
+            uint32_t out;
+            lower(v,fold_constant(i,bits[0],bits[1],out) ? sccp_value{sccp_state::constant,out} : over);
+            return;
+        }
+        default:
+            if(i.type != ir_type::none) lower(v,over);
+            return;
+        }
+    }
+
+    void solve(){
+        values.assign(fn.insts.size(),{sccp_state::unknown,0});
+        for(uint32_t v = 0;v < fn.insts.size();++v){
+            const ir_inst &i = fn.insts[v];
+            if(i.block != no_block || !is_leaf(i.op)) continue;
+            if(i.op == ir_op::iconst) values[v] = {sccp_state::constant,(uint32_t)i.imm};
+            else if(i.op == ir_op::fconst) values[v] = {sccp_state::constant,float_bits(i.fimm)};
+            else values[v] = {sccp_state::overdefined,0};
+        }
+        executable.assign(fn.blocks.size(),0);
+        edge_start.assign(fn.blocks.size() + 1,0);
+        for(uint32_t b = 0;b < fn.blocks.size();++b) edge_start[b + 1] = edge_start[b] + fn.blocks[b].preds.size();
+        edge_executable.assign(edge_start.back(),0);
+        build_users();
+
+        executable[0] = 1;
+        block_work.push_back(0);
+        while(!block_work.empty() || !value_work.empty()){
+            while(!value_work.empty()){
+                uint32_t v = value_work.back();
+                value_work.pop_back();
+                for(uint32_t k = user_start[v];k < user_start[v + 1];++k){
+                    uint32_t u = users[k];
+                    if(executable[fn.insts[u].block]) visit(u);
+                }
+            }
+            if(!block_work.empty()){
+                uint32_t b = block_work.back();
+                block_work.pop_back();
+                for(uint32_t v : fn.blocks[b].insts) visit(v);
+            }
+        }
+    }
+};
+
+//Rewrites operands through map (no_value: keep) and drops the mapped
+//instructions from their blocks.
+static void substitute(ir_function &fn,const vector<uint32_t> &map){
+    for(auto &b : fn.blocks){
+        auto dead = [&](uint32_t v){
+            if(map[v] == no_value) return false;
+            fn.insts[v].op = ir_op::nop;
+            fn.insts[v].block = no_block;
+            return true;
+        };
+        b.insts.erase(remove_if(b.insts.begin(),b.insts.end(),dead),b.insts.end());
+        for(uint32_t v : b.insts){
+            for_each_operand(fn,fn.insts[v],[&](uint32_t &op){
+                while(map[op] != no_value) op = map[op];
+            });
+        }
+    }
+}
+
+uint32_t sccp(ir_function &fn,const ir_module &m){
+    uint32_t before = fn.inst_count();
+    sccp_solver s(fn,m);
+    s.solve();
+
+    //Constants become leaves, reusing the ones the function has.
+    unordered_map<uint64_t,uint32_t> leaves;
+    for(uint32_t v = 0;v < fn.insts.size();++v){
+        const ir_inst &i = fn.insts[v];
+        if(i.block != no_block) continue;
+        if(i.op == ir_op::iconst) leaves.try_emplace((uint64_t)ir_type::i32 << 32 | (uint32_t)i.imm,v);
+        else if(i.op == ir_op::fconst) leaves.try_emplace((uint64_t)ir_type::f32 << 32 | float_bits(i.fimm),v);
+    }
+    auto leaf = [&](ir_type t,uint32_t bits){
+        auto [it,fresh] = leaves.try_emplace((uint64_t)t << 32 | bits,0);
+        if(fresh){
+            ir_inst c{};
+            c.op = t == ir_type::f32 ? ir_op::fconst : ir_op::iconst;
+            c.type = t;
+            c.ops[0] = c.ops[1] = c.ops[2] = no_value;
+            if(t == ir_type::f32) c.fimm = as_float(bits);
+            else c.imm = bits;
+            it->second = fn.add(c);
+        }
+        return it->second;
+    };
+
+    vector<uint32_t> map(fn.insts.size(),no_value);
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        if(!s.executable[b]) continue;
+        for(uint32_t v : fn.blocks[b].insts){
+            ir_inst &i = fn.insts[v];
+            if(i.op == ir_op::condbr && s.values[i.ops[0]].state == sccp_state::constant){
+                bool taken = s.values[i.ops[0]].bits != 0;
+                uint32_t target = taken ? i.ops[1] : i.ops[2];
+                fn.remove_pred(taken ? i.ops[2] : i.ops[1],b);
+                i.op = ir_op::br;
+                i.ops[0] = target;
+                i.ops[1] = i.ops[2] = no_value;
+            }else if(s.values[v].state == sccp_state::constant && !has_side_effects(i.op)){
+                map[v] = leaf(i.type,s.values[v].bits);
+            }
+        }
+    }
+    map.resize(fn.insts.size(),no_value);
+    substitute(fn,map);
+    fn.remove_unreachable();
+
+    //Pruned edges leave phis that merge a single value.
+    for(bool changed = true;changed;){
+        changed = false;
+        fill(map.begin(),map.end(),no_value);
+        for(auto &b : fn.blocks){
+            for(uint32_t v : b.insts){
+                const ir_inst &i = fn.insts[v];
+                if(i.op != ir_op::phi) break;
+                uint32_t same = no_value;
+                bool trivial = true;
+                for(uint32_t k = 0;k < i.nlist && trivial;++k){
+                    uint32_t op = fn.list(i)[k];
+                    while(map[op] != no_value) op = map[op];
+                    if(op == v || op == same) continue;
+                    if(same != no_value) trivial = false;
+                    same = op;
+                }
+                if(trivial && same != no_value){
+                    map[v] = same;
+                    changed = true;
+                }
+            }
+        }
+        if(changed) substitute(fn,map);
+    }
+    return before - fn.inst_count();
+}
@@ -0,0 +1,90 @@
+#include "source.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+source_buffer::source_buffer(source_buffer &&o) noexcept
+    : data(o.data),size(o.size),map_base(o.map_base),map_len(o.map_len),owned(o.owned){
+    o.data = nullptr;o.size = 0;o.map_base = nullptr;o.map_len = 0;o.owned = nullptr;
+}
+source_buffer& source_buffer::operator=(source_buffer &&o) noexcept{
+    if(this != &o){
+        release();
+        data = o.data;size = o.size;map_base = o.map_base;map_len = o.map_len;owned = o.owned;
+        o.data = nullptr;o.size = 0;o.map_base = nullptr;o.map_len = 0;o.owned = nullptr;
+    }
+    return *this;
+}
+source_buffer::~source_buffer(){release();}
+
+void source_buffer::release(){
+    if(map_base) munmap(map_base, map_len);
+    free(owned);
+    map_base = nullptr;map_len = 0;owned = nullptr;
+}
+
+source_buffer source_buffer::from_string(const string &s){
+    source_buffer buf;
+    buf.owned = (char*)calloc(s.size() + padding, 1);
+    if(buf.owned == nullptr) throw string("out of memory while reading source.");
+    memcpy(buf.owned, s.data(), s.size());
+    buf.data = buf.owned;
+    buf.size = s.size();
+    return buf;
+}
+
+static source_buffer read_stream(int fd){
+    string content;
+    char chunk[1 << 16];
+    ssize_t n;
+    while((n = read(fd, chunk, sizeof(chunk))) > 0) content.append(chunk, n);
+    if(n < 0) throw string("failed to read source file.");
+    return source_buffer::from_string(content);
+}
+
+source_buffer source_buffer::from_file(const char *path){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) throw string("file doesn't exist!");
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0){
+        //pipes, devices and empty files go through a plain read.
+        source_buffer buf = read_stream(fd);
+        close(fd);
+        return buf;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = st.st_size;
+    size_t file_pages = (size + page - 1) / page * page;
+    size_t total = (size + padding + page - 1) / page * page;
+    //Reserve the whole range as zeroed anonymous memory, then map the file
+    //over its beginning. Bytes past the end of the file in its last page are
+    //zero as well, so the text is always followed by `padding` zero bytes.
+    void *base = mmap(nullptr, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED){
+        source_buffer buf = read_stream(fd);
+        close(fd);
+        return buf;
+    }
+    void *text = mmap(base, file_pages, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    close(fd);
+    if(text == MAP_FAILED){
+        munmap(base, total);
+        throw string("failed to map source file.");
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(base, file_pages, MADV_SEQUENTIAL);
+#endif
+    source_buffer buf;
+    buf.map_base = base;
+    buf.map_len = total;
+    buf.data = (const char*)base;
+    buf.size = size;
+    return buf;
+}
@@ -1,7 +1,13 @@
+#include "const_eval.hpp"
+#include "runtime.hpp"
 #include "static_checker.hpp"
 #include "syntax_tree.hpp"
+#include "thread_pool.hpp"
+#include "time_report.hpp"
 #include "token.hpp"
+#include <exception>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <type_traits>
@@ -31,36 +37,57 @@ ostream& operator<<(ostream& os,const VarType& vt){
     os << endl;
     return os;
 }
-static_checker::static_checker() {env = new Environment;env->enclosing = nullptr;need_replace = false;}
-static_checker::~static_checker() {if(env != nullptr) delete env;}
+static_checker::static_checker(arena &a) : ast_arena(a),bodies(make_shared<function_bodies>()),root(this),defined(0) {need_replace = false;const_context = 0;}
+static_checker::static_checker(const static_checker &global,arena &a)
+    : funcs(global.funcs),env(global.env),ast_arena(a),bodies(global.bodies),root(global.root),defined(0),
+      need_replace(false),second_pass(true),const_context(0){}
+
+func_def* static_checker::checked_body(symbol f){
+    auto it = bodies->index.find(f);
+    //Not while a signature is checked: its parameters would be in scope.
+    if(it == bodies->index.end() || it->second >= defined || root->env.depth() != 0) return nullptr;
+    check_once(it->second,nullptr);
+    return bodies->defs[it->second];
+}
+
+void static_checker::check_once(uint32_t i,static_checker *checker){
+    call_once(bodies->checked[i],[&]{
+        auto run = [&](static_checker &c){
+            c.defined = i;
+            c.env.visible = bodies->globals[i];
+            bodies->defs[i]->accept(c);
+        };
+        try{
+            if(checker) run(*checker);
+            else{
+                static_checker sub(*root,ast_arena);
+                run(sub);
+            }
+        }catch(...){
+            bodies->errors[i] = current_exception();
+        }
+    });
+    if(bodies->errors[i]) rethrow_exception(bodies->errors[i]);
+}
 
 bool is_int_literal(expr* e){
     return typeid(*e) == typeid(int_literal_expr);
 }
-bool is_int_literal(shared_ptr<expr> e){
-    return is_int_literal(e.get());
-}
 bool is_float_literal(expr* e){
     return typeid(*e) == typeid(float_literal_expr);
 }
-bool is_float_literal(shared_ptr<expr> e){
-    return is_float_literal(e.get());
-}
 bool is_literal(expr* e){
     return typeid(*e) == typeid(int_literal_expr) || typeid(*e) == typeid(float_literal_expr);
 }
-bool is_literal(shared_ptr<expr> e){
-    return is_literal(e.get());
-}
 
-shared_ptr<int_literal_expr> int_literal_with_vartype(int v){
-    auto r = make_shared<int_literal_expr>(v);
-    r->type = new VarType(true,false,Int,{});
+int_literal_expr* static_checker::int_literal_with_vartype(int v){
+    auto r = make<int_literal_expr>(v);
+    r->type = new_type(VarType(true,false,Int,{}));
     return r;
 }
-shared_ptr<float_literal_expr> float_literal_with_vartype(float v){
-    auto r = make_shared<float_literal_expr>(v);
-    r->type = new VarType(true,false,Float,{});
+float_literal_expr* static_checker::float_literal_with_vartype(float v){
+    auto r = make<float_literal_expr>(v);
+    r->type = new_type(VarType(true,false,Float,{}));
     return r;
 }
 
@@ -72,15 +99,15 @@ ast_printerv1 debug;
 void static_checker::accept(ast_node& e){}
 void static_checker::accept(expr& e){}
 void static_checker::accept(int_literal_expr& e){
-    e.type = new VarType(true,false,Int,{});
+    e.type = new_type(VarType(true,false,Int,{}));
 }
 void static_checker::accept(float_literal_expr& e){
-    e.type = new VarType(true,false,Float,{});
+    e.type = new_type(VarType(true,false,Float,{}));
 }
 void static_checker::accept(var_expr& e){
-    if(VarType *vt = env->lookup(e.varname);vt != nullptr){
+    if(VarType *vt = env.lookup(e.varname);vt != nullptr){
         #ifdef DEBUG
-            cout << "Find \"" << e.varname << "\" : " << *vt << endl;
+            cout << "Find \"" << symbols.name(e.varname) << "\" : " << *vt << endl;
         #endif
         if(vt->is_const && !vt->is_array()){
             if(vt->basetype == Int){
@@ -89,10 +116,10 @@ void static_checker::accept(var_expr& e){
                 this->save_replace(float_literal_with_vartype(vt->float_value()));
             }
         }else{
-            e.type = new VarType(*vt);
+            e.type = new_type(VarType(*vt));
         }
     }else{
-        throw e.varname + " : undefined variable.";
+        throw symbols.name(e.varname) + " : undefined variable.";
     }
 
     #ifdef DEBUG
@@ -112,27 +139,27 @@ void static_checker::accept(prefix_expr &e){
     if(e.rhs->type->basetype == Void){
         throw string("Can't negative or not a Void.");
     }
-    if(is_literal(e.rhs)){
+    if(const_context && is_literal(e.rhs)){
         if(is_float_literal(e.rhs)){
-            float v = dynamic_pointer_cast<float_literal_expr>(e.rhs)->value;
+            float v = dynamic_cast<float_literal_expr*>(e.rhs)->value;
             switch (e.op) {
-            case Plus : this->save_replace(make_shared<float_literal_expr>(v));break;
-            case Minus : this->save_replace(make_shared<float_literal_expr>(-v));break;
-            case Not : this->save_replace(make_shared<float_literal_expr>(!v));break;
+            case Plus : this->save_replace(float_literal_with_vartype(v));break;
+            case Minus : this->save_replace(float_literal_with_vartype(-v));break;
+            case Not : this->save_replace(float_literal_with_vartype(!v));break;
             default: throw string("Unreachable : Unknown prefix operator.");
             }
         }else{
-            int v = dynamic_pointer_cast<int_literal_expr>(e.rhs)->value;
+            int v = dynamic_cast<int_literal_expr*>(e.rhs)->value;
             switch (e.op) {
-            case Plus : this->save_replace(make_shared<int_literal_expr>(v));break; 
-            case Minus : this->save_replace(make_shared<int_literal_expr>(-v));break;
-            case Not : this->save_replace(make_shared<int_literal_expr>(!v));break;
+            case Plus : this->save_replace(int_literal_with_vartype(v));break; 
+            case Minus : this->save_replace(int_literal_with_vartype(-v));break;
+            case Not : this->save_replace(int_literal_with_vartype(!v));break;
             default: throw string("Unreachable : Unknown prefix operator.");
             }
         }
     }else{
         VarType* rhs = e.rhs->type;
-        e.type = new VarType(rhs->is_const,false,rhs->basetype,{});
+        e.type = new_type(VarType(rhs->is_const,false,rhs->basetype,{}));
     }
     #ifdef DEBUG
         e.accept(debug);
@@ -162,10 +189,10 @@ void static_checker::accept(binary_expr& e){
         expr_type = Int;
     }
 
-    if(is_literal(e.lhs) && is_literal(e.rhs)){
+    if(const_context && is_literal(e.lhs) && is_literal(e.rhs)){
         if(is_int_literal(e.lhs) && is_int_literal(e.rhs)){
-            int lhs = dynamic_pointer_cast<int_literal_expr>(e.lhs)->value;
-            int rhs = dynamic_pointer_cast<int_literal_expr>(e.rhs)->value;
+            int lhs = dynamic_cast<int_literal_expr*>(e.lhs)->value;
+            int rhs = dynamic_cast<int_literal_expr*>(e.rhs)->value;
             int res;
             switch (e.op) {
             case Plus: res = lhs+rhs;break;
@@ -192,11 +219,11 @@ void static_checker::accept(binary_expr& e){
             this->save_replace(int_literal_with_vartype(res));
         }else{
             float lhs = is_float_literal(e.lhs) ?
-                 dynamic_pointer_cast<float_literal_expr>(e.lhs)->value :
-                 dynamic_pointer_cast<int_literal_expr>(e.lhs)->value;
+                 dynamic_cast<float_literal_expr*>(e.lhs)->value :
+                 dynamic_cast<int_literal_expr*>(e.lhs)->value;
             float rhs = is_float_literal(e.rhs) ?
-                 dynamic_pointer_cast<float_literal_expr>(e.rhs)->value :
-                 dynamic_pointer_cast<int_literal_expr>(e.rhs)->value;
+                 dynamic_cast<float_literal_expr*>(e.rhs)->value :
+                 dynamic_cast<int_literal_expr*>(e.rhs)->value;
             float res;
             switch (e.op) {
             case Plus: res = lhs+rhs;break;
@@ -221,7 +248,7 @@ void static_checker::accept(binary_expr& e){
             this->save_replace(float_literal_with_vartype(res));
         }
     }else{
-        e.type = new VarType(false,false,expr_type,{});
+        e.type = new_type(VarType(false,false,expr_type,{}));
     }
 
     #ifdef DEBUG
@@ -243,16 +270,16 @@ void static_checker::accept(assign_expr& e){
         throw string("Can't assign Void to variables.");
     }
 
-    e.type = new VarType(false,false,e.lhs->type->basetype,{});
+    e.type = new_type(VarType(false,false,e.lhs->type->basetype,{}));
 }
 void static_checker::accept(fun_call_expr& e){
     if(typeid(*e.func) != typeid(var_expr)){
         throw string("Function is not a variable?");
     }
-    string funcname = dynamic_pointer_cast<var_expr>(e.func)->varname;
+    symbol funcname = dynamic_cast<var_expr*>(e.func)->varname;
     auto f = this->funcs.find(funcname);
     if(f == this->funcs.end()){
-        throw string("Undefined function : ") + funcname;
+        throw string("Undefined function : ") + symbols.name(funcname);
     }
     Func &func = f->second;
     for(auto &param : e.params) {
@@ -261,13 +288,14 @@ void static_checker::accept(fun_call_expr& e){
     }
 
     if(e.params.size() != func.params.size()){
-        throw funcname + string(" requires ") + to_string(func.params.size()) + " parameter(s),but given " + to_string(e.params.size());
+        throw symbols.name(funcname) + string(" requires ") + to_string(func.params.size()) + " parameter(s),but given " + to_string(e.params.size());
     }
     for(int i = 0;i < e.params.size();++i){
         auto &formal = func.params[i].first;
         auto &actual = *e.params[i]->type;
-        if(formal.dimens != actual.dimens){
-            throw "When call " + func.params[i].second +string("The dimensions of formal parameter and actual parameter are different.");
+        //The leading dimension of an array parameter is -1: only the rank has to match here.
+        if(formal.dimens.size() != actual.dimens.size()){
+            throw "When call " + symbols.name(func.params[i].second) +string("The dimensions of formal parameter and actual parameter are different.");
         }
         if(actual.basetype == Void){
             throw string("Can't use Void as parameter.");
@@ -283,8 +311,17 @@ void static_checker::accept(fun_call_expr& e){
             }
         }
     }
+    if(const_context){
+        //Run it if it can be: it's the value or an error.
+        literal_value v;
+        if(evaluate_call(e,[this](symbol f){return checked_body(f);},v) && v.type != Void){
+            if(v.type == Int) this->save_replace(int_literal_with_vartype(v.i));
+            else this->save_replace(float_literal_with_vartype(v.f));
+            return;
+        }
+    }
 
-    e.type = new VarType(false,false,func.return_type,{});
+    e.type = new_type(VarType(false,false,func.return_type,{}));
 
     #ifdef DEBUG
         e.accept(debug);
@@ -302,25 +339,26 @@ void static_checker::accept(index_expr& e){
     }
     if(e.array->type->is_const && is_literal(e.index)){
         VarType* arr = e.array->type;
-        int index = is_float_literal(e.index) ?
-                 dynamic_pointer_cast<float_literal_expr>(e.index)->value :
-                 dynamic_pointer_cast<int_literal_expr>(e.index)->value;
+        float f = is_float_literal(e.index) ? dynamic_cast<float_literal_expr*>(e.index)->value : 0;
+        if(!(f >= -2147483648.0f && f < 2147483648.0f)) throw string("index will overflow.");
+        int index = is_float_literal(e.index) ? (int)f :
+                 dynamic_cast<int_literal_expr*>(e.index)->value;
         if(arr->will_overflow(index)) {
             throw string("index will overflow.");
         }
         VarType res = arr->index(index);
         // cout << "---" << *e.array->type << " " << index << " " << res << "---";
-        if(!res.is_array()){
+        if(!res.is_array() && const_context){
             if(res.is_int()) this->save_replace(int_literal_with_vartype(res.int_value()));
             else this->save_replace(float_literal_with_vartype(res.float_value()));
 
             // cout << "Replace constant : " << res.float_value();
             // cout << '\n';
         }else{
-            e.type = new VarType(res);
+            e.type = new_type(VarType(res));
         }
     }else{
-        e.type = new VarType(e.array->type->index());
+        e.type = new_type(VarType(e.array->type->index()));
     }
 
     // cerr << "New index : " << *e.type << endl;
@@ -342,13 +380,17 @@ void static_checker::accept(init_val& e){
 }
 void static_checker::accept(Type& e){
     for(auto &dimen : e.dimens) {
+        const_context++;
         dimen->accept(*this);
+        const_context--;
         check_replace(dimen);
         if(!is_literal(dimen)){
             throw string("Dimension in variable declaration or in function parameter must be known.");
         }
         if(is_float_literal(dimen)){
-            int v = dynamic_pointer_cast<float_literal_expr>(dimen)->value;
+            float f = dynamic_cast<float_literal_expr*>(dimen)->value;
+            if(!(f < 2147483648.0f)){throw string("Dimension out of the range of int.");}
+            int v = f > 0 ? (int)f : 0;
             if(v <= 0){throw string("Dimension must be positive.");}
             dimen = int_literal_with_vartype(v);
         }
@@ -359,24 +401,24 @@ void static_checker::accept(func_def& e){
         this->enter_env();
         auto &func = this->funcs.find(e.name)->second;
         for(auto &param : func.params){
-            this->env->vars.insert({param.second,param.first});
+            this->env.insert(param.second,param.first);
         }
         e.body->accept(*this);
         this->quit_env();
     }else{
-        if(this->funcs.count(e.name) || this->env->vars.count(e.name)){
-            throw string("Duplicated global name : ") + e.name;
+        if(this->funcs.count(e.name) || this->env.declared_here(e.name)){
+            throw string("Duplicated global name : ") + symbols.name(e.name);
         }
         this->enter_env();
-        vector<pair<VarType, string>> formal_params;
+        vector<pair<VarType, symbol>> formal_params;
         for(auto &p : e.fparams){
-            if(env->vars.count(p.second)){
-                throw string("Duplicated parameter name : ") + p.second + "in function definition : " + e.name ;
+            if(env.declared_here(p.second)){
+                throw string("Duplicated parameter name : ") + symbols.name(p.second) + "in function definition : " + symbols.name(e.name) ;
             }
             p.first.accept(*this);
             vector<int> dimens;
             for(auto &dimen : p.first.dimens){
-                dimens.push_back(dynamic_pointer_cast<int_literal_expr>(dimen)->value);
+                dimens.push_back(dynamic_cast<int_literal_expr*>(dimen)->value);
             }
             formal_params.push_back({VarType(false,true,p.first.typ,dimens),p.second});
         }
@@ -385,59 +427,60 @@ void static_checker::accept(func_def& e){
     }
 }
 void static_checker::accept(decl& e){
-    if(env->vars.count(e.name)) {
-        throw string("Redefine ") + e.name;
+    if(env.declared_here(e.name)) {
+        throw string("Redefine ") + symbols.name(e.name);
+    }
+    if(is_global() && bodies->index.count(e.name)){
+        throw string("Duplicated global name : ") + symbols.name(e.name);
     }
     e.type.accept(*this);
-    if(e.init != nullptr) e.init->accept(*this);
+    if(e.init != nullptr){
+        bool fold = e.is_const || this->is_global();
+        const_context += fold;
+        e.init->accept(*this);
+        const_context -= fold;
+    }
     
     TokenType basetype = e.type.typ;
     vector<int> dimens;
     for(auto &dimen : e.type.dimens){
         if(!is_literal(dimen)){throw string("Each dimension of array must be known in compile time.");}
-        int d = is_int_literal(dimen) ? dynamic_pointer_cast<int_literal_expr>(dimen)->value
-                                    : dynamic_pointer_cast<float_literal_expr>(dimen)->value;
+        int d = is_int_literal(dimen) ? dynamic_cast<int_literal_expr*>(dimen)->value
+                                    : dynamic_cast<float_literal_expr*>(dimen)->value;
         if(d <= 0) {throw string("Dimension of array must greater than 0.");}
         dimens.push_back(d);
     }
     VarType type(e.is_const,true,basetype,dimens);
+    vector<expr*> elems;
+    if(e.init != nullptr) elems = flatten_init(e.init,dimens);
     if((e.is_const || this->is_global()) && e.init != nullptr){
-        auto aux_check = [](shared_ptr<expr> &e){
-            if(!is_literal(e)){throw string("Global variable or constants must be initialized by value can be known in compile time.");}
-        };
-        if(e.init->val){
-            aux_check(e.init->val);
-        }else{
-            for(int i = 0;i < e.init->vals.size();++i){
-                aux_check(e.init->vals[i]->val);
+        for(auto elem : elems){
+            if(elem != nullptr && !is_literal(elem)){
+                throw string("Global variable or constants must be initialized by value can be known in compile time.");
             }
         }
     }
     if(e.is_const && e.init != nullptr){
-        //For now,we assume initval can't be nested.
-        auto aux_set_int = [](void* p,shared_ptr<expr> &e){
-            int d = is_int_literal(e) ? dynamic_pointer_cast<int_literal_expr>(e)->value 
-                                    : dynamic_pointer_cast<float_literal_expr>(e)->value;
-            
-            // cout << "Replace " << d ;
-            *(int*)p = d;
-        };
-        auto aux_set_float = [](void* p,shared_ptr<expr> &e){
-            float d = is_int_literal(e) ? dynamic_pointer_cast<int_literal_expr>(e)->value 
-                                    : dynamic_pointer_cast<float_literal_expr>(e)->value;
-            *(float*)p = d;
-        };
-        if(e.init->val){
-            if(basetype == Int) aux_set_int(type.data.get(), e.init->val);
-            else aux_set_float(type.data.get(), e.init->val);
-        }else{
-            for(int i = 0;i < e.init->vals.size();++i){
-                if(basetype == Int) aux_set_int(type.data.get()+4*i, e.init->vals[i]->val);
-                else aux_set_float(type.data.get()+4*i, e.init->vals[i]->val);
+        for(size_t i = 0;i < elems.size();++i){
+            expr* elem = elems[i];
+            if(elem == nullptr) continue;
+            if(basetype == Int){
+                int d;
+                if(is_int_literal(elem)) d = dynamic_cast<int_literal_expr*>(elem)->value;
+                else{
+                    float v = dynamic_cast<float_literal_expr*>(elem)->value;
+                    if(!(v >= -2147483648.0f && v < 2147483648.0f)) throw string("Initializer out of the range of int.");
+                    d = v;
+                }
+                memcpy(type.data.get() + 4*i,&d,4);
+            }else{
+                float d = is_int_literal(elem) ? dynamic_cast<int_literal_expr*>(elem)->value
+                                               : dynamic_cast<float_literal_expr*>(elem)->value;
+                memcpy(type.data.get() + 4*i,&d,4);
             }
         }
     }
-    env->vars.insert({e.name,type});
+    env.insert(e.name,std::move(type));
 
     #ifdef DEBUG
         e.accept(debug);
@@ -478,24 +521,97 @@ void static_checker::accept(break_stmt& e){
     //do nothing
 }
 void static_checker::accept(return_stmt& e){
+    if(e.return_value == nullptr) return;
     e.return_value->accept(*this);check_replace(e.return_value);
     if(e.return_value->type->is_array()){
         throw string("Can't return array.");
     }
 }
 
-void static_checker::check(std::vector<CompUnit> &ast){
-    this->funcs.insert({"putint",{Void,{ {VarType(false,true,Int,{}),"i"} }}});
+void static_checker::check(std::vector<CompUnit> &ast,unsigned jobs){
+    for(auto &rt : runtime_functions){
+        vector<pair<VarType,symbol>> params;
+        for(size_t i = 0;i < rt.params.size();++i){
+            TokenType base = rt.params[i] == runtime_arg::f32 || rt.params[i] == runtime_arg::f32_array ? Float : Int;
+            bool is_array = rt.params[i] == runtime_arg::i32_array || rt.params[i] == runtime_arg::f32_array;
+            params.push_back({VarType(false,true,base,is_array ? vector<int>{-1} : vector<int>{}),symbols.intern("p" + to_string(i))});
+        }
+        this->funcs.insert({symbols.intern(rt.name),{rt.ret,std::move(params)}});
+    }
 
+    size_t nfunctions = 0;
+    for(auto &unit : ast) nfunctions += unit.function != nullptr;
+    bodies->checked.reset(new once_flag[nfunctions]);
+    bodies->errors.reset(new exception_ptr[nfunctions]);
+    auto &defs = bodies->defs;
+
+    //Declarations and signatures in source order: a body sees the globals
+    //declared before it, and constant expressions may call the functions
+    //defined before them.
     second_pass = false;
     for(auto &unit : ast){
         if(unit.declaration) unit.declaration->accept(*this);
-    }
-    for(auto &unit : ast){
-        if(unit.function) unit.function->accept(*this);
+        if(unit.function){
+            unit.function->accept(*this);
+            bodies->index[unit.function->name] = defs.size();
+            bodies->globals.push_back(env.bindings.size());
+            defs.push_back(unit.function);
+            defined = defs.size();
+        }
     }
     second_pass = true;
-    for(auto &unit : ast){
-        if(unit.function) unit.function->accept(*this);
+    bool timed = compile_report.enabled;
+    vector<phase_record> timings(timed ? defs.size() : 0);
+    auto check_body = [&](uint32_t i,static_checker &checker){
+        if(!timed){
+            check_once(i,&checker);
+            return;
+        }
+        function_timer t;
+        try{
+            check_once(i,&checker);
+        }catch(...){
+            timings[i] = {symbols.name(defs[i]->name),t.stop(),-1};
+            throw;
+        }
+        timings[i] = {symbols.name(defs[i]->name),t.stop(),-1};
+    };
+    auto keep_timings = [&]{
+        for(auto &r : timings){
+            if(!r.name.empty()) compile_report.functions.push_back(std::move(r));
+        }
+    };
+    if(jobs <= 1 || defs.size() < 2){
+        //Bodies are checked apart from the global scope, which on-demand
+        //checks start from.
+        static_checker worker(*this,ast_arena);
+        try{
+            for(uint32_t i = 0;i < defs.size();++i) check_body(i,worker);
+        }catch(...){
+            keep_timings();
+            throw;
+        }
+        keep_timings();
+        return;
+    }
+
+    //Globals and funcs are read-only from here on: every worker gets its own
+    //copy of the global scope to push locals onto, and its own arena.
+    thread_pool pool(jobs);
+    vector<arena> arenas(pool.size());
+    vector<unique_ptr<static_checker>> workers;
+    for(unsigned w = 0;w < pool.size();++w) workers.push_back(make_unique<static_checker>(*this,arenas[w]));
+    vector<exception_ptr> errors(defs.size());
+    pool.run(defs.size(), [&](uint32_t i,unsigned w){
+        try{
+            check_body(i,*workers[w]);
+        }catch(...){
+            errors[i] = current_exception();
+        }
+    });
+    for(auto &a : arenas) ast_arena.merge(std::move(a));
+    keep_timings();
+    for(auto &e : errors){
+        if(e) rethrow_exception(e);
     }
 }
\ No newline at end of file
@@ -0,0 +1,340 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+// A value of the loop as a linear function of a basic induction variable:
+// base + iv * mult + offset + addend, where base (addresses only) and addend
+// are loop-invariant values and may be missing.
+struct linear_form {
+    uint32_t iv = no_value;
+    int64_t mult = 0;
+    int64_t offset = 0;
+    uint32_t addend = no_value;
+    uint32_t base = no_value;
+    uint32_t muls = 0; //multiplications the form replaces
+    bool ok() const {return iv != no_value;}
+};
+
+struct strength_reducer {
+    ir_function &fn;
+    const dominator_tree &dom;
+    const loop_forest &lf;
+    uint32_t loop = no_loop,pre = no_block,latch = no_block;
+    vector<char> in_loop;
+    vector<uint32_t> user_start,users;
+    unordered_map<uint32_t,int64_t> steps;   //basic induction variable -> step
+    unordered_map<uint32_t,uint32_t> nexts;  //basic induction variable -> its latch value
+    unordered_map<uint32_t,linear_form> forms;
+    uint32_t reduced = 0,tests = 0;
+
+    strength_reducer(ir_function &fn,const dominator_tree &dom,const loop_forest &lf) : fn(fn),dom(dom),lf(lf),in_loop(fn.blocks.size(),0){}
+
+    bool invariant(uint32_t v) const {
+        uint32_t b = fn.insts[v].block;
+        return b == no_block || !in_loop[b];
+    }
+    bool is_const(uint32_t v) const {return fn.insts[v].op == ir_op::iconst;}
+    int64_t const_of(uint32_t v) const {return fn.insts[v].imm;}
+
+    void build_users(){
+        user_start.assign(fn.insts.size() + 1,0);
+        for(auto &b : fn.blocks){
+            for(uint32_t v : b.insts) for_each_operand(fn,fn.insts[v],[&](uint32_t op){user_start[op + 1]++;});
+        }
+        for(uint32_t v = 0;v < fn.insts.size();++v) user_start[v + 1] += user_start[v];
+        users.resize(user_start.back());
+        vector<uint32_t> fill(user_start.begin(),user_start.end() - 1);
+        for(auto &b : fn.blocks){
+            for(uint32_t v : b.insts) for_each_operand(fn,fn.insts[v],[&](uint32_t op){users[fill[op]++] = v;});
+        }
+    }
+    template<typename F> bool all_users(uint32_t v,F &&f) const {
+        for(uint32_t k = user_start[v];k < user_start[v + 1];++k){
+            if(!f(users[k])) return false;
+        }
+        return true;
+    }
+
+    //The linear form of v, if it has one; operands the form is built from
+    //go to parts.
+    linear_form form(uint32_t v,vector<uint32_t> *parts = nullptr){
+        if(parts == nullptr){
+            auto it = forms.find(v);
+            if(it != forms.end()) return it->second;
+        }
+        linear_form r = compute(v,parts);
+        if(parts == nullptr) forms[v] = r;
+        return r;
+    }
+    linear_form compute(uint32_t v,vector<uint32_t> *parts){
+        linear_form r;
+        if(steps.count(v)){
+            r.iv = v;
+            r.mult = 1;
+            return r;
+        }
+        if(invariant(v)) return r;
+        const ir_inst &i = fn.insts[v];
+        uint32_t a = i.ops[0],b = i.ops[1];
+        switch(i.op){
+        case ir_op::mul:
+            if(is_const(a)) swap(a,b);
+            if(!is_const(b)) return r;
+            r = form(a,parts);
+            if(!r.ok() || r.base != no_value || r.addend != no_value) return {};
+            r.mult *= const_of(b);
+            r.offset *= const_of(b);
+            r.muls++;
+            break;
+        case ir_op::add:
+            if(invariant(a)) swap(a,b);
+            if(!invariant(b)) return r;
+            r = form(a,parts);
+            if(!r.ok() || r.base != no_value) return {};
+            if(is_const(b)) r.offset += const_of(b);
+            else if(r.addend == no_value) r.addend = b;
+            else return {};
+            break;
+        case ir_op::sub:
+            if(!is_const(b)) return r;
+            r = form(a,parts);
+            if(!r.ok() || r.base != no_value) return {};
+            r.offset -= const_of(b);
+            break;
+        case ir_op::ptradd:
+            if(invariant(a)){
+                r = form(b,parts);
+                if(!r.ok() || r.base != no_value) return {};
+                r.base = a;
+                break;
+            }
+            if(!invariant(b)) return r;
+            r = form(a,parts);
+            if(!r.ok() || r.base == no_value) return {};
+            if(is_const(b)) r.offset += const_of(b);
+            else if(r.addend == no_value) r.addend = b;
+            else return {};
+            break;
+        default:
+            return r;
+        }
+        //Keep every constant a 32-bit offset can hold.
+        if(r.mult != (int32_t)r.mult || r.offset != (int32_t)r.offset) return {};
+        if(parts) parts->push_back(v);
+        return r;
+    }
+
+    uint32_t emit_before_end(uint32_t b,ir_op op,ir_type t,uint32_t x,uint32_t y){
+        ir_inst i{};
+        i.op = op;
+        i.type = t;
+        i.ops[0] = x;
+        i.ops[1] = y;
+        i.ops[2] = no_value;
+        uint32_t v = fn.append(b,i);
+        //Ahead of the branch's condition too, which the backends fold into
+        //the branch.
+        auto &insts = fn.blocks[b].insts;
+        auto at = insts.end() - 2;
+        const ir_inst &end = fn.insts[*at];
+        if(end.op == ir_op::condbr && at != insts.begin() && *(at - 1) == end.ops[0]) --at;
+        rotate(at,insts.end() - 1,insts.end());
+        return v;
+    }
+    uint32_t iconst(int64_t c){
+        ir_inst i{};
+        i.op = ir_op::iconst;
+        i.type = ir_type::i32;
+        i.ops[0] = i.ops[1] = i.ops[2] = no_value;
+        i.imm = c;
+        return fn.add(i);
+    }
+    //base + x * f.mult + f.offset + f.addend, computed in the preheader.
+    uint32_t address_at(const linear_form &f,uint32_t x){
+        uint32_t t = no_value;
+        if(is_const(x)){
+            int64_t c = const_of(x) * f.mult + f.offset;
+            if(c != (int32_t)c) return no_value;
+            if(c != 0 || f.addend == no_value) t = iconst(c);
+        }else{
+            t = f.mult == 1 ? x : emit_before_end(pre,ir_op::mul,ir_type::i32,x,iconst(f.mult));
+            if(f.offset) t = emit_before_end(pre,ir_op::add,ir_type::i32,t,iconst(f.offset));
+        }
+        if(f.addend != no_value) t = t == no_value ? f.addend : emit_before_end(pre,ir_op::add,ir_type::i32,t,f.addend);
+        if(is_const(t) && const_of(t) == 0) return f.base;
+        return emit_before_end(pre,ir_op::ptradd,ir_type::ptr,f.base,t);
+    }
+
+    //Replaces the address a by a pointer stepping along with its induction
+    //variable; returns the new phi or no_value.
+    uint32_t reduce(uint32_t a,const linear_form &f){
+        int64_t step = steps[f.iv] * f.mult;
+        if(step != (int32_t)step) return no_value;
+        auto &preds = fn.blocks[lf.loops[loop].header].preds;
+        uint32_t k = preds[0] == pre ? 0 : 1;
+        uint32_t init = fn.list(fn.insts[f.iv])[k];
+        uint32_t start = address_at(f,init);
+        if(start == no_value) return no_value;
+        ir_inst phi{};
+        phi.op = ir_op::phi;
+        phi.type = ir_type::ptr;
+        phi.ops[0] = phi.ops[1] = phi.ops[2] = no_value;
+        uint32_t p = fn.add(phi);
+        uint32_t h = lf.loops[loop].header;
+        fn.insts[p].block = h;
+        fn.blocks[h].insts.insert(fn.blocks[h].insts.begin(),p);
+        uint32_t next = emit_before_end(latch,ir_op::ptradd,ir_type::ptr,p,iconst(step));
+        fn.set_list(p,k == 0 ? vector<uint32_t>{start,next} : vector<uint32_t>{next,start});
+        for(uint32_t u = user_start[a];u < user_start[a + 1];++u){
+            for_each_operand(fn,fn.insts[users[u]],[&](uint32_t &op){if(op == a) op = p;});
+        }
+        reduced++;
+        return p;
+    }
+
+    //The compare deciding whether the loop goes on, if it is `iv cc n` for an
+    //invariant n and the header's branch is the only way out.
+    uint32_t exit_test(uint32_t iv) const {
+        const ir_loop &l = lf.loops[loop];
+        for(uint32_t b : l.blocks){
+            uint32_t succ[2];
+            for(uint32_t k = fn.successors(b,succ);k-- > 0;){
+                if(!in_loop[succ[k]] && b != l.header) return no_value;
+            }
+        }
+        const ir_inst *t = fn.terminator(l.header);
+        if(t->op != ir_op::condbr) return no_value;
+        uint32_t c = t->ops[0];
+        const ir_inst &i = fn.insts[c];
+        if(i.op != ir_op::icmp || i.block != l.header || user_start[c + 1] - user_start[c] != 1) return no_value;
+        if(!((i.ops[0] == iv && invariant(i.ops[1])) || (i.ops[1] == iv && invariant(i.ops[0])))) return no_value;
+        return c;
+    }
+
+    void run_loop(uint32_t l){
+        const ir_loop &lp = lf.loops[l];
+        uint32_t h = lp.header;
+        if(fn.blocks[h].preds.size() != 2 || lp.latches.size() != 1) return;
+        loop = l;
+        latch = lp.latches[0];
+        pre = fn.blocks[h].preds[0] == latch ? fn.blocks[h].preds[1] : fn.blocks[h].preds[0];
+        if(fn.terminator(pre)->op != ir_op::br) return;
+        for(uint32_t b : lp.blocks) in_loop[b] = 1;
+        steps.clear();
+        nexts.clear();
+        forms.clear();
+        uint32_t k = fn.blocks[h].preds[0] == latch ? 0 : 1;
+        for(uint32_t v : fn.blocks[h].insts){
+            const ir_inst &i = fn.insts[v];
+            if(i.op != ir_op::phi) break;
+            if(i.type != ir_type::i32) continue;
+            uint32_t n = fn.list(i)[k];
+            const ir_inst &inc = fn.insts[n];
+            if(invariant(n)) continue;
+            if(inc.op == ir_op::add && inc.ops[0] == v && is_const(inc.ops[1])) steps[v] = const_of(inc.ops[1]);
+            else if(inc.op == ir_op::add && inc.ops[1] == v && is_const(inc.ops[0])) steps[v] = const_of(inc.ops[0]);
+            else if(inc.op == ir_op::sub && inc.ops[0] == v && is_const(inc.ops[1])) steps[v] = -const_of(inc.ops[1]);
+            else continue;
+            nexts[v] = n;
+        }
+        if(!steps.empty()) run_ivs();
+        for(uint32_t b : lp.blocks) in_loop[b] = 0;
+    }
+
+    void run_ivs(){
+        //Addresses with a linear form some user needs as a whole, used
+        //only in the loop.
+        map<uint32_t,vector<uint32_t>> candidates;
+        for(uint32_t b : lf.loops[loop].blocks){
+            for(uint32_t v : fn.blocks[b].insts){
+                if(fn.insts[v].op != ir_op::ptradd) continue;
+                linear_form f = form(v);
+                if(!f.ok() || f.base == no_value) continue;
+                bool inside = true,whole = false;
+                all_users(v,[&](uint32_t u){
+                    if(!in_loop[fn.insts[u].block]) inside = false;
+                    linear_form g = fn.insts[u].op == ir_op::ptradd ? form(u) : linear_form{};
+                    if(!g.ok()) whole = true;
+                    return true;
+                });
+                if(inside && whole) candidates[f.iv].push_back(v);
+            }
+        }
+        for(auto &[iv,addresses] : candidates){
+            //If the addresses were all the variable was needed for besides
+            //its exit test, it can go: reduce them all and test a pointer.
+            unordered_set<uint32_t> parts,whole(addresses.begin(),addresses.end());
+            for(uint32_t a : addresses){
+                vector<uint32_t> p;
+                form(a,&p);
+                parts.insert(p.begin(),p.end());
+            }
+            uint32_t test = exit_test(iv),next = nexts[iv];
+            bool dies = test != no_value;
+            dies = dies && all_users(iv,[&](uint32_t u){return u == next || u == test || parts.count(u);});
+            dies = dies && all_users(next,[&](uint32_t u){return u == iv;});
+            for(uint32_t p : parts){
+                if(!dies) break;
+                dies = whole.count(p) || all_users(p,[&](uint32_t u){return parts.count(u) != 0;});
+            }
+            uint32_t replaced = no_value;
+            linear_form rf;
+            for(uint32_t a : addresses){
+                linear_form f = form(a);
+                bool scaled = f.muls == 1 && (f.mult == 1 || f.mult == 2 || f.mult == 4 || f.mult == 8);
+                if(!dies && (f.muls == 0 || scaled)) continue;
+                uint32_t p = reduce(a,f);
+                //The test can follow an address computed on every trip, which
+                //keeps the end address within what the loop reaches.
+                bool every_trip = dom.dominates(fn.insts[a].block,latch);
+                if(p != no_value && replaced == no_value && f.mult != 0 && every_trip){
+                    replaced = p;
+                    rf = f;
+                }
+            }
+            if(dies && replaced != no_value) replace_test(test,iv,replaced,rf);
+        }
+    }
+
+    //Linear-function test replacement: `iv cc n` becomes `p cc end`, with
+    //end the address p reaches when iv gets to n.
+    void replace_test(uint32_t test,uint32_t iv,uint32_t p,const linear_form &f){
+        ir_inst &c = fn.insts[test];
+        uint32_t n = c.ops[0] == iv ? c.ops[1] : c.ops[0];
+        uint32_t end = address_at(f,n);
+        if(end == no_value) return;
+        ir_inst &t = fn.insts[test];
+        if(f.mult < 0){
+            static const ir_cmp swapped[] = {ir_cmp::eq,ir_cmp::ne,ir_cmp::gt,ir_cmp::ge,ir_cmp::lt,ir_cmp::le};
+            t.cc = swapped[(int)t.cc];
+        }
+        if(t.ops[0] == iv){
+            t.ops[0] = p;
+            t.ops[1] = end;
+        }else{
+            t.ops[0] = end;
+            t.ops[1] = p;
+        }
+        tests++;
+    }
+};
+
+uint32_t reduce_strength(ir_function &fn,uint32_t &tests_replaced){
+    dominator_tree dom(fn);
+    loop_forest lf(fn,dom);
+    strength_reducer s(fn,dom,lf);
+    //Users only change where something was reduced.
+    uint32_t seen = ~0u;
+    for(uint32_t l = lf.loops.size();l-- > 0;){
+        if(seen != s.reduced + s.tests) s.build_users();
+        seen = s.reduced + s.tests;
+        s.run_loop(l);
+    }
+    tests_replaced += s.tests;
+    return s.reduced;
+}
@@ -0,0 +1,3 @@
+#include "symbol.hpp"
+
+symbol_table symbols;
@@ -1,8 +1,11 @@
 #include "syntax_tree.hpp"
 #include "token.hpp"
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
 
-ast_node::~ast_node() = default;
 void ast_node::accept(tree_visitor &tv){
     tv.accept(*this);
 }
@@ -11,41 +14,61 @@ void expr::accept(tree_visitor &tv){
     tv.accept(*this);
 }
 
-var_expr::~var_expr() = default;
 void var_expr::accept(tree_visitor & tv){
     tv.accept(*this);
 }
-int_literal_expr::~int_literal_expr() = default;
 void int_literal_expr::accept(tree_visitor &tv){
     tv.accept(*this);
 }
-float_literal_expr::~float_literal_expr() = default;
 void float_literal_expr::accept(tree_visitor &tv){
     tv.accept(*this);
 }
-binary_expr::~binary_expr() = default;
 void binary_expr::accept(tree_visitor &tv){
     tv.accept(*this);
 }
-assign_expr::~assign_expr() = default;
 void assign_expr::accept(tree_visitor &tv){
     tv.accept(*this);
 }
-prefix_expr::~prefix_expr() = default;
 void prefix_expr::accept(tree_visitor &tv){
     tv.accept(*this);
 }
-fun_call_expr::~fun_call_expr() = default;
 void fun_call_expr::accept(tree_visitor &tv){
     tv.accept(*this);
 }
-index_expr::~index_expr() = default;
 void index_expr::accept(tree_visitor &tv){
     tv.accept(*this);
 }
 void init_val::accept(tree_visitor &tv){
     tv.accept(*this);
 }
+static size_t elements(const vector<int> &dimens,size_t from){
+    size_t n = 1;
+    for(size_t k = from;k < dimens.size();++k) n *= dimens[k];
+    return n;
+}
+//Fills out[begin,end) from a brace list covering dimens[dim..].
+static void flatten_into(const init_val* list,const vector<int> &dimens,size_t dim,vector<expr*> &out,size_t begin,size_t end){
+    size_t cur = begin;
+    for(auto item : list->vals){
+        if(cur >= end) throw string("Too many initializers.");
+        if(item->val){
+            out[cur++] = item->val;
+            continue;
+        }
+        size_t k = dim + 1;
+        while(k < dimens.size() && (cur - begin) % elements(dimens,k) != 0) k++;
+        size_t size = elements(dimens,k);
+        flatten_into(item,dimens,k,out,cur,min(cur + size,end));
+        cur += size;
+    }
+}
+vector<expr*> flatten_init(const init_val* init,const vector<int> &dimens){
+    vector<expr*> out(elements(dimens,0),nullptr);
+    if(init->val) out[0] = init->val;
+    else flatten_into(init,dimens,0,out,0,out.size());
+    return out;
+}
+
 void Type::accept(tree_visitor &tv){
     tv.accept(*this);
 }
@@ -95,7 +118,7 @@ ast_printerv1::~ast_printerv1() {};
 void ast_printerv1::accept(ast_node &an){}
 void ast_printerv1::accept(expr &e){}
 void ast_printerv1::accept(var_expr& ve){
-    std::cout << ve.varname;
+    std::cout << symbols.name(ve.varname);
 }
 void ast_printerv1::accept(int_literal_expr& e) {
     std::cout << e.value;
@@ -160,10 +183,10 @@ void ast_printerv1::accept(Type& t){
     }
 }
 void ast_printerv1::accept(func_def& fd){
-    std::cout << fd.return_type << " " << fd.name << "(";
+    std::cout << fd.return_type << " " << symbols.name(fd.name) << "(";
     for(auto &p : fd.fparams){
         p.first.accept(*this);
-        std::cout << " " << p.second << ',';
+        std::cout << " " << symbols.name(p.second) << ',';
     }
     std::cout << ")";
     fd.body->accept(*this);
@@ -171,7 +194,7 @@ void ast_printerv1::accept(func_def& fd){
 void ast_printerv1::accept(decl &d) {
     if(d.is_const) std::cout << "const ";
     d.type.accept(*this);
-    std::cout << " " << d.name;
+    std::cout << " " << symbols.name(d.name);
     if(d.init){
         std::cout << " = ";
         d.init->accept(*this);
@@ -0,0 +1,178 @@
+#include "ir.hpp"
+#include "ir_opt.hpp"
+#include <utility>
+#include <vector>
+using namespace std;
+
+// A call of the function itself that b returns, directly or as `x + call`
+// or `x * call`.
+struct tail_site {
+    uint32_t block;
+    uint32_t call;
+    uint32_t combine; //the add or mul of an accumulating call, or no_value
+};
+
+//Whether a pointer argument may lead into a stack slot of the function,
+//which the next trip of the loop would reuse while it's still being read.
+static bool into_frame(const ir_function &fn,uint32_t p){
+    while(fn.insts[p].op == ir_op::ptradd) p = fn.insts[p].ops[0];
+    return fn.insts[p].op != ir_op::arg && fn.insts[p].op != ir_op::global;
+}
+
+//Exchanges the numbers of blocks a and b, which are laid out in number
+//order by the backends.
+static void swap_blocks(ir_function &fn,uint32_t a,uint32_t b){
+    auto other = [&](uint32_t &x){
+        if(x == a) x = b;
+        else if(x == b) x = a;
+    };
+    for(auto &blk : fn.blocks){
+        for(auto &p : blk.preds) other(p);
+        if(blk.insts.empty()) continue;
+        ir_inst &t = fn.insts[blk.insts.back()];
+        if(t.op == ir_op::br) other(t.ops[0]);
+        else if(t.op == ir_op::condbr){
+            other(t.ops[1]);
+            other(t.ops[2]);
+        }
+    }
+    swap(fn.blocks[a],fn.blocks[b]);
+    for(uint32_t v : fn.blocks[a].insts) fn.insts[v].block = a;
+    for(uint32_t v : fn.blocks[b].insts) fn.insts[v].block = b;
+}
+
+static bool find_site(const ir_function &fn,uint32_t self,uint32_t b,bool frame,ir_op &acc,tail_site &s){
+    auto &insts = fn.blocks[b].insts;
+    size_t n = insts.size();
+    if(n < 2 || fn.insts[insts.back()].op != ir_op::ret) return false;
+    uint32_t result = fn.insts[insts.back()].ops[0],last = insts[n - 2];
+    s = {b,last,no_value};
+    if(fn.insts[last].op != ir_op::call){
+        //x op call, where op is the accumulating one of the function.
+        const ir_inst &a = fn.insts[last];
+        if(n < 3 || result != last || a.type != ir_type::i32) return false;
+        if((a.op != ir_op::add && a.op != ir_op::mul) || (acc != ir_op::nop && a.op != acc)) return false;
+        s = {b,insts[n - 3],last};
+        if((a.ops[0] == s.call) == (a.ops[1] == s.call)) return false;
+    }else if(result != last && result != no_value) return false;
+    const ir_inst &c = fn.insts[s.call];
+    if(c.op != ir_op::call || c.index != self) return false;
+    for(uint32_t k = 0;frame && k < c.nlist;++k){
+        if(fn.params[k] == ir_type::ptr && into_frame(fn,fn.list(c)[k])) return false;
+    }
+    if(s.combine != no_value) acc = fn.insts[s.combine].op;
+    return true;
+}
+
+uint32_t tail_recursion(ir_function &fn,uint32_t self){
+    if(!fn.blocks[0].preds.empty()) return 0;
+    bool frame = false;
+    for(uint32_t v : fn.blocks[0].insts) frame |= fn.insts[v].op == ir_op::alloca;
+    ir_op acc = ir_op::nop;
+    vector<tail_site> sites;
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        tail_site s;
+        if(!fn.blocks[b].insts.empty() && find_site(fn,self,b,frame,acc,s)) sites.push_back(s);
+    }
+    if(sites.empty()) return 0;
+
+    //The entry keeps the stack slots and jumps to the new loop header.
+    uint32_t head = fn.new_block();
+    vector<uint32_t> slots;
+    for(uint32_t v : fn.blocks[0].insts){
+        auto &to = fn.insts[v].op == ir_op::alloca ? slots : fn.blocks[head].insts;
+        to.push_back(v);
+    }
+    for(uint32_t v : fn.blocks[head].insts) fn.insts[v].block = head;
+    fn.blocks[0].insts = slots;
+    for(auto &s : sites){
+        if(s.block == 0) s.block = head;
+    }
+    uint32_t succ[2];
+    for(uint32_t k = fn.successors(head,succ);k-- > 0;){
+        for(auto &p : fn.blocks[succ[k]].preds){
+            if(p == 0) p = head;
+        }
+    }
+    ir_inst br{};
+    br.op = ir_op::br;
+    br.ops[0] = head;
+    br.ops[1] = br.ops[2] = no_value;
+    fn.append(0,br);
+    fn.blocks[head].preds.push_back(0);
+
+    //A phi per parameter, and one for the accumulated value.
+    ir_inst phi{};
+    phi.op = ir_op::phi;
+    phi.ops[0] = phi.ops[1] = phi.ops[2] = no_value;
+    vector<uint32_t> phis;
+    vector<vector<uint32_t>> incoming;
+    for(uint32_t k = 0;k < fn.args.size();++k){
+        phi.type = fn.params[k];
+        uint32_t p = fn.add(phi);
+        fn.replace_uses(fn.args[k],p);
+        phis.push_back(p);
+        incoming.push_back({fn.args[k]});
+    }
+    uint32_t acc_phi = no_value;
+    if(acc != ir_op::nop){
+        ir_inst unit{};
+        unit.op = ir_op::iconst;
+        unit.type = ir_type::i32;
+        unit.ops[0] = unit.ops[1] = unit.ops[2] = no_value;
+        unit.imm = acc == ir_op::mul;
+        phi.type = ir_type::i32;
+        acc_phi = fn.add(phi);
+        phis.push_back(acc_phi);
+        incoming.push_back({fn.add(unit)});
+    }
+    for(uint32_t k = phis.size();k-- > 0;){
+        fn.insts[phis[k]].block = head;
+        fn.blocks[head].insts.insert(fn.blocks[head].insts.begin(),phis[k]);
+    }
+
+    for(auto &s : sites){
+        auto &insts = fn.blocks[s.block].insts;
+        const ir_inst &c = fn.insts[s.call];
+        for(uint32_t k = 0;k < fn.args.size();++k) incoming[k].push_back(fn.list(c)[k]);
+        fn.erase(insts.back());
+        if(s.combine != no_value){
+            //acc op x carries on to the next trip.
+            ir_inst &a = fn.insts[s.combine];
+            for(auto &op : a.ops){
+                if(op == s.call) op = acc_phi;
+            }
+            incoming.back().push_back(s.combine);
+        }else if(acc_phi != no_value) incoming.back().push_back(acc_phi);
+        fn.erase(s.call);
+        fn.append(s.block,br);
+        fn.blocks[head].preds.push_back(s.block);
+    }
+    for(uint32_t k = 0;k < phis.size();++k) fn.set_list(phis[k],incoming[k]);
+    //Right after the entry, where the code it took was.
+    swap_blocks(fn,1,head);
+
+    //What the other returns give back is combined with what was accumulated.
+    if(acc_phi != no_value){
+        for(uint32_t b = 0;b < fn.blocks.size();++b){
+            auto &insts = fn.blocks[b].insts;
+            if(insts.empty() || fn.insts[insts.back()].op != ir_op::ret) continue;
+            const ir_inst &value = fn.insts[fn.insts[insts.back()].ops[0]];
+            if(value.op == ir_op::iconst && value.imm == (acc == ir_op::mul)){
+                fn.insts[insts.back()].ops[0] = acc_phi;
+                continue;
+            }
+            ir_inst a{};
+            a.op = acc;
+            a.type = ir_type::i32;
+            a.ops[0] = acc_phi;
+            a.ops[1] = fn.insts[insts.back()].ops[0];
+            a.ops[2] = no_value;
+            uint32_t v = fn.add(a),r = insts.back();
+            fn.insts[v].block = b;
+            insts.insert(insts.end() - 1,v);
+            fn.insts[r].ops[0] = v;
+        }
+    }
+    return sites.size();
+}
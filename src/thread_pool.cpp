@@ -0,0 +1,84 @@
+#include "thread_pool.hpp"
+
+using namespace std;
+
+thread_pool::thread_pool(unsigned workers) : generation(0),busy(0),stopping(false),job(nullptr){
+    if(workers == 0) workers = 1;
+    for(unsigned i = 0;i < workers;++i) queues.push_back(make_unique<task_queue>());
+    for(unsigned i = 1;i < workers;++i) threads.emplace_back([this,i]{loop(i);});
+}
+
+thread_pool::~thread_pool(){
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for(auto &t : threads) t.join();
+}
+
+bool thread_pool::pop(unsigned worker,uint32_t &task){
+    {
+        task_queue &own = *queues[worker];
+        lock_guard<mutex> lock(own.m);
+        if(!own.tasks.empty()){
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for(unsigned i = 1;i < queues.size();++i){
+        task_queue &victim = *queues[(worker + i) % queues.size()];
+        lock_guard<mutex> lock(victim.m);
+        if(!victim.tasks.empty()){
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::work(unsigned worker){
+    uint32_t task;
+    while(pop(worker, task)) (*job)(task, worker);
+}
+
+void thread_pool::loop(unsigned worker){
+    uint64_t seen = 0;
+    for(;;){
+        {
+            unique_lock<mutex> lock(m);
+            start_cv.wait(lock, [&]{return stopping || generation != seen;});
+            if(stopping) return;
+            seen = generation;
+        }
+        work(worker);
+        {
+            lock_guard<mutex> lock(m);
+            busy--;
+        }
+        done_cv.notify_all();
+    }
+}
+
+void thread_pool::run(uint32_t count,const task_fn &fn){
+    unsigned n = queues.size();
+    for(unsigned w = 0;w < n;++w){
+        uint32_t beg = (uint64_t)count * w / n,end = (uint64_t)count * (w + 1) / n;
+        //Own tasks are popped from the back, so push the block reversed to
+        //start with its first task.
+        for(uint32_t t = end;t > beg;--t) queues[w]->tasks.push_back(t - 1);
+    }
+    {
+        lock_guard<mutex> lock(m);
+        job = &fn;
+        busy = n - 1;
+        generation++;
+    }
+    start_cv.notify_all();
+    work(0);
+    unique_lock<mutex> lock(m);
+    done_cv.wait(lock, [&]{return busy == 0;});
+    job = nullptr;
+}
@@ -0,0 +1,157 @@
+#include "time_report.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <new>
+#include <sys/resource.h>
+
+using namespace std;
+
+time_report compile_report;
+
+static atomic<uint64_t> total_allocs{0},total_bytes{0};
+static thread_local uint64_t local_allocs = 0,local_bytes = 0;
+
+static void* counted_alloc(size_t size){
+    total_allocs.fetch_add(1, memory_order_relaxed);
+    total_bytes.fetch_add(size, memory_order_relaxed);
+    local_allocs++;local_bytes += size;
+    if(size == 0) size = 1;
+    return malloc(size);
+}
+
+void* operator new(size_t size){
+    if(void *p = counted_alloc(size)) return p;
+    throw bad_alloc();
+}
+void* operator new[](size_t size){
+    if(void *p = counted_alloc(size)) return p;
+    throw bad_alloc();
+}
+void* operator new(size_t size,const nothrow_t&) noexcept{return counted_alloc(size);}
+void* operator new[](size_t size,const nothrow_t&) noexcept{return counted_alloc(size);}
+void operator delete(void *p) noexcept{free(p);}
+void operator delete[](void *p) noexcept{free(p);}
+void operator delete(void *p,size_t) noexcept{free(p);}
+void operator delete[](void *p,size_t) noexcept{free(p);}
+
+uint64_t alloc_count(){return total_allocs.load(memory_order_relaxed);}
+uint64_t alloc_bytes(){return total_bytes.load(memory_order_relaxed);}
+uint64_t thread_alloc_count(){return local_allocs;}
+uint64_t thread_alloc_bytes(){return local_bytes;}
+
+long peak_rss_kb(){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024; //bytes on macOS
+#else
+    return ru.ru_maxrss;
+#endif
+}
+double wall_now_ms(){
+    return chrono::duration<double,milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+static double clock_ms(clockid_t id){
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+double process_cpu_ms(){return clock_ms(CLOCK_PROCESS_CPUTIME_ID);}
+double thread_cpu_ms(){return clock_ms(CLOCK_THREAD_CPUTIME_ID);}
+
+phase_timer::phase_timer(const char *name) : name(name){
+    start = {wall_now_ms(),process_cpu_ms(),alloc_count(),alloc_bytes()};
+}
+phase_timer::~phase_timer(){
+    if(!compile_report.enabled) return;
+    usage_sample u = {
+        wall_now_ms() - start.wall_ms,process_cpu_ms() - start.cpu_ms,
+        alloc_count() - start.allocs,alloc_bytes() - start.alloc_bytes
+    };
+    compile_report.phases.push_back({name,u,peak_rss_kb()});
+}
+
+function_timer::function_timer(){
+    start = {wall_now_ms(),thread_cpu_ms(),thread_alloc_count(),thread_alloc_bytes()};
+}
+usage_sample function_timer::stop() const{
+    return {
+        wall_now_ms() - start.wall_ms,thread_cpu_ms() - start.cpu_ms,
+        thread_alloc_count() - start.allocs,thread_alloc_bytes() - start.alloc_bytes
+    };
+}
+
+static void print_row(ostream &os,const string &name,const usage_sample &u,long rss){
+    os << left << setw(28) << name << right << fixed << setprecision(2)
+       << setw(11) << u.wall_ms << setw(11) << u.cpu_ms
+       << setw(12) << u.allocs << setw(14) << u.alloc_bytes;
+    if(rss >= 0) os << setw(12) << rss;
+    os << "\n";
+}
+
+void time_report::print_table(ostream &os) const{
+    os << left << setw(28) << "phase" << right << setw(11) << "wall ms" << setw(11) << "cpu ms"
+       << setw(12) << "allocs" << setw(14) << "alloc bytes" << setw(12) << "peak KB" << "\n";
+    usage_sample total = {0,0,0,0};
+    for(auto &p : phases){
+        print_row(os, p.name, p.usage, p.peak_rss_kb);
+        total.wall_ms += p.usage.wall_ms;total.cpu_ms += p.usage.cpu_ms;
+        total.allocs += p.usage.allocs;total.alloc_bytes += p.usage.alloc_bytes;
+    }
+    print_row(os, "total", total, peak_rss_kb());
+    if(!counters.empty()) os << "\n";
+    for(auto &c : counters) os << left << setw(28) << c.first << right << setw(16) << fixed << setprecision(0) << c.second << "\n";
+    if(functions.empty()) return;
+
+    const size_t shown = 10;
+    vector<const phase_record*> slowest;
+    for(auto &f : functions) slowest.push_back(&f);
+    sort(slowest.begin(), slowest.end(), [](auto a,auto b){return a->usage.wall_ms > b->usage.wall_ms;});
+    if(slowest.size() > shown) slowest.resize(shown);
+    os << "\n" << left << setw(28) << "slowest functions (check)" << right << setw(11) << "wall ms" << setw(11) << "cpu ms"
+       << setw(12) << "allocs" << setw(14) << "alloc bytes" << "\n";
+    for(auto f : slowest) print_row(os, f->name, f->usage, -1);
+    os << "(" << functions.size() << " functions checked)\n";
+}
+
+static void json_string(ostream &os,const string &s){
+    os << '"';
+    for(char c : s){
+        if(c == '"' || c == '\\') os << '\\';
+        os << c;
+    }
+    os << '"';
+}
+static void json_usage(ostream &os,const usage_sample &u){
+    os << "\"wall_ms\":" << u.wall_ms << ",\"cpu_ms\":" << u.cpu_ms
+       << ",\"allocs\":" << u.allocs << ",\"alloc_bytes\":" << u.alloc_bytes;
+}
+
+void time_report::print_json(ostream &os) const{
+    os << fixed << setprecision(3) << "{\"phases\":[";
+    for(size_t i = 0;i < phases.size();++i){
+        if(i) os << ",";
+        os << "{\"name\":";json_string(os, phases[i].name);
+        os << ",";json_usage(os, phases[i].usage);
+        os << ",\"peak_rss_kb\":" << phases[i].peak_rss_kb << "}";
+    }
+    os << "],\"functions\":[";
+    for(size_t i = 0;i < functions.size();++i){
+        if(i) os << ",";
+        os << "{\"name\":";json_string(os, functions[i].name);
+        os << ",";json_usage(os, functions[i].usage);
+        os << "}";
+    }
+    os << "],\"counters\":{";
+    for(size_t i = 0;i < counters.size();++i){
+        if(i) os << ",";
+        json_string(os, counters[i].first);
+        os << ":" << counters[i].second;
+    }
+    os << "},\"peak_rss_kb\":" << peak_rss_kb() << "}\n";
+}
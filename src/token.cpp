@@ -33,30 +33,35 @@ std::ostream& operator<<(std::ostream& os,const TokenType &t){
     return os;
 }
 
-Token::~Token(){
-    switch (this->type) {
-    case IntLiteral : delete (int*)this->literal;break;
-    case FloatLiteral : delete (float*)this->literal;break;
-    case StringLiteral :
-    case LexError:
-    case Ident : delete (std::string*)this->literal;break;
-    default:break;
+std::string Token::string_value() const{
+    std::string res;
+    for(uint32_t i = 0;i < len;++i){
+        char c = beg[i];
+        if(c == '\\' && i + 1 < len){
+            switch (beg[++i]) {//todo!
+            case 'n' : c = '\n';break;
+            case 't' : c = '\t';break;
+            case '\"' : c = '\"';break;
+            default: c = '\\';
+            }
+        }
+        res.push_back(c);
     }
+    return res;
 }
 
 std::ostream& operator<<(std::ostream& os,const Token &token){
     os << '(';
     os << token.type << ',';
     switch (token.type) {
-    case IntLiteral : os << *(int*)token.literal << ",";break;
-    case FloatLiteral : os << *(float*)token.literal << ",";break;
-    case StringLiteral :
+    case IntLiteral : os << token.int_value << ",";break;
+    case FloatLiteral : os << token.float_value << ",";break;
+    case StringLiteral : os << token.string_value() << ",";break;
     case LexError:
-    case Ident: os << *(std::string*)token.literal << ",";break;
+    case Ident: os << token.text() << ",";break;
 
     default:break;
     }
     os << "line:" << token.line << ",column:" << token.column << ")";
     return os;
 }
-
@@ -0,0 +1,486 @@
+#include "vm.hpp"
+#include "runtime.hpp"
+#include <climits>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <sys/mman.h>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#if defined(__GNUC__) && !defined(SYSY_VM_SWITCH)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+uint32_t vm_program::inst_count() const {
+    uint32_t n = 0;
+    for(auto &f : functions) n += f.code.size();
+    return n;
+}
+
+// Lowers one IR function. Blocks are laid out in IR order so a jump to the
+// next block can be dropped.
+struct bytecode_compiler {
+    const ir_module &mod;
+    const ir_function &fn;
+    const vm_program &program;
+    vm_function &out;
+
+    vector<uint32_t> reg;    //IR value -> register
+    vector<uint32_t> uses;
+    vector<char> fused;      //compare or index scale folded into its user
+    vector<uint32_t> block_pc;
+    uint32_t temp;           //breaks copy cycles, receives unused call results
+
+    struct fixup {
+        uint32_t pc;
+        uint32_t block;
+    };
+    struct stub {
+        uint32_t pc;       //branch jumping to the stub
+        uint32_t from,to;  //the edge
+    };
+    vector<fixup> fixups;
+    vector<stub> stubs;
+
+    bytecode_compiler(const ir_module &m,const ir_function &fn,const vm_program &p,vm_function &out)
+        : mod(m),fn(fn),program(p),out(out){}
+
+    void emit(vm_op op,uint32_t a = 0,uint32_t b = 0,uint32_t c = 0){out.code.push_back({op,a,b,c});}
+    void emit_jump(vm_op op,uint32_t a,uint32_t b,uint32_t block){
+        fixups.push_back({(uint32_t)out.code.size(),block});
+        emit(op,a,b,0);
+    }
+    bool has_phis(uint32_t b) const {
+        auto &insts = fn.blocks[b].insts;
+        return !insts.empty() && fn.insts[insts[0]].op == ir_op::phi;
+    }
+    void assign_registers();
+    void copies(uint32_t from,uint32_t to);
+    void branch(uint32_t b,const ir_inst &t);
+    void inst(uint32_t b,uint32_t v);
+    void compile();
+};
+
+void bytecode_compiler::assign_registers(){
+    reg.assign(fn.insts.size(),no_value);
+    uses.assign(fn.insts.size(),0);
+    fused.assign(fn.insts.size(),0);
+    for(auto &b : fn.blocks){
+        for(uint32_t v : b.insts){
+            for_each_operand(fn,fn.insts[v],[&](const uint32_t &op){uses[op]++;});
+        }
+    }
+    for(uint32_t v = 0;v < fn.insts.size();++v){
+        const ir_inst &i = fn.insts[v];
+        if(!is_leaf(i.op) || i.op == ir_op::arg || uses[v] == 0) continue;
+        vm_value c;
+        c.p = nullptr;
+        if(i.op == ir_op::iconst) c.i = i.imm;
+        else if(i.op == ir_op::fconst) c.f = i.fimm;
+        else if(i.op == ir_op::global) c.p = (char*)program.globals[i.index].data();
+        reg[v] = out.consts.size();
+        out.consts.push_back(c);
+    }
+    uint32_t next = out.consts.size();
+    for(uint32_t v : fn.args) reg[v] = next++;
+    out.nparams = fn.args.size();
+
+    //Single-use compares feeding the branch of their block and `index * 4`
+    //feeding only ptradds become one instruction.
+    vector<uint32_t> scaled(fn.insts.size(),0);
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        for(uint32_t v : fn.blocks[b].insts){
+            const ir_inst &i = fn.insts[v];
+            if(i.op == ir_op::condbr){
+                const ir_inst &c = fn.insts[i.ops[0]];
+                bool pointers = c.op == ir_op::icmp && fn.insts[c.ops[0]].type == ir_type::ptr;
+                if((c.op == ir_op::icmp || c.op == ir_op::fcmp) && !pointers && c.block == b && uses[i.ops[0]] == 1) fused[i.ops[0]] = 1;
+            }else if(i.op == ir_op::ptradd){
+                const ir_inst &m = fn.insts[i.ops[1]];
+                if(m.op == ir_op::mul && ++scaled[i.ops[1]] == uses[i.ops[1]]
+                    && fn.insts[m.ops[1]].op == ir_op::iconst && fn.insts[m.ops[1]].imm == 4) fused[i.ops[1]] = 1;
+            }
+        }
+    }
+    for(auto &b : fn.blocks){
+        for(uint32_t v : b.insts){
+            if(fn.insts[v].type != ir_type::none && !fused[v]) reg[v] = next++;
+        }
+    }
+    temp = next++;
+    out.nregs = next;
+}
+
+//Parallel copies into the phis of `to` along the edge from -> to.
+void bytecode_compiler::copies(uint32_t from,uint32_t to){
+    auto &preds = fn.blocks[to].preds;
+    uint32_t k = 0;
+    while(preds[k] != from) ++k;
+    vector<pair<uint32_t,uint32_t>> moves; //(dst,src)
+    for(uint32_t v : fn.blocks[to].insts){
+        const ir_inst &i = fn.insts[v];
+        if(i.op != ir_op::phi) break;
+        uint32_t src = reg[fn.list(i)[k]];
+        if(src != reg[v]) moves.push_back({reg[v],src});
+    }
+    while(!moves.empty()){
+        bool progress = false;
+        for(size_t m = 0;m < moves.size();++m){
+            bool read = false;
+            for(auto &o : moves) read |= o.second == moves[m].first;
+            if(read) continue;
+            emit(vm_op::mov,moves[m].first,moves[m].second);
+            moves.erase(moves.begin() + m);
+            progress = true;
+            break;
+        }
+        if(progress) continue;
+        //Only cycles are left: save one destination and redirect its readers.
+        uint32_t d = moves[0].first;
+        emit(vm_op::mov,temp,d);
+        for(auto &o : moves) if(o.second == d) o.second = temp;
+    }
+}
+
+static vm_op jump_op(ir_op op,ir_cmp cc){
+    static const vm_op ints[] = {vm_op::jeq,vm_op::jne,vm_op::jlt,vm_op::jle,vm_op::jgt,vm_op::jge};
+    static const vm_op floats[] = {vm_op::jfeq,vm_op::jfne,vm_op::jflt,vm_op::jfle,vm_op::jfgt,vm_op::jfge};
+    return (op == ir_op::icmp ? ints : floats)[(int)cc];
+}
+static ir_cmp invert(ir_cmp cc){
+    static const ir_cmp inverse[] = {ir_cmp::ne,ir_cmp::eq,ir_cmp::ge,ir_cmp::gt,ir_cmp::le,ir_cmp::lt};
+    return inverse[(int)cc];
+}
+
+void bytecode_compiler::branch(uint32_t b,const ir_inst &t){
+    uint32_t then_block = t.ops[1],else_block = t.ops[2];
+    //An edge into phis is critical here; its copies go to a stub.
+    auto target = [&](vm_op op,uint32_t x,uint32_t y,uint32_t to){
+        if(has_phis(to)){
+            stubs.push_back({(uint32_t)out.code.size(),b,to});
+            emit(op,x,y,0);
+        }else emit_jump(op,x,y,to);
+    };
+    bool then_next = then_block == b + 1 && !has_phis(then_block);
+    bool else_next = else_block == b + 1 && !has_phis(else_block);
+    const ir_inst &c = fn.insts[t.ops[0]];
+    if(fused[t.ops[0]]){
+        uint32_t x = reg[c.ops[0]],y = reg[c.ops[1]];
+        //Only integer compares can be inverted: !(a < b) is not a >= b for NaN.
+        if(then_next && c.op == ir_op::icmp){
+            target(jump_op(c.op,invert(c.cc)),x,y,else_block);
+            return;
+        }
+        target(jump_op(c.op,c.cc),x,y,then_block);
+    }else if(then_next){
+        target(vm_op::jz,reg[t.ops[0]],0,else_block);
+        return;
+    }else target(vm_op::jnz,reg[t.ops[0]],0,then_block);
+    if(!else_next) target(vm_op::jmp,0,0,else_block);
+}
+
+void bytecode_compiler::inst(uint32_t b,uint32_t v){
+    static const vm_op int_cmp[] = {vm_op::eq,vm_op::ne,vm_op::lt,vm_op::le,vm_op::gt,vm_op::ge};
+    static const vm_op float_cmp[] = {vm_op::feq,vm_op::fne,vm_op::flt,vm_op::fle,vm_op::fgt,vm_op::fge};
+    static const vm_op ptr_cmp[] = {vm_op::peq,vm_op::pne,vm_op::plt,vm_op::ple,vm_op::pgt,vm_op::pge};
+    const ir_inst &i = fn.insts[v];
+    if(fused[v]) return;
+    uint32_t a = reg[v];
+    auto r = [&](uint32_t k){return reg[i.ops[k]];};
+    switch(i.op){
+    case ir_op::add: emit(vm_op::add,a,r(0),r(1)); break;
+    case ir_op::sub: emit(vm_op::sub,a,r(0),r(1)); break;
+    case ir_op::mul: emit(vm_op::mul,a,r(0),r(1)); break;
+    case ir_op::div: emit(vm_op::div,a,r(0),r(1)); break;
+    case ir_op::rem: emit(vm_op::rem,a,r(0),r(1)); break;
+    case ir_op::fadd: emit(vm_op::fadd,a,r(0),r(1)); break;
+    case ir_op::fsub: emit(vm_op::fsub,a,r(0),r(1)); break;
+    case ir_op::fmul: emit(vm_op::fmul,a,r(0),r(1)); break;
+    case ir_op::fdiv: emit(vm_op::fdiv,a,r(0),r(1)); break;
+    case ir_op::fneg: emit(vm_op::fneg,a,r(0)); break;
+    case ir_op::icmp:
+        emit((fn.insts[i.ops[0]].type == ir_type::ptr ? ptr_cmp : int_cmp)[(int)i.cc],a,r(0),r(1));
+        break;
+    case ir_op::fcmp: emit(float_cmp[(int)i.cc],a,r(0),r(1)); break;
+    case ir_op::itof: emit(vm_op::itof,a,r(0)); break;
+    case ir_op::ftoi: emit(vm_op::ftoi,a,r(0)); break;
+    case ir_op::alloca:
+        emit(vm_op::alloca,a,out.frame_bytes);
+        out.frame_bytes += (i.imm + 7) & ~7;
+        break;
+    case ir_op::ptradd:
+        if(fused[i.ops[1]]) emit(vm_op::index4,a,r(0),reg[fn.insts[i.ops[1]].ops[0]]);
+        else emit(vm_op::ptradd,a,r(0),r(1));
+        break;
+    case ir_op::load: emit(vm_op::load,a,r(0)); break;
+    case ir_op::store: emit(vm_op::store,r(0),r(1)); break;
+    case ir_op::memzero: emit(vm_op::memzero,r(0),i.imm); break;
+    case ir_op::call:{
+        const ir_function &callee = mod.functions[i.index];
+        uint32_t args = out.args.size();
+        for(uint32_t k = 0;k < i.nlist;++k) out.args.push_back(reg[fn.list(i)[k]]);
+        uint32_t dest = a == no_value ? temp : a;
+        if(callee.is_extern) emit(vm_op::callrt,dest,find_runtime(callee.name),args);
+        else emit(vm_op::call,dest,i.index,args);
+        break;
+    }
+    case ir_op::phi: break;
+    case ir_op::br:
+        copies(b,i.ops[0]);
+        if(i.ops[0] != b + 1) emit_jump(vm_op::jmp,0,0,i.ops[0]);
+        break;
+    case ir_op::condbr: branch(b,i); break;
+    case ir_op::ret:
+        if(i.ops[0] == no_value) emit(vm_op::retv);
+        else emit(vm_op::ret,r(0));
+        break;
+    default:
+        throw string("Can't lower ") + to_string((int)i.op) + " to bytecode.";
+    }
+}
+
+void bytecode_compiler::compile(){
+    out.name = fn.name;
+    assign_registers();
+    block_pc.resize(fn.blocks.size());
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        block_pc[b] = out.code.size();
+        for(uint32_t v : fn.blocks[b].insts) inst(b,v);
+    }
+    for(auto &s : stubs){
+        out.code[s.pc].c = out.code.size();
+        copies(s.from,s.to);
+        emit_jump(vm_op::jmp,0,0,s.to);
+    }
+    for(auto &f : fixups) out.code[f.pc].c = block_pc[f.block];
+}
+
+vm_program compile_bytecode(const ir_module &m){
+    vm_program p;
+    for(auto &g : m.globals){
+        p.globals.emplace_back((g.size + 3) / 4,0);
+        copy(g.init.begin(),g.init.end(),p.globals.back().begin());
+    }
+    p.functions.resize(m.functions.size());
+    for(uint32_t f = 0;f < m.functions.size();++f){
+        const ir_function &fn = m.functions[f];
+        if(fn.is_extern){
+            p.functions[f].name = fn.name;
+            p.functions[f].runtime = find_runtime(fn.name);
+            p.functions[f].nparams = fn.params.size();
+            continue;
+        }
+        bytecode_compiler(m,fn,p,p.functions[f]).compile();
+    }
+    p.entry = m.find_function("main");
+    if(p.entry < 0) throw string("No main function.");
+    return p;
+}
+
+void print(ostream &os,const vm_program &p){
+    static const char* const names[] = {
+#define VM_NAME(name) #name,
+        VM_OPS(VM_NAME)
+#undef VM_NAME
+    };
+    for(auto &f : p.functions){
+        if(f.runtime >= 0) continue;
+        os << f.name << ": " << f.nregs << " registers, " << f.consts.size() << " constants, "
+           << f.nparams << " parameters, " << f.frame_bytes << " bytes of frame\n";
+        for(uint32_t pc = 0;pc < f.code.size();++pc){
+            const vm_inst &i = f.code[pc];
+            os << "  " << pc << "\t" << names[(int)i.op] << " " << i.a << " " << i.b << " " << i.c << "\n";
+        }
+    }
+}
+
+static vm_value call_runtime(const runtime_function &rt,const vm_value *a){
+    vm_value v;
+    v.p = nullptr;
+    //Every library function has one of these signatures.
+    switch(rt.params.size()){
+    case 0:
+        if(rt.ret == Int) v.i = ((int(*)())rt.native)();
+        else if(rt.ret == Float) v.f = ((float(*)())rt.native)();
+        else ((void(*)())rt.native)();
+        break;
+    case 1:
+        if(rt.params[0] == runtime_arg::i32) ((void(*)(int))rt.native)(a[0].i);
+        else if(rt.params[0] == runtime_arg::f32) ((void(*)(float))rt.native)(a[0].f);
+        else v.i = ((int(*)(void*))rt.native)(a[0].p);
+        break;
+    default:
+        ((void(*)(int,void*))rt.native)(a[0].i,a[1].p);
+    }
+    return v;
+}
+
+// Reserved address space; pages are only touched when a frame gets there.
+struct vm_stack {
+    char *base;
+    size_t size;
+    explicit vm_stack(size_t size) : size(size){
+        base = (char*)mmap(nullptr,size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,-1,0);
+        if(base == MAP_FAILED) throw string("Can't reserve the VM stack.");
+    }
+    ~vm_stack(){munmap(base,size);}
+};
+
+int vm::run(){
+    struct frame {
+        const vm_function *fn;
+        const vm_inst *ret;
+        vm_value *regs;
+        char *mem;
+        uint32_t dest;
+    };
+    vm_stack reg_stack(size_t(1) << 29),mem_stack(size_t(1) << 28);
+    vm_value *const reg_limit = (vm_value*)(reg_stack.base + reg_stack.size);
+    char *const mem_limit = mem_stack.base + mem_stack.size;
+    vector<frame> frames;
+
+    const vm_function *f = &program.functions[program.entry];
+    vm_value *r = (vm_value*)reg_stack.base;
+    char *mem = mem_stack.base;
+    if(f->nregs > 0) memcpy(r,f->consts.data(),f->consts.size() * sizeof(vm_value));
+    const vm_inst *pc = f->code.data();
+    uint64_t count = 0;
+
+#define R(x) r[pc->x]
+#define BINARY(name,field,expr) VM_CASE(name): R(a).field = (expr); ++pc; VM_NEXT();
+#define WRAP(op) (int32_t)((uint32_t)R(b).i op (uint32_t)R(c).i)
+#define JUMP_IF(name,cond) VM_CASE(name): pc = (cond) ? f->code.data() + pc->c : pc + 1; VM_NEXT();
+#ifdef VM_COMPUTED_GOTO
+    static void* const labels[] = {
+#define VM_LABEL(name) &&op_##name,
+        VM_OPS(VM_LABEL)
+#undef VM_LABEL
+    };
+#define VM_CASE(name) op_##name
+#define VM_NEXT() do{++count;goto *labels[(uint32_t)pc->op];}while(0)
+    VM_NEXT();
+#else
+#define VM_CASE(name) case vm_op::name
+#define VM_NEXT() continue
+    for(;;){
+    ++count;
+    switch(pc->op){
+#endif
+    VM_CASE(mov): r[pc->a] = r[pc->b]; ++pc; VM_NEXT();
+    BINARY(add,i,WRAP(+))
+    BINARY(sub,i,WRAP(-))
+    BINARY(mul,i,WRAP(*))
+    VM_CASE(div):
+        if(R(c).i == 0) throw string("Division by zero in ") + f->name;
+        R(a).i = R(c).i == -1 ? (int32_t)(0u - (uint32_t)R(b).i) : R(b).i / R(c).i;
+        ++pc;
+        VM_NEXT();
+    VM_CASE(rem):
+        if(R(c).i == 0) throw string("Division by zero in ") + f->name;
+        R(a).i = R(c).i == -1 ? 0 : R(b).i % R(c).i;
+        ++pc;
+        VM_NEXT();
+    BINARY(fadd,f,R(b).f + R(c).f)
+    BINARY(fsub,f,R(b).f - R(c).f)
+    BINARY(fmul,f,R(b).f * R(c).f)
+    BINARY(fdiv,f,R(b).f / R(c).f)
+    BINARY(fneg,f,-R(b).f)
+    BINARY(eq,i,R(b).i == R(c).i)
+    BINARY(ne,i,R(b).i != R(c).i)
+    BINARY(lt,i,R(b).i < R(c).i)
+    BINARY(le,i,R(b).i <= R(c).i)
+    BINARY(gt,i,R(b).i > R(c).i)
+    BINARY(ge,i,R(b).i >= R(c).i)
+    BINARY(feq,i,R(b).f == R(c).f)
+    BINARY(fne,i,R(b).f != R(c).f)
+    BINARY(flt,i,R(b).f < R(c).f)
+    BINARY(fle,i,R(b).f <= R(c).f)
+    BINARY(fgt,i,R(b).f > R(c).f)
+    BINARY(fge,i,R(b).f >= R(c).f)
+    BINARY(peq,i,R(b).p == R(c).p)
+    BINARY(pne,i,R(b).p != R(c).p)
+    BINARY(plt,i,R(b).p < R(c).p)
+    BINARY(ple,i,R(b).p <= R(c).p)
+    BINARY(pgt,i,R(b).p > R(c).p)
+    BINARY(pge,i,R(b).p >= R(c).p)
+    BINARY(itof,f,(float)R(b).i)
+    //Out of range or NaN gives INT32_MIN, as cvttss2si does.
+    BINARY(ftoi,i,R(b).f >= -2147483648.0f && R(b).f < 2147483648.0f ? (int32_t)R(b).f : INT32_MIN)
+    BINARY(alloca,p,mem + pc->b)
+    BINARY(index4,p,R(b).p + (ptrdiff_t)R(c).i * 4)
+    BINARY(ptradd,p,R(b).p + R(c).i)
+    VM_CASE(load): memcpy(&R(a).i,R(b).p,4); ++pc; VM_NEXT();
+    VM_CASE(store): memcpy(R(a).p,&R(b).i,4); ++pc; VM_NEXT();
+    VM_CASE(memzero): memset(R(a).p,0,pc->b); ++pc; VM_NEXT();
+    VM_CASE(jmp): pc = f->code.data() + pc->c; VM_NEXT();
+    JUMP_IF(jnz,R(a).i != 0)
+    JUMP_IF(jz,R(a).i == 0)
+    JUMP_IF(jeq,R(a).i == R(b).i)
+    JUMP_IF(jne,R(a).i != R(b).i)
+    JUMP_IF(jlt,R(a).i < R(b).i)
+    JUMP_IF(jle,R(a).i <= R(b).i)
+    JUMP_IF(jgt,R(a).i > R(b).i)
+    JUMP_IF(jge,R(a).i >= R(b).i)
+    JUMP_IF(jfeq,R(a).f == R(b).f)
+    JUMP_IF(jfne,R(a).f != R(b).f)
+    JUMP_IF(jflt,R(a).f < R(b).f)
+    JUMP_IF(jfle,R(a).f <= R(b).f)
+    JUMP_IF(jfgt,R(a).f > R(b).f)
+    JUMP_IF(jfge,R(a).f >= R(b).f)
+    VM_CASE(call):{
+        const vm_function *callee = &program.functions[pc->b];
+        vm_value *regs = r + f->nregs;
+        char *frame_mem = mem + f->frame_bytes;
+        if(regs + callee->nregs > reg_limit || frame_mem + callee->frame_bytes > mem_limit){
+            throw string("Stack overflow in ") + callee->name;
+        }
+        memcpy(regs,callee->consts.data(),callee->consts.size() * sizeof(vm_value));
+        const uint32_t *args = f->args.data() + pc->c;
+        vm_value *params = regs + callee->consts.size();
+        for(uint32_t k = 0;k < callee->nparams;++k) params[k] = r[args[k]];
+        frames.push_back({f,pc + 1,r,mem,pc->a});
+        f = callee;
+        r = regs;
+        mem = frame_mem;
+        pc = f->code.data();
+        VM_NEXT();
+    }
+    VM_CASE(callrt):{
+        const runtime_function &rt = runtime_functions[pc->b];
+        vm_value args[2];
+        for(uint32_t k = 0;k < rt.params.size();++k) args[k] = r[f->args[pc->c + k]];
+        R(a) = call_runtime(rt,args);
+        ++pc;
+        VM_NEXT();
+    }
+    VM_CASE(ret):
+    VM_CASE(retv):{
+        vm_value v;
+        v.p = nullptr;
+        if(pc->op == vm_op::ret) v = R(a);
+        if(frames.empty()){
+            executed = count;
+            return v.i;
+        }
+        frame &caller = frames.back();
+        f = caller.fn;
+        pc = caller.ret;
+        r = caller.regs;
+        mem = caller.mem;
+        r[caller.dest] = v;
+        frames.pop_back();
+        VM_NEXT();
+    }
+#ifndef VM_COMPUTED_GOTO
+    }
+    }
+#endif
+#undef R
+#undef BINARY
+#undef WRAP
+#undef JUMP_IF
+#undef VM_CASE
+#undef VM_NEXT
+}
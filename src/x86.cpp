@@ -0,0 +1,688 @@
+#include "x86.hpp"
+#include "runtime.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+const uint32_t int_arg_regs[6] = {rdi,rsi,rdx,rcx,r8,r9};
+const uint32_t caller_saved_regs[9] = {rax,rcx,rdx,rsi,rdi,r8,r9,r10,r11};
+const uint32_t gpr_alloc_order[14] = {rax,rcx,rdx,rsi,rdi,r8,r9,r10,r11,rbx,r12,r13,r14,r15};
+const uint32_t xmm_alloc_order[16] = {xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7,xmm8,xmm9,xmm10,xmm11,xmm12,xmm13,xmm14,xmm15};
+
+x86_cc invert(x86_cc cc){
+    if(cc == x86_cc::fe) return x86_cc::fne;
+    if(cc == x86_cc::fne) return x86_cc::fe;
+    return (x86_cc)((int)cc ^ 1);
+}
+
+uint32_t operand_count(x86_op op){
+    switch(op){
+    case x86_op::cdq: case x86_op::rep_stosd: case x86_op::ret:
+        return 0;
+    case x86_op::neg32: case x86_op::idiv32: case x86_op::setcc:
+    case x86_op::jmp: case x86_op::jcc: case x86_op::call: case x86_op::tail_jmp: case x86_op::push: case x86_op::pop:
+        return 1;
+    case x86_op::imul3:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+x86_access operand_access(const x86_inst &i,uint32_t k){
+    if(k >= operand_count(i.op)) return access_none;
+    switch(i.op){
+    case x86_op::mov32: case x86_op::mov64: case x86_op::movss: case x86_op::movsx:
+    case x86_op::lea: case x86_op::lea_global: case x86_op::imul3:
+    case x86_op::cvtsi2ss: case x86_op::cvttss2si: case x86_op::movd_to_xmm: case x86_op::movd_from_xmm:
+        return k == 0 ? access_def : access_use;
+    case x86_op::setcc: case x86_op::pop:
+        return access_def;
+    case x86_op::cmp32: case x86_op::cmp64: case x86_op::test32: case x86_op::ucomiss:
+    case x86_op::idiv32: case x86_op::push:
+        return access_use;
+    case x86_op::jmp: case x86_op::jcc: case x86_op::call: case x86_op::tail_jmp:
+        return access_none;
+    default: //two-address arithmetic
+        return k == 0 ? access_use_def : access_use;
+    }
+}
+
+uint32_t x86_function::successors(uint32_t b,uint32_t out[2]) const {
+    auto &insts = blocks[b].insts;
+    uint32_t n = 0;
+    if(!insts.empty()){
+        const x86_inst &last = insts.back();
+        if(last.op == x86_op::ret || last.op == x86_op::tail_jmp) return 0;
+        if(last.op == x86_op::jmp){
+            out[n++] = last.ops[0].index;
+            if(insts.size() >= 2 && insts[insts.size() - 2].op == x86_op::jcc) out[n++] = insts[insts.size() - 2].ops[0].index;
+            if(n == 2 && out[0] == out[1]) n = 1;
+            return n;
+        }
+        if(last.op == x86_op::jcc) out[n++] = last.ops[0].index;
+    }
+    //Falls through into the next block.
+    if(b + 1 < blocks.size() && (n == 0 || out[0] != b + 1)) out[n++] = b + 1;
+    return n;
+}
+
+static x86_op move_op(ir_type t){
+    return t == ir_type::f32 ? x86_op::movss : t == ir_type::ptr ? x86_op::mov64 : x86_op::mov32;
+}
+
+// Lowers one IR function. IR block b becomes machine block b; the copies
+// of critical edges into phis get blocks of their own after them.
+struct x86_lowering {
+    const ir_module &mod;
+    const ir_function &fn;
+    x86_function &out;
+    vector<uint32_t> vreg; //IR value -> virtual register
+    vector<uint32_t> uses;
+    vector<char> fused;    //compares folded into their branch, index scales into the ptradd, returns into the tail call before them
+    vector<uint32_t> slot; //alloca -> frame slot
+    uint32_t cur;
+
+    x86_lowering(const ir_module &m,const ir_function &fn,x86_function &out) : mod(m),fn(fn),out(out){}
+
+    void emit(x86_op op,x86_operand a = {},x86_operand b = {},x86_operand c = {}){
+        x86_inst i{};
+        i.op = op;
+        i.ops[0] = a;
+        i.ops[1] = b;
+        i.ops[2] = c;
+        out.blocks[cur].insts.push_back(i);
+    }
+    void emit_cc(x86_op op,x86_cc cc,x86_operand a){
+        emit(op,a);
+        out.blocks[cur].insts.back().cc = cc;
+    }
+    void jump(x86_op op,x86_cc cc,uint32_t block){emit_cc(op,cc,x86_operand::ref(x86_kind::block,block));}
+    ir_type type_of(uint32_t v) const {return fn.insts[v].type;}
+    x86_operand operand(uint32_t v);
+    uint32_t in_reg(uint32_t v);
+    x86_operand reg(uint32_t v){return x86_operand::r(in_reg(v));}
+    bool has_phis(uint32_t b) const {
+        auto &insts = fn.blocks[b].insts;
+        return !insts.empty() && fn.insts[insts[0]].op == ir_op::phi;
+    }
+    void copies(uint32_t from,uint32_t to);
+    uint32_t edge(uint32_t from,uint32_t to);
+    void compare(const ir_inst &c,x86_cc &cc);
+    bool tail_call(uint32_t b) const;
+    void call(uint32_t v);
+    void params();
+    void inst(uint32_t b,uint32_t v);
+    void lower();
+};
+
+//An i32 constant is an immediate; other leaves are materialized at the use.
+x86_operand x86_lowering::operand(uint32_t v){
+    const ir_inst &i = fn.insts[v];
+    if(i.op == ir_op::iconst) return x86_operand::i(i.imm);
+    if(i.op == ir_op::undef && i.type == ir_type::i32) return x86_operand::i(0);
+    return x86_operand::r(in_reg(v));
+}
+uint32_t x86_lowering::in_reg(uint32_t v){
+    const ir_inst &i = fn.insts[v];
+    switch(i.op){
+    case ir_op::iconst:{
+        uint32_t r = out.new_vreg(ir_type::i32);
+        emit(x86_op::mov32,x86_operand::r(r),x86_operand::i(i.imm));
+        return r;
+    }
+    case ir_op::fconst: case ir_op::undef:{
+        if(i.type != ir_type::f32){
+            uint32_t r = out.new_vreg(i.type);
+            emit(x86_op::mov32,x86_operand::r(r),x86_operand::i(0));
+            return r;
+        }
+        int32_t bits = 0;
+        if(i.op == ir_op::fconst) memcpy(&bits,&i.fimm,4);
+        uint32_t t = out.new_vreg(ir_type::i32),r = out.new_vreg(ir_type::f32);
+        emit(x86_op::mov32,x86_operand::r(t),x86_operand::i(bits));
+        emit(x86_op::movd_to_xmm,x86_operand::r(r),x86_operand::r(t));
+        return r;
+    }
+    case ir_op::global:{
+        uint32_t r = out.new_vreg(ir_type::ptr);
+        emit(x86_op::lea_global,x86_operand::r(r),x86_operand::ref(x86_kind::global,i.index));
+        return r;
+    }
+    default:
+        return vreg[v];
+    }
+}
+
+//Parallel copies into the phis of `to` along from -> to.
+void x86_lowering::copies(uint32_t from,uint32_t to){
+    auto &preds = fn.blocks[to].preds;
+    uint32_t k = 0;
+    while(preds[k] != from) ++k;
+    struct move {
+        uint32_t dst;
+        x86_operand src;
+        ir_type type;
+    };
+    vector<move> moves;
+    for(uint32_t v : fn.blocks[to].insts){
+        const ir_inst &i = fn.insts[v];
+        if(i.op != ir_op::phi) break;
+        x86_operand src = operand(fn.list(i)[k]);
+        if(!src.is(x86_kind::reg) || src.reg != vreg[v]) moves.push_back({vreg[v],src,i.type});
+    }
+    while(!moves.empty()){
+        bool progress = false;
+        for(size_t m = 0;m < moves.size();++m){
+            bool read = false;
+            for(auto &o : moves) read |= o.src.is(x86_kind::reg) && o.src.reg == moves[m].dst;
+            if(read) continue;
+            emit(move_op(moves[m].type),x86_operand::r(moves[m].dst),moves[m].src);
+            moves.erase(moves.begin() + m);
+            progress = true;
+            break;
+        }
+        if(progress) continue;
+        //Only cycles are left: save one destination and redirect its readers.
+        uint32_t d = moves[0].dst,t = out.new_vreg(moves[0].type);
+        emit(move_op(moves[0].type),x86_operand::r(t),x86_operand::r(d));
+        for(auto &o : moves) if(o.src.is(x86_kind::reg) && o.src.reg == d) o.src.reg = t;
+    }
+}
+
+//The block a branch of `from` jumps to for the edge from -> to.
+uint32_t x86_lowering::edge(uint32_t from,uint32_t to){
+    if(!has_phis(to)) return to;
+    uint32_t saved = cur;
+    cur = out.blocks.size();
+    out.blocks.emplace_back();
+    copies(from,to);
+    jump(x86_op::jmp,x86_cc::o,to);
+    swap(cur,saved);
+    return saved;
+}
+
+//Emits the compare for c and sets cc to the condition that is true when c is.
+void x86_lowering::compare(const ir_inst &c,x86_cc &cc){
+    static const x86_cc int_cc[] = {x86_cc::e,x86_cc::ne,x86_cc::l,x86_cc::le,x86_cc::g,x86_cc::ge};
+    static const x86_cc swapped[] = {x86_cc::e,x86_cc::ne,x86_cc::g,x86_cc::ge,x86_cc::l,x86_cc::le};
+    if(c.op == ir_op::icmp){
+        x86_operand a = operand(c.ops[0]),b = operand(c.ops[1]);
+        if(a.is(x86_kind::imm) && !b.is(x86_kind::imm)){
+            emit(x86_op::cmp32,b,a);
+            cc = swapped[(int)c.cc];
+            return;
+        }
+        if(a.is(x86_kind::imm)) a = reg(c.ops[0]);
+        emit(type_of(c.ops[0]) == ir_type::ptr ? x86_op::cmp64 : x86_op::cmp32,a,b);
+        cc = int_cc[(int)c.cc];
+        return;
+    }
+    //ucomiss sets CF for below and for unordered, so < and <= are tested
+    //as > and >= with the operands swapped, which are false on NaN.
+    uint32_t a = in_reg(c.ops[0]),b = in_reg(c.ops[1]);
+    switch(c.cc){
+    case ir_cmp::eq: emit(x86_op::ucomiss,x86_operand::r(a),x86_operand::r(b));cc = x86_cc::fe;break;
+    case ir_cmp::ne: emit(x86_op::ucomiss,x86_operand::r(a),x86_operand::r(b));cc = x86_cc::fne;break;
+    case ir_cmp::lt: emit(x86_op::ucomiss,x86_operand::r(b),x86_operand::r(a));cc = x86_cc::a;break;
+    case ir_cmp::le: emit(x86_op::ucomiss,x86_operand::r(b),x86_operand::r(a));cc = x86_cc::ae;break;
+    case ir_cmp::gt: emit(x86_op::ucomiss,x86_operand::r(a),x86_operand::r(b));cc = x86_cc::a;break;
+    case ir_cmp::ge: emit(x86_op::ucomiss,x86_operand::r(a),x86_operand::r(b));cc = x86_cc::ae;break;
+    }
+}
+
+//Whether b ends with a call whose result, if any, it returns, and which can
+//be a jump once our frame is gone: its arguments all go in registers, so
+//none needs the stack we leave, and no pointer among them leads into our
+//frame.
+bool x86_lowering::tail_call(uint32_t b) const {
+    auto &insts = fn.blocks[b].insts;
+    if(insts.size() < 2) return false;
+    const ir_inst &r = fn.insts[insts.back()],&c = fn.insts[insts[insts.size() - 2]];
+    if(r.op != ir_op::ret || c.op != ir_op::call || (r.ops[0] != no_value && r.ops[0] != insts[insts.size() - 2])) return false;
+    const ir_function &callee = mod.functions[c.index];
+    uint32_t ints = 0,floats = 0;
+    for(uint32_t k = 0;k < c.nlist;++k){
+        ir_type t = callee.params[k];
+        if(t == ir_type::f32 ? ++floats > 8 : ++ints > 6) return false;
+        if(t != ir_type::ptr) continue;
+        uint32_t p = fn.list(c)[k];
+        while(fn.insts[p].op == ir_op::ptradd) p = fn.insts[p].ops[0];
+        if(fn.insts[p].op != ir_op::arg && fn.insts[p].op != ir_op::global) return false;
+    }
+    return true;
+}
+
+//System V: the first six integer or pointer arguments in registers, the
+//first eight floats in xmm0-7, the rest on the stack in 8-byte slots.
+void x86_lowering::call(uint32_t v){
+    const ir_inst &i = fn.insts[v];
+    const ir_function &callee = mod.functions[i.index];
+    vector<pair<uint32_t,uint32_t>> regs; //(register,value)
+    uint32_t ints = 0,floats = 0,stack = 0;
+    for(uint32_t k = 0;k < i.nlist;++k){
+        uint32_t a = fn.list(i)[k];
+        ir_type t = callee.params[k];
+        if(t == ir_type::f32 && floats < 8) regs.push_back({xmm0 + floats++,a});
+        else if(t != ir_type::f32 && ints < 6) regs.push_back({int_arg_regs[ints++],a});
+        else{
+            x86_operand src = t == ir_type::f32 ? reg(a) : operand(a);
+            emit(move_op(t),x86_operand::m(rsp,8 * stack++),src);
+        }
+    }
+    out.outgoing = max(out.outgoing,8 * stack);
+    for(auto &r : regs) emit(move_op(type_of(r.second)),x86_operand::r(r.first),type_of(r.second) == ir_type::f32 ? reg(r.second) : operand(r.second));
+    //The ret after a tail call is fused into it.
+    auto &insts = fn.blocks[i.block].insts;
+    x86_op op = fused[insts.back()] && insts[insts.size() - 2] == v ? x86_op::tail_jmp : x86_op::call;
+    if(callee.is_extern) emit(op,x86_operand::ref(x86_kind::runtime,find_runtime(callee.name)));
+    else emit(op,x86_operand::ref(x86_kind::func,i.index));
+    x86_inst &c = out.blocks[cur].insts.back();
+    c.int_args = ints;
+    c.float_args = floats;
+    if(op == x86_op::tail_jmp) return;
+    if(i.type == ir_type::f32) emit(x86_op::movss,x86_operand::r(vreg[v]),x86_operand::r(xmm0));
+    else if(i.type != ir_type::none) emit(move_op(i.type),x86_operand::r(vreg[v]),x86_operand::r(rax));
+}
+
+void x86_lowering::params(){
+    uint32_t ints = 0,floats = 0,stack = 0;
+    for(uint32_t k = 0;k < fn.args.size();++k){
+        ir_type t = fn.params[k];
+        x86_operand src;
+        if(t == ir_type::f32 && floats < 8) src = x86_operand::r(xmm0 + floats++);
+        else if(t != ir_type::f32 && ints < 6) src = x86_operand::r(int_arg_regs[ints++]);
+        else src = x86_operand::m(rbp,16 + 8 * stack++);
+        emit(move_op(t),x86_operand::r(vreg[fn.args[k]]),src);
+    }
+}
+
+void x86_lowering::inst(uint32_t b,uint32_t v){
+    const ir_inst &i = fn.insts[v];
+    if(fused[v]) return;
+    x86_operand d = x86_operand::r(vreg[v]);
+    auto two_address = [&](x86_op op,bool commutative){
+        x86_operand a = operand(i.ops[0]),c = operand(i.ops[1]);
+        if(commutative && a.is(x86_kind::imm) && !c.is(x86_kind::imm)) swap(a,c);
+        emit(x86_op::mov32,d,a);
+        emit(op,d,c);
+    };
+    auto sse = [&](x86_op op){
+        emit(x86_op::movss,d,reg(i.ops[0]));
+        emit(op,d,reg(i.ops[1]));
+    };
+    switch(i.op){
+    case ir_op::add: two_address(x86_op::add32,true);break;
+    case ir_op::sub: two_address(x86_op::sub32,false);break;
+    case ir_op::mul:{
+        x86_operand a = operand(i.ops[0]),c = operand(i.ops[1]);
+        if(a.is(x86_kind::imm)) swap(a,c);
+        if(c.is(x86_kind::imm) && !a.is(x86_kind::imm)) emit(x86_op::imul3,d,a,c);
+        else if(c.is(x86_kind::imm)) emit(x86_op::mov32,d,x86_operand::i((int32_t)((uint32_t)a.disp * (uint32_t)c.disp)));
+        else{
+            emit(x86_op::mov32,d,a);
+            emit(x86_op::imul32,d,c);
+        }
+        break;
+    }
+    case ir_op::div: case ir_op::rem:{
+        emit(x86_op::mov32,x86_operand::r(rax),operand(i.ops[0]));
+        x86_operand divisor = reg(i.ops[1]);
+        emit(x86_op::cdq);
+        emit(x86_op::idiv32,divisor);
+        emit(x86_op::mov32,d,x86_operand::r(i.op == ir_op::div ? rax : rdx));
+        break;
+    }
+    case ir_op::fadd: sse(x86_op::addss);break;
+    case ir_op::fsub: sse(x86_op::subss);break;
+    case ir_op::fmul: sse(x86_op::mulss);break;
+    case ir_op::fdiv: sse(x86_op::divss);break;
+    case ir_op::fneg:{
+        uint32_t t = out.new_vreg(ir_type::i32),m = out.new_vreg(ir_type::f32);
+        emit(x86_op::movss,d,reg(i.ops[0]));
+        emit(x86_op::mov32,x86_operand::r(t),x86_operand::i(INT32_MIN));
+        emit(x86_op::movd_to_xmm,x86_operand::r(m),x86_operand::r(t));
+        emit(x86_op::xorps,d,x86_operand::r(m));
+        break;
+    }
+    case ir_op::icmp: case ir_op::fcmp:{
+        x86_cc cc;
+        compare(i,cc);
+        emit_cc(x86_op::setcc,cc,d);
+        break;
+    }
+    case ir_op::itof: emit(x86_op::cvtsi2ss,d,reg(i.ops[0]));break;
+    case ir_op::ftoi: emit(x86_op::cvttss2si,d,reg(i.ops[0]));break;
+    case ir_op::alloca: emit(x86_op::lea,d,x86_operand::frame(slot[v]));break;
+    case ir_op::ptradd:{
+        uint32_t base = in_reg(i.ops[0]);
+        const ir_inst &off = fn.insts[i.ops[1]];
+        if(off.op == ir_op::iconst){
+            emit(x86_op::lea,d,x86_operand::m(base,off.imm));
+            break;
+        }
+        uint32_t index = out.new_vreg(ir_type::ptr);
+        uint8_t scale = 1;
+        if(fused[i.ops[1]]){
+            emit(x86_op::movsx,x86_operand::r(index),reg(off.ops[0]));
+            scale = fn.insts[off.ops[1]].imm;
+        }else emit(x86_op::movsx,x86_operand::r(index),reg(i.ops[1]));
+        emit(x86_op::lea,d,x86_operand::m(base,0,index,scale));
+        break;
+    }
+    case ir_op::load: emit(move_op(i.type),d,x86_operand::m(in_reg(i.ops[0])));break;
+    case ir_op::store:{
+        ir_type t = type_of(i.ops[1]);
+        uint32_t p = in_reg(i.ops[0]);
+        emit(move_op(t),x86_operand::m(p),t == ir_type::f32 ? reg(i.ops[1]) : operand(i.ops[1]));
+        break;
+    }
+    case ir_op::memzero:
+        emit(x86_op::mov64,x86_operand::r(rdi),reg(i.ops[0]));
+        emit(x86_op::mov32,x86_operand::r(rcx),x86_operand::i(i.imm / 4));
+        emit(x86_op::mov32,x86_operand::r(rax),x86_operand::i(0));
+        emit(x86_op::rep_stosd);
+        break;
+    case ir_op::call: call(v);break;
+    case ir_op::phi: break;
+    case ir_op::br:
+        copies(b,i.ops[0]);
+        jump(x86_op::jmp,x86_cc::o,i.ops[0]);
+        break;
+    case ir_op::condbr:{
+        const ir_inst &c = fn.insts[i.ops[0]];
+        x86_cc cc = x86_cc::ne;
+        if(fused[i.ops[0]]) compare(c,cc);
+        else if(c.op == ir_op::iconst || c.op == ir_op::undef){
+            uint32_t target = c.op == ir_op::iconst && c.imm != 0 ? i.ops[1] : i.ops[2];
+            jump(x86_op::jmp,x86_cc::o,edge(b,target));
+            break;
+        }else{
+            x86_operand r = reg(i.ops[0]);
+            emit(x86_op::test32,r,r);
+        }
+        uint32_t then_block = edge(b,i.ops[1]),else_block = edge(b,i.ops[2]);
+        jump(x86_op::jcc,cc,then_block);
+        jump(x86_op::jmp,x86_cc::o,else_block);
+        break;
+    }
+    case ir_op::ret:
+        if(i.ops[0] != no_value){
+            ir_type t = type_of(i.ops[0]);
+            if(t == ir_type::f32) emit(x86_op::movss,x86_operand::r(xmm0),reg(i.ops[0]));
+            else emit(move_op(t),x86_operand::r(rax),operand(i.ops[0]));
+        }
+        emit(x86_op::ret);
+        break;
+    default:
+        throw string("Can't lower ") + to_string((int)i.op) + " to x86.";
+    }
+}
+
+void x86_lowering::lower(){
+    out.name = fn.name;
+    vreg.assign(fn.insts.size(),no_reg);
+    uses.assign(fn.insts.size(),0);
+    fused.assign(fn.insts.size(),0);
+    slot.assign(fn.insts.size(),no_reg);
+    for(auto &b : fn.blocks){
+        for(uint32_t v : b.insts){
+            for_each_operand(fn,fn.insts[v],[&](const uint32_t &op){uses[op]++;});
+        }
+    }
+    for(uint32_t v : fn.args) vreg[v] = out.new_vreg(fn.insts[v].type);
+    vector<uint32_t> scaled(fn.insts.size(),0);
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        if(tail_call(b)) fused[fn.blocks[b].insts.back()] = 1;
+        for(uint32_t v : fn.blocks[b].insts){
+            const ir_inst &i = fn.insts[v];
+            if(i.type != ir_type::none) vreg[v] = out.new_vreg(i.type);
+            if(i.op == ir_op::alloca) slot[v] = out.new_slot(i.imm);
+            //A compare used only by the branch after it sets the flags the
+            //branch tests; `index * 1/2/4/8` used only by ptradds is their
+            //scaled index.
+            if(i.op == ir_op::condbr){
+                const ir_inst &c = fn.insts[i.ops[0]];
+                if((c.op == ir_op::icmp || c.op == ir_op::fcmp) && c.block == b && uses[i.ops[0]] == 1) fused[i.ops[0]] = 1;
+            }else if(i.op == ir_op::ptradd){
+                const ir_inst &m = fn.insts[i.ops[1]];
+                if(m.op == ir_op::mul && ++scaled[i.ops[1]] == uses[i.ops[1]] && fn.insts[m.ops[1]].op == ir_op::iconst){
+                    int s = fn.insts[m.ops[1]].imm;
+                    if(s == 1 || s == 2 || s == 4 || s == 8) fused[i.ops[1]] = 1;
+                }
+            }
+        }
+    }
+    out.blocks.resize(fn.blocks.size());
+    cur = 0;
+    params();
+    for(uint32_t b = 0;b < fn.blocks.size();++b){
+        cur = b;
+        for(uint32_t v : fn.blocks[b].insts) inst(b,v);
+    }
+}
+
+vector<x86_function> lower_x86(const ir_module &m){
+    vector<x86_function> fns(m.functions.size());
+    for(uint32_t f = 0;f < m.functions.size();++f){
+        if(m.functions[f].is_extern) continue;
+        x86_lowering(m,m.functions[f],fns[f]).lower();
+    }
+    return fns;
+}
+
+regalloc_stats assign_stack_slots(x86_function &f){
+    regalloc_stats stats;
+    stats.function = f.name;
+    stats.vregs = stats.intervals = f.vregs.size();
+    vector<uint32_t> depth = loop_depth(f);
+    vector<uint32_t> slot_of(f.vregs.size(),no_reg);
+    auto slot = [&](uint32_t r){
+        uint32_t &s = slot_of[r - first_vreg];
+        if(s == no_reg){
+            s = f.new_slot(8);
+            stats.spilled++;
+        }
+        return s;
+    };
+    static const uint32_t gpr_scratch[2] = {r10,r11},xmm_scratch[2] = {xmm14,xmm15};
+    for(uint32_t bi = 0;bi < f.blocks.size();++bi){
+        auto &b = f.blocks[bi];
+        double weight = 1;
+        for(uint32_t d = depth[bi];d;--d) weight *= 10;
+        vector<x86_inst> insts;
+        insts.reserve(b.insts.size() * 2);
+        for(x86_inst &i : b.insts){
+            //(vreg,scratch), the uses first
+            pair<uint32_t,uint32_t> assigned[4];
+            uint32_t n = 0,gprs = 0,xmms = 0;
+            auto scratch = [&](uint32_t r,bool is_use) -> uint32_t {
+                for(uint32_t k = 0;k < n;++k) if(assigned[k].first == r) return assigned[k].second;
+                bool fl = f.is_float(r);
+                //A register only written can share a scratch register with a use.
+                uint32_t s = fl ? xmm_scratch[is_use ? xmms++ : 0] : gpr_scratch[is_use ? gprs++ : 0];
+                assigned[n++] = {r,s};
+                if(is_use){
+                    x86_inst load{};
+                    load.op = fl ? x86_op::movss : x86_op::mov64;
+                    load.ops[0] = x86_operand::r(s);
+                    load.ops[1] = x86_operand::frame(slot(r));
+                    insts.push_back(load);
+                    stats.loads++;
+                    stats.cost += weight;
+                }
+                return s;
+            };
+            uint32_t count = operand_count(i.op);
+            uint32_t written[3];
+            for(uint32_t k = 0;k < count;++k){
+                x86_operand &o = i.ops[k];
+                written[k] = no_reg;
+                if(o.is(x86_kind::mem)){
+                    if(o.reg != no_reg && o.reg >= first_vreg) o.reg = scratch(o.reg,true);
+                    if(o.index != no_reg && o.index >= first_vreg) o.index = scratch(o.index,true);
+                }else if(o.is(x86_kind::reg) && o.reg >= first_vreg){
+                    if(operand_access(i,k) & access_def) written[k] = o.reg;
+                    if(operand_access(i,k) & access_use) o.reg = scratch(o.reg,true);
+                }
+            }
+            vector<pair<uint32_t,uint32_t>> stores; //(scratch,vreg)
+            for(uint32_t k = 0;k < count;++k){
+                if(written[k] == no_reg) continue;
+                i.ops[k].reg = scratch(written[k],false);
+                stores.push_back({i.ops[k].reg,written[k]});
+            }
+            insts.push_back(i);
+            for(auto &s : stores){
+                x86_inst store{};
+                store.op = f.is_float(s.second) ? x86_op::movss : x86_op::mov64;
+                store.ops[0] = x86_operand::frame(slot(s.second));
+                store.ops[1] = x86_operand::r(s.first);
+                insts.push_back(store);
+                stats.stores++;
+                stats.cost += weight;
+            }
+        }
+        b.insts = std::move(insts);
+        for(auto &i : b.insts) stats.moves += is_copy(i) && i.ops[0].reg != i.ops[1].reg;
+    }
+    f.vregs.clear();
+    return stats;
+}
+
+void layout_frame(x86_function &f){
+    //rbp, then the callee-saved registers, then the slots.
+    int32_t offset = -8 * (int32_t)f.saved.size();
+    for(auto &s : f.slots){
+        uint32_t align = s.size >= 16 ? 16 : 8;
+        offset -= s.size;
+        offset &= ~(int32_t)(align - 1);
+        s.offset = offset;
+    }
+    uint32_t below = -offset + f.outgoing;
+    f.frame_size = ((below + 15) & ~15u) - 8 * f.saved.size();
+    for(auto &b : f.blocks){
+        for(auto &i : b.insts){
+            for(auto &o : i.ops){
+                if(o.is(x86_kind::mem) && o.slot != no_reg){
+                    o.disp += f.slots[o.slot].offset;
+                    o.reg = rbp;
+                    o.slot = no_reg;
+                }
+            }
+        }
+    }
+    auto make = [](x86_op op,x86_operand a = {},x86_operand b = {}){
+        x86_inst i{};
+        i.op = op;
+        i.ops[0] = a;
+        i.ops[1] = b;
+        return i;
+    };
+    vector<x86_inst> prologue = {make(x86_op::push,x86_operand::r(rbp)),make(x86_op::mov64,x86_operand::r(rbp),x86_operand::r(rsp))};
+    for(uint32_t r : f.saved) prologue.push_back(make(x86_op::push,x86_operand::r(r)));
+    if(f.frame_size) prologue.push_back(make(x86_op::sub64,x86_operand::r(rsp),x86_operand::i(f.frame_size)));
+    auto &entry = f.blocks[0].insts;
+    entry.insert(entry.begin(),prologue.begin(),prologue.end());
+    for(auto &b : f.blocks){
+        for(size_t k = 0;k < b.insts.size();++k){
+            if(b.insts[k].op != x86_op::ret && b.insts[k].op != x86_op::tail_jmp) continue;
+            vector<x86_inst> epilogue;
+            if(f.frame_size || !f.saved.empty()){
+                epilogue.push_back(make(x86_op::lea,x86_operand::r(rsp),x86_operand::m(rbp,-8 * (int64_t)f.saved.size())));
+            }
+            for(auto it = f.saved.rbegin();it != f.saved.rend();++it) epilogue.push_back(make(x86_op::pop,x86_operand::r(*it)));
+            epilogue.push_back(make(x86_op::pop,x86_operand::r(rbp)));
+            b.insts.insert(b.insts.begin() + k,epilogue.begin(),epilogue.end());
+            k += epilogue.size();
+        }
+    }
+}
+
+void remove_fallthrough(x86_function &f){
+    for(uint32_t b = 0;b < f.blocks.size();++b){
+        auto &insts = f.blocks[b].insts;
+        if(insts.empty() || insts.back().op != x86_op::jmp) continue;
+        x86_inst &last = insts.back();
+        if(last.ops[0].index == b + 1){
+            insts.pop_back();
+            continue;
+        }
+        if(insts.size() >= 2){
+            x86_inst &branch = insts[insts.size() - 2];
+            if(branch.op == x86_op::jcc && branch.ops[0].index == b + 1){
+                branch.cc = invert(branch.cc);
+                branch.ops[0].index = last.ops[0].index;
+                insts.pop_back();
+            }
+        }
+    }
+}
+
+vector<x86_function> compile_x86(const ir_module &m,x86_regalloc alloc,vector<regalloc_stats> *stats){
+    vector<x86_function> fns = lower_x86(m);
+    for(uint32_t f = 0;f < fns.size();++f){
+        if(m.functions[f].is_extern) continue;
+        regalloc_stats s = alloc == x86_regalloc::stack ? assign_stack_slots(fns[f])
+            : alloc == x86_regalloc::graph_coloring ? graph_coloring(fns[f]) : linear_scan(fns[f]);
+        if(stats) stats->push_back(s);
+        layout_frame(fns[f]);
+        remove_fallthrough(fns[f]);
+    }
+    return fns;
+}
+
+void print_spill_report(ostream &os,const vector<regalloc_stats> &stats){
+    auto row = [&](const regalloc_stats &s){
+        os << left << setw(24) << s.function << right << setw(8) << s.vregs << setw(10) << s.intervals << setw(9) << s.spilled
+           << setw(8) << s.loads << setw(8) << s.stores << setw(8) << s.moves << setw(14) << s.cost << "\n";
+    };
+    os << left << setw(24) << "function" << right << setw(8) << "vregs" << setw(10) << "intervals" << setw(9) << "spilled"
+       << setw(8) << "loads" << setw(8) << "stores" << setw(8) << "moves" << setw(14) << "weighted cost" << "\n";
+    regalloc_stats total;
+    total.function = "total";
+    for(auto &s : stats){
+        row(s);
+        total.vregs += s.vregs;
+        total.intervals += s.intervals;
+        total.spilled += s.spilled;
+        total.loads += s.loads;
+        total.stores += s.stores;
+        total.moves += s.moves;
+        total.cost += s.cost;
+    }
+    row(total);
+}
+
+void print_regalloc_comparison(ostream &os,const vector<regalloc_stats> &fast,const vector<regalloc_stats> &coloring){
+    os << left << setw(24) << "" << right << setw(36) << "linear scan" << setw(36) << "graph coloring" << "\n";
+    os << left << setw(24) << "function" << right;
+    for(int k = 0;k < 2;++k) os << setw(8) << "spilled" << setw(7) << "loads" << setw(7) << "stores" << setw(6) << "moves" << setw(8) << "cost";
+    os << "\n";
+    regalloc_stats total[2];
+    total[0].function = total[1].function = "total";
+    auto row = [&](const regalloc_stats &a,const regalloc_stats &b){
+        os << left << setw(24) << a.function << right;
+        for(const regalloc_stats *s : {&a,&b}){
+            os << setw(8) << s->spilled << setw(7) << s->loads << setw(7) << s->stores << setw(6) << s->moves << setw(8) << s->cost;
+        }
+        os << "\n";
+    };
+    for(size_t k = 0;k < fast.size() && k < coloring.size();++k){
+        row(fast[k],coloring[k]);
+        for(int c = 0;c < 2;++c){
+            const regalloc_stats &s = c ? coloring[k] : fast[k];
+            total[c].spilled += s.spilled;
+            total[c].loads += s.loads;
+            total[c].stores += s.stores;
+            total[c].moves += s.moves;
+            total[c].cost += s.cost;
+        }
+    }
+    row(total[0],total[1]);
+}
@@ -0,0 +1,183 @@
+#include "x86_asm.hpp"
+#include "runtime.hpp"
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+static const char* const names64[16] = {"rax","rcx","rdx","rbx","rsp","rbp","rsi","rdi","r8","r9","r10","r11","r12","r13","r14","r15"};
+static const char* const names32[16] = {"eax","ecx","edx","ebx","esp","ebp","esi","edi","r8d","r9d","r10d","r11d","r12d","r13d","r14d","r15d"};
+static const char* const names8[16] = {"al","cl","dl","bl","spl","bpl","sil","dil","r8b","r9b","r10b","r11b","r12b","r13b","r14b","r15b"};
+static const char* const cc_names[16] = {"o","no","b","ae","e","ne","be","a","s","ns","p","np","l","ge","le","g"};
+
+struct asm_printer {
+    ostream &os;
+    const ir_module &mod;
+    uint32_t fn_id;
+
+    enum width {w8,w32,w64};
+
+    void reg(uint32_t r,width w){
+        if(is_xmm(r)) os << "%xmm" << r - xmm0;
+        else os << '%' << (w == w8 ? names8 : w == w32 ? names32 : names64)[r];
+    }
+    void operand(const x86_operand &o,width w){
+        switch(o.kind){
+        case x86_kind::reg: reg(o.reg,w);break;
+        case x86_kind::imm: os << '$' << o.disp;break;
+        case x86_kind::mem:
+            if(o.disp) os << o.disp;
+            os << '(';
+            reg(o.reg,w64);
+            if(o.index != no_reg){
+                os << ',';
+                reg(o.index,w64);
+                os << ',' << (int)o.scale;
+            }
+            os << ')';
+            break;
+        case x86_kind::block: os << ".L" << fn_id << '_' << o.index;break;
+        case x86_kind::global: os << mod.globals[o.index].name << "(%rip)";break;
+        case x86_kind::func: os << mod.functions[o.index].name;break;
+        case x86_kind::runtime: os << runtime_functions[o.index].name;break;
+        default: break;
+        }
+    }
+    //AT&T order: sources first.
+    void two(const char *mnemonic,const x86_operand &dst,width dw,const x86_operand &src,width sw){
+        os << '\t' << mnemonic << '\t';
+        operand(src,sw);
+        os << ", ";
+        operand(dst,dw);
+        os << '\n';
+    }
+    void one(const char *mnemonic,const x86_operand &o,width w){
+        os << '\t' << mnemonic << '\t';
+        operand(o,w);
+        os << '\n';
+    }
+    void inst(const x86_inst &i);
+    void function(const x86_function &f);
+};
+
+void asm_printer::inst(const x86_inst &i){
+    const x86_operand &a = i.ops[0],&b = i.ops[1];
+    auto setcc = [&](x86_cc cc){
+        os << "\tset" << cc_names[(int)cc] << '\t';
+        operand(a,w8);
+        os << '\n';
+        two("movzbl",a,w32,a,w8);
+    };
+    switch(i.op){
+    case x86_op::mov32: two("movl",a,w32,b,w32);break;
+    case x86_op::mov64:
+        if(b.is(x86_kind::imm) && (b.disp < INT32_MIN || b.disp > INT32_MAX)) two("movabsq",a,w64,b,w64);
+        else two("movq",a,w64,b,w64);
+        break;
+    case x86_op::movss: two(a.is(x86_kind::reg) && b.is(x86_kind::reg) ? "movaps" : "movss",a,w32,b,w32);break;
+    case x86_op::movsx: two("movslq",a,w64,b,w32);break;
+    case x86_op::lea: case x86_op::lea_global: two("leaq",a,w64,b,w64);break;
+    case x86_op::add32: two("addl",a,w32,b,w32);break;
+    case x86_op::sub32: two("subl",a,w32,b,w32);break;
+    case x86_op::imul32: two("imull",a,w32,b,w32);break;
+    case x86_op::and32: two("andl",a,w32,b,w32);break;
+    case x86_op::or32: two("orl",a,w32,b,w32);break;
+    case x86_op::xor32: two("xorl",a,w32,b,w32);break;
+    case x86_op::add64: two("addq",a,w64,b,w64);break;
+    case x86_op::sub64: two("subq",a,w64,b,w64);break;
+    case x86_op::imul3:
+        os << "\timull\t";
+        operand(i.ops[2],w32);
+        os << ", ";
+        operand(b,w32);
+        os << ", ";
+        operand(a,w32);
+        os << '\n';
+        break;
+    case x86_op::shl32: two("shll",a,w32,b,w32);break;
+    case x86_op::sar32: two("sarl",a,w32,b,w32);break;
+    case x86_op::shr32: two("shrl",a,w32,b,w32);break;
+    case x86_op::neg32: one("negl",a,w32);break;
+    case x86_op::cmp32: two("cmpl",a,w32,b,w32);break;
+    case x86_op::cmp64: two("cmpq",a,w64,b,w64);break;
+    case x86_op::test32: two("testl",a,w32,b,w32);break;
+    case x86_op::cdq: os << "\tcltd\n";break;
+    case x86_op::idiv32: one("idivl",a,w32);break;
+    case x86_op::setcc:
+        if(i.cc == x86_cc::fe || i.cc == x86_cc::fne){
+            //e/ne, then fix up the unordered case (PF set): fe is false, fne true
+            setcc(i.cc == x86_cc::fe ? x86_cc::e : x86_cc::ne);
+            os << "\tjnp\t1f\n";
+            if(i.cc == x86_cc::fe) two("xorl",a,w32,a,w32);
+            else two("movl",a,w32,x86_operand::i(1),w32);
+            os << "1:\n";
+        }else setcc(i.cc);
+        break;
+    case x86_op::addss: two("addss",a,w32,b,w32);break;
+    case x86_op::subss: two("subss",a,w32,b,w32);break;
+    case x86_op::mulss: two("mulss",a,w32,b,w32);break;
+    case x86_op::divss: two("divss",a,w32,b,w32);break;
+    case x86_op::xorps: two("xorps",a,w32,b,w32);break;
+    case x86_op::ucomiss: two("ucomiss",a,w32,b,w32);break;
+    case x86_op::cvtsi2ss: two("cvtsi2ssl",a,w32,b,w32);break;
+    case x86_op::cvttss2si: two("cvttss2si",a,w32,b,w32);break;
+    case x86_op::movd_to_xmm: case x86_op::movd_from_xmm: two("movd",a,w32,b,w32);break;
+    case x86_op::rep_stosd: os << "\trep stosl\n";break;
+    case x86_op::jmp: one("jmp",a,w64);break;
+    case x86_op::jcc:
+        if(i.cc == x86_cc::fe){
+            os << "\tjp\t1f\n";
+            one("je",a,w64);
+            os << "1:\n";
+        }else if(i.cc == x86_cc::fne){
+            one("jp",a,w64);
+            one("jne",a,w64);
+        }else{
+            os << "\tj" << cc_names[(int)i.cc] << '\t';
+            operand(a,w64);
+            os << '\n';
+        }
+        break;
+    case x86_op::call: one("call",a,w64);break;
+    case x86_op::tail_jmp: one("jmp",a,w64);break;
+    case x86_op::push: one("pushq",a,w64);break;
+    case x86_op::pop: one("popq",a,w64);break;
+    case x86_op::ret: os << "\tret\n";break;
+    }
+}
+
+void asm_printer::function(const x86_function &f){
+    os << "\t.text\n\t.p2align 4\n";
+    if(f.name == "main") os << "\t.globl\tmain\n";
+    os << "\t.type\t" << f.name << ", @function\n" << f.name << ":\n";
+    for(uint32_t b = 0;b < f.blocks.size();++b){
+        if(b) os << ".L" << fn_id << '_' << b << ":\n";
+        for(auto &i : f.blocks[b].insts) inst(i);
+    }
+    os << "\t.size\t" << f.name << ", .-" << f.name << "\n\n";
+}
+
+static void write_global(ostream &os,const ir_global &g){
+    bool zero = true;
+    for(uint32_t w : g.init) zero &= w == 0;
+    if(g.is_const) os << "\t.section\t.rodata\n";
+    else os << (zero ? "\t.bss\n" : "\t.data\n");
+    os << "\t.p2align " << (g.size >= 16 ? 4 : 2) << "\n";
+    os << "\t.type\t" << g.name << ", @object\n\t.size\t" << g.name << ", " << g.size << "\n";
+    os << g.name << ":\n";
+    uint32_t words = zero ? 0 : g.init.size();
+    for(uint32_t k = 0;k < words;++k) os << "\t.long\t" << g.init[k] << "\n";
+    if(g.size > 4 * words) os << "\t.zero\t" << g.size - 4 * words << "\n";
+    os << "\n";
+}
+
+void write_assembly(ostream &os,const ir_module &m,const vector<x86_function> &fns){
+    for(auto &g : m.globals) write_global(os,g);
+    asm_printer p{os,m,0};
+    for(uint32_t f = 0;f < fns.size();++f){
+        if(m.functions[f].is_extern) continue;
+        p.fn_id = f;
+        p.function(fns[f]);
+    }
+    os << "\t.section\t.note.GNU-stack,\"\",@progbits\n";
+}
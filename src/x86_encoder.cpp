@@ -0,0 +1,221 @@
+#include "x86_encoder.hpp"
+#include "runtime.hpp"
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+static bool fits8(int64_t v){return v >= -128 && v <= 127;}
+static bool fits32(int64_t v){return v >= INT32_MIN && v <= INT32_MAX;}
+
+void x86_encoder::u32(uint32_t v){
+    for(int k = 0;k < 4;++k) byte(v >> 8 * k);
+}
+void x86_encoder::u64(uint64_t v){
+    for(int k = 0;k < 8;++k) byte(v >> 8 * k);
+}
+
+//reg is a register or the /digit opcode extension.
+void x86_encoder::rex(bool w,uint32_t reg,const x86_operand &rm,bool byte_reg){
+    uint8_t bits = w << 3 | ((reg & 15) >> 3) << 2;
+    bool force = false;
+    if(rm.is(x86_kind::reg)){
+        bits |= (rm.reg & 15) >> 3;
+        //spl, bpl, sil and dil only exist with a REX prefix
+        force = byte_reg && (rm.reg & 15) >= 4 && (rm.reg & 15) < 8;
+    }else{
+        if(rm.reg != no_reg) bits |= (rm.reg & 15) >> 3;
+        if(rm.index != no_reg) bits |= ((rm.index & 15) >> 3) << 1;
+    }
+    if(bits || force) byte(0x40 | bits);
+}
+
+void x86_encoder::modrm(uint32_t reg,const x86_operand &rm){
+    uint8_t r = reg & 7;
+    if(rm.is(x86_kind::reg)){
+        byte(0xc0 | r << 3 | (rm.reg & 7));
+        return;
+    }
+    if(rm.reg == no_reg) throw string("x86: memory operand without a base.");
+    uint8_t base = rm.reg & 7;
+    uint8_t mod = rm.disp == 0 && base != 5 ? 0 : fits8(rm.disp) ? 1 : 2;
+    if(rm.index != no_reg || base == 4){
+        static const uint8_t scale_bits[9] = {0,0,1,0,2,0,0,0,3};
+        uint8_t index = rm.index == no_reg ? 4 : rm.index & 7;
+        byte(mod << 6 | r << 3 | 4);
+        byte(scale_bits[rm.scale] << 6 | index << 3 | base);
+    }else byte(mod << 6 | r << 3 | base);
+    if(mod == 1) byte(rm.disp);
+    else if(mod == 2) u32(rm.disp);
+}
+
+void x86_encoder::op_rm(uint8_t prefix,bool w,initializer_list<uint8_t> opcode,uint32_t reg,const x86_operand &rm,bool byte_reg){
+    if(prefix) byte(prefix);
+    rex(w,reg,rm,byte_reg);
+    for(uint8_t b : opcode) byte(b);
+    modrm(reg,rm);
+}
+
+//ext is the /digit of the immediate forms, rm_reg and reg_rm the opcodes
+//with the register as source and as destination.
+void x86_encoder::alu(uint8_t ext,uint8_t rm_reg,uint8_t reg_rm,bool w,const x86_operand &dst,const x86_operand &src){
+    if(src.is(x86_kind::imm)){
+        if(fits8(src.disp)){
+            op_rm(0,w,{0x83},ext,dst);
+            byte(src.disp);
+        }else{
+            op_rm(0,w,{0x81},ext,dst);
+            u32(src.disp);
+        }
+    }else if(src.is(x86_kind::reg)) op_rm(0,w,{rm_reg},src.reg,dst);
+    else op_rm(0,w,{reg_rm},dst.reg,src);
+}
+
+void x86_encoder::mov(bool w,const x86_operand &dst,const x86_operand &src){
+    if(src.is(x86_kind::imm)){
+        if(dst.is(x86_kind::reg)){
+            //mov r32, imm32 zero-extends, so it also serves small unsigned 64-bit values.
+            if(!w || (src.disp >= 0 && src.disp <= UINT32_MAX)){
+                rex(false,0,dst);
+                byte(0xb8 + (dst.reg & 7));
+                u32(src.disp);
+            }else if(fits32(src.disp)){
+                op_rm(0,true,{0xc7},0,dst);
+                u32(src.disp);
+            }else{
+                rex(true,0,dst);
+                byte(0xb8 + (dst.reg & 7));
+                u64(src.disp);
+            }
+            return;
+        }
+        op_rm(0,w,{0xc7},0,dst);
+        u32(src.disp);
+    }else if(dst.is(x86_kind::reg)) op_rm(0,w,{0x8b},dst.reg,src);
+    else op_rm(0,w,{0x89},src.reg,dst);
+}
+
+void x86_encoder::inst(const x86_inst &i,vector<pair<uint32_t,uint32_t>> &labels){
+    const x86_operand &a = i.ops[0],&b = i.ops[1];
+    auto jump_to = [&](uint32_t block){
+        labels.push_back({(uint32_t)code.size(),block});
+        u32(0);
+    };
+    auto setcc = [&](x86_cc cc){
+        op_rm(0,false,{0x0f,(uint8_t)(0x90 + (int)cc)},0,a,true);
+        op_rm(0,false,{0x0f,0xb6},a.reg,a,true);
+    };
+    switch(i.op){
+    case x86_op::mov32: mov(false,a,b);break;
+    case x86_op::mov64: mov(true,a,b);break;
+    case x86_op::movss:
+        if(a.is(x86_kind::reg) && b.is(x86_kind::reg)) op_rm(0,false,{0x0f,0x28},a.reg,b);
+        else if(a.is(x86_kind::reg)) op_rm(0xf3,false,{0x0f,0x10},a.reg,b);
+        else op_rm(0xf3,false,{0x0f,0x11},b.reg,a);
+        break;
+    case x86_op::movsx: op_rm(0,true,{0x63},a.reg,b);break;
+    case x86_op::lea: op_rm(0,true,{0x8d},a.reg,b);break;
+    case x86_op::lea_global: mov(true,a,x86_operand::i(globals[b.index]));break;
+    case x86_op::add32: alu(0,0x01,0x03,false,a,b);break;
+    case x86_op::or32: alu(1,0x09,0x0b,false,a,b);break;
+    case x86_op::and32: alu(4,0x21,0x23,false,a,b);break;
+    case x86_op::sub32: alu(5,0x29,0x2b,false,a,b);break;
+    case x86_op::xor32: alu(6,0x31,0x33,false,a,b);break;
+    case x86_op::cmp32: alu(7,0x39,0x3b,false,a,b);break;
+    case x86_op::add64: alu(0,0x01,0x03,true,a,b);break;
+    case x86_op::sub64: alu(5,0x29,0x2b,true,a,b);break;
+    case x86_op::cmp64: alu(7,0x39,0x3b,true,a,b);break;
+    case x86_op::imul32: op_rm(0,false,{0x0f,0xaf},a.reg,b);break;
+    case x86_op::imul3:
+        if(fits8(i.ops[2].disp)){
+            op_rm(0,false,{0x6b},a.reg,b);
+            byte(i.ops[2].disp);
+        }else{
+            op_rm(0,false,{0x69},a.reg,b);
+            u32(i.ops[2].disp);
+        }
+        break;
+    case x86_op::shl32: op_rm(0,false,{0xc1},4,a);byte(b.disp);break;
+    case x86_op::shr32: op_rm(0,false,{0xc1},5,a);byte(b.disp);break;
+    case x86_op::sar32: op_rm(0,false,{0xc1},7,a);byte(b.disp);break;
+    case x86_op::neg32: op_rm(0,false,{0xf7},3,a);break;
+    case x86_op::test32: op_rm(0,false,{0x85},b.reg,a);break;
+    case x86_op::cdq: byte(0x99);break;
+    case x86_op::idiv32: op_rm(0,false,{0xf7},7,a);break;
+    case x86_op::setcc:
+        if(i.cc == x86_cc::fe || i.cc == x86_cc::fne){
+            //e/ne, then fix up the unordered case (PF set): fe is false, fne true
+            setcc(i.cc == x86_cc::fe ? x86_cc::e : x86_cc::ne);
+            byte(0x7b); //jnp
+            byte(0);
+            size_t start = code.size();
+            if(i.cc == x86_cc::fe) alu(6,0x31,0x33,false,a,a);
+            else mov(false,a,x86_operand::i(1));
+            code[start - 1] = code.size() - start;
+        }else setcc(i.cc);
+        break;
+    case x86_op::addss: op_rm(0xf3,false,{0x0f,0x58},a.reg,b);break;
+    case x86_op::mulss: op_rm(0xf3,false,{0x0f,0x59},a.reg,b);break;
+    case x86_op::subss: op_rm(0xf3,false,{0x0f,0x5c},a.reg,b);break;
+    case x86_op::divss: op_rm(0xf3,false,{0x0f,0x5e},a.reg,b);break;
+    case x86_op::xorps: op_rm(0,false,{0x0f,0x57},a.reg,b);break;
+    case x86_op::ucomiss: op_rm(0,false,{0x0f,0x2e},a.reg,b);break;
+    case x86_op::cvtsi2ss: op_rm(0xf3,false,{0x0f,0x2a},a.reg,b);break;
+    case x86_op::cvttss2si: op_rm(0xf3,false,{0x0f,0x2c},a.reg,b);break;
+    case x86_op::movd_to_xmm: op_rm(0x66,false,{0x0f,0x6e},a.reg,b);break;
+    case x86_op::movd_from_xmm: op_rm(0x66,false,{0x0f,0x7e},b.reg,a);break;
+    case x86_op::rep_stosd: byte(0xf3);byte(0xab);break;
+    case x86_op::jmp: byte(0xe9);jump_to(a.index);break;
+    case x86_op::jcc:
+        if(i.cc == x86_cc::fe){
+            byte(0x7a); //jp over the je
+            byte(6);
+            byte(0x0f);byte(0x84);jump_to(a.index);
+        }else if(i.cc == x86_cc::fne){
+            byte(0x0f);byte(0x8a);jump_to(a.index);
+            byte(0x0f);byte(0x85);jump_to(a.index);
+        }else{
+            byte(0x0f);byte(0x80 + (int)i.cc);jump_to(a.index);
+        }
+        break;
+    case x86_op::call:
+        if(a.is(x86_kind::func)){
+            byte(0xe8);
+            calls.push_back({(uint32_t)code.size(),a.index});
+            u32(0);
+        }else{
+            //r11 is neither an argument nor preserved across the call
+            mov(true,x86_operand::r(r11),x86_operand::i((int64_t)runtime_functions[a.index].native));
+            op_rm(0,false,{0xff},2,x86_operand::r(r11));
+        }
+        break;
+    case x86_op::tail_jmp:
+        if(a.is(x86_kind::func)){
+            byte(0xe9);
+            calls.push_back({(uint32_t)code.size(),a.index});
+            u32(0);
+        }else{
+            mov(true,x86_operand::r(r11),x86_operand::i((int64_t)runtime_functions[a.index].native));
+            op_rm(0,false,{0xff},4,x86_operand::r(r11));
+        }
+        break;
+    case x86_op::push: rex(false,0,a);byte(0x50 + (a.reg & 7));break;
+    case x86_op::pop: rex(false,0,a);byte(0x58 + (a.reg & 7));break;
+    case x86_op::ret: byte(0xc3);break;
+    }
+}
+
+uint32_t x86_encoder::encode(const x86_function &f){
+    uint32_t start = code.size();
+    vector<uint32_t> block_start(f.blocks.size());
+    vector<pair<uint32_t,uint32_t>> labels; //(rel32 field,block)
+    for(uint32_t b = 0;b < f.blocks.size();++b){
+        block_start[b] = code.size();
+        for(auto &i : f.blocks[b].insts) inst(i,labels);
+    }
+    for(auto &l : labels){
+        int32_t rel = block_start[l.second] - (l.first + 4);
+        for(int k = 0;k < 4;++k) code[l.first + k] = (uint32_t)rel >> 8 * k;
+    }
+    return start;
+}
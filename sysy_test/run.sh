@@ -0,0 +1,47 @@
+#!/bin/sh
+# Runs each sysy_test/NNN.sysy that has an NNN.out with --run at -O0, -O1 and
+# -O2, and compares what it prints, followed by its exit status on a line of
+# its own, with NNN.out. NNN.in, if there is one, is its input. A program
+# that doesn't compile exits with 125 and prints nothing; with -o instead of
+# --run, it has to exit with 1. With options, programs whose first line is
+# "// vm-only..." are skipped.
+#   sh sysy_test/run.sh path/to/sysyc [options, e.g. --jit]
+sysyc=${1:?usage: run.sh path/to/sysyc [options]}
+shift
+dir=$(dirname "$0")
+out=$(mktemp)
+exe=$(mktemp)
+trap 'rm -f "$out" "$exe"' EXIT
+pass=0
+fail=0
+for src in "$dir"/*.sysy; do
+    expected=${src%.sysy}.out
+    [ -f "$expected" ] || continue
+    if [ $# -gt 0 ] && head -n 1 "$src" | grep -q '^// vm-only'; then continue; fi
+    input=${src%.sysy}.in
+    [ -f "$input" ] || input=/dev/null
+    for level in -O0 -O1 -O2; do
+        "$sysyc" --run $level "$@" "$src" < "$input" > "$out" 2> /dev/null
+        status=$?
+        if [ -s "$out" ] && [ -n "$(tail -c 1 "$out")" ]; then echo >> "$out"; fi
+        echo $status >> "$out"
+        if cmp -s "$out" "$expected"; then
+            pass=$((pass + 1))
+        else
+            fail=$((fail + 1))
+            echo "FAIL $src $level $*"
+        fi
+    done
+    if [ "$(cat "$expected")" = 125 ]; then
+        "$sysyc" -o "$exe" "$@" "$src" > "$out" 2> /dev/null
+        status=$?
+        if [ $status -eq 1 ] && [ ! -s "$out" ]; then
+            pass=$((pass + 1))
+        else
+            fail=$((fail + 1))
+            echo "FAIL $src -o $*"
+        fi
+    fi
+done
+echo "$pass passed, $fail failed"
+[ $fail -eq 0 ]
@@ -1,6 +1,38 @@
 add_rules("mode.release","mode.debug")
+set_languages("c11","c++17")
+
+target("sysy")
+    set_kind("static")
+    add_files("src/*.cpp|main.cpp","runtime/sylib.c")
+    add_includedirs("include/",{public = true})
+    add_includedirs("runtime/")
+    add_syslinks("pthread",{public = true})
+
 target("sysyc")
     set_kind("binary")
-    add_files("src/*.cpp")
-    add_includedirs("include/")
-    set_languages("c++17")
\ No newline at end of file
+    add_deps("sysy")
+    add_files("src/main.cpp")
+    -- `sysyc -o` compiles runtime/sylib.c next to the program
+    add_defines("SYSY_RUNTIME_DIR=\"$(projectdir)/runtime\"")
+
+-- xmake build scope_bench && xmake run scope_bench [depth] [repeat]
+target("scope_bench")
+    set_kind("binary")
+    set_default(false)
+    add_deps("sysy")
+    add_files("bench/scope_bench.cpp")
+
+-- xmake build keyword_bench && xmake run keyword_bench [words]
+target("keyword_bench")
+    set_kind("binary")
+    set_default(false)
+    add_deps("sysy")
+    add_files("bench/keyword_bench.cpp")
+
+-- Front-end throughput on generated programs, see bench/throughput_bench.cpp.
+-- xmake build throughput_bench && xmake run throughput_bench --compare bench/results/baseline.tsv
+target("throughput_bench")
+    set_kind("binary")
+    set_default(false)
+    add_deps("sysy")
+    add_files("bench/throughput_bench.cpp","bench/sysy_gen.cpp")